@@ -12,6 +12,11 @@
 struct Super *super;		// superblock
 uint32_t *bitmap;			// bitmap blocks mapped in memory
 
+// fs_gen[0] counts modifications to any file.  It sits alone in its
+// page so that page can be shared read-only with clients (FSREQ_GEN).
+volatile uint32_t fs_gen[PGSIZE / sizeof(uint32_t)]
+	__attribute__((aligned(PGSIZE)));
+
 // --------------------------------------------------------------
 // Super block
 // --------------------------------------------------------------
@@ -318,6 +323,14 @@ dir_alloc_file(struct File *dir, struct File **file)
 	return 0;
 }
 
+// Note that f changed, so clients caching its contents revalidate.
+static void
+file_modified(struct File *f)
+{
+	f->f_gen++;
+	fs_gen[0]++;
+}
+
 // Skip over slashes.
 static const char*
 skip_slash(const char *p)
@@ -407,6 +420,7 @@ file_create(const char *path, struct File **pf, uint32_t filetype, bool crash)
 		return r;
 	strcpy(f->f_name, name);
 	f->f_type = filetype;
+	file_modified(f);
 	*pf = f;
 
 #if defined(TEST_CRASH)
@@ -478,6 +492,7 @@ file_write(struct File *f, const void *buf, size_t count, off_t offset)
 		pos += bn;
 		buf += bn;
 	}
+	file_modified(f);
 
 	return count;
 }
@@ -534,6 +549,7 @@ file_set_size(struct File *f, off_t newsize)
 	if (f->f_size > newsize)
 		file_truncate_blocks(f, newsize);
 	f->f_size = newsize;
+	file_modified(f);
 	flush_block(f);
 	return 0;
 }
@@ -595,6 +611,7 @@ file_remove(const char *path, bool crash)
 	file_truncate_blocks(f, 0);
 	f->f_name[0] = '\0';
 	f->f_size = 0;
+	file_modified(f);
 
 #if defined(TEST_CRASH)
 	if (crash) {
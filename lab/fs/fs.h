@@ -16,6 +16,7 @@
 
 extern struct Super *super;		// superblock
 extern uint32_t *bitmap;		// bitmap blocks mapped in memory
+extern volatile uint32_t fs_gen[];	// file system modification generation
 
 /* ide.c */
 bool	ide_probe_disk1(void);
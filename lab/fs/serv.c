@@ -39,18 +39,30 @@
 //    communicate with the server.  File IDs are a lot like
 //    environment IDs in the kernel.  Use openfile_lookup to translate
 //    file IDs to struct OpenFile.
+//
+// Free entries are kept on a list, and the others on a list per client,
+// so that opening a file does not search the array.  A file is closed
+// once no client has its Fd page mapped any more, which the server
+// only notices when it looks.  A client's files are taken back in one
+// pass when another env first opens a file from its env slot, and
+// those of clients with files open are looked over when the free list
+// runs dry.  Files an exited client passed on, to a child say, wait on
+// a list of their own until nobody has them mapped.
 
 struct OpenFile {
 	uint32_t o_fileid;	// file id
 	struct File *o_file;	// mapped descriptor for open file
 	int o_mode;		// open mode
 	struct Fd *o_fd;	// Fd page
-	// FIXME: optimize to remove the following
+	envid_t o_client;	// env that opened it
+	LIST_ENTRY(OpenFile) o_link;	// free, client or orphan list link
 #if defined(ENABLE_JBD)
-	char o_fpath[MAXPATHLEN];	// full file path
+	char *o_fpath;		// full file path, malloc'd
 #endif
 };
 
+LIST_HEAD(OpenFile_list, OpenFile);
+
 // Max number of open files in the file system at once
 #define MAXOPEN		1024
 #define HVA			0xA0000000
@@ -61,6 +73,24 @@ struct OpenFile opentab[MAXOPEN] = {
 	{ 0, 0, 1, 0 }
 };
 
+// The files an env opened
+struct Client {
+	envid_t c_envid;		// the env, 0 for none
+	struct OpenFile_list c_open;	// its open files
+	bool c_active;			// whether on clients_active
+	LIST_ENTRY(Client) c_link;	// clients_active link
+};
+
+LIST_HEAD(Client_list, Client);
+
+static struct OpenFile_list openfile_free;
+// Files of exited clients that others still have mapped
+static struct OpenFile_list openfile_orphan;
+// Indexed by ENVX(c_envid)
+static struct Client clients[NENV];
+// Clients that may have files open
+static struct Client_list clients_active;
+
 #if defined(ENABLE_JBD)
 //static Handle_t *hndl = (Handle_t*) HVA;
 static Handle_t hndl;
@@ -79,32 +109,128 @@ serve_init(void)
 		opentab[i].o_fd = (struct Fd*) va;
 		va += PGSIZE;
 	}
+	for (i = MAXOPEN - 1; i >= 0; i--)
+		LIST_INSERT_HEAD(&openfile_free, &opentab[i], o_link);
 }
 
-// Allocate an open file.
-int
-openfile_alloc(struct OpenFile **o)
+// Put o back on the free list if no client has it mapped any more.
+// Returns 1 if it did.
+static int
+openfile_release(struct OpenFile *o)
 {
-	int i, r;
-
-	// Find an available open-file table entry
-	for (i = 0; i < MAXOPEN; i++) {
-		switch (pageref(opentab[i].o_fd)) {
-		case 0:
-			if ((r = sys_page_alloc(0, opentab[i].o_fd, PTE_P|PTE_U|PTE_W|PTE_SHARE)) < 0)
-				return r;
-			/* fall through */
-		case 1:
-			opentab[i].o_fileid += MAXOPEN;
-			*o = &opentab[i];
-			memset(opentab[i].o_fd, 0, PGSIZE);
+	if (pageref(o->o_fd) > 1)
+		return 0;
+	LIST_REMOVE(o, o_link);
 #if defined(ENABLE_JBD)
-			memset(opentab[i].o_fpath, 0, MAXPATHLEN);
+	free(o->o_fpath);
+	o->o_fpath = NULL;
 #endif
-			return (*o)->o_fileid;
+	LIST_INSERT_HEAD(&openfile_free, o, o_link);
+	return 1;
+}
+
+// Release the closed files on 'list'; move the rest to 'keep' unless
+// that is 'list' itself.
+static void
+openfile_release_all(struct OpenFile_list *list, struct OpenFile_list *keep)
+{
+	struct OpenFile *o, *next;
+
+	for (o = LIST_FIRST(list); o; o = next) {
+		next = LIST_NEXT(o, o_link);
+		if (!openfile_release(o) && keep != list) {
+			LIST_REMOVE(o, o_link);
+			LIST_INSERT_HEAD(keep, o, o_link);
 		}
 	}
-	return -E_MAX_OPEN;
+}
+
+static int
+client_alive(envid_t envid)
+{
+	volatile struct Env *e = &envs[ENVX(envid)];
+
+	return e->env_id == envid && e->env_status != ENV_FREE;
+}
+
+// c's env has exited: release its files, keeping those it passed on.
+static void
+client_drop(struct Client *c)
+{
+	openfile_release_all(&c->c_open, &openfile_orphan);
+	c->c_envid = 0;
+	if (c->c_active) {
+		LIST_REMOVE(c, c_link);
+		c->c_active = 0;
+	}
+}
+
+// The Client for envid, which takes over its env slot from any earlier
+// env there.
+static struct Client *
+client_get(envid_t envid)
+{
+	struct Client *c = &clients[ENVX(envid)];
+
+	if (c->c_envid != envid) {
+		client_drop(c);
+		c->c_envid = envid;
+	}
+	return c;
+}
+
+// Take back the closed files of clients that have exited, and if that
+// frees nothing, those of all clients.
+static void
+openfile_reclaim(void)
+{
+	struct Client *c, *next;
+	int all;
+
+	openfile_release_all(&openfile_orphan, &openfile_orphan);
+	for (all = 0; all < 2 && LIST_EMPTY(&openfile_free); all++)
+		for (c = LIST_FIRST(&clients_active); c; c = next) {
+			next = LIST_NEXT(c, c_link);
+			if (!client_alive(c->c_envid))
+				client_drop(c);
+			else if (all)
+				openfile_release_all(&c->c_open, &c->c_open);
+			if (c->c_active && LIST_EMPTY(&c->c_open)) {
+				LIST_REMOVE(c, c_link);
+				c->c_active = 0;
+			}
+		}
+}
+
+// Allocate an open file for envid.
+int
+openfile_alloc(envid_t envid, struct OpenFile **o)
+{
+	struct OpenFile *of;
+	struct Client *c = client_get(envid);
+	int r;
+
+	if (LIST_EMPTY(&openfile_free))
+		openfile_reclaim();
+	if ((of = LIST_FIRST(&openfile_free)) == NULL)
+		return -E_MAX_OPEN;
+
+	if (pageref(of->o_fd) == 0) {
+		if ((r = sys_page_alloc(0, of->o_fd, PTE_P|PTE_U|PTE_W|PTE_SHARE)) < 0)
+			return r;
+	} else
+		memset(of->o_fd, 0, sizeof(struct Fd));
+
+	LIST_REMOVE(of, o_link);
+	of->o_fileid += MAXOPEN;
+	of->o_client = envid;
+	LIST_INSERT_HEAD(&c->c_open, of, o_link);
+	if (!c->c_active) {
+		LIST_INSERT_HEAD(&clients_active, c, c_link);
+		c->c_active = 1;
+	}
+	*o = of;
+	return of->o_fileid;
 }
 
 // Look up an open file for envid.
@@ -151,11 +277,10 @@ serve_open(envid_t envid, struct Fsreq_open *req,
 		cprintf("serve_open %08x %s 0x%x\n", envid, req->req_path, req->req_omode);
 
 	// Copy in the path, making sure it's null-terminated
-	memmove(path, req->req_path, MAXPATHLEN);
-	path[MAXPATHLEN-1] = 0;
+	strlcpy(path, req->req_path, MAXPATHLEN);
 
 	// Find an open file ID
-	if ((r = openfile_alloc(&o)) < 0) {
+	if ((r = openfile_alloc(envid, &o)) < 0) {
 		if (debug)
 			cprintf("openfile_alloc failed: %e", r);
 		return r;
@@ -184,7 +309,7 @@ serve_open(envid_t envid, struct Fsreq_open *req,
 				goto try_open;
 			if (debug)
 				cprintf("file_create failed: %e", r);
-			return r;
+			goto fail;
 		}
 	} else {
 
@@ -198,7 +323,7 @@ try_open:
 		if ((r = file_open(path, &f)) < 0) {
 			if (debug)
 				cprintf("file_open failed: %e", r);
-			return r;
+			goto fail;
 		}
 	}
 
@@ -216,7 +341,7 @@ try_open:
 		if ((r = file_set_size(f, 0)) < 0) {
 			if (debug)
 				cprintf("file_set_size failed: %e", r);
-			return r;
+			goto fail;
 		}
 	}
 
@@ -230,7 +355,11 @@ try_open:
 	o->o_mode = req->req_omode;
 
 #if defined(ENABLE_JBD)
-	memmove(o->o_fpath, path, MAXPATHLEN);
+	if ((o->o_fpath = malloc(strlen(path) + 1)) == NULL) {
+		r = -E_NO_MEM;
+		goto fail;
+	}
+	strcpy(o->o_fpath, path);
 #endif
 
 	if (debug)
@@ -243,6 +372,11 @@ try_open:
 	PROFILE_END();
 
 	return 0;
+
+fail:
+	// Nobody else has the Fd page yet
+	openfile_release(o);
+	return r;
 }
 
 // Set the size of req->req_fileid to req->req_size bytes, truncating
@@ -269,7 +403,7 @@ serve_set_size(envid_t envid, struct Fsreq_set_size *req)
 #if defined(ENABLE_JBD)
 	memset(&hndl, 0, sizeof(hndl));
 	hndl.h_hdr.h_oper = JBD_TRUNC;
-	memmove(hndl.h_hdr.h_filename, o->o_fpath, MAXPATHLEN);
+	strcpy(hndl.h_hdr.h_filename, o->o_fpath);
 	hndl.h_params.trunc.p_off = req->req_size;
 	add_handle_to_transaction(envid, &hndl);
 #endif
@@ -365,7 +499,7 @@ serve_write(envid_t envid, struct Fsreq_write *req)
 
 	memset(&hndl, 0, sizeof(hndl));
 	hndl.h_hdr.h_oper = JBD_WRITE;
-	memmove(hndl.h_hdr.h_filename, o->o_fpath, MAXPATHLEN);
+	strcpy(hndl.h_hdr.h_filename, o->o_fpath);
 	hndl.h_params.write.p_off = o->o_fd->fd_offset;
 	hndl.h_params.write.p_dsize = count;
 	memmove(hndl.h_params.write.p_data, req->req_buf, count);
@@ -405,6 +539,7 @@ serve_stat(envid_t envid, union Fsipc *ipc)
 	strcpy(ret->ret_name, o->o_file->f_name);
 	ret->ret_size = o->o_file->f_size;
 	ret->ret_isdir = (o->o_file->f_type == FTYPE_DIR);
+	ret->ret_gen = o->o_file->f_gen;
 	return 0;
 }
 
@@ -511,6 +646,194 @@ serve_remove(envid_t envid, struct Fsreq_remove *req)
 	return r;
 }
 
+// Map the block cache page holding byte req->req_offset of
+// req->req_fileid read-only at *pg_store, so the caller can hand file
+// data on (e.g. to the network server) without copying it.  Returns the
+// number of valid bytes in the page starting at req_offset % BLKSIZE,
+// 0 at end of file, or < 0 on error.
+int
+serve_map(envid_t envid, struct Fsreq_map *req,
+	  void **pg_store, int *perm_store)
+{
+	struct OpenFile *o;
+	char *blk;
+	int r;
+
+	if (debug)
+		cprintf("serve_map %08x %08x %08x\n", envid, req->req_fileid, req->req_offset);
+
+	if ((r = openfile_lookup(envid, req->req_fileid, &o)) < 0)
+		return r;
+	if (req->req_offset < 0)
+		return -E_INVAL;
+	if (req->req_offset >= o->o_file->f_size)
+		return 0;
+
+	if ((r = file_get_block(o->o_file, req->req_offset / BLKSIZE, &blk)) < 0)
+		return r;
+
+	// Fault the block in, ipc can only share mapped pages
+	if (!va_is_mapped(blk))
+		(void) *(volatile char *) blk;
+
+	*pg_store = blk;
+	*perm_store = PTE_P|PTE_U;
+
+	return MIN(BLKSIZE - req->req_offset % BLKSIZE,
+		   o->o_file->f_size - req->req_offset);
+}
+
+// Share the page holding fs_gen read-only at *pg_store, so the caller
+// can tell whether anything changed without asking us again.
+int
+serve_gen(envid_t envid, union Fsipc *req, void **pg_store, int *perm_store)
+{
+	*pg_store = (void *) fs_gen;
+	*perm_store = PTE_P|PTE_U|PTE_SHARE;
+	return 0;
+}
+
+// Parts of program images we page in on demand (see spawn), by the
+// envid the image was spawned as; envs forked from it have the same
+// key.  A slot is reused once no env with its key is left.
+struct PagerRegion {
+	envid_t pr_key;		// 0 if the slot is free
+	struct File *pr_file;
+	uintptr_t pr_va;	// page-aligned
+	size_t pr_len;
+	off_t pr_offset;	// page-aligned file offset of pr_va
+};
+
+#define MAXREGION	128
+
+static struct PagerRegion pagertab[MAXREGION];
+
+static bool
+pager_key_live(envid_t key)
+{
+	int i;
+
+	for (i = 0; i < NENV; i++)
+		if (envs[i].env_status != ENV_FREE
+		    && envs[i].env_pager == env->env_id
+		    && envs[i].env_pager_key == key)
+			return 1;
+	// spawn may not have named us its pager yet
+	return envs[ENVX(key)].env_id == key
+		&& envs[ENVX(key)].env_status != ENV_FREE;
+}
+
+static struct PagerRegion *
+pager_region_alloc(void)
+{
+	int i;
+
+	for (i = 0; i < MAXREGION; i++)
+		if (pagertab[i].pr_key == 0)
+			return &pagertab[i];
+	for (i = 0; i < MAXREGION; i++)
+		if (!pager_key_live(pagertab[i].pr_key))
+			pagertab[i].pr_key = 0;
+	for (i = 0; i < MAXREGION; i++)
+		if (pagertab[i].pr_key == 0)
+			return &pagertab[i];
+	return NULL;
+}
+
+// Page in part of the image of envid, a child of the caller, from an
+// open file the caller has.
+int
+serve_pager(envid_t envid, struct Fsreq_pager *req)
+{
+	struct OpenFile *o;
+	struct PagerRegion *pr;
+	const volatile struct Env *e;
+	int r;
+
+	if (debug)
+		cprintf("serve_pager %08x %08x %08x %08x+%x @%x\n", envid,
+			req->req_fileid, req->req_envid, req->req_va,
+			req->req_len, req->req_offset);
+
+	if ((r = openfile_lookup(envid, req->req_fileid, &o)) < 0)
+		return r;
+	e = &envs[ENVX(req->req_envid)];
+	if (e->env_id != req->req_envid || e->env_parent_id != envid)
+		return -E_BAD_ENV;
+	if (req->req_va % PGSIZE || req->req_offset % PGSIZE
+	    || req->req_offset < 0 || req->req_va >= UTOP
+	    || req->req_len > UTOP - req->req_va)
+		return -E_INVAL;
+
+	if ((pr = pager_region_alloc()) == NULL)
+		return -E_NO_MEM;
+	pr->pr_key = req->req_envid;
+	pr->pr_file = o->o_file;
+	pr->pr_va = req->req_va;
+	pr->pr_len = req->req_len;
+	pr->pr_offset = req->req_offset;
+	return 0;
+}
+
+// The kernel passed us a fault by envid on the page at va: map the
+// block cache page holding that part of the image into envid.
+void
+serve_pagein(envid_t envid, uintptr_t va)
+{
+	struct PagerRegion *pr;
+	envid_t key = envs[ENVX(envid)].env_pager_key;
+	off_t off;
+	char *blk;
+	int i, r;
+
+	if (debug)
+		cprintf("serve_pagein %08x %08x\n", envid, va);
+
+	for (i = 0; i < MAXREGION; i++) {
+		pr = &pagertab[i];
+		if (pr->pr_key == key && va - pr->pr_va < pr->pr_len)
+			break;
+	}
+	if (i == MAXREGION)
+		goto fail;
+
+	// A file removed since has no blocks left
+	off = pr->pr_offset + (va - pr->pr_va);
+	if (off >= pr->pr_file->f_size)
+		goto fail;
+	if ((r = file_get_block(pr->pr_file, off / BLKSIZE, &blk)) < 0)
+		goto fail;
+	if (!va_is_mapped(blk))
+		(void) *(volatile char *) blk;
+
+	if ((r = sys_pager_reply(envid, blk, PTE_P|PTE_U)) < 0)
+		cprintf("serve_pagein %08x %08x: %e\n", envid, va, r);
+	return;
+
+fail:
+	sys_pager_reply(envid, 0, 0);
+}
+
+// Send the reply to a request like ipc_send.  A client that faults on
+// a page of its text between sending the request and waiting for the
+// reply waits for us to page it in, so do that while we wait for it.
+static void
+serve_reply(envid_t envid, uint32_t val, void *pg, int perm)
+{
+	const volatile struct Env *e = &envs[ENVX(envid)];
+	int r;
+
+	while ((r = sys_ipc_try_send(envid, val, pg ? pg : (void *) UTOP,
+				     perm)) == -E_IPC_NOT_RECV) {
+		if (e->env_pager == env->env_id && e->env_pager_va)
+			serve_pagein(envid, e->env_pager_va);
+		else
+			sys_yield();
+	}
+	if (r < 0)
+		panic("serve_reply: sys_ipc_try_send: %e", r);
+}
+
 // Sync the file system.
 int
 serve_sync(envid_t envid, union Fsipc *req)
@@ -522,8 +845,10 @@ serve_sync(envid_t envid, union Fsipc *req)
 typedef int (*fshandler)(envid_t envid, union Fsipc *req);
 
 fshandler handlers[] = {
-	// Open is handled specially because it passes pages
+	// Open, map and gen are handled specially because they pass pages
 	/* [FSREQ_OPEN] =	(fshandler)serve_open, */
+	/* [FSREQ_MAP] =	(fshandler)serve_map, */
+	/* [FSREQ_GEN] =	(fshandler)serve_gen, */
 	[FSREQ_SET_SIZE] =	(fshandler)serve_set_size,
 	[FSREQ_READ] =		serve_read,
 	[FSREQ_WRITE] =		(fshandler)serve_write,
@@ -548,7 +873,14 @@ serve(void)
 			cprintf("fs req %d from %08x [page %08x: %s]\n",
 				req, whom, vpt[VPN(fsreq)], fsreq);
 
-		// All requests must contain an argument page
+		// Faults the kernel passes us as a pager come without one
+		if (!(perm & PTE_P) && envs[ENVX(whom)].env_pager == env->env_id
+		    && envs[ENVX(whom)].env_pager_va == req) {
+			serve_pagein(whom, req);
+			continue;
+		}
+
+		// All other requests must contain an argument page
 		if (!(perm & PTE_P)) {
 			cprintf("Invalid request from %08x: no argument page\n",
 				whom);
@@ -558,13 +890,19 @@ serve(void)
 		pg = NULL;
 		if (req == FSREQ_OPEN) {
 			r = serve_open(whom, (struct Fsreq_open*)fsreq, &pg, &perm);
+		} else if (req == FSREQ_MAP) {
+			r = serve_map(whom, (struct Fsreq_map*)fsreq, &pg, &perm);
+		} else if (req == FSREQ_GEN) {
+			r = serve_gen(whom, fsreq, &pg, &perm);
+		} else if (req == FSREQ_PAGER) {
+			r = serve_pager(whom, (struct Fsreq_pager*)fsreq);
 		} else if (req < NHANDLERS && handlers[req]) {
 			r = handlers[req](whom, fsreq);
 		} else {
 			cprintf("Invalid request code %d from %08x\n", whom, req);
 			r = -E_INVAL;
 		}
-		ipc_send(whom, r, pg, perm);
+		serve_reply(whom, r, pg, perm);
 		sys_page_unmap(0, fsreq);
 	}
 }
@@ -0,0 +1,34 @@
+#ifndef JOS_INC_CLOCK_H
+#define JOS_INC_CLOCK_H
+
+#include <inc/types.h>
+#include <inc/x86.h>
+
+// Parameters for turning the time stamp counter into nanoseconds since
+// boot.  The kernel fills this in once it has calibrated the TSC and
+// maps it read-only into every environment at UCLOCK, so user code can
+// read the time without a system call.
+struct Clock {
+	uint64_t c_tsc_base;		// TSC value at time 0
+	uint32_t c_mult;		// nsec per TSC cycle << c_shift
+	uint32_t c_shift;
+	uint32_t c_tsc_khz;		// TSC frequency
+};
+
+static __inline uint64_t
+clock_tsc2nsec(const volatile struct Clock *c, uint64_t tsc)
+{
+	uint64_t d = tsc - c->c_tsc_base;
+
+	// d * c_mult >> c_shift without overflowing 64 bits
+	return (((d >> 32) * c->c_mult) << (32 - c->c_shift))
+		+ (((d & 0xffffffff) * c->c_mult) >> c->c_shift);
+}
+
+static __inline uint64_t
+clock_nsec(const volatile struct Clock *c)
+{
+	return clock_tsc2nsec(c, read_tsc());
+}
+
+#endif /* !JOS_INC_CLOCK_H */
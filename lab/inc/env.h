@@ -7,6 +7,7 @@
 #include <inc/queue.h>
 #include <inc/trap.h>
 #include <inc/memlayout.h>
+#include <inc/kstat.h>
 
 typedef int32_t envid_t;
 
@@ -35,6 +36,17 @@ typedef int32_t envid_t;
 #define ENV_RUNNABLE		1
 #define ENV_NOT_RUNNABLE	2
 
+// A range of user memory the kernel found accessible (see
+// user_mem_check in kern/pmap.c)
+struct UserRange {
+	uintptr_t ur_start;		// page-aligned
+	uintptr_t ur_end;		// page-aligned, exclusive
+	uint32_t ur_gen;		// page directory generation checked in
+	int ur_perm;			// permissions all its pages have
+};
+
+#define ENV_NURANGE		4
+
 struct Env {
 	struct Trapframe env_tf;	// Saved registers
 	LIST_ENTRY(Env) env_link;	// Free list link pointers
@@ -46,9 +58,15 @@ struct Env {
 	// Address space
 	pde_t *env_pgdir;		// Kernel virtual address of page dir
 	physaddr_t env_cr3;		// Physical address of page dir
+	struct UserRange env_urange[ENV_NURANGE];	// recently checked
+	unsigned env_urange_next;	// slot to replace next
 
 	// Exception handling
 	void *env_pgfault_upcall;	// page fault upcall entry point
+	uintptr_t env_xstacktop;	// top of the upcall's exception stack
+
+	// Threads share env_pgdir with the env that created them
+	uintptr_t env_tls;		// %gs base, 0 for none
 
 	// Lab 4 IPC
 	bool env_ipc_recving;		// env is blocked receiving
@@ -57,8 +75,32 @@ struct Env {
 	envid_t env_ipc_from;		// envid of the sender	
 	int env_ipc_perm;		// perm of page mapping received
 
+	// Timeouts (kern/timer.c)
+	unsigned env_timer_expire;	// clock tick to wake at, 0 if none
+	LIST_ENTRY(Env) env_timer_link;	// timer wheel slot link
+
+	// Futex wait (kern/futex.c)
+	physaddr_t env_futex_pa;	// word waited on, 0 if none
+	LIST_ENTRY(Env) env_futex_link;	// futex hash chain link
+
+	// Network device wait (kern/e100.c)
+	bool env_net_waiting;		// on a tx or rx wait list
+	LIST_ENTRY(Env) env_net_link;	// wait list link
+
+	// Demand paging (kern/pager.c)
+	envid_t env_pager;		// env paging in [lo, hi), 0 if none
+	uintptr_t env_pager_lo;
+	uintptr_t env_pager_hi;
+	envid_t env_pager_key;		// env the pager knows our image by
+	uintptr_t env_pager_va;		// page we wait for, 0 if none
+	bool env_pager_queued;		// fault not yet sent to the pager
+
 	// FS journaling/JBD
 	void *env_trans;
+
+	// Kernel entry statistics (kern/kstat.c)
+	struct KStat env_syscalls[NSYSCALLS];	// by system call number
+	struct KStat env_traps;			// all other traps
 };
 
 #endif // !JOS_INC_ENV_H
@@ -29,8 +29,10 @@
 #define E_NO_BUFS	16	// No buffer space available
 #define E_NO_DATA	17	// No data available
 #define E_BUSY		18	// Device or resource busy
+#define E_TIMEOUT	19	// Timed out
+#define E_AGAIN		20	// Try again
 
-#define MAXERROR	18
+#define MAXERROR	20
 
 // Generic function return codes, quite self-explanatory
 //#define R_ERROR		-1
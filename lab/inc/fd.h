@@ -47,6 +47,7 @@ struct Stat {
 	char st_name[MAXNAMELEN];
 	off_t st_size;
 	int st_isdir;
+	uint32_t st_gen;	// changes whenever the file does
 	struct Dev *st_dev;
 };
 
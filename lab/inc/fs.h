@@ -36,9 +36,11 @@ struct File {
 	uint32_t f_direct[NDIRECT];	// direct blocks
 	uint32_t f_indirect;		// indirect block
 
+	uint32_t f_gen;			// bumped on every modification
+
 	// Pad out to 256 bytes; must do arithmetic in case we're compiling
 	// fsformat on a 64-bit machine.
-	uint8_t f_pad[256 - MAXNAMELEN - 8 - 4*NDIRECT - 4];
+	uint8_t f_pad[256 - MAXNAMELEN - 8 - 4*NDIRECT - 4 - 4];
 } __attribute__((packed));	// required only on some 64-bit machines
 
 // An inode block contains exactly BLKFILES 'struct File's
@@ -70,7 +72,15 @@ enum {
 	FSREQ_STAT,
 	FSREQ_FLUSH,
 	FSREQ_REMOVE,
-	FSREQ_SYNC
+	FSREQ_SYNC,
+	// Map returns the block cache page holding req_offset
+	FSREQ_MAP,
+	// Gen returns the page holding the file system's modification
+	// generation, shared read-only
+	FSREQ_GEN,
+	// Pager has the file server page in part of a child's image
+	// from the file on demand
+	FSREQ_PAGER
 };
 
 union Fsipc {
@@ -101,6 +111,7 @@ union Fsipc {
 		char ret_name[MAXNAMELEN];
 		off_t ret_size;
 		int ret_isdir;
+		uint32_t ret_gen;
 	} statRet;
 	struct Fsreq_flush {
 		int req_fileid;
@@ -108,6 +119,17 @@ union Fsipc {
 	struct Fsreq_remove {
 		char req_path[MAXPATHLEN];
 	} remove;
+	struct Fsreq_map {
+		int req_fileid;
+		off_t req_offset;
+	} map;
+	struct Fsreq_pager {
+		int req_fileid;
+		int req_envid;
+		uintptr_t req_va;
+		size_t req_len;
+		off_t req_offset;
+	} pager;
 };
 
 #endif /* !JOS_INC_FS_H */
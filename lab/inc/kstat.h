@@ -0,0 +1,26 @@
+#ifndef JOS_INC_KSTAT_H
+#define JOS_INC_KSTAT_H
+
+#include <inc/types.h>
+#include <inc/syscall.h>
+
+// Kernel entry statistics (kern/kstat.c).  The kernel counts every
+// trap and system call, with the TSC cycles from kernel entry until it
+// returns to an environment or goes idle, and maps the totals
+// read-only into every environment at USYSSTAT.  Each Env also keeps
+// its own system call totals (env_syscalls).
+
+#define KSTAT_NTRAP	64	// trap numbers counted, T_SYSCALL included
+
+struct KStat {
+	uint32_t ks_count;		// calls or traps
+	uint32_t ks_max;		// most cycles one took
+	uint64_t ks_cycles;		// cycles all took
+};
+
+struct SysStat {
+	struct KStat ss_syscall[NSYSCALLS];	// by system call number
+	struct KStat ss_trap[KSTAT_NTRAP];	// by trap number
+};
+
+#endif	// !JOS_INC_KSTAT_H
@@ -24,6 +24,10 @@
 #include <inc/fd.h>
 #include <inc/args.h>
 #include <inc/malloc.h>
+#include <inc/mutex.h>
+#include <inc/thread.h>
+#include <inc/prof.h>
+#include <inc/trace.h>
 #include <inc/ns.h>
 
 #define USED(x)		(void)(x)
@@ -38,6 +42,15 @@ void	exit(void);
 // libmain.c
 volatile struct Env *getenv();
 
+// The calling thread's Env: env in the initial thread.
+static __inline volatile struct Env *
+thisenv(void)
+{
+	struct Thread *t = thr_self();
+
+	return t ? t->t_env : env;
+}
+
 // pgfault.c
 void	set_pgfault_handler(void (*handler)(struct UTrapframe *utf));
 
@@ -59,9 +72,22 @@ int	sys_page_alloc(envid_t env, void *pg, int perm);
 int	sys_page_map(envid_t src_env, void *src_pg,
 		     envid_t dst_env, void *dst_pg, int perm);
 int	sys_page_unmap(envid_t env, void *pg);
+int	sys_page_table_share(envid_t src_env, void *va, envid_t dst_env);
+int	sys_env_set_pager(envid_t env, envid_t pager, uintptr_t lo, uintptr_t hi);
+int	sys_pager_reply(envid_t env, void *pg, int perm);
+int	sys_futex_wait(volatile uint32_t *addr, uint32_t val, unsigned deadline);
+int	sys_futex_wake(volatile uint32_t *addr, int n);
+envid_t	sys_thread_create(uintptr_t eip, uintptr_t esp, uintptr_t xstacktop,
+			  uintptr_t tls);
+int	sys_cons_log(uint32_t *pos, char *buf, size_t len);
+int	sys_prof(int cmd, envid_t envid, struct ProfEntry *ents, size_t n);
+int	sys_trace(int cmd, uint32_t mask, uint32_t *pos, struct TraceEvent *ev,
+		  size_t n);
 int	sys_ipc_try_send(envid_t to_env, uint32_t value, void *pg, int perm);
-int	sys_ipc_recv(void *rcv_pg);
+int	sys_ipc_recv(void *rcv_pg, unsigned deadline);
 unsigned int sys_time_msec(void);
+int	sys_time_nsec(uint64_t *nsec);
+int	sys_sleep_until(unsigned msec);
 int sys_net_get_hw_addr(void *buf, size_t len);
 int sys_net_tx_pkt(const void *pkt_buf, size_t pkt_len);
 int sys_net_rx_pkt(void *pkt_buf, size_t pkt_len);
@@ -83,11 +109,12 @@ sys_exofork(void)
 // ipc.c
 void	ipc_send(envid_t to_env, uint32_t value, void *pg, int perm);
 int32_t ipc_recv(envid_t *from_env_store, void *pg, int *perm_store);
+int32_t ipc_recv_until(envid_t *from_env_store, void *pg, int *perm_store,
+		       unsigned deadline);
 
 // fork.c
 #define	PTE_SHARE	0x400
 envid_t	fork(void);
-envid_t	sfork(void);	// Challenge!
 
 // fd.c
 int	close(int fd);
@@ -105,6 +132,8 @@ int	open(const char *path, int mode);
 int	ftruncate(int fd, off_t size);
 int	remove(const char *path);
 int	sync(void);
+const volatile uint32_t *fs_generation(void);
+int	file_pager(int fd, envid_t env, uintptr_t va, size_t len, off_t offset);
 
 // pageref.c
 int	pageref(void *addr);
@@ -112,6 +141,9 @@ int	pageref(void *addr);
 // sleep.c
 void sleep(int sec);
 
+// clock.c
+uint64_t time_nsec(void);
+
 // sockets.c
 int     accept(int s, struct sockaddr *addr, socklen_t *addrlen);
 int     bind(int s, struct sockaddr *name, socklen_t namelen);
@@ -119,6 +151,12 @@ int     shutdown(int s, int how);
 int     connect(int s, const struct sockaddr *name, socklen_t namelen);
 int     listen(int s, int backlog);
 int     socket(int domain, int type, int protocol);
+int     recv(int s, void *buf, size_t len, int flags);
+int     send(int s, const void *buf, size_t len, int flags);
+int     sendfile(int s, int fd, off_t offset, size_t len, int flags);
+int     sendpage(int s, union Nsipc *pg, int size, int flags);
+int     select(int nfds, fd_set *readset, fd_set *writeset, fd_set *exceptset,
+	       struct timeval *timeout);
 
 // nsipc.c
 int     nsipc_accept(int s, struct sockaddr *addr, socklen_t *addrlen);
@@ -130,8 +168,14 @@ int     nsipc_listen(int s, int backlog);
 int     nsipc_recv(int s, void *mem, int len, unsigned int flags);
 int     nsipc_send(int s, const void *buf, int size, unsigned int flags);
 int     nsipc_socket(int domain, int type, int protocol);
+int     nsipc_sendfile(int s, int fileid, off_t offset, size_t len,
+		       unsigned int flags);
+int     nsipc_send_page(int s, union Nsipc *pg, int size, unsigned int flags);
+int     nsipc_select(int nfds, fd_set *readset, fd_set *writeset,
+		     fd_set *exceptset, int timeout);
 
 // spawn.c
+extern int spawn_demand;
 envid_t	spawn(const char *program, const char **argv);
 envid_t	spawnl(const char *program, const char *arg0, ...);
 
@@ -1,7 +1,20 @@
 #ifndef JOS_INC_MALLOC_H
 #define JOS_INC_MALLOC_H 1
 
+struct MallocStats {
+	size_t ms_nmalloc;	// successful allocations
+	size_t ms_nfree;	// calls to free with a non-null pointer
+	size_t ms_nfailed;	// allocations that returned null
+	size_t ms_inuse;	// bytes allocated, rounded up to block size
+	size_t ms_slab_pages;	// pages holding small objects
+	size_t ms_run_pages;	// pages holding large objects
+};
+
 void *malloc(size_t size);
+void *calloc(size_t nmemb, size_t size);
+void *realloc(void *addr, size_t size);
 void free(void *addr);
+void malloc_getstats(struct MallocStats *ms);
+void malloc_stats(void);
 
 #endif
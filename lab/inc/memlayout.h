@@ -18,6 +18,7 @@
 #define GD_UT     0x18     // user text
 #define GD_UD     0x20     // user data
 #define GD_TSS    0x28     // Task segment selector
+#define GD_UTLS   0x30     // user thread-local data, loaded in %gs
 
 /*
  * Virtual memory map:                                Permissions
@@ -44,7 +45,9 @@
  *    UVPT      ---->  +------------------------------+ 0xef400000
  *                     |          RO PAGES            | R-/R-  PTSIZE
  *    UPAGES    ---->  +------------------------------+ 0xef000000
- *                     |           RO ENVS            | R-/R-  PTSIZE
+ *                     |           RO CLOCK           | R-/R-  PGSIZE
+ *    UCLOCK    ---->  +------------------------------+ 0xeefff000
+ *                     |           RO ENVS            | R-/R-  PTSIZE-PGSIZE
  * UTOP,UENVS ------>  +------------------------------+ 0xeec00000
  * UXSTACKTOP -/       |     User Exception Stack     | RW/RW  PGSIZE
  *                     +------------------------------+ 0xeebff000
@@ -112,6 +115,12 @@
 #define UPAGES		(UVPT - PTSIZE)
 // Read-only copies of the global env structures
 #define UENVS		(UPAGES - PTSIZE)
+// Read-only clock parameters (struct Clock), in the last page of the
+// UENVS slot
+#define UCLOCK		(UENVS + PTSIZE - PGSIZE)
+// Read-only trap and system call statistics (struct SysStat), in the
+// page below UCLOCK
+#define USYSSTAT	(UCLOCK - PGSIZE)
 
 /*
  * Top of user VM. User can manipulate VA from UTOP-1 and down!
@@ -136,6 +145,14 @@
 // The location of the user-level STABS data structure
 #define USTABDATA	(PTSIZE / 2)	
 
+// Fixed places libjos and programs map pages at, besides malloc's heap
+// (lib/malloc.c, 0x08000000-0x10000000) and the thread slots from
+// THRBASE (inc/thread.h).
+#define HTTPD_CACHEVA	0xA0000000	// httpd's response cache
+#define HTTPD_CACHESIZE	PTSIZE
+#define FSGENVA		(FDTABLE - PGSIZE)	// file server generation page
+#define FDTABLE		0xD0000000	// Fd pages, then their data pages
+
 
 #ifndef __ASSEMBLER__
 
@@ -180,7 +197,19 @@ struct Page {
 	// boot_alloc do not have valid reference count fields.
 
 	uint16_t pp_ref;
+
+	// Buddy allocator state, only meaningful in the first Page of a
+	// free block: PP_FREE is set and pp_order is the block's order.
+	uint8_t pp_order;
+	uint8_t pp_flags;
+
+	// For a page directory: changes whenever a user mapping in it is
+	// removed or loses permissions, which expires the ranges
+	// user_mem_check() remembers as accessible.
+	uint32_t pp_gen;
 };
 
+#define PP_FREE		0x01	// heads a block on a free list
+
 #endif /* !__ASSEMBLER__ */
 #endif /* !JOS_INC_MEMLAYOUT_H */
@@ -0,0 +1,30 @@
+#ifndef JOS_INC_MUTEX_H
+#define JOS_INC_MUTEX_H 1
+
+#include <inc/types.h>
+
+// Blocking mutexes and condition variables (lib/mutex.c).
+// Both are a single word, and zero-filled memory is a valid unlocked
+// mutex or condition variable.  To synchronize different environments
+// they must live in a page shared with PTE_SHARE.
+
+struct Mutex {
+	volatile uint32_t m_state;	// 0 free, 1 held, 2 held with waiters
+};
+
+struct Cond {
+	volatile uint32_t c_seq;	// bumped by every signal
+};
+
+void	mutex_init(struct Mutex *m);
+void	mutex_lock(struct Mutex *m);
+int	mutex_trylock(struct Mutex *m);
+void	mutex_unlock(struct Mutex *m);
+
+void	cond_init(struct Cond *c);
+void	cond_wait(struct Cond *c, struct Mutex *m);
+int	cond_wait_until(struct Cond *c, struct Mutex *m, unsigned deadline);
+void	cond_signal(struct Cond *c);
+void	cond_broadcast(struct Cond *c);
+
+#endif
@@ -32,17 +32,26 @@ enum {
 	NSREQ_RECV,
 	NSREQ_SEND,
 	NSREQ_SOCKET,
+	// Sendfile transmits file data straight out of the file server's
+	// block cache; the network server maps the blocks itself.
+	NSREQ_SENDFILE,
+	// Sendpage is a send whose request page lwIP may keep until the
+	// peer acknowledges the data, so its data must never change.
+	NSREQ_SENDPAGE,
+	// Select returns the ready sets in the Nsreq_select on the
+	// request page.
+	NSREQ_SELECT,
 
 	// The following two messages pass a page containing a struct jif_pkt
 	NSREQ_INPUT,
 	// NSREQ_OUTPUT, unlike all other messages, is sent *from* the
 	// network server, to the output environment
 	NSREQ_OUTPUT,
-
-	// The following message passes no page
-	NSREQ_TIMER,
 };
 
+// Most data an Nsreq_send in a page of its own can carry
+#define NSIPC_SENDPAGE_MAX	(PGSIZE - 3 * sizeof(int))
+
 union Nsipc {
 	struct Nsreq_accept {
 		int req_s;
@@ -96,6 +105,22 @@ union Nsipc {
 		char req_buf[0];
 	} send;
 
+	struct Nsreq_sendfile {
+		int req_s;
+		int req_fileid;
+		off_t req_offset;
+		size_t req_len;
+		unsigned int req_flags;
+	} sendfile;
+
+	struct Nsreq_select {
+		int req_nfds;
+		fd_set req_readset;
+		fd_set req_writeset;
+		fd_set req_exceptset;
+		int req_timeout;	// in msec, < 0 waits forever
+	} select;
+
 	struct Nsreq_socket {
 		int req_domain;
 		int req_type;
@@ -10,18 +10,19 @@
 #define dclog(dbg, fmt, ...) \
 	if (dbg) clog(fmt, ##__VA_ARGS__)
 
-// Profile utility macros
+// Profile utility macros (user level; time_nsec() reads the TSC)
 #define PROFILE_START() \
-	unsigned __time_start, __time_end; \
+	uint64_t __time_start, __time_end; \
  \
-	if (profile) __time_start = sys_time_msec()
+	if (profile) __time_start = time_nsec()
 
 #define PROFILE_END() \
 	do { \
 		if (profile) { \
-			__time_end = sys_time_msec(); \
-			clog("PROFILE: time taken = %u msecs", \
-					(__time_end - __time_start)); \
+			__time_end = time_nsec() - __time_start; \
+			clog("PROFILE: time taken = %u.%03u usecs", \
+					(unsigned) (__time_end / 1000), \
+					(unsigned) (__time_end % 1000)); \
 		} \
 	} while (0)
 
@@ -0,0 +1,28 @@
+#ifndef JOS_INC_PROF_H
+#define JOS_INC_PROF_H
+
+#include <inc/types.h>
+
+// Sampling profiler (kern/prof.c): while it is on, every clock
+// interrupt notes the interrupted eip for the running env, or for the
+// kernel.  sys_prof() and the monitor's prof command report the
+// samples by function.
+
+// sys_prof() commands
+#define PROF_START	1	// start taking samples
+#define PROF_STOP	2	// stop, keeping those taken
+#define PROF_RESET	3	// drop all samples
+#define PROF_REPORT	4	// report envid's address space, 0 for own
+#define PROF_KREPORT	5	// report the kernel's samples
+
+#define PROF_NAMELEN	32
+
+// Samples in a function, as reported
+struct ProfEntry {
+	uintptr_t pe_addr;		// its start, 0 for the unknown and
+					// samples taken but not kept
+	uint32_t pe_count;		// samples in it
+	char pe_name[PROF_NAMELEN];	// its name, null-terminated
+};
+
+#endif	// !JOS_INC_PROF_H
@@ -1,6 +1,7 @@
 #ifndef JOS_INC_STDIO_H
 #define JOS_INC_STDIO_H
 
+#include <inc/types.h>
 #include <inc/stdarg.h>
 
 #ifndef NULL
@@ -27,6 +28,45 @@ int	printf(const char *fmt, ...);
 int	fprintf(int fd, const char *fmt, ...);
 int	vfprintf(int fd, const char *fmt, va_list);
 
+// lib/bufio.c
+#define BUFSIZ		4096	// a page, the file server's transfer unit
+#define EOF		(-1)
+
+#define _IOFBF		0	// write out when the buffer fills
+#define _IOLBF		1	// ... or a line ends
+#define _IONBF		2	// ... or the call returns
+
+typedef struct FILE {
+	int f_fd;		// file descriptor
+	int f_flags;		// F_* in lib/bufio.c
+	int f_mode;		// _IOFBF, _IOLBF or _IONBF; -1 until known
+	char *f_buf;		// buffer of f_bufsize bytes
+	size_t f_bufsize;
+	size_t f_pos;		// next byte in f_buf to read or write
+	size_t f_len;		// bytes of input in f_buf
+	struct FILE *f_next;	// next open FILE
+	char f_ibuf[BUFSIZ];	// default buffer
+} FILE;
+
+extern FILE *stdin, *stdout, *stderr;
+
+FILE *	fopen(const char *path, const char *mode);
+FILE *	fdopen(int fd, const char *mode);
+int	fclose(FILE *f);
+int	fflush(FILE *f);
+int	setvbuf(FILE *f, char *buf, int mode, size_t size);
+size_t	fread(void *buf, size_t size, size_t n, FILE *f);
+size_t	fwrite(const void *buf, size_t size, size_t n, FILE *f);
+int	fgetc(FILE *f);
+char *	fgets(char *s, int size, FILE *f);
+int	fputc(int c, FILE *f);
+int	fputs(const char *s, FILE *f);
+int	bprintf(FILE *f, const char *fmt, ...);
+int	vbprintf(FILE *f, const char *fmt, va_list);
+int	feof(FILE *f);
+int	ferror(FILE *f);
+int	fileno(FILE *f);
+
 // lib/readline.c
 char*	readline(const char *prompt);
 
@@ -18,6 +18,8 @@ void *	memset(void *dst, int c, size_t len);
 void *	memmove(void *dst, const void *src, size_t len);
 int	memcmp(const void *s1, const void *s2, size_t len);
 void *	memfind(const void *s, int c, size_t len);
+void *	pagezero(void *dst);
+void *	pagecopy(void *dst, const void *src);
 
 long	strtol(const char *s, char **endptr, int base);
 
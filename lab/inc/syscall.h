@@ -23,7 +23,21 @@ enum
 	SYS_net_get_hw_addr,
 	SYS_net_tx_pkt,
 	SYS_net_rx_pkt,
+	SYS_sleep_until,
+	SYS_time_nsec,
+	SYS_page_table_share,
+	SYS_env_set_pager,
+	SYS_pager_reply,
+	SYS_futex_wait,
+	SYS_futex_wake,
+	SYS_thread_create,
+	SYS_cons_log,
+	SYS_prof,
+	SYS_trace,
 	NSYSCALLS
 };
 
+// Bytes of console output the kernel keeps for sys_cons_log; a power of 2
+#define CONSLOG_SIZE	16384
+
 #endif /* !JOS_INC_SYSCALL_H */
@@ -0,0 +1,57 @@
+#ifndef JOS_INC_THREAD_H
+#define JOS_INC_THREAD_H 1
+
+#include <inc/types.h>
+#include <inc/memlayout.h>
+#include <inc/env.h>
+
+// Threads (lib/thread.c): envs that run in the address space of the
+// env that created them, each with its own registers, stack, exception
+// stack and thread block.  The kernel bases %gs at the thread block.
+// A thread exits on its own; the others, and the address space, live
+// on until the last of them is gone.
+
+// Thread stacks: slots of THRSLOT bytes from THRBASE up, each a guard
+// page, the exception stack, another guard page and the stack.
+#define THRBASE		0xE0000000	// above the fd table, unused
+#define THRSLOT		(8 * PGSIZE)
+#define THRMAX		256
+#define THRXSTACK	(2 * PGSIZE)	// exception stack top in a slot
+#define THRSTACK	(3 * PGSIZE)	// stack bottom in a slot
+
+struct Thread {
+	struct Thread *t_self;		// %gs:0
+	volatile struct Env *t_env;	// this thread's Env
+	void (*t_func)(void *);		// entry point
+	void *t_arg;			// its argument, free for the thread's use
+};
+
+envid_t	thr_create(void (*func)(void *), void *arg);
+void	thr_exit(void) __attribute__((noreturn));
+void	thr_forkchild(void);
+
+// Return the calling thread's block, or NULL in the env's initial
+// thread, which has none.
+static __inline struct Thread *
+thr_self(void)
+{
+	struct Thread *t;
+	uint16_t gs;
+
+	__asm __volatile("movw %%gs,%0" : "=r" (gs));
+	if (gs != (GD_UTLS | 3))
+		return NULL;
+	__asm __volatile("movl %%gs:0,%0" : "=r" (t));
+	return t;
+}
+
+// Whether va is in a thread's exception stack, which fork() must leave
+// writable, as it does UXSTACK.
+static __inline bool
+thr_isxstack(uintptr_t va)
+{
+	return va >= THRBASE && va < THRBASE + THRMAX * THRSLOT
+		&& va % THRSLOT / PGSIZE == THRXSTACK / PGSIZE - 1;
+}
+
+#endif	// !JOS_INC_THREAD_H
@@ -0,0 +1,69 @@
+#ifndef JOS_INC_TRACE_H
+#define JOS_INC_TRACE_H
+
+#include <inc/types.h>
+
+// Event trace (kern/trace.c): the kernel records the events of the
+// categories enabled, each with its TSC time, in a ring of the last
+// TRACE_NEVENTS.  sys_trace() and the monitor's trace command read it.
+//
+// user/trace writes what it reads either as text, a line an event
+//	<tsc> <event> <envid> <arg0> <arg1>
+// with the numbers in hex, after a "# tsc_khz <khz> tsc_base <tsc>"
+// line, or (-o) as a file of a struct TraceHeader and then struct
+// TraceEvents, for turning into a timeline off-line.
+
+// Categories, for sys_trace(TRACE_SETMASK)
+#define TRACE_SCHED	0x01	// envs run, kernel idle
+#define TRACE_IPC	0x02	// IPC sends and receives
+#define TRACE_PGFLT	0x04	// user page faults
+#define TRACE_IRQ	0x08	// device interrupts
+#define TRACE_CLOCK	0x10	// clock interrupts
+#define TRACE_ALL	0x1f
+
+// Events, with their category in the high byte, and what the env
+// and arguments are
+#define TRACE_EVENT(cat, n)	((cat) << 8 | (n))
+#define TRACE_CAT(type)		((type) >> 8)
+#define TE_RUN		TRACE_EVENT(TRACE_SCHED, 0)	// env to run; env
+							// before (0 idle), eip
+#define TE_IDLE		TRACE_EVENT(TRACE_SCHED, 1)	// env last run; -, -
+#define TE_SEND		TRACE_EVENT(TRACE_IPC, 0)	// sender; to, value
+#define TE_SEND_BUSY	TRACE_EVENT(TRACE_IPC, 1)	// sender; to, value
+							// (to not receiving)
+#define TE_RECV		TRACE_EVENT(TRACE_IPC, 2)	// receiver; dstva,
+							// deadline
+#define TE_PGFLT	TRACE_EVENT(TRACE_PGFLT, 0)	// env; va, eip
+#define TE_IRQ		TRACE_EVENT(TRACE_IRQ, 0)	// env interrupted
+							// (0 kernel); irq, eip
+#define TE_CLOCK	TRACE_EVENT(TRACE_CLOCK, 0)	// as TE_IRQ
+
+#define TRACE_NEVENTS	2048	// events the ring holds; a power of 2
+
+struct TraceEvent {
+	uint64_t te_tsc;		// when
+	uint32_t te_type;		// TE_*
+	uint32_t te_env;		// envid, 0 for none
+	uint32_t te_arg[2];
+};
+
+// sys_trace() commands
+#define TRACE_SETMASK	1	// enable the categories in mask only
+#define TRACE_CLEAR	2	// drop the events recorded so far
+#define TRACE_READ	3	// read events from *pos
+
+#define TRACE_MAGIC	0x4352544a	// "JTRC"
+
+// What user/trace -o writes first
+struct TraceHeader {
+	uint32_t th_magic;		// TRACE_MAGIC
+	uint32_t th_tsc_khz;		// TSC frequency
+	uint64_t th_tsc_base;		// TSC at time 0
+};
+
+// lib/tracefmt.c
+int	trace_parse_mask(const char *s);
+void	trace_mask_names(char *buf, int size, uint32_t mask);
+int	trace_format(char *buf, int size, const struct TraceEvent *te);
+
+#endif	// !JOS_INC_TRACE_H
@@ -36,6 +36,8 @@ static __inline void cpuid(uint32_t info, uint32_t *eaxp, uint32_t *ebxp, uint32
 static __inline uint64_t read_tsc(void) __attribute__((always_inline));
 static __inline void rdmsr(uint32_t msr, uint32_t *lop, uint32_t *hip) __attribute__((always_inline));
 static __inline void wrmsr(uint32_t msr, uint32_t lo, uint32_t hi) __attribute__((always_inline));
+static __inline uint32_t xchg(volatile uint32_t *addr, uint32_t newval) __attribute__((always_inline));
+static __inline uint32_t cmpxchg(volatile uint32_t *addr, uint32_t oldval, uint32_t newval) __attribute__((always_inline));
 
 static __inline void
 breakpoint(void)
@@ -295,4 +297,31 @@ wrmsr(uint32_t msr, uint32_t lo, uint32_t hi)
 			: "c" (msr), "a" (lo), "d" (hi));
 }
 
+// Atomically store 'newval' in *addr and return the old value.
+static __inline uint32_t
+xchg(volatile uint32_t *addr, uint32_t newval)
+{
+	uint32_t result;
+
+	__asm __volatile("lock; xchgl %0, %1"
+			 : "+m" (*addr), "=a" (result)
+			 : "1" (newval)
+			 : "cc", "memory");
+	return result;
+}
+
+// Atomically store 'newval' in *addr if it holds 'oldval'.
+// Returns the value *addr held.
+static __inline uint32_t
+cmpxchg(volatile uint32_t *addr, uint32_t oldval, uint32_t newval)
+{
+	uint32_t result;
+
+	__asm __volatile("lock; cmpxchgl %2, %1"
+			 : "=a" (result), "+m" (*addr)
+			 : "r" (newval), "0" (oldval)
+			 : "cc", "memory");
+	return result;
+}
+
 #endif /* !JOS_INC_X86_H */
@@ -11,6 +11,7 @@
 
 static void cons_intr(int (*proc)(void));
 static void cons_putc(int c);
+static void cga_cursor(void);
 
 // Stupid I/O delay routine necessitated by historical PC design flaws
 static void
@@ -32,8 +33,12 @@ delay(void)
 #define COM_DLM		1	// Out: Divisor Latch High (DLAB=1)
 #define COM_IER		1	// Out: Interrupt Enable Register
 #define   COM_IER_RDI	0x01	//   Enable receiver data interrupt
+#define   COM_IER_TXI	0x02	//   Enable transmitter empty interrupt
 #define COM_IIR		2	// In:	Interrupt ID Register
+#define   COM_IIR_FIFO	0xC0	//   FIFOs enabled
 #define COM_FCR		2	// Out: FIFO Control Register
+#define   COM_FCR_FIFO	0x01	//   Enable FIFOs
+#define   COM_FCR_CLR	0x06	//   Clear both FIFOs
 #define COM_LCR		3	// Out: Line Control Register
 #define	  COM_LCR_DLAB	0x80	//   Divisor latch access bit
 #define	  COM_LCR_WLEN8	0x03	//   Wordlength: 8 bits
@@ -47,6 +52,7 @@ delay(void)
 #define   COM_LSR_TSRE	0x40	//   Transmitter off
 
 static bool serial_exists;
+static int serial_txburst = 1;	// bytes the transmitter takes when empty
 
 static int
 serial_proc_data(void)
@@ -56,11 +62,16 @@ serial_proc_data(void)
 	return inb(COM1+COM_RX);
 }
 
+// Reading the IIR acknowledges a transmitter-empty interrupt, which
+// otherwise stays pending when there is nothing more to send.
 void
 serial_intr(void)
 {
-	if (serial_exists)
+	if (serial_exists) {
+		(void) inb(COM1+COM_IIR);
 		cons_intr(serial_proc_data);
+		cons_drain(CONSLOG_SIZE);
+	}
 }
 
 static void
@@ -79,8 +90,11 @@ serial_putc(int c)
 static void
 serial_init(void)
 {
-	// Turn off the FIFO
-	outb(COM1+COM_FCR, 0);
+	// Turn on the FIFOs, so that each transmitter-empty interrupt
+	// can take a burst of output
+	outb(COM1+COM_FCR, COM_FCR_FIFO | COM_FCR_CLR);
+	if ((inb(COM1+COM_IIR) & COM_IIR_FIFO) == COM_IIR_FIFO)
+		serial_txburst = 16;
 	
 	// Set speed; requires DLAB latch
 	outb(COM1+COM_LCR, COM_LCR_DLAB);
@@ -92,8 +106,8 @@ serial_init(void)
 
 	// No modem controls
 	outb(COM1+COM_MCR, 0);
-	// Enable rcv interrupts
-	outb(COM1+COM_IER, COM_IER_RDI);
+	// Enable rcv and xmit interrupts
+	outb(COM1+COM_IER, COM_IER_RDI | COM_IER_TXI);
 
 	// Clear any preexisting overrun indications and interrupts
 	// Serial port doesn't exist if COM_LSR returns 0xFF
@@ -124,6 +138,17 @@ lpt_putc(int c)
 	outb(0x378+2, 0x08);
 }
 
+// Output c if the printer is ready for it, else drop it.
+static void
+lpt_trysend(int c)
+{
+	if (inb(0x378+1) & 0x80) {
+		outb(0x378+0, c);
+		outb(0x378+2, 0x08|0x04|0x01);
+		outb(0x378+2, 0x08);
+	}
+}
+
 
 
 
@@ -184,11 +209,11 @@ cga_putc(int c)
 		crt_pos -= (crt_pos % CRT_COLS);
 		break;
 	case '\t':
-		cons_putc(' ');
-		cons_putc(' ');
-		cons_putc(' ');
-		cons_putc(' ');
-		cons_putc(' ');
+		cga_putc(' ');
+		cga_putc(' ');
+		cga_putc(' ');
+		cga_putc(' ');
+		cga_putc(' ');
 		break;
 	default:
 		crt_buf[crt_pos++] = c;		/* write the character */
@@ -205,8 +230,12 @@ cga_putc(int c)
 			crt_buf[i] = 0x0700 | ' ';
 		crt_pos -= CRT_COLS;
 	}
+}
 
-	/* move that little blinky thing */
+/* move that little blinky thing, once per batch of output */
+static void
+cga_cursor(void)
+{
 	outb(addr_6845, 14);
 	outb(addr_6845 + 1, crt_pos >> 8);
 	outb(addr_6845, 15);
@@ -432,7 +461,7 @@ cons_getc(void)
 	return 0;
 }
 
-// output a character to the console
+// output a character to the console devices
 static void
 cons_putc(int c)
 {
@@ -441,6 +470,143 @@ cons_putc(int c)
 	cga_putc(c);
 }
 
+
+
+/***** Console output log *****/
+// All console output goes into this ring first, and cons_drain()
+// passes it on to the devices.  The kernel's own output is drained
+// right away.  sys_cputs output is left to the serial transmitter-empty
+// interrupt, the clock and idle time, so the caller only pays for
+// copying it, unless the ring is full of output the devices have not
+// taken yet: then the writer waits for them.
+
+#define CONSLOGMASK	(CONSLOG_SIZE - 1)
+
+static struct {
+	char buf[CONSLOG_SIZE];
+	uint32_t wpos;	// bytes ever written
+	uint32_t dpos;	// bytes ever passed on to the devices
+} conslog;
+
+// Pass n bytes of the log on to the devices, waiting for them as long
+// as it takes.
+static void
+cons_sync(uint32_t n)
+{
+	for (; n > 0; n--)
+		cons_putc((uint8_t) conslog.buf[conslog.dpos++ & CONSLOGMASK]);
+	cga_cursor();
+}
+
+// Pass all of the log on to the devices.
+void
+cons_flush(void)
+{
+	if (conslog.dpos != conslog.wpos)
+		cons_sync(conslog.wpos - conslog.dpos);
+}
+
+// Pass up to max bytes of the log on to the devices, but no more than
+// the serial transmitter can take without waiting.  Returns the number
+// of bytes passed on.
+//
+// Once TXRDY shows the transmitter empty, a whole burst fits in its
+// FIFO, so the burst is written without polling between bytes.  The
+// display takes output at once; the printer gets what it is ready for
+// and the rest is dropped rather than waited for.
+unsigned
+cons_drain(unsigned max)
+{
+	unsigned n = 0, burst;
+	int c;
+
+	while (n < max && conslog.dpos != conslog.wpos) {
+		if (!serial_exists)
+			burst = max - n;
+		else if (inb(COM1+COM_LSR) & COM_LSR_TXRDY)
+			burst = serial_txburst;
+		else
+			break;
+		burst = MIN(burst, MIN(max - n, conslog.wpos - conslog.dpos));
+		n += burst;
+		for (; burst > 0; burst--) {
+			c = (uint8_t) conslog.buf[conslog.dpos++ & CONSLOGMASK];
+			if (serial_exists)
+				outb(COM1+COM_TX, c);
+			lpt_trysend(c);
+			cga_putc(c);
+		}
+	}
+	if (n > 0)
+		cga_cursor();
+	return n;
+}
+
+// Add len bytes to the log, and start the serial transmitter on them.
+void
+cons_write(const char *s, size_t len)
+{
+	uint32_t off, m;
+
+	while (len > 0) {
+		if (conslog.wpos - conslog.dpos == CONSLOG_SIZE)
+			cons_sync(MIN(len, CONSLOG_SIZE));
+		off = conslog.wpos & CONSLOGMASK;
+		m = MIN(len, CONSLOG_SIZE - (conslog.wpos - conslog.dpos));
+		m = MIN(m, CONSLOG_SIZE - off);
+		memmove(conslog.buf + off, s, m);
+		conslog.wpos += m;
+		s += m;
+		len -= m;
+	}
+	if (serial_exists)
+		cons_drain(CONSLOG_SIZE);
+}
+
+// Copy to buf up to len bytes of the log from *pos on, or from the
+// oldest byte still held if that is later, and set *pos past the last
+// byte copied.  Positions count bytes ever written.
+// Returns the number of bytes copied.
+size_t
+cons_log_read(uint32_t *pos, char *buf, size_t len)
+{
+	uint32_t p = *pos, off, m;
+	size_t n = 0;
+
+	if ((int32_t) (conslog.wpos - p) < 0)
+		return 0;
+	if (conslog.wpos - p > CONSLOG_SIZE)
+		p = conslog.wpos - CONSLOG_SIZE;
+	len = MIN(len, conslog.wpos - p);
+	while (n < len) {
+		off = p & CONSLOGMASK;
+		m = MIN(len - n, CONSLOG_SIZE - off);
+		memmove(buf + n, conslog.buf + off, m);
+		p += m;
+		n += m;
+	}
+	*pos = p;
+	return n;
+}
+
+// Show what the log holds on the devices, without adding it to the
+// log again.
+void
+cons_log_show(void)
+{
+	char buf[64];
+	uint32_t pos = 0, end;
+	size_t i, n;
+
+	cons_flush();
+	end = conslog.wpos;
+	while (pos != end && (n = cons_log_read(&pos, buf,
+						MIN(sizeof(buf), end - pos))) > 0)
+		for (i = 0; i < n; i++)
+			cons_putc((uint8_t) buf[i]);
+	cga_cursor();
+}
+
 // initialize the console devices
 void
 cons_init(void)
@@ -466,7 +632,17 @@ putclrch(int ch, int bkc,int frc)
 void
 cputchar(int c)
 {
-	cons_putc(c);
+	char ch = c;
+
+	// Colored characters bypass the log, which holds plain bytes
+	if (c & ~0xFF) {
+		cons_flush();
+		cons_putc(c);
+		cga_cursor();
+		return;
+	}
+	cons_write(&ch, 1);
+	cons_flush();
 }
 
 int
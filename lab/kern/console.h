@@ -7,6 +7,7 @@
 #endif
 
 #include <inc/types.h>
+#include <inc/syscall.h>
 
 #define MONO_BASE	0x3B4
 #define MONO_BUF	0xB0000
@@ -19,6 +20,14 @@
 
 void cons_init(void);
 int cons_getc(void);
+// Console output to pass on per clock tick or idle step
+#define CONS_BURST	64
+
+void cons_write(const char *s, size_t len);
+unsigned cons_drain(unsigned max);
+void cons_flush(void);
+size_t cons_log_read(uint32_t *pos, char *buf, size_t len);
+void cons_log_show(void);
 
 void kbd_intr(void); // irq 1
 void serial_intr(void); // irq 4
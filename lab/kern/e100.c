@@ -8,17 +8,31 @@
 #include <kern/e100.h>
 #include <kern/pci.h>
 #include <kern/pmap.h>
+#include <kern/env.h>
 #include <kern/picirq.h>
 
 static uint32_t csr_base;
 static uint32_t csr_size;
 uint8_t e100_irq_line;
 
-static struct E100_crb cbl[E100_CBL_SIZE];
-static struct E100_crb rfa[E100_RFA_SIZE];
-static int last_tx_id;
+// The rings are allocated a page at a time when the device is
+// attached, so descriptors are reached through these arrays.
+static struct E100_tcb *cbl[E100_MAXTX];
+static struct E100_rfd *rfa[E100_MAXRX];
+static int ntx, nrx;
+
+// TCBs tx_clean .. tx_next-1 are queued; tx_free are available.
+// tx_pages holds a reference on each page a queued frame is gathered
+// from, dropped once the CU has transmitted it.
+static struct Page *tx_pages[E100_MAXTX][E100_TX_NTBD];
+static int tx_next, tx_clean, tx_free;
 static int last_rx_id;
 
+// Environments sleeping until a TCB frees up or a frame comes in.
+// All of a list is woken at once; each retries its call.
+static struct Env_list tx_waiters;
+static struct Env_list rx_waiters;
+
 static uint8_t eeprom_size;
 static uint8_t eeprom_hw_addr[HWADDR_LEN_82559ER];
 
@@ -32,52 +46,96 @@ udelay(int micros)
 	}
 }
 
-static void
+// Carve 'n' descriptors of 'size' bytes out of one physically
+// contiguous run of fresh pages, never letting one straddle a page
+// boundary.
+static int
+alloc_ring(void **ring, int n, size_t size)
+{
+	struct Page *pp = NULL;
+	int i, per = PGSIZE / size;
+	int npages = (n + per - 1) / per;
+	int order = 0;
+	int r;
+
+	while ((1 << order) < npages) {
+		++order;
+	}
+	if ((r = page_alloc_order(order, &pp)) < 0) {
+		return r;
+	}
+	for (i = 0; i < (1 << order); ++i) {
+		pp[i].pp_ref++;
+	}
+	memset(page2kva(pp), 0, PGSIZE << order);
+
+	for (i = 0; i < n; ++i) {
+		ring[i] = (char *) page2kva(pp + i / per) + (i % per) * size;
+	}
+
+	return 0;
+}
+
+static int
+ring_size(int n, int max)
+{
+	if (n < 8) {
+		return 8;
+	}
+	return n > max ? max : n;
+}
+
+static int
 init_dma_rings()
 {
-	int i;
+	int i, r;
 
-	// Initialize CBL
-	for (i = 0; i < E100_CBL_SIZE; ++i) {
-		cbl[i].status = E100_TCB_SW_NULL;
-		cbl[i].cmd = E100_TCB_CW_NULL;
-		if (i == (E100_CBL_SIZE - 1)) {
-			// Last in the ring
-			cbl[i].link = PADDR(&cbl[0]);
-		}
-		else {
-			cbl[i].link = PADDR(&cbl[i + 1]);
-		}
-		cbl[i].data.tx_data.tbd_addr = E100_TCB_TBD_NULL;
-		cbl[i].data.tx_data.tbd_count = E100_TCB_TBD_CNT;
-		cbl[i].data.tx_data.tx_thrs = E100_TCB_TX_THRESHOLD;
+	ntx = ring_size(E100_NTX, E100_MAXTX);
+	nrx = ring_size(E100_NRX, E100_MAXRX);
+	if ((r = alloc_ring((void **) cbl, ntx, sizeof(struct E100_tcb))) < 0
+			|| (r = alloc_ring((void **) rfa, nrx,
+					sizeof(struct E100_rfd))) < 0) {
+		return r;
 	}
 
+	// Initialize CBL
+	for (i = 0; i < ntx; ++i) {
+		cbl[i]->status = E100_TCB_SW_NULL;
+		cbl[i]->cmd = E100_TCB_CW_NULL;
+		cbl[i]->link = PADDR(cbl[(i + 1) % ntx]);
+		cbl[i]->tbd_addr = PADDR(cbl[i]->tbd);
+		cbl[i]->tcb_bcount = 0;
+		cbl[i]->tbd_count = E100_TCB_TBD_CNT;
+		cbl[i]->tx_thrs = E100_TCB_TX_THRESHOLD;
+	}
+	tx_next = tx_clean = 0;
+	tx_free = ntx;
+
 	assert((ETH_PKTSZ_MAX % 2) == 0);
 
 	// Initialize RFA
-	for (i = 0; i < E100_RFA_SIZE; ++i) {
-		rfa[i].status = E100_RFD_SW_NULL;
-		if (i == (E100_RFA_SIZE - 1)) {
+	for (i = 0; i < nrx; ++i) {
+		rfa[i]->status = E100_RFD_SW_NULL;
+		if (i == (nrx - 1)) {
 			// Last in the ring
-			rfa[i].cmd = E100_RFD_CW_S;
-			rfa[i].link = PADDR(&rfa[0]);
+			rfa[i]->cmd = E100_RFD_CW_S;
 		}
 		else {
-			rfa[i].cmd = E100_RFD_CW_CMD;
-			rfa[i].link = PADDR(&rfa[i + 1]);
+			rfa[i]->cmd = E100_RFD_CW_CMD;
 		}
-		rfa[i].data.rx_data.rfd_rsv = E100_RFD_RSV_NULL;
-		rfa[i].data.rx_data.rfd_count = E100_RFD_AC_NULL;
-		rfa[i].data.rx_data.rfd_size = ETH_PKTSZ_MAX;
+		rfa[i]->link = PADDR(rfa[(i + 1) % nrx]);
+		rfa[i]->rfd_rsv = E100_RFD_RSV_NULL;
+		rfa[i]->rfd_count = E100_RFD_AC_NULL;
+		rfa[i]->rfd_size = ETH_PKTSZ_MAX;
 	}
+
+	return 0;
 }
 
-static int
-restart_cu()
+static void
+wait_scb_cmd()
 {
 	uint16_t scb_cmd;
-	uint16_t scb_status;
 
 	scb_cmd = E100_SCB_CW_CU_DMASK | E100_SCB_CW_RU_DMASK;
 	while ((scb_cmd & (E100_SCB_CW_CU_DMASK | E100_SCB_CW_RU_DMASK)) != 0x0) {
@@ -85,11 +143,20 @@ restart_cu()
 		scb_cmd = inw(E100_CSR_SCB_CW(csr_base));
 		udelay(1);
 	}
+}
+
+// Get the CU going on the queued TCBs, 'first' being the oldest.
+static int
+restart_cu(struct E100_tcb *first)
+{
+	uint16_t scb_status;
+
+	wait_scb_cmd();
 
 	scb_status = inw(E100_CSR_SCB_SW(csr_base));
 	if ((scb_status & E100_SCB_SW_CU_DMASK) == E100_SCB_SW_CU_IDLE) {
 		// Idle, so do CU start
-		outl(E100_CSR_SCB_GP(csr_base), PADDR(&cbl[0]));
+		outl(E100_CSR_SCB_GP(csr_base), PADDR(first));
 		outw(E100_CSR_SCB_CW(csr_base),
 				(E100_SCB_CW_INTR | E100_SCB_CW_CU_START));
 	}
@@ -99,7 +166,7 @@ restart_cu()
 				(E100_SCB_CW_INTR | E100_SCB_CW_CU_RESUME));
 	}
 	else {
-		//panic("scb_status = %u", scb_status);
+		// Active, it will get to the new TCB through the links
 	}
 
 	return 0;
@@ -108,20 +175,14 @@ restart_cu()
 static int
 restart_rx()
 {
-	uint16_t scb_cmd;
 	uint16_t scb_status;
 
-	scb_cmd = E100_SCB_CW_CU_DMASK | E100_SCB_CW_RU_DMASK;
-	while ((scb_cmd & (E100_SCB_CW_CU_DMASK | E100_SCB_CW_RU_DMASK)) != 0x0) {
-		//return -E_BUSY;
-		scb_cmd = inw(E100_CSR_SCB_CW(csr_base));
-		udelay(1);
-	}
+	wait_scb_cmd();
 
 	scb_status = inw(E100_CSR_SCB_SW(csr_base));
 	if ((scb_status & E100_SCB_SW_RU_DMASK) == E100_SCB_SW_RU_IDLE) {
 		// Idle, so do RU start
-		outl(E100_CSR_SCB_GP(csr_base), PADDR(&rfa[0]));
+		outl(E100_CSR_SCB_GP(csr_base), PADDR(rfa[0]));
 		outw(E100_CSR_SCB_CW(csr_base),
 				(E100_SCB_CW_INTR | E100_SCB_CW_RU_START));
 	}
@@ -164,10 +225,10 @@ print_dma_ring_rx()
 	int i;
 
 	clog("");
-	for (i = 0; i < E100_RFA_SIZE; ++i) {
-		cprintf("%d: %04x %04x %08x, %08x %04x %04x\n", i, rfa[i].status,
-				rfa[i].cmd, rfa[i].link, rfa[i].data.rx_data.rfd_rsv,
-				rfa[i].data.rx_data.rfd_count, rfa[i].data.rx_data.rfd_size);
+	for (i = 0; i < nrx; ++i) {
+		cprintf("%d: %04x %04x %08x, %08x %04x %04x\n", i, rfa[i]->status,
+				rfa[i]->cmd, rfa[i]->link, rfa[i]->rfd_rsv,
+				rfa[i]->rfd_count, rfa[i]->rfd_size);
 	}
 }
 
@@ -321,6 +382,8 @@ eeprom_get_hw_addr()
 int
 pci_network_8255x_attach(struct pci_func *pcif)
 {
+	int r;
+
 	pci_func_enable(pcif);
 	//clog("CSR Mem Map: %p %x", pcif->reg_base[0], pcif->reg_size[0]);
 	clog("CSR I/O Map: %p %x", pcif->reg_base[1], pcif->reg_size[1]);
@@ -341,17 +404,14 @@ pci_network_8255x_attach(struct pci_func *pcif)
 			eeprom_hw_addr[0], eeprom_hw_addr[1], eeprom_hw_addr[2],
 			eeprom_hw_addr[3], eeprom_hw_addr[4], eeprom_hw_addr[5]);
 
-#if 0
-	clog("wp1: sizeof(struct E100_crb) = %u", sizeof(struct E100_crb));
-	clog("wp2: sizeof(struct E100_txcb) = %u", sizeof(struct E100_txcb));
-	clog("wp2: sizeof(struct E100_rxcb) = %u", sizeof(struct E100_rxcb));
-#endif
-	init_dma_rings();
+	if ((r = init_dma_rings()) < 0) {
+		panic("pci_network_8255x_attach: init_dma_rings: %e", r);
+	}
+	clog("DMA rings: %d TCBs, %d RFDs", ntx, nrx);
 
 	irq_setmask_8259A(irq_mask_8259A & ~(1 << e100_irq_line));
 
-	last_tx_id = E100_CBL_SIZE - 1;
-	last_rx_id = E100_RFA_SIZE - 1;
+	last_rx_id = nrx - 1;
 	restart_rx();
 
 	return 1;
@@ -367,86 +427,181 @@ e100_get_hw_addr(void *buf, size_t len)
 	return len;
 }
 
-int
-e100_tx_pkt(const void *buf, size_t len)
+// Release the TCBs the CU has finished with, and the pages their
+// frames were gathered from.
+static void
+tx_reclaim()
 {
-	int i, busy = -1, next = -1;
-	struct E100_crb *pcb = NULL;
-
-#if 0
-	for (i = 0; i < E100_CBL_SIZE; ++i) {
-		if (cbl[i].cmd == E100_TCB_CW_NULL) {
-			if (next < 0) {
-				next = i;
-			}
+	struct E100_tcb *tcb;
+	int j;
+
+	while (tx_free < ntx) {
+		tcb = cbl[tx_clean];
+		if (!(tcb->status & E100_TCB_SW_C)) {
+			break;
 		}
-		else {
-			busy = i;
+		for (j = 0; j < E100_TX_NTBD; ++j) {
+			if (tx_pages[tx_clean][j]) {
+				page_decref(tx_pages[tx_clean][j]);
+				tx_pages[tx_clean][j] = NULL;
+			}
 		}
+		tcb->cmd = E100_TCB_CW_NULL;
+		tcb->status = E100_TCB_SW_NULL;
+		tx_clean = (tx_clean + 1) % ntx;
+		++tx_free;
 	}
-	if (busy != (E100_CBL_SIZE - 1)) {
-		next = busy + 1;
-	}
+}
 
-	if (next < 0) {
-		return -E_NO_BUFS;
+// Queue the frame at 'buf' in address space 'pgdir' for transmission.
+// The frame is not copied: a TBD points at each physical page it
+// spans, and those pages are held until the CU is done with them.
+// Returns -E_NO_BUFS if every TCB is still in use.
+int
+e100_tx_pkt(pde_t *pgdir, const void *buf, size_t len)
+{
+	struct E100_tcb *tcb, *prev;
+	struct Page *pp;
+	uintptr_t va;
+	size_t n;
+	int i, j;
+
+	if (tx_free == 0) {
+		tx_reclaim();
+		if (tx_free == 0) {
+			return -E_NO_BUFS;
+		}
 	}
 
-	pcb = &cbl[next];
-#endif
+	i = tx_next;
+	tcb = cbl[i];
+	assert(tcb->cmd == E100_TCB_CW_NULL);
 
-	if (last_tx_id == E100_CBL_SIZE - 1) {
-		i = 0;
+	va = (uintptr_t) buf;
+	for (j = 0; len > 0; ++j) {
+		assert(j < E100_TX_NTBD);
+		if ((pp = page_lookup(pgdir, (void *) va, NULL)) == NULL) {
+			panic("e100_tx_pkt: %08x not mapped", va);
+		}
+		pp->pp_ref++;
+		tx_pages[i][j] = pp;
+		n = MIN(len, PGSIZE - PGOFF(va));
+		tcb->tbd[j].tbd_addr = page2pa(pp) + PGOFF(va);
+		tcb->tbd[j].tbd_size = n;
+		tcb->tbd[j].tbd_flags = 0;
+		va += n;
+		len -= n;
 	}
-	else {
-		i = last_tx_id + 1;
+	tcb->tbd[j - 1].tbd_flags = E100_TBD_EL;
+	tcb->tbd_count = j;
+	tcb->status = E100_TCB_SW_NULL;
+	tcb->cmd = E100_TCB_CW_S | E100_TCB_CW_SF | E100_TCB_CW_CMD;
+
+	// The CU now suspends after this TCB instead of the previous one,
+	// so back-to-back frames go out without a resume each.
+	prev = cbl[(i + ntx - 1) % ntx];
+	if (prev->cmd != E100_TCB_CW_NULL) {
+		prev->cmd &= ~E100_TCB_CW_S;
 	}
-	if (cbl[i].cmd == E100_TCB_CW_NULL) {
-		assert(cbl[i].status == E100_TCB_SW_NULL);
-		pcb = &cbl[i];
+
+	tx_next = (i + 1) % ntx;
+	--tx_free;
+
+	restart_cu(cbl[tx_clean]);
+
+	return (int) (va - (uintptr_t) buf);
+}
+
+static void
+e100_wait(struct Env_list *list, struct Env *e)
+{
+	assert(!e->env_net_waiting);
+	LIST_INSERT_HEAD(list, e, env_net_link);
+	e->env_net_waiting = 1;
+}
+
+static void
+e100_wake_all(struct Env_list *list)
+{
+	struct Env *e;
+
+	while ((e = LIST_FIRST(list)) != NULL) {
+		e100_cancel(e);
+		e->env_status = ENV_RUNNABLE;
 	}
+}
 
-	if (!pcb) {
-		return -E_NO_BUFS;
+// Stop e waiting for the device, if it is.
+void
+e100_cancel(struct Env *e)
+{
+	if (!e->env_net_waiting) {
+		return;
 	}
+	LIST_REMOVE(e, env_net_link);
+	e->env_net_waiting = 0;
+}
 
-	memmove(pcb->data.tx_data.data, buf, len);
-	pcb->data.tx_data.tcb_bcount = len;
-	pcb->cmd = E100_TCB_CW_S | E100_TCB_CW_CMD;
-	last_tx_id = i;
+// Note that 'e' is sleeping until a TCB frees up.
+void
+e100_tx_wait(struct Env *e)
+{
+	e100_wait(&tx_waiters, e);
+}
 
-	for (i = 0; i < E100_CBL_SIZE; ++i) {
-		if ((cbl[i].status & (E100_TCB_SW_C | E100_TCB_SW_OK)) ==
-				(E100_TCB_SW_C | E100_TCB_SW_OK)) {
-			cbl[i].cmd = E100_TCB_CW_NULL;
-			cbl[i].status = E100_TCB_SW_NULL;
-		}
+// Reclaim finished TCBs and wake the senders waiting for one.
+void
+e100_tx_wakeup(void)
+{
+	if (LIST_EMPTY(&tx_waiters)) {
+		return;
+	}
+	tx_reclaim();
+	if (tx_free == 0) {
+		return;
 	}
+	e100_wake_all(&tx_waiters);
+}
 
-	restart_cu();
+// The CU went idle or suspended (every queued frame has been sent),
+// or a frame came in.
+void
+e100_intr(void)
+{
+	uint8_t stat;
 
-	return len;
+	stat = inb(E100_CSR_SCB_STATACK(csr_base));
+	outb(E100_CSR_SCB_STATACK(csr_base), stat);
+	if (e100_irq_line >= 8) {
+		irq_eoi();
+	}
+
+	if (stat & E100_SCB_STATACK_CNA) {
+		tx_reclaim();
+		e100_tx_wakeup();
+	}
+	if (stat & E100_SCB_STATACK_FR) {
+		e100_rx_wakeup();
+	}
 }
 
+// Copy the next received frame to 'buf' in the current environment.
+// Returns its length, -E_NO_DATA if none has come in, or -E_FAULT if
+// the environment can't write 'buf'.
 int
 e100_rx_pkt(void *buf, size_t len)
 {
 	int i;
-	struct E100_crb *prfd = NULL;
+	struct E100_rfd *prfd = NULL;
 	size_t ac_len;
 
-	if (last_rx_id == E100_RFA_SIZE - 1) {
-		i = 0;
-	}
-	else {
-		i = last_rx_id + 1;
-	}
-	if ((rfa[i].status & (E100_RFD_SW_C | E100_RFD_SW_OK))
+	i = (last_rx_id + 1) % nrx;
+	if ((rfa[i]->status & (E100_RFD_SW_C | E100_RFD_SW_OK))
 			== (E100_RFD_SW_C | E100_RFD_SW_OK)) {
-		assert((rfa[i].data.rx_data.rfd_count & (E100_RFD_AC_EOF
+		assert((rfa[i]->rfd_count & (E100_RFD_AC_EOF
 						| E100_RFD_AC_F)) == (E100_RFD_AC_EOF
 						| E100_RFD_AC_F));
-		prfd = &rfa[i];
+		prfd = rfa[i];
 	}
 
 	if (!prfd) {
@@ -454,11 +609,14 @@ e100_rx_pkt(void *buf, size_t len)
 	}
 
 	//print_dma_ring_rx();
-	ac_len = prfd->data.rx_data.rfd_count & E100_RFD_AC_DMASK;
+	ac_len = prfd->rfd_count & E100_RFD_AC_DMASK;
 	assert(ac_len <= len);
-	//hexdump("e100_rx_pkt: ", prfd->data.rx_data.data, ac_len);
-	memmove(buf, prfd->data.rx_data.data, ac_len);
-	prfd->data.rx_data.rfd_count = E100_RFD_AC_NULL;
+	//hexdump("e100_rx_pkt: ", prfd->data, ac_len);
+	// The frame stays in the ring if the caller's buffer is bad
+	if (copyout(buf, prfd->data, ac_len) < 0) {
+		return -E_FAULT;
+	}
+	prfd->rfd_count = E100_RFD_AC_NULL;
 	prfd->status = E100_RFD_SW_NULL;
 	last_rx_id = i;
 	//clog("wp1: last_rx_id = %d, ac_len = %u", last_rx_id, ac_len);
@@ -468,3 +626,30 @@ e100_rx_pkt(void *buf, size_t len)
 	return ac_len;
 }
 
+// Return whether an environment is sleeping until the device
+// interrupts.
+int
+e100_waiting(void)
+{
+	return !LIST_EMPTY(&tx_waiters) || !LIST_EMPTY(&rx_waiters);
+}
+
+// Note that 'e' is sleeping until a frame arrives.
+void
+e100_rx_wait(struct Env *e)
+{
+	e100_wait(&rx_waiters, e);
+}
+
+// Wake the receivers waiting for a frame, if one has come in.
+void
+e100_rx_wakeup(void)
+{
+	if (LIST_EMPTY(&rx_waiters)) {
+		return;
+	}
+	if (!(rfa[(last_rx_id + 1) % nrx]->status & E100_RFD_SW_C)) {
+		return;
+	}
+	e100_wake_all(&rx_waiters);
+}
@@ -2,6 +2,7 @@
 #define JOS_KERN_E100_H
 
 #include <inc/ns.h>
+#include <inc/env.h>
 
 #include <kern/pci.h>
 
@@ -12,6 +13,7 @@
 #define HWADDR_LEN_82559ER				6
 
 #define E100_CSR_SCB_SW(base)			(base + 0x0)
+#define E100_CSR_SCB_STATACK(base)		(base + 0x1)
 #define E100_CSR_SCB_CW(base)			(base + 0x2)
 #define E100_CSR_SCB_GP(base)			(base + 0x4)
 #define E100_CSR_PORT(base)				(base + 0x8)
@@ -27,9 +29,17 @@
 #define E100_SCB_SW_RU_IDLE				0x0000
 #define E100_SCB_SW_RU_SUSP				0x0004
 
+// STAT/ACK byte: write a bit back to acknowledge that interrupt
+#define E100_SCB_STATACK_CNA			0x20
+#define E100_SCB_STATACK_FR				0x40
+
 #define E100_SCB_CW_NULL				0x0000
 //#define E100_SCB_CW_INTR				0xbe00
-#define E100_SCB_CW_INTR				0x0100
+//#define E100_SCB_CW_INTR				0x0100
+// Interrupt mask: everything but CNA (CU not active), which drives
+// reclamation of transmitted descriptors, and FR (frame received),
+// which wakes the receiver.
+#define E100_SCB_CW_INTR				0x9c00
 #define E100_SCB_CW_CU_DMASK			0x00f0
 #define E100_SCB_CW_CU_START			0x0010
 #define E100_SCB_CW_CU_RESUME			0x0020
@@ -41,8 +51,19 @@
 
 #define E100_PORT_FN_SW_RESET			0x0
 
-#define E100_CBL_SIZE					(5 * PGSIZE / sizeof(struct E100_crb))
-#define E100_RFA_SIZE					(10 * PGSIZE / sizeof(struct E100_crb))
+// Ring sizes, fixed when the device is attached.  Override at build
+// time with e.g. -DE100_NTX=256; they are clamped to [8, E100_MAX*].
+#ifndef E100_NTX
+#define E100_NTX						128
+#endif
+#ifndef E100_NRX
+#define E100_NRX						64
+#endif
+#define E100_MAXTX						1024
+#define E100_MAXRX						1024
+
+// TBDs per TCB: a frame never spans more than two pages
+#define E100_TX_NTBD					2
 
 /* ===== TCB related values ===== */
 
@@ -63,6 +84,8 @@
 #define E100_TCB_TX_THRESHOLD			0xe0
 #define E100_TCB_TBD_CNT				0x00
 
+#define E100_TBD_EL						0x0001
+
 /* =====  ===== */
 /* ===== RFD related values ===== */
 
@@ -104,41 +127,48 @@
 /* =====  ===== */
 
 
-struct E100_txcb {
+// Transmit buffer descriptor (flexible mode)
+struct E100_tbd {
+	uint32_t tbd_addr;
+	uint16_t tbd_size;
+	uint16_t tbd_flags;
+} __attribute__((packed));
+
+// Transmit command block, flexible mode: the frame is gathered from
+// the TBD array that follows, no data lives in the TCB itself.
+struct E100_tcb {
+	volatile uint16_t status;
+	uint16_t cmd;
+	uint32_t link;
 	uint32_t tbd_addr;
 	uint16_t tcb_bcount;
 	uint8_t tx_thrs;
 	uint8_t tbd_count;
-	char data[ETH_PKTSZ_MAX];
+	struct E100_tbd tbd[E100_TX_NTBD];
 } __attribute__((packed));
 
-struct E100_rxcb {
+// Receive frame descriptor (simplified mode)
+struct E100_rfd {
+	volatile uint16_t status;
+	uint16_t cmd;
+	uint32_t link;
 	uint32_t rfd_rsv;
 	volatile uint16_t rfd_count;
 	uint16_t rfd_size;
 	char data[ETH_PKTSZ_MAX];
 } __attribute__((packed));
 
-struct E100_crb {
-	volatile uint16_t status;
-	uint16_t cmd;
-	uint32_t link;
-	union E100_cmd_data {
-		struct E100_txcb tx_data;
-		struct E100_rxcb rx_data;
-	} data;
-} __attribute__((packed));
-
-#if 0
-struct E100_rfd {
-	//volatile uint16_t status;
-} __attribute__((packed));
-#endif
-
 int pci_network_8255x_attach(struct pci_func *pcif);
 int e100_get_hw_addr(void *buf, size_t len);
-int e100_tx_pkt(const void *buf, size_t len);
+int e100_tx_pkt(pde_t *pgdir, const void *buf, size_t len);
+void e100_tx_wait(struct Env *e);
+void e100_tx_wakeup(void);
 int e100_rx_pkt(void *buf, size_t len);
+void e100_rx_wait(struct Env *e);
+void e100_rx_wakeup(void);
+int e100_waiting(void);
+void e100_cancel(struct Env *e);
+void e100_intr(void);
 
 extern uint8_t e100_irq_line;
 
@@ -13,10 +13,29 @@
 #include <kern/trap.h>
 #include <kern/monitor.h>
 #include <kern/sched.h>
+#include <kern/timer.h>
+#include <kern/pager.h>
+#include <kern/fpu.h>
+#include <kern/futex.h>
+#include <kern/e100.h>
+#include <kern/kclock.h>
+#include <kern/prof.h>
+#include <kern/kstat.h>
+#include <kern/trace.h>
 
 struct Env *envs = NULL;		// All environments
 struct Env *curenv = NULL;		// The current env
 static struct Env_list env_free_list;	// Free list
+uint32_t env_cr3_loads;			// Address space switches in env_run
+uint32_t env_cr3_skips;			// ... and those avoided
+static uintptr_t tls_base;		// base of gdt[GD_UTLS]
+
+// Address spaces with more than ENV_REAP_NPT page tables are not torn
+// down in env_free(), but queued here, by their page directory's
+// pp_link, for env_reap() to take apart while the CPU is idle.
+#define ENV_REAP_NPT	8
+static struct Page_list env_reap_list;
+uint32_t env_reap_queued;		// Address spaces queued
 
 #define ENVGENSHIFT	12		// >= LOG2NENV
 
@@ -133,7 +152,7 @@ env_setup_vm(struct Env *e)
 	e->env_pgdir = (pde_t *) page2kva(p);
 	e->env_cr3 = page2pa(p);
 	p->pp_ref = 1;
-	memset(e->env_pgdir, 0, PGSIZE);
+	pagezero(e->env_pgdir);
 	for (i = PDX(UTOP); i < NPDENTRIES; i++) {
 		e->env_pgdir[i] = boot_pgdir[i];
 	}
@@ -154,8 +173,12 @@ env_setup_vm(struct Env *e)
 //	-E_NO_FREE_ENV if all NENVS environments are allocated
 //	-E_NO_MEM on memory exhaustion
 //
-int
-env_alloc(struct Env **newenv_store, envid_t parent_id)
+// If 'peer' is not NULL, the new environment is a thread: it shares
+// peer's page directory, which keeps one reference per env using it,
+// instead of getting an empty one.
+//
+static int
+env_alloc_as(struct Env **newenv_store, envid_t parent_id, struct Env *peer)
 {
 	int32_t generation;
 	int r;
@@ -165,7 +188,11 @@ env_alloc(struct Env **newenv_store, envid_t parent_id)
 		return -E_NO_FREE_ENV;
 
 	// Allocate and set up the page directory for this environment.
-	if ((r = env_setup_vm(e)) < 0)
+	if (peer) {
+		e->env_pgdir = peer->env_pgdir;
+		e->env_cr3 = peer->env_cr3;
+		pa2page(e->env_cr3)->pp_ref++;
+	} else if ((r = env_setup_vm(e)) < 0)
 		return r;
 
 	// Generate an env_id for this environment.
@@ -178,6 +205,9 @@ env_alloc(struct Env **newenv_store, envid_t parent_id)
 	e->env_parent_id = parent_id;
 	e->env_status = ENV_RUNNABLE;
 	e->env_runs = 0;
+	memset(e->env_syscalls, 0, sizeof(e->env_syscalls));
+	memset(&e->env_traps, 0, sizeof(e->env_traps));
+	prof_alloc(e);
 
 	// Clear out all the saved register state,
 	// to prevent the register values
@@ -203,9 +233,18 @@ env_alloc(struct Env **newenv_store, envid_t parent_id)
 
 	// Clear the page fault handler until user installs one.
 	e->env_pgfault_upcall = 0;
+	e->env_xstacktop = UXSTACKTOP;
+	e->env_tls = 0;
 
 	// Also clear the IPC receiving flag.
 	e->env_ipc_recving = 0;
+	e->env_timer_expire = 0;
+	e->env_futex_pa = 0;
+	memset(e->env_urange, 0, sizeof(e->env_urange));
+	e->env_urange_next = 0;
+	e->env_pager = 0;
+	e->env_pager_va = 0;
+	e->env_pager_queued = 0;
 
 	// Initialize journal transaction reference to NULL
 	e->env_trans = NULL;
@@ -224,6 +263,37 @@ env_alloc(struct Env **newenv_store, envid_t parent_id)
 	return 0;
 }
 
+int
+env_alloc(struct Env **newenv_store, envid_t parent_id)
+{
+	return env_alloc_as(newenv_store, parent_id, NULL);
+}
+
+//
+// Allocates a new thread of 'peer': an environment with its own
+// registers that runs in peer's address space, takes page faults to
+// the same upcall and pages in the same image.  The caller sets up
+// its registers, exception stack and TLS base.
+//
+// Returns 0 on success, < 0 on failure, as env_alloc.
+//
+int
+env_alloc_thread(struct Env **newenv_store, struct Env *peer)
+{
+	struct Env *e;
+	int r;
+
+	if ((r = env_alloc_as(&e, peer->env_id, peer)) < 0)
+		return r;
+	e->env_pgfault_upcall = peer->env_pgfault_upcall;
+	e->env_pager = peer->env_pager;
+	e->env_pager_lo = peer->env_pager_lo;
+	e->env_pager_hi = peer->env_pager_hi;
+	e->env_pager_key = peer->env_pager_key;
+	*newenv_store = e;
+	return 0;
+}
+
 //
 // Allocate len bytes of physical memory for environment env,
 // and map it at virtual address va in the environment's address space.
@@ -371,57 +441,135 @@ env_create(uint8_t *binary, size_t size)
 	load_icode(penv, binary, size);
 }
 
+//
+// Unmap all of the 4MB of user address space at pgdir[pdeno], which
+// must be present, in a page directory no longer loaded: there are no
+// TLB entries to flush, so the pages just lose a reference each.
+//
+static void
+env_free_pde(pde_t *pgdir, uint32_t pdeno)
+{
+	pte_t *pt;
+	uint32_t pteno;
+	physaddr_t pa;
+
+	// a 4MB page has no page table to walk, and a page table
+	// other envs share only loses a reference
+	if ((pgdir[pdeno] & PTE_PS)
+	    || pa2page(PTE_ADDR(pgdir[pdeno]))->pp_ref > 1) {
+		page_remove_pde(pgdir, PGADDR(pdeno, 0, 0));
+		return;
+	}
+
+	// find the pa and va of the page table
+	pa = PTE_ADDR(pgdir[pdeno]);
+	pt = (pte_t*) KADDR(pa);
+
+	// drop all the pages it maps
+	for (pteno = 0; pteno < NPTENTRIES; pteno++) {
+		if (pt[pteno] & PTE_P)
+			page_decref(pa2page(PTE_ADDR(pt[pteno])));
+	}
+
+	// free the page table itself
+	pgdir[pdeno] = 0;
+	page_decref(pa2page(pa));
+}
+
+//
+// Tear down up to 'npt' page tables of the address spaces env_free()
+// queued, and free each page directory once it is empty.
+// Returns the number of page tables and directories freed, 0 when
+// there is nothing left to do.
+//
+unsigned
+env_reap(unsigned npt)
+{
+	struct Page *pp;
+	pde_t *pgdir;
+	uint32_t pdeno;
+	unsigned n = 0;
+
+	while (n < npt && (pp = LIST_FIRST(&env_reap_list))) {
+		pgdir = page2kva(pp);
+		for (pdeno = 0; pdeno < PDX(UTOP) && n < npt; pdeno++) {
+			if (pgdir[pdeno] & PTE_P) {
+				env_free_pde(pgdir, pdeno);
+				n++;
+			}
+		}
+		if (pdeno == PDX(UTOP)) {
+			LIST_REMOVE(pp, pp_link);
+			page_decref(pp);
+			n++;
+		}
+	}
+	return n;
+}
+
 //
 // Frees env e and all memory it uses.
 // 
 void
 env_free(struct Env *e)
 {
-	pte_t *pt;
-	uint32_t pdeno, pteno;
+	uint32_t pdeno, npt;
 	physaddr_t pa;
 	
-	// If freeing the current environment, switch to boot_pgdir
-	// before freeing the page directory, just in case the page
-	// gets reused.
-	if (e == curenv)
-		lcr3(boot_cr3);
-
 	// Note the environment's demise.
 	// cprintf("[%08x] free env %08x\n", curenv ? curenv->env_id : 0, e->env_id);
 
-	// Flush all mapped pages in the user portion of the address space
-	static_assert(UTOP % PTSIZE == 0);
-	for (pdeno = 0; pdeno < PDX(UTOP); pdeno++) {
-
-		// only look at mapped page tables
-		if (!(e->env_pgdir[pdeno] & PTE_P))
-			continue;
+	// A thread leaves the address space to the envs still sharing it.
+	if (pa2page(e->env_cr3)->pp_ref > 1)
+		goto free_pgdir;
 
-		// find the pa and va of the page table
-		pa = PTE_ADDR(e->env_pgdir[pdeno]);
-		pt = (pte_t*) KADDR(pa);
+	// If freeing the loaded address space, switch to boot_pgdir
+	// before freeing the page directory, just in case the page
+	// gets reused.  (It may still be loaded after e stopped running.)
+	// Nothing below has to flush the TLB then.
+	if (rcr3() == e->env_cr3)
+		lcr3(boot_cr3);
 
-		// unmap all PTEs in this page table
-		for (pteno = 0; pteno <= PTX(~0); pteno++) {
-			if (pt[pteno] & PTE_P)
-				page_remove(e->env_pgdir, PGADDR(pdeno, pteno, 0));
-		}
+	// Leave a big address space to env_reap()
+	static_assert(UTOP % PTSIZE == 0);
+	for (pdeno = npt = 0; pdeno < PDX(UTOP); pdeno++) {
+		if (e->env_pgdir[pdeno] & PTE_P)
+			npt++;
+	}
+	if (npt > ENV_REAP_NPT) {
+		LIST_INSERT_HEAD(&env_reap_list, pa2page(e->env_cr3), pp_link);
+		env_reap_queued++;
+		e->env_pgdir = 0;
+		e->env_cr3 = 0;
+		goto free_env;
+	}
 
-		// free the page table itself
-		e->env_pgdir[pdeno] = 0;
-		page_decref(pa2page(pa));
+	// Flush all mapped pages in the user portion of the address space
+	for (pdeno = 0; pdeno < PDX(UTOP); pdeno++) {
+		if (e->env_pgdir[pdeno] & PTE_P)
+			env_free_pde(e->env_pgdir, pdeno);
 	}
 
 	// free the page directory
+free_pgdir:
 	pa = e->env_cr3;
 	e->env_pgdir = 0;
 	e->env_cr3 = 0;
 	page_decref(pa2page(pa));
 
 	// return the environment to the free list
+free_env:
+	timer_cancel(e);
+	pager_clear(e);
+	futex_cancel(e);
+	e100_cancel(e);
+	fpu_free(e);
+	prof_free(e);
 	e->env_status = ENV_FREE;
 	LIST_INSERT_HEAD(&env_free_list, e, env_link);
+	// Wake wait() and ipc_send() callers waiting on e
+	futex_wake_kva(&e->env_status);
+	futex_wake_kva(&e->env_ipc_recving);
 }
 
 //
@@ -484,12 +632,39 @@ env_run(struct Env *e)
 	
 	// LAB 3: Your code here.
 	assert(e != NULL);
+	// Environments are preempted by the periodic clock
+	kclock_periodic();
 	if (e != curenv) {
+		trace(TE_RUN, e->env_id, curenv ? curenv->env_id : 0,
+		      e->env_tf.tf_eip);
 		curenv = e;
 		++e->env_runs;
+	}
+	// Skip the CR3 load, and the TLB flush that comes with it, when
+	// e's address space is still loaded: e ran last before the
+	// kernel halted, or shares its page directory with the env that
+	// ran before it.  Global kernel mappings survive a load anyway.
+	if (rcr3() != e->env_cr3) {
 		lcr3(e->env_cr3);
+		++env_cr3_loads;
+	} else {
+		++env_cr3_skips;
 	}
+	// %gs is not in the Trapframe: the kernel leaves it alone, so it
+	// only has to be reloaded here, based at e's thread-local data.
+	if (e->env_tls) {
+		if (tls_base != e->env_tls) {
+			tls_base = e->env_tls;
+			gdt[GD_UTLS >> 3].sd_base_15_0 = tls_base & 0xffff;
+			gdt[GD_UTLS >> 3].sd_base_23_16 = (tls_base >> 16) & 0xff;
+			gdt[GD_UTLS >> 3].sd_base_31_24 = tls_base >> 24;
+		}
+		asm volatile("movw %w0,%%gs" : : "r" (GD_UTLS | 3));
+	} else
+		asm volatile("movw %w0,%%gs" : : "r" (GD_UD | 3));
+	fpu_run(e);
 	//clog("wp3");
+	kstat_leave();
 	env_pop_tf(&e->env_tf);
 
 	panic("env_run not yet implemented");
@@ -13,12 +13,16 @@
 
 extern struct Env *envs;		// All environments
 extern struct Env *curenv;		// Current environment
+extern uint32_t env_cr3_loads, env_cr3_skips;
+extern uint32_t env_reap_queued;
 
 LIST_HEAD(Env_list, Env);		// Declares 'struct Env_list'
 
 void	env_init(void);
 int	env_alloc(struct Env **e, envid_t parent_id);
+int	env_alloc_thread(struct Env **e, struct Env *peer);
 void	env_free(struct Env *e);
+unsigned env_reap(unsigned npt);
 void	env_create(uint8_t *binary, size_t size);
 void	env_destroy(struct Env *e);	// Does not return if e == curenv
 
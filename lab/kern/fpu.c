@@ -0,0 +1,116 @@
+// Lazy saving and restoring of the x87/SSE register state.
+//
+// The kernel itself never touches the FPU or SSE registers, so an
+// environment's state can stay in the CPU until some other environment
+// wants it.  env_run() sets CR0_TS whenever the environment it runs
+// does not own the registers; that environment's first FPU or SSE
+// instruction then traps with T_DEVICE, and fpu_trap() saves the
+// owner's registers and loads the new owner's.  An environment that
+// never uses them costs nothing, and one that is the only user pays
+// for no saves at all.
+//
+// A new environment starts from the state left by FNINIT; fork and
+// spawn children do not inherit their parent's registers.
+
+#include <inc/x86.h>
+#include <inc/mmu.h>
+#include <inc/string.h>
+#include <inc/assert.h>
+
+#include <kern/env.h>
+#include <kern/fpu.h>
+
+#define CPUID_FXSR	(1 << 24)
+#define CPUID_SSE	(1 << 25)
+
+struct FpuState {
+	uint8_t fs_regs[512];		// FXSAVE image, or FNSAVE's 108 bytes
+} __attribute__((aligned(16)));
+
+static struct FpuState fpu_state[NENV];
+static uint8_t fpu_used[NENV];		// fpu_state holds the env's registers
+static struct FpuState fpu_clean;	// state right after FNINIT
+static struct Env *fpu_owner;		// env whose registers are loaded
+static int fpu_fxsr;			// CPU has FXSAVE/FXRSTOR
+
+static inline void
+clts(void)
+{
+	asm volatile("clts");
+}
+
+static void
+fpu_save(struct FpuState *fs)
+{
+	if (fpu_fxsr)
+		asm volatile("fxsave %0" : "=m" (*fs));
+	else
+		asm volatile("fnsave %0; fwait" : "=m" (*fs));
+}
+
+static void
+fpu_restore(struct FpuState *fs)
+{
+	if (fpu_fxsr)
+		asm volatile("fxrstor %0" : : "m" (*fs));
+	else
+		asm volatile("frstor %0" : : "m" (*fs));
+}
+
+void
+fpu_init(void)
+{
+	uint32_t edx;
+
+	cpuid(1, NULL, NULL, NULL, &edx);
+	fpu_fxsr = (edx & CPUID_FXSR) != 0;
+	// Let user code use SSE, with SIMD exceptions rather than #UD
+	if (fpu_fxsr)
+		lcr4(rcr4() | CR4_OSFXSR
+		     | ((edx & CPUID_SSE) ? CR4_OSXMMEXCPT : 0));
+
+	clts();
+	asm volatile("fninit");
+	fpu_save(&fpu_clean);
+	lcr0(rcr0() | CR0_TS);
+}
+
+// Called by env_run: let e use the registers directly if it owns them.
+void
+fpu_run(struct Env *e)
+{
+	uint32_t cr0 = rcr0();
+
+	if (e == fpu_owner) {
+		if (cr0 & CR0_TS)
+			clts();
+	} else if (!(cr0 & CR0_TS))
+		lcr0(cr0 | CR0_TS);
+}
+
+// T_DEVICE from user mode: hand the registers to curenv.
+void
+fpu_trap(void)
+{
+	assert(curenv && curenv != fpu_owner);
+
+	clts();
+	if (fpu_owner) {
+		fpu_save(&fpu_state[ENVX(fpu_owner->env_id)]);
+		fpu_used[ENVX(fpu_owner->env_id)] = 1;
+	}
+	if (fpu_used[ENVX(curenv->env_id)])
+		fpu_restore(&fpu_state[ENVX(curenv->env_id)]);
+	else
+		fpu_restore(&fpu_clean);
+	fpu_owner = curenv;
+}
+
+// e is going away: forget its registers.
+void
+fpu_free(struct Env *e)
+{
+	if (fpu_owner == e)
+		fpu_owner = NULL;
+	fpu_used[ENVX(e->env_id)] = 0;
+}
@@ -0,0 +1,14 @@
+#ifndef JOS_KERN_FPU_H
+#define JOS_KERN_FPU_H
+#ifndef JOS_KERNEL
+# error "This is a JOS kernel header; user programs should not #include it"
+#endif
+
+#include <inc/env.h>
+
+void fpu_init(void);
+void fpu_run(struct Env *e);
+void fpu_trap(void);
+void fpu_free(struct Env *e);
+
+#endif /* JOS_KERN_FPU_H */
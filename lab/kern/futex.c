@@ -0,0 +1,138 @@
+// Blocking on a word of user memory.
+//
+// futex_wait() puts an environment to sleep as long as the 32-bit word
+// at a user address holds an expected value, and futex_wake() wakes
+// the environments sleeping on a word.  Waiters are keyed by the
+// physical address of the word, so any environments that map the same
+// page -- a PTE_SHARE page passed on by fork or spawn, say -- can wait
+// for and wake each other, at whatever addresses they map it.  A word
+// on a copy-on-write page stops being shared as soon as someone writes
+// it, so such words are no good for this.
+//
+// The value check and going to sleep happen together in the kernel,
+// so a waker that changes the word and then calls futex_wake() can
+// never slip in between and leave the waiter asleep.
+//
+// Words in the read-only pages the kernel exports, like the Env
+// structures at UENVS, can be waited on too.  The kernel wakes them
+// with futex_wake_kva() when it changes a field worth waiting for:
+// env_ipc_recving going up, and env_status going to ENV_FREE.
+
+#include <inc/error.h>
+#include <inc/assert.h>
+
+#include <kern/env.h>
+#include <kern/pmap.h>
+#include <kern/time.h>
+#include <kern/timer.h>
+#include <kern/futex.h>
+
+#define FUTEX_HASH_SIZE		64	// a power of two
+
+static struct Env_list futex_hash[FUTEX_HASH_SIZE];
+
+static int futex_wake_pa(physaddr_t pa, int n);
+
+static struct Env_list *
+futex_bucket(physaddr_t pa)
+{
+	return &futex_hash[(pa >> 2) & (FUTEX_HASH_SIZE - 1)];
+}
+
+// Find the physical address of the word at 'va' in e's address space.
+static int
+futex_key(struct Env *e, uintptr_t va, physaddr_t *pa)
+{
+	struct Page *pp;
+	pte_t *pte;
+
+	if (va % sizeof(uint32_t) != 0 || va >= ULIM)
+		return -E_INVAL;
+	pp = page_lookup(e->env_pgdir, (void *) va, &pte);
+	if (pp == NULL || !(*pte & PTE_U))
+		return -E_FAULT;
+	*pa = page2pa(pp) + PGOFF(va);
+	return 0;
+}
+
+// Put e to sleep until someone calls futex_wake() on 'va' or until
+// time 'deadline' (in time_msec() units, 0 for none) passes, provided
+// the word at 'va' still holds 'val'.  Returns 0 with e NOT_RUNNABLE
+// and a system call result of 0 (woken) or -E_TIMEOUT (deadline
+// passed) to come, or < 0 on error.
+// Errors are:
+//	-E_INVAL if va is not word-aligned or is above ULIM.
+//	-E_FAULT if va is not mapped user-readable.
+//	-E_AGAIN if the word does not hold 'val'.
+//	-E_TIMEOUT if the deadline has passed already.
+int
+futex_wait(struct Env *e, uintptr_t va, uint32_t val, unsigned deadline)
+{
+	physaddr_t pa;
+	int r;
+
+	if ((r = futex_key(e, va, &pa)) < 0)
+		return r;
+	if (*(volatile uint32_t *) KADDR(pa) != val)
+		return -E_AGAIN;
+	if (deadline && (int) (deadline - time_msec()) <= 0)
+		return -E_TIMEOUT;
+
+	assert(!e->env_futex_pa);
+	if (deadline)
+		timer_add(e, deadline);
+	e->env_futex_pa = pa;
+	LIST_INSERT_HEAD(futex_bucket(pa), e, env_futex_link);
+	e->env_tf.tf_regs.reg_eax = 0;
+	e->env_status = ENV_NOT_RUNNABLE;
+	return 0;
+}
+
+// Wake up to 'n' environments waiting on the word at 'va' in e's
+// address space.  Returns the number woken, or < 0 on error as for
+// futex_wait().
+int
+futex_wake(struct Env *e, uintptr_t va, int n)
+{
+	physaddr_t pa;
+	int r;
+
+	if ((r = futex_key(e, va, &pa)) < 0)
+		return r;
+	return futex_wake_pa(pa, n);
+}
+
+// Wake everyone waiting on the kernel word at 'kva'.
+void
+futex_wake_kva(volatile void *kva)
+{
+	futex_wake_pa(PADDR((void *) kva), NENV);
+}
+
+static int
+futex_wake_pa(physaddr_t pa, int n)
+{
+	struct Env *w, *next;
+	int woken = 0;
+
+	for (w = LIST_FIRST(futex_bucket(pa)); w && woken < n; w = next) {
+		next = LIST_NEXT(w, env_futex_link);
+		if (w->env_futex_pa != pa)
+			continue;
+		futex_cancel(w);
+		timer_cancel(w);
+		w->env_status = ENV_RUNNABLE;
+		woken++;
+	}
+	return woken;
+}
+
+// Stop e waiting, if it is.
+void
+futex_cancel(struct Env *e)
+{
+	if (!e->env_futex_pa)
+		return;
+	LIST_REMOVE(e, env_futex_link);
+	e->env_futex_pa = 0;
+}
@@ -0,0 +1,14 @@
+#ifndef JOS_KERN_FUTEX_H
+#define JOS_KERN_FUTEX_H
+#ifndef JOS_KERNEL
+# error "This is a JOS kernel header; user programs should not #include it"
+#endif
+
+#include <inc/env.h>
+
+int futex_wait(struct Env *e, uintptr_t va, uint32_t val, unsigned deadline);
+int futex_wake(struct Env *e, uintptr_t va, int n);
+void futex_wake_kva(volatile void *kva);
+void futex_cancel(struct Env *e);
+
+#endif /* JOS_KERN_FUTEX_H */
@@ -15,7 +15,9 @@
 #include <kern/sched.h>
 #include <kern/picirq.h>
 #include <kern/time.h>
+#include <kern/timer.h>
 #include <kern/pci.h>
+#include <kern/fpu.h>
 
 
 static void
@@ -67,12 +69,14 @@ i386_init(void)
 	setup_msr();
 	env_init();
 	idt_init();
+	fpu_init();
 
 	// Lab 4 multitasking initialization functions
 	pic_init();
 	kclock_init();
 
 	time_init();
+	timer_init();
 	pci_init();
 
 	// Should always have an idle process as first one.
@@ -3,6 +3,10 @@
 /* Support for two time-related hardware gadgets: 1) the run time
  * clock with its NVRAM access functions; 2) the 8253 timer, which
  * generates interrupts on IRQ 0.
+ *
+ * The 8253 ticks periodically while environments run, to preempt
+ * them.  When the CPU idles, the scheduler instead asks for a single
+ * interrupt at the next timer deadline, or none at all.
  */
 
 #include <inc/x86.h>
@@ -29,15 +33,67 @@ mc146818_write(unsigned reg, unsigned datum)
 }
 
 
+enum {
+	KCLOCK_PERIODIC,
+	KCLOCK_ONESHOT,
+	KCLOCK_STOPPED
+};
+
+static int kclock_mode;
+
 void
 kclock_init(void)
 {
-	/* initialize 8253 clock to interrupt 100 times/sec */
+	/* initialize 8253 clock to interrupt KCLOCK_HZ times/sec */
 	outb(TIMER_MODE, TIMER_SEL0 | TIMER_RATEGEN | TIMER_16BIT);
-	outb(IO_TIMER1, TIMER_DIV(100) % 256);
-	outb(IO_TIMER1, TIMER_DIV(100) / 256);
+	outb(IO_TIMER1, TIMER_DIV(KCLOCK_HZ) % 256);
+	outb(IO_TIMER1, TIMER_DIV(KCLOCK_HZ) / 256);
+	kclock_mode = KCLOCK_PERIODIC;
 	cprintf("	Setup timer interrupts via 8259A\n");
 	irq_setmask_8259A(irq_mask_8259A & ~(1<<0));
 	cprintf("	unmasked timer interrupt\n");
 }
 
+// Go back to interrupting KCLOCK_HZ times a second.
+void
+kclock_periodic(void)
+{
+	if (kclock_mode == KCLOCK_PERIODIC)
+		return;
+	outb(TIMER_MODE, TIMER_SEL0 | TIMER_RATEGEN | TIMER_16BIT);
+	outb(IO_TIMER1, TIMER_DIV(KCLOCK_HZ) % 256);
+	outb(IO_TIMER1, TIMER_DIV(KCLOCK_HZ) / 256);
+	kclock_mode = KCLOCK_PERIODIC;
+}
+
+// Interrupt once, 'nsec' from now.  The 8253 cannot wait longer than
+// about 55 msec; a longer wait ends early and the caller re-arms.
+void
+kclock_oneshot(uint64_t nsec)
+{
+	uint64_t count;
+
+	if (nsec > 100000000)
+		nsec = 100000000;
+	count = nsec * TIMER_FREQ / 1000000000;
+	if (count > 0xffff)
+		count = 0xffff;
+	if (count == 0)
+		count = 1;
+	outb(TIMER_MODE, TIMER_SEL0 | TIMER_INTTC | TIMER_16BIT);
+	outb(IO_TIMER1, count % 256);
+	outb(IO_TIMER1, count / 256);
+	kclock_mode = KCLOCK_ONESHOT;
+}
+
+// No timer interrupts at all: in mode 0 the counter does not start
+// until a count is written.
+void
+kclock_stop(void)
+{
+	if (kclock_mode == KCLOCK_STOPPED)
+		return;
+	outb(TIMER_MODE, TIMER_SEL0 | TIMER_INTTC | TIMER_16BIT);
+	kclock_mode = KCLOCK_STOPPED;
+}
+
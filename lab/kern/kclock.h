@@ -6,8 +6,12 @@
 # error "This is a JOS kernel header; user programs should not #include it"
 #endif
 
+#include <inc/types.h>
+
 #define	IO_RTC		0x070		/* RTC port */
 
+#define	KCLOCK_HZ	100	/* timer interrupts/sec while envs run */
+
 #define	MC_NVRAM_START	0xe	/* start of NVRAM: offset 14 */
 #define	MC_NVRAM_SIZE	50	/* 50 bytes of NVRAM */
 
@@ -29,5 +33,8 @@
 unsigned mc146818_read(unsigned reg);
 void mc146818_write(unsigned reg, unsigned datum);
 void kclock_init(void);
+void kclock_periodic(void);
+void kclock_oneshot(uint64_t nsec);
+void kclock_stop(void);
 
 #endif	// !JOS_KERN_KCLOCK_H
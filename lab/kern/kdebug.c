@@ -113,6 +113,17 @@ stab_binsearch(const struct Stab *stabs, int *region_left, int *region_right,
 //
 int
 debuginfo_eip(uintptr_t addr, struct Eipdebuginfo *info)
+{
+	return debuginfo_eip_env(curenv, addr, info);
+}
+
+// debuginfo_eip_env(env, addr, info)
+//
+//	Like debuginfo_eip, but looks user addresses up in 'env', whose
+//	address space must be the loaded one.
+//
+int
+debuginfo_eip_env(struct Env *env, uintptr_t addr, struct Eipdebuginfo *info)
 {
 	const struct Stab *stabs, *stab_end;
 	const char *stabstr, *stabstr_end;
@@ -143,7 +154,7 @@ debuginfo_eip(uintptr_t addr, struct Eipdebuginfo *info)
 		// Make sure this memory is valid.
 		// Return -1 if it is not.  Hint: Call user_mem_check.
 		// LAB 3: Your code here.
-		if (user_mem_check(curenv, usd, sizeof(struct UserStabData),
+		if (user_mem_check(env, usd, sizeof(struct UserStabData),
 					PTE_U) != 0) {
 			//clog("wp1");
 			return -1;
@@ -156,12 +167,12 @@ debuginfo_eip(uintptr_t addr, struct Eipdebuginfo *info)
 
 		// Make sure the STABS and string table memory is valid.
 		// LAB 3: Your code here.
-		if (user_mem_check(curenv, stabs, stab_end - stabs + 1,
+		if (user_mem_check(env, stabs, stab_end - stabs + 1,
 					PTE_U) != 0) {
 			//clog("wp2");
 			return -1;
 		}
-		if (user_mem_check(curenv, stabstr, stabstr_end - stabstr + 1,
+		if (user_mem_check(env, stabstr, stabstr_end - stabstr + 1,
 					PTE_U) != 0) {
 			//clog("wp3");
 			return -1;
@@ -2,6 +2,7 @@
 #define JOS_KERN_KDEBUG_H
 
 #include <inc/types.h>
+#include <inc/env.h>
 
 // Debug information about a particular instruction pointer
 struct Eipdebuginfo {
@@ -16,5 +17,7 @@ struct Eipdebuginfo {
 };
 
 int debuginfo_eip(uintptr_t eip, struct Eipdebuginfo *info);
+int debuginfo_eip_env(struct Env *env, uintptr_t eip,
+		      struct Eipdebuginfo *info);
 
 #endif
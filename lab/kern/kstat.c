@@ -0,0 +1,100 @@
+// Trap and system call statistics.
+//
+// kstat_trap() and kstat_syscall() note the TSC when the kernel is
+// entered, and the cycles are charged when it leaves again: to the
+// environment in env_run(), or to idle in sched_halt().  A system call
+// that returns straight to its caller, as with sysenter, is charged
+// when it returns.  A call that blocks is charged for the kernel time
+// up to the switch, not for the time it sleeps.
+//
+// The totals are in sysstat_page, mapped read-only at USYSSTAT, and
+// per env in env_syscalls and env_traps.  The kernel runs with
+// interrupts off except when idle, so at most one trap and one system
+// call are ever in progress.
+
+#include <inc/x86.h>
+#include <inc/assert.h>
+
+#include <kern/env.h>
+#include <kern/kstat.h>
+
+union Sysstat_page sysstat_page __attribute__((aligned(PGSIZE)));
+
+struct Pending {
+	struct KStat *p_stat;	// charged when done, NULL if none
+	struct KStat *p_envstat;	// and the env's, NULL if none
+	uint64_t p_tsc;		// when it began
+};
+
+static struct Pending kstat_trap_p, kstat_syscall_p;
+
+static void
+kstat_add(struct KStat *ks, uint32_t cycles)
+{
+	ks->ks_count++;
+	ks->ks_cycles += cycles;
+	if (cycles > ks->ks_max)
+		ks->ks_max = cycles;
+}
+
+static void
+kstat_begin(struct Pending *p, struct KStat *ks, struct KStat *envks)
+{
+	p->p_stat = ks;
+	p->p_envstat = envks;
+	p->p_tsc = read_tsc();
+}
+
+static void
+kstat_end(struct Pending *p, uint64_t now)
+{
+	uint64_t d = now - p->p_tsc;
+	uint32_t cycles = d > ~0U ? ~0U : d;
+
+	if (!p->p_stat)
+		return;
+	kstat_add(p->p_stat, cycles);
+	if (p->p_envstat)
+		kstat_add(p->p_envstat, cycles);
+	p->p_stat = NULL;
+}
+
+// Called on entry to trap().
+void
+kstat_trap(uint32_t trapno)
+{
+	static_assert(sizeof(struct SysStat) <= PGSIZE);
+
+	if (trapno >= KSTAT_NTRAP)
+		return;
+	kstat_begin(&kstat_trap_p, &sysstat_page.sp_stat.ss_trap[trapno],
+		    curenv && trapno != T_SYSCALL ? &curenv->env_traps : NULL);
+}
+
+// Called on entry to syscall().
+void
+kstat_syscall(uint32_t syscallno)
+{
+	if (syscallno >= NSYSCALLS)
+		return;
+	kstat_begin(&kstat_syscall_p,
+		    &sysstat_page.sp_stat.ss_syscall[syscallno],
+		    curenv ? &curenv->env_syscalls[syscallno] : NULL);
+}
+
+// Called when syscall() returns.
+void
+kstat_syscall_done(void)
+{
+	kstat_end(&kstat_syscall_p, read_tsc());
+}
+
+// Called as the kernel leaves for an environment or goes idle.
+void
+kstat_leave(void)
+{
+	uint64_t now = read_tsc();
+
+	kstat_end(&kstat_syscall_p, now);
+	kstat_end(&kstat_trap_p, now);
+}
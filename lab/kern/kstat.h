@@ -0,0 +1,22 @@
+#ifndef JOS_KERN_KSTAT_H
+#define JOS_KERN_KSTAT_H
+#ifndef JOS_KERNEL
+# error "This is a JOS kernel header; user programs should not #include it"
+#endif
+
+#include <inc/kstat.h>
+#include <inc/mmu.h>
+
+union Sysstat_page {
+	struct SysStat sp_stat;
+	uint8_t sp_pad[PGSIZE];
+};
+
+extern union Sysstat_page sysstat_page;
+
+void kstat_trap(uint32_t trapno);
+void kstat_syscall(uint32_t syscallno);
+void kstat_syscall_done(void);
+void kstat_leave(void);
+
+#endif /* JOS_KERN_KSTAT_H */
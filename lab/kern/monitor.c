@@ -16,6 +16,9 @@
 #include <kern/pmap.h>
 #include <kern/env.h>
 #include <kern/syscall.h>
+#include <kern/prof.h>
+#include <kern/trace.h>
+#include <kern/time.h>
 
 #define CMDBUF_SIZE	80	// enough for one VGA text line
 
@@ -34,11 +37,15 @@ static struct Command commands[] = {
 	{ "alloc_page", "Allocate a page of physical memory", mon_alloc_page},
 	{ "free_page", "Free a page of physical memory", mon_free_page},
 	{ "page_status", "Find current status of a page of physical memory", mon_page_status},
+	{ "buddy", "Show free physical memory blocks per order ([-v] lists them)", mon_buddy},
 	{ "set_page_perms", "(Re)set permissions on a page of virtual memory", mon_set_page_perms},
 	{ "sm", "Show page mapping using virtual addresses", mon_showmapping},
 	{ "dumpva", "Show virtual memory content", mon_dumpva},
 	{ "dumppa", "Show physical memory content", mon_dumppa},
 	{ "si", "Single-step next instruction", mon_si},
+	{ "log", "Show the console output the kernel keeps", mon_log},
+	{ "prof", "Sampling profiler: prof [on|off|reset|kern|envid]", mon_prof},
+	{ "trace", "Event trace: trace [on [cats]|off|clear|dump]", mon_trace},
 };
 #define NCOMMANDS (sizeof(commands)/sizeof(commands[0]))
 
@@ -67,6 +74,10 @@ mon_kerninfo(int argc, char **argv, struct Trapframe *tf)
 	cprintf("  end    %08x (virt)  %08x (phys)\n", end, end - KERNBASE);
 	cprintf("Kernel executable memory footprint: %dKB\n",
 		(end-_start+1023)/1024);
+	cprintf("Address space loads: %u, skipped: %u\n",
+		env_cr3_loads, env_cr3_skips);
+	cprintf("Address spaces left to the idle reaper: %u\n",
+		env_reap_queued);
 	return 0;
 }
 
@@ -248,6 +259,133 @@ mon_free_page(int argc, char **argv, struct Trapframe *tf)
 
 }
 
+int
+mon_buddy(int argc, char **argv, struct Trapframe *tf)
+{
+	if (argc > 2 || (argc == 2 && strcmp(argv[1], "-v") != 0)) {
+		cprintf("Command/> buddy [-v]\n");
+		return R_ERROR;
+	}
+	page_buddy_print(argc == 2);
+	return R_SUCCESS;
+}
+
+int
+mon_log(int argc, char **argv, struct Trapframe *tf)
+{
+	cons_log_show();
+	return R_SUCCESS;
+}
+
+#define PROF_NSHOW	20
+
+static void
+prof_show(struct Env *e)
+{
+	struct ProfEntry *tab;
+	uint32_t total = 0;
+	int i, n;
+
+	n = prof_report(e, &tab);
+	for (i = 0; i < n; i++)
+		total += tab[i].pe_count;
+	for (i = 0; i < n && i < PROF_NSHOW; i++)
+		cprintf("%8u %3u%%  %08x %s\n", tab[i].pe_count,
+			tab[i].pe_count * 100 / total, tab[i].pe_addr,
+			tab[i].pe_name);
+	if (n == 0)
+		cprintf("no samples\n");
+}
+
+int
+mon_prof(int argc, char **argv, struct Trapframe *tf)
+{
+	struct Env *e;
+	int i;
+
+	if (argc > 2) {
+		cprintf("Command/> prof [on|off|reset|kern|envid]\n");
+		return R_ERROR;
+	}
+	if (argc == 1) {
+		cprintf("profiler %s; samples:\n", prof_on ? "on" : "off");
+		cprintf("  kernel   %u\n", prof_nsamples(NULL));
+		cprintf("  dropped  %u\n", prof_dropped);
+		for (i = 0; i < NENV; i++)
+			if (envs[i].env_status != ENV_FREE
+			    && prof_nsamples(&envs[i]) > 0)
+				cprintf("  %08x %u\n", envs[i].env_id,
+					prof_nsamples(&envs[i]));
+	} else if (strcmp(argv[1], "on") == 0)
+		prof_start();
+	else if (strcmp(argv[1], "off") == 0)
+		prof_on = 0;
+	else if (strcmp(argv[1], "reset") == 0)
+		prof_reset();
+	else if (strcmp(argv[1], "kern") == 0)
+		prof_show(NULL);
+	else {
+		if (envid2env(strtol(argv[1], 0, 16), &e, 0) < 0 || !e) {
+			cprintf("prof: no env %s\n", argv[1]);
+			return R_ERROR;
+		}
+		prof_show(e);
+	}
+	return R_SUCCESS;
+}
+
+// Print the events the trace holds, as user/trace does.
+static void
+trace_show(void)
+{
+	struct TraceEvent te;
+	uint32_t pos = 0, held, end;
+	char buf[64];
+
+	trace_counts(&held, &end);
+	cprintf("# tsc_khz %u tsc_base %llx\n", clock_page.cp_clock.c_tsc_khz,
+		clock_page.cp_clock.c_tsc_base);
+	while (pos != end && trace_read(&pos, &te, 1) == 1) {
+		trace_format(buf, sizeof(buf), &te);
+		cprintf("%s", buf);
+	}
+}
+
+int
+mon_trace(int argc, char **argv, struct Trapframe *tf)
+{
+	uint32_t held, total;
+	char buf[64];
+	int mask = TRACE_ALL;
+
+	if (argc > 3 || (argc == 3 && strcmp(argv[1], "on") != 0)) {
+		cprintf("Command/> trace [on [cats]|off|clear|dump]\n");
+		return R_ERROR;
+	}
+	if (argc == 1) {
+		trace_counts(&held, &total);
+		trace_mask_names(buf, sizeof(buf), trace_mask);
+		cprintf("tracing %s; %u events held, %u recorded\n",
+			buf, held, total);
+	} else if (strcmp(argv[1], "on") == 0) {
+		if (argc == 3 && (mask = trace_parse_mask(argv[2])) < 0) {
+			cprintf("trace: categories are sched,ipc,pgflt,irq,clock,all\n");
+			return R_ERROR;
+		}
+		trace_mask = mask;
+	} else if (strcmp(argv[1], "off") == 0)
+		trace_mask = 0;
+	else if (strcmp(argv[1], "clear") == 0)
+		trace_clear();
+	else if (strcmp(argv[1], "dump") == 0)
+		trace_show();
+	else {
+		cprintf("Command/> trace [on [cats]|off|clear|dump]\n");
+		return R_ERROR;
+	}
+	return R_SUCCESS;
+}
+
 int
 mon_set_page_perms(int argc, char **argv, struct Trapframe *tf)
 {
@@ -297,8 +435,13 @@ mon_showmapping(int argc, char **argv, struct Trapframe *tf)
 				continue ;
 			}
 
-			pgtable = (pte_t*) KADDR(PTE_ADDR(*pgdir_entry));
-			pgtable_entry = &pgtable[PTX(virtual_addr)];
+			if(*pgdir_entry & PTE_PS){
+				//a 4MB page is mapped by the directory entry itself
+				pgtable_entry = pgdir_entry;
+			}else{
+				pgtable = (pte_t*) KADDR(PTE_ADDR(*pgdir_entry));
+				pgtable_entry = &pgtable[PTX(virtual_addr)];
+			}
 
 			if(!(*pgtable_entry & PTE_P)){
 				continue;
@@ -307,7 +450,12 @@ mon_showmapping(int argc, char **argv, struct Trapframe *tf)
 			//if available then only show it other wise show smoething else
 			atleast_one_mapping_present = 1;
 
-			cprintf("VA( %08p ) PA( %08p ) ", (virtual_addr), PTE_ADDR(*pgtable_entry));
+			if(*pgtable_entry & PTE_PS){
+				cprintf("VA( %08p ) PA( %08p ) |4MB|", (virtual_addr),
+					PTE_ADDR(*pgtable_entry) + (PTX(virtual_addr) << PTXSHIFT));
+			}else{
+				cprintf("VA( %08p ) PA( %08p ) ", (virtual_addr), PTE_ADDR(*pgtable_entry));
+			}
 
 
 			if(*pgtable_entry & PTE_AVAIL){
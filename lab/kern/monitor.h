@@ -18,11 +18,15 @@ int mon_backtrace(int argc, char **argv, struct Trapframe *tf);
 int mon_alloc_page(int argc, char **argv, struct Trapframe *tf);
 int mon_page_status(int argc, char **argv, struct Trapframe *tf);
 int mon_free_page(int argc, char **argv, struct Trapframe *tf);
+int mon_buddy(int argc, char **argv, struct Trapframe *tf);
 int mon_set_page_perms(int argc, char **argv, struct Trapframe *tf);
 int mon_showmapping(int argc, char **argv, struct Trapframe *tf);
 int mon_dumpva(int argc, char **argv, struct Trapframe *tf);
 int mon_dumppa(int argc, char **argv, struct Trapframe *tf);
 int mon_si(int argc, char **argv, struct Trapframe *tf);
+int mon_log(int argc, char **argv, struct Trapframe *tf);
+int mon_prof(int argc, char **argv, struct Trapframe *tf);
+int mon_trace(int argc, char **argv, struct Trapframe *tf);
 int mon_brkpt(int argc, char **argv, struct Trapframe *tf);
 
 // Utility function
@@ -0,0 +1,114 @@
+// Demand paging through a user-level pager.
+//
+// spawn() can leave part of a child's image unmapped and name a pager
+// environment (the file server) for the range with sys_env_set_pager().
+// A user-mode fault on a page that is not present in that range blocks
+// the faulting environment and sends the pager an IPC message from it,
+// with the page address as the value and no page.  The pager maps the
+// page in with sys_pager_reply(), which lets the environment run again
+// to retry the faulting instruction.  If the pager is busy, the fault
+// waits here until its next sys_ipc_recv(), though the pager may also
+// reply to it right away if it finds the environment waiting.
+//
+// A system call argument that points at such a page is paged in the
+// same way (pager_syscall_fault): the environment blocks, and issues
+// the system call again once the page is in.  So a call that finds a
+// page missing must not have done anything yet it cannot do twice.
+
+#include <inc/assert.h>
+#include <inc/trap.h>
+
+#include <kern/env.h>
+#include <kern/pmap.h>
+#include <kern/sched.h>
+#include <kern/timer.h>
+#include <kern/pager.h>
+
+static int pager_nqueued;	// faults not yet passed to their pager
+
+// Pass e's fault to 'pager' if it is waiting for a message.
+static void
+pager_send(struct Env *pager, struct Env *e)
+{
+	if (!pager->env_ipc_recving)
+		return;
+
+	timer_cancel(pager);
+	pager->env_ipc_recving = 0;
+	pager->env_ipc_from = e->env_id;
+	pager->env_ipc_value = e->env_pager_va;
+	pager->env_ipc_perm = 0;
+	pager->env_tf.tf_regs.reg_eax = 0;
+	pager->env_status = ENV_RUNNABLE;
+
+	e->env_pager_queued = 0;
+	pager_nqueued--;
+}
+
+// Handle a user-mode fault by 'e' on the missing page at 'va'.
+// Returns if e has no pager for 'va', so the fault should be
+// delivered as usual.  Otherwise blocks e and does not return.
+void
+pager_fault(struct Env *e, uintptr_t va)
+{
+	struct Env *pager;
+
+	if (!e->env_pager || va < e->env_pager_lo || va >= e->env_pager_hi)
+		return;
+	if (envid2env(e->env_pager, &pager, 0) < 0)
+		return;
+
+	e->env_pager_va = ROUNDDOWN(va, PGSIZE);
+	e->env_pager_queued = 1;
+	e->env_status = ENV_NOT_RUNNABLE;
+	pager_nqueued++;
+	pager_send(pager, e);
+	sched_yield();
+}
+
+// A system call by the current environment needs the page at 'va',
+// which is not mapped.  If it is the environment's to demand page,
+// block it on its pager and restart the call once the page is in;
+// this does not return then.  Otherwise returns, and the call fails
+// as it would have.
+void
+pager_syscall_fault(uintptr_t va)
+{
+	struct Env *e = curenv;
+
+	if (e->env_tf.tf_trapno != T_SYSCALL
+	    || page_lookup(e->env_pgdir, (void *) va, NULL) != NULL)
+		return;
+	// Back over the 2-byte 'int $T_SYSCALL', whose registers still
+	// hold the call number and arguments
+	e->env_tf.tf_eip -= 2;
+	pager_fault(e, va);
+	e->env_tf.tf_eip += 2;
+}
+
+// 'pager' is about to block in sys_ipc_recv(); give it a waiting
+// fault, if there is one.
+void
+pager_recv(struct Env *pager)
+{
+	int i;
+
+	if (!pager_nqueued)
+		return;
+	for (i = 0; i < NENV; i++)
+		if (envs[i].env_pager_queued
+		    && envs[i].env_pager == pager->env_id) {
+			pager_send(pager, &envs[i]);
+			return;
+		}
+}
+
+// 'e' no longer waits on its pager: the page is in, or e is going away.
+void
+pager_clear(struct Env *e)
+{
+	if (e->env_pager_queued)
+		pager_nqueued--;
+	e->env_pager_queued = 0;
+	e->env_pager_va = 0;
+}
@@ -0,0 +1,14 @@
+#ifndef JOS_KERN_PAGER_H
+#define JOS_KERN_PAGER_H
+#ifndef JOS_KERNEL
+# error "This is a JOS kernel header; user programs should not #include it"
+#endif
+
+#include <inc/env.h>
+
+void pager_fault(struct Env *e, uintptr_t va);
+void pager_syscall_fault(uintptr_t va);
+void pager_recv(struct Env *pager);
+void pager_clear(struct Env *e);
+
+#endif /* JOS_KERN_PAGER_H */
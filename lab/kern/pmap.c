@@ -10,6 +10,9 @@
 #include <kern/pmap.h>
 #include <kern/kclock.h>
 #include <kern/env.h>
+#include <kern/time.h>
+#include <kern/kstat.h>
+#include <kern/pager.h>
 
 // These variables are set by i386_detect_memory()
 static physaddr_t maxpa;	// Maximum physical address
@@ -23,7 +26,18 @@ physaddr_t boot_cr3;		// Physical address of boot time page directory
 static char* boot_freemem;	// Pointer to next byte of free mem
 
 struct Page* pages;		// Virtual address of physical page array
-static struct Page_list page_free_list;	// Free list of physical pages
+// Set once CR4.PSE is on and 4MB pages may be mapped
+int pse_enabled;
+// PTE_G if the CPU keeps global pages across CR3 loads, else 0
+static uint32_t pte_global;
+
+#define CPUID_PSE	(1 << 3)
+#define CPUID_PGE	(1 << 13)
+
+// Buddy allocator: free blocks of 2^order pages, naturally aligned
+static struct Page_list page_free_list[PAGE_MAX_ORDER + 1];
+static size_t page_nfree[PAGE_MAX_ORDER + 1];	// blocks on each list
+static unsigned page_nsplit, page_nmerge, page_nfail;
 
 // Global descriptor table.
 //
@@ -49,7 +63,10 @@ struct Segdesc gdt[] =
 	[GD_UD >> 3] = SEG(STA_W, 0x0, 0xffffffff, 3),
 
 	// 0x28 - tss, initialized in idt_init()
-	[GD_TSS >> 3] = SEG_NULL
+	[GD_TSS >> 3] = SEG_NULL,
+
+	// 0x30 - user thread-local data, based at curenv->env_tls by env_run()
+	[GD_UTLS >> 3] = SEG(STA_W, 0x0, 0xffffffff, 3)
 };
 
 struct Pseudodesc gdt_pd = {
@@ -90,6 +107,12 @@ i386_detect_memory(void)
 static void check_boot_pgdir(void);
 static void check_page_alloc();
 static void page_check(void);
+static void page_initpp(struct Page *pp);
+static int page_demote(pde_t *pgdir, const void *va);
+static int page_table_unshare(pde_t *pgdir, const void *va);
+static void user_mem_changed(pde_t *pgdir);
+static void page_steal(struct Page_list *fl);
+static void page_unsteal(struct Page_list *fl);
 static void boot_map_segment(pde_t *pgdir, uintptr_t la, size_t size, physaddr_t pa, int perm);
 
 //
@@ -159,7 +182,7 @@ void
 i386_vm_init(void)
 {
 	pde_t* pgdir;
-	uint32_t cr0;
+	uint32_t cr0, edx;
 	size_t n;
 
 	// Delete this line:
@@ -220,6 +243,11 @@ i386_vm_init(void)
 	//////////////////////////////////////////////////////////////////////
 	// Now we set up virtual memory 
 	
+	// Everything mapped above UTOP from here on is the same in every
+	// address space, so it can stay in the TLB across env switches.
+	cpuid(1, NULL, NULL, NULL, &edx);
+	pte_global = (edx & CPUID_PGE) ? PTE_G : 0;
+
 	//////////////////////////////////////////////////////////////////////
 	// Map 'pages' read-only by the user at linear address UPAGES
 	// Permissions:
@@ -229,7 +257,8 @@ i386_vm_init(void)
 	// Your code goes here:
 	n = ROUNDUP(npage * sizeof(struct Page), PGSIZE);
 	clog("UPAGES = %p", UPAGES);
-	boot_map_segment(pgdir, UPAGES, n, PADDR(pages), PTE_U | PTE_P);
+	boot_map_segment(pgdir, UPAGES, n, PADDR(pages),
+			PTE_U | PTE_P | pte_global);
 
 	//////////////////////////////////////////////////////////////////////
 	// Map the 'envs' array read-only by the user at linear address UENVS
@@ -239,8 +268,18 @@ i386_vm_init(void)
 	//    - envs itself -- kernel RW, user NONE
 	// LAB 3: Your code here.
 	n = ROUNDUP(NENV * sizeof(struct Env), PGSIZE);
+	assert(UENVS + n <= USYSSTAT);
 	clog("UENVS = %p", UENVS);
-	boot_map_segment(pgdir, UENVS, n, PADDR(envs), PTE_U | PTE_P);
+	boot_map_segment(pgdir, UENVS, n, PADDR(envs),
+			PTE_U | PTE_P | pte_global);
+
+	// Map the clock parameters read-only by the user at UCLOCK
+	boot_map_segment(pgdir, UCLOCK, PGSIZE, PADDR(&clock_page),
+			 PTE_U | PTE_P | pte_global);
+
+	// Map the trap and system call statistics read-only at USYSSTAT
+	boot_map_segment(pgdir, USYSSTAT, PGSIZE, PADDR(&sysstat_page),
+			 PTE_U | PTE_P | pte_global);
 
 	//////////////////////////////////////////////////////////////////////
 	// Use the physical memory that 'bootstack' refers to as the kernel
@@ -256,7 +295,7 @@ i386_vm_init(void)
 	n = ROUNDUP(KSTKSIZE, PGSIZE);
 	clog("KSTACKTOP - KSTKSIZE = %p", KSTACKTOP - KSTKSIZE);
 	boot_map_segment(pgdir, KSTACKTOP - KSTKSIZE, n, PADDR(bootstack),
-			PTE_W | PTE_P);
+			PTE_W | PTE_P | pte_global);
 
 	//////////////////////////////////////////////////////////////////////
 	// Map all of physical memory at KERNBASE. 
@@ -265,11 +304,15 @@ i386_vm_init(void)
 	// We might not have 2^32 - KERNBASE bytes of physical memory, but
 	// we just set up the mapping anyway.
 	// Permissions: kernel RW, user NONE
+	// Use 4MB pages if the CPU has them: the direct map then needs
+	// no page tables and a few TLB entries cover all of it.
 	// Your code goes here: 
 	n = ROUNDUP(MAXVAL(uintptr_t) - KERNBASE, PGSIZE);
 	clog("MAXVAL(uintptr_t) = %p, MAXVAL(intptr_t) = %p",
 			MAXVAL(uintptr_t), MAXVAL(intptr_t));
-	boot_map_segment(pgdir, KERNBASE, n, 0, PTE_W | PTE_P);
+	pse_enabled = (edx & CPUID_PSE) != 0;
+	boot_map_segment(pgdir, KERNBASE, n, 0,
+			PTE_W | PTE_P | pte_global | (pse_enabled ? PTE_PS : 0));
 	//clog("MAXVAL(uint64_t) = 0x%llx, MAXVAL(int64_t) = 0x%llx",
 	//		MAXVAL(uint64_t), MAXVAL(int64_t));
 
@@ -294,6 +337,10 @@ i386_vm_init(void)
 	// (Limits our kernel to <4MB)
 	pgdir[0] = pgdir[PDX(KERNBASE)];
 
+	// Large pages must be understood before the first one is used.
+	if (pse_enabled)
+		lcr4(rcr4() | CR4_PSE);
+
 	// Install page table.
 	lcr3(boot_cr3);
 
@@ -324,6 +371,12 @@ i386_vm_init(void)
 
 	// Flush the TLB for good measure, to kill the pgdir[0] mapping.
 	lcr3(boot_cr3);
+
+	// Only now honour PTE_G: pgdir[0] shared a global entry with
+	// KERNBASE, and a CR3 load would not have flushed it.  Turning
+	// on PGE flushes the whole TLB.
+	if (pte_global)
+		lcr4(rcr4() | CR4_PGE);
 }
 
 //
@@ -335,26 +388,34 @@ check_page_alloc()
 {
 	struct Page *pp, *pp0, *pp1, *pp2;
 	struct Page_list fl;
+	size_t nfree;
+	int i, order;
 
 	// if there's a page that shouldn't be on
 	// the free list, try to make sure it
 	// eventually causes trouble.
-	LIST_FOREACH(pp0, &page_free_list, pp_link)
-		memset(page2kva(pp0), 0x97, 128);
-
-	LIST_FOREACH(pp0, &page_free_list, pp_link) {
-		// check that we didn't corrupt the free list itself
-        //clog("%p %p %d", pages, pp0, npage);
-		assert(pp0 >= pages);
-		assert(pp0 < pages + npage);
-
-		// check a few pages that shouldn't be on the free list
-		assert(page2pa(pp0) != 0);
-		assert(page2pa(pp0) != IOPHYSMEM);
-		assert(page2pa(pp0) != EXTPHYSMEM - PGSIZE);
-		assert(page2pa(pp0) != EXTPHYSMEM);
-		assert(page2kva(pp0) != ROUNDDOWN(boot_freemem - 1, PGSIZE));
-	}
+	for (order = 0; order <= PAGE_MAX_ORDER; order++)
+		LIST_FOREACH(pp0, &page_free_list[order], pp_link)
+			memset(page2kva(pp0), 0x97, 128 << order);
+
+	for (order = 0; order <= PAGE_MAX_ORDER; order++)
+		LIST_FOREACH(pp, &page_free_list[order], pp_link) {
+			// check that we didn't corrupt the free lists
+			assert(pp >= pages);
+			assert(pp + (1 << order) <= pages + npage);
+			assert((page2ppn(pp) & ((1 << order) - 1)) == 0);
+			assert(pp->pp_flags & PP_FREE);
+			assert(pp->pp_order == order);
+
+			// check a few pages that shouldn't be on the free list
+			for (pp0 = pp; pp0 < pp + (1 << order); pp0++) {
+				assert(page2pa(pp0) != 0);
+				assert(page2pa(pp0) != IOPHYSMEM);
+				assert(page2pa(pp0) != EXTPHYSMEM - PGSIZE);
+				assert(page2pa(pp0) != EXTPHYSMEM);
+				assert(page2kva(pp0) != ROUNDDOWN(boot_freemem - 1, PGSIZE));
+			}
+		}
 
 	// should be able to allocate three pages
 	pp0 = pp1 = pp2 = 0;
@@ -369,12 +430,24 @@ check_page_alloc()
 	assert(page2pa(pp1) < npage*PGSIZE);
 	assert(page2pa(pp2) < npage*PGSIZE);
 
+	// a block comes back naturally aligned and whole,
+	// and freeing it merges it back with its buddies
+	nfree = page_free_count();
+	assert(page_alloc_order(PAGE_MAX_ORDER + 1, &pp) == -E_INVAL);
+	assert(page_alloc_order(3, &pp) == 0);
+	assert((page2ppn(pp) & 7) == 0);
+	for (i = 0; i < 8; i++)
+		assert(pp[i].pp_ref == 0 && !(pp[i].pp_flags & PP_FREE));
+	assert(page_free_count() == nfree - 8);
+	page_free_order(pp, 3);
+	assert(page_free_count() == nfree);
+
 	// temporarily steal the rest of the free pages
-	fl = page_free_list;
-	LIST_INIT(&page_free_list);
+	page_steal(&fl);
 
 	// should be no free memory
 	assert(page_alloc(&pp) == -E_NO_MEM);
+	assert(page_alloc_order(1, &pp) == -E_NO_MEM);
 
 	// free and re-allocate?
 	page_free(pp0);
@@ -390,12 +463,13 @@ check_page_alloc()
 	assert(page_alloc(&pp) == -E_NO_MEM);
 
 	// give free list back
-	page_free_list = fl;
+	page_unsteal(&fl);
 
 	// free the pages we took
 	page_free(pp0);
 	page_free(pp1);
 	page_free(pp2);
+	assert(page_free_count() == nfree + 3);
 
 	cprintf("check_page_alloc() succeeded!\n");
 }
@@ -471,6 +545,8 @@ check_va2pa(pde_t *pgdir, uintptr_t va)
 	pgdir = &pgdir[PDX(va)];
 	if (!(*pgdir & PTE_P))
 		return ~0;
+	if (*pgdir & PTE_PS)
+		return PTE_ADDR(*pgdir) + (PTX(va) << PTXSHIFT);
 	p = (pte_t*) KADDR(PTE_ADDR(*pgdir));
 	if (!(p[PTX(va)] & PTE_P))
 		return ~0;
@@ -480,14 +556,17 @@ check_va2pa(pde_t *pgdir, uintptr_t va)
 // --------------------------------------------------------------
 // Tracking of physical pages.
 // The 'pages' array has one 'struct Page' entry per physical page.
-// Pages are reference counted, and free pages are kept on a linked list.
+// Pages are reference counted.  Free pages are kept by a buddy
+// allocator: free blocks of 2^order contiguous pages, aligned to their
+// size, sit on one list per order, and a freed block is merged with its
+// equally sized neighbour (its buddy) whenever that one is free too.
 // --------------------------------------------------------------
 
 //
 // Initialize page structure and memory free list.
 // After this is done, NEVER use boot_alloc again.  ONLY use the page
 // allocator functions below to allocate and deallocate physical
-// memory via the page_free_list.
+// memory via the page_free_list[].
 //
 void
 page_init(void)
@@ -507,11 +586,18 @@ page_init(void)
 	//
 	// Change the code to reflect this.
 	int i;
-	LIST_INIT(&page_free_list);
+
+	for (i = 0; i <= PAGE_MAX_ORDER; i++) {
+		LIST_INIT(&page_free_list[i]);
+		page_nfree[i] = 0;
+	}
 	clog("PPN(IOPHYSMEM) = %d, PPN(EXTPHYSMEM) = %d, PPN(PADDR(boot_freemem)) = %d",
 			PPN(IOPHYSMEM), PPN(EXTPHYSMEM), PPN(PADDR(boot_freemem)));
+	// Every Page must be clean before any is freed: coalescing
+	// looks at buddies above the page being freed.
+	for (i = 0; i < npage; i++)
+		page_initpp(&pages[i]);
 	for (i = 0; i < npage; i++) {
-		pages[i].pp_ref = 0;
 		if (i == 0) continue;
 		if ( (PPN(IOPHYSMEM) <= i) && (i < PPN(EXTPHYSMEM)) ) {
 			//clog("skipped PPN %d", i);
@@ -521,7 +607,7 @@ page_init(void)
 			//clog("skipped PPN %d", i);
 			continue;
 		}
-		LIST_INSERT_HEAD(&page_free_list, &pages[i], pp_link);
+		page_free(&pages[i]);
 	}
 }
 
@@ -536,6 +622,69 @@ page_initpp(struct Page *pp)
 	memset(pp, 0, sizeof(*pp));
 }
 
+static void
+page_push(struct Page *pp, int order)
+{
+	pp->pp_order = order;
+	pp->pp_flags |= PP_FREE;
+	LIST_INSERT_HEAD(&page_free_list[order], pp, pp_link);
+	page_nfree[order]++;
+}
+
+static void
+page_pop(struct Page *pp)
+{
+	LIST_REMOVE(pp, pp_link);
+	pp->pp_flags &= ~PP_FREE;
+	page_nfree[pp->pp_order]--;
+}
+
+//
+// Allocates a physically contiguous block of 2^order pages, aligned
+// to its own size.  Like page_alloc, neither the memory nor the
+// reference counts are touched: every Page in the block starts out
+// with a 0 refcount.  The block must be returned with page_free_order
+// and the same order, or page by page once split up by the caller.
+//
+// RETURNS
+//   0 -- on success
+//   -E_NO_MEM -- if no block that large is free
+//   -E_INVAL -- if order is out of range
+//
+int
+page_alloc_order(int order, struct Page **pp_store)
+{
+	struct Page *pp;
+	int o, i;
+
+	if (order < 0 || order > PAGE_MAX_ORDER)
+		return -E_INVAL;
+
+retry:
+	for (o = order; LIST_EMPTY(&page_free_list[o]); o++)
+		if (o == PAGE_MAX_ORDER) {
+			// Take back the address spaces of dead envs the
+			// idle-time reaper has not gotten to yet
+			if (env_reap(~0U))
+				goto retry;
+			page_nfail++;
+			return -E_NO_MEM;
+		}
+	pp = LIST_FIRST(&page_free_list[o]);
+	page_pop(pp);
+
+	// Split down to size, keeping the lower half each time
+	for (; o > order; o--) {
+		page_push(pp + (1 << (o - 1)), o - 1);
+		page_nsplit++;
+	}
+
+	for (i = 0; i < (1 << order); i++)
+		page_initpp(&pp[i]);
+	*pp_store = pp;
+	return 0;
+}
+
 //
 // Allocates a physical page.
 // Does NOT set the contents of the physical page to zero, NOR does it
@@ -549,21 +698,47 @@ page_initpp(struct Page *pp)
 //   0 -- on success
 //   -E_NO_MEM -- otherwise 
 //
-// Hint: use LIST_FIRST, LIST_REMOVE, and page_initpp
 int
 page_alloc(struct Page **pp_store)
 {
-	// Fill this function in
-	struct Page* pf;
+	struct Page *pp;
 
-	pf = LIST_FIRST(&page_free_list);
-	if (pf != NULL) {
-		LIST_REMOVE(pf, pp_link);
-		page_initpp(pf);
-		*pp_store = pf;
+	// Fast path: most of the time there is a loose page around
+	if ((pp = LIST_FIRST(&page_free_list[0])) != NULL) {
+		page_pop(pp);
+		page_initpp(pp);
+		*pp_store = pp;
 		return 0;
 	}
-	return -E_NO_MEM;
+	return page_alloc_order(0, pp_store);
+}
+
+//
+// Return a block of 2^order pages to the free lists, merging it with
+// its buddy for as long as the buddy is free and whole.
+//
+void
+page_free_order(struct Page *pp, int order)
+{
+	ppn_t ppn, buddy;
+
+	assert(pp != NULL);
+	assert(order >= 0 && order <= PAGE_MAX_ORDER);
+	ppn = page2ppn(pp);
+	assert((ppn & ((1 << order) - 1)) == 0);
+	if (pp->pp_flags & PP_FREE)
+		panic("page_free: page %08x is already free", page2pa(pp));
+
+	for (; order < PAGE_MAX_ORDER; order++) {
+		buddy = ppn ^ (1 << order);
+		if (buddy >= npage || !(pages[buddy].pp_flags & PP_FREE)
+		    || pages[buddy].pp_order != order)
+			break;
+		page_pop(&pages[buddy]);
+		ppn &= ~(1 << order);
+		page_nmerge++;
+	}
+	page_push(&pages[ppn], order);
 }
 
 //
@@ -573,14 +748,65 @@ page_alloc(struct Page **pp_store)
 void
 page_free(struct Page *pp)
 {
-	// Fill this function in
-	/*
-	if (pp == NULL) {
-		return;
+	page_free_order(pp, 0);
+}
+
+// Number of free pages, over all the free lists.
+size_t
+page_free_count(void)
+{
+	size_t n = 0;
+	int i;
+
+	for (i = 0; i <= PAGE_MAX_ORDER; i++)
+		n += page_nfree[i] << i;
+	return n;
+}
+
+//
+// Print the free block counts per order and the allocator's counters.
+// With 'verbose', also list every free block.
+//
+void
+page_buddy_print(int verbose)
+{
+	struct Page *pp;
+	int i;
+
+	cprintf("order  block   free\n");
+	for (i = 0; i <= PAGE_MAX_ORDER; i++) {
+		cprintf("%5d %5dK %6u\n", i, PGSIZE / 1024 << i, page_nfree[i]);
+		if (!verbose)
+			continue;
+		LIST_FOREACH(pp, &page_free_list[i], pp_link)
+			cprintf("\t[%08x, %08x)\n", page2pa(pp),
+				page2pa(pp) + (PGSIZE << i));
+	}
+	cprintf("%u of %u pages free, %u splits, %u merges, %u failures\n",
+		page_free_count(), npage, page_nsplit, page_nmerge, page_nfail);
+}
+
+// Take every free page, one page at a time, onto 'fl'.
+static void
+page_steal(struct Page_list *fl)
+{
+	struct Page *pp;
+
+	LIST_INIT(fl);
+	while (page_alloc(&pp) == 0)
+		LIST_INSERT_HEAD(fl, pp, pp_link);
+}
+
+// Give back the pages taken by page_steal.
+static void
+page_unsteal(struct Page_list *fl)
+{
+	struct Page *pp;
+
+	while ((pp = LIST_FIRST(fl)) != NULL) {
+		LIST_REMOVE(pp, pp_link);
+		page_free(pp);
 	}
-	 */
-	assert(pp != NULL);
-	LIST_INSERT_HEAD(&page_free_list, pp, pp_link);
 }
 
 //
@@ -598,6 +824,14 @@ page_decref(struct Page* pp)
 // a pointer to the page table entry (PTE) for linear address 'va'.
 // This requires walking the two-level page table structure.
 //
+// A page table below UTOP may be shared by several page directories
+// (see page_table_share).  With create != 0, pgdir is first given a
+// private copy of it, since the caller means to change the PTE.
+//
+// If 'va' is mapped by a 4MB page, there is no PTE for it: with
+// create == 0 pgdir_walk returns NULL, otherwise the 4MB page is first
+// split into a page table mapping the same pages (see page_demote).
+//
 // If the relevant page table doesn't exist in the page directory, then:
 //    - If create == 0, pgdir_walk returns NULL.
 //    - Otherwise, pgdir_walk tries to allocate a new page table
@@ -623,7 +857,14 @@ pgdir_walk(pde_t *pgdir, const void *va, int create)
 	int rc;
 
 	pgde = pgdir[PDX(va)];
-	if ((pgde & PTE_P) == 0) {
+	if ((pgde & (PTE_PS | PTE_P)) == (PTE_PS | PTE_P)) {
+		// A 4MB page has no page table entries; split it into
+		// a page table if one is wanted.
+		if (create == 0 || page_demote(pgdir, va) < 0) {
+			return NULL;
+		}
+		pgde = pgdir[PDX(va)];
+	} else if ((pgde & PTE_P) == 0) {
 		if (create == 0) {
 			return NULL;
 		}
@@ -636,11 +877,20 @@ pgdir_walk(pde_t *pgdir, const void *va, int create)
 		pp->pp_ref = 1;
 		ppa = page2pa(pp);
 		//clog("pp = %p, KADDR(ppa) = %p", pp, KADDR(ppa));
-		memset(KADDR(ppa), 0, PGSIZE);
+		pagezero(KADDR(ppa));
 		//pgde = ppa | PTE_USER;
 		pgde = ppa | PTE_W | PTE_U | PTE_P;
 		pgdir[PDX(va)] = pgde;
 	}
+	// A page table shared with other envs is copied before anyone
+	// gets to change it.
+	if (create && (uintptr_t) va < UTOP
+	    && pa2page(PTE_ADDR(pgde))->pp_ref > 1) {
+		if (page_table_unshare(pgdir, va) < 0) {
+			return NULL;
+		}
+		pgde = pgdir[PDX(va)];
+	}
 	pgtbl = (pte_t*) KADDR(PTE_ADDR(pgde));
 	//clog("pgtbl = %p", pgtbl);
 	return &pgtbl[PTX(va)];
@@ -648,8 +898,185 @@ pgdir_walk(pde_t *pgdir, const void *va, int create)
 }
 
 //
-// Map the physical page 'pp' at virtual address 'va'.
-// The permissions (the low 12 bits) of the page table
+// Replace the 4MB page mapped at 'va' by a page table that maps the
+// same physical pages with the same permissions.  The pages keep the
+// references the 4MB mapping already held, one for each of them.
+//
+// RETURNS
+//   0 on success
+//   -E_NO_MEM, if the page table couldn't be allocated
+//
+static int
+page_demote(pde_t *pgdir, const void *va)
+{
+	pde_t pde = pgdir[PDX(va)];
+	struct Page *pp;
+	pte_t *pt;
+	int i;
+
+	if (page_alloc(&pp) < 0) {
+		return -E_NO_MEM;
+	}
+	pp->pp_ref = 1;
+	pt = page2kva(pp);
+	for (i = 0; i < NPTENTRIES; i++) {
+		pt[i] = (PTE_ADDR(pde) + (i << PTXSHIFT)) | (pde & PTE_USER);
+	}
+	pgdir[PDX(va)] = page2pa(pp) | PTE_W | PTE_U | PTE_P;
+	// One invlpg drops the whole 4MB TLB entry; the page table's
+	// view through UVPT used to be the 4MB page's first frame.
+	tlb_invalidate(pgdir, (void *) va);
+	tlb_invalidate(pgdir, (void *) (UVPT + PDX(va) * PGSIZE));
+	return 0;
+}
+
+//
+// Give 'pgdir' a private copy of the page table mapping 'va', which
+// other page directories share.  The copy takes its own reference on
+// every page it maps.
+//
+// RETURNS
+//   0 on success
+//   -E_NO_MEM, if the copy couldn't be allocated
+//
+static int
+page_table_unshare(pde_t *pgdir, const void *va)
+{
+	pde_t pde = pgdir[PDX(va)];
+	pte_t *src, *dst;
+	struct Page *pp;
+	int i;
+
+	if (page_alloc(&pp) < 0) {
+		return -E_NO_MEM;
+	}
+	pp->pp_ref = 1;
+	src = (pte_t *) KADDR(PTE_ADDR(pde));
+	dst = page2kva(pp);
+	for (i = 0; i < NPTENTRIES; i++) {
+		dst[i] = src[i];
+		if (src[i] & PTE_P) {
+			pa2page(PTE_ADDR(src[i]))->pp_ref++;
+		}
+	}
+	pgdir[PDX(va)] = page2pa(pp) | (pde & PTE_USER);
+	pa2page(PTE_ADDR(pde))->pp_ref--;
+	// The translations are unchanged, but UVPT showed the old table
+	tlb_invalidate(pgdir, (void *) (UVPT + PDX(va) * PGSIZE));
+	return 0;
+}
+
+//
+// Make the 4MB of address space around 'va' in 'dstpgdir' use the
+// very page table that maps it in 'srcpgdir'.  The table is reference
+// counted like any other page, and whichever page directory next
+// changes a mapping in it gets a private copy first (see pgdir_walk).
+// The pages it maps hold one reference for the table as a whole.
+// Sharing a table shares every mapping in it, writable ones included;
+// the caller decides whether that is what it wants.
+//
+// RETURNS
+//   0 on success
+//   -E_INVAL, if srcpgdir maps no page table there (nothing, or a
+//     4MB page), or dstpgdir already has something there
+//
+int
+page_table_share(pde_t *srcpgdir, pde_t *dstpgdir, void *va)
+{
+	pde_t pde = srcpgdir[PDX(va)];
+
+	assert((uintptr_t) va < UTOP);
+	if ((pde & (PTE_PS | PTE_P)) != PTE_P || (dstpgdir[PDX(va)] & PTE_P)) {
+		return -E_INVAL;
+	}
+	pa2page(PTE_ADDR(pde))->pp_ref++;
+	dstpgdir[PDX(va)] = pde;
+	tlb_invalidate(dstpgdir, (void *) (UVPT + PDX(va) * PGSIZE));
+	return 0;
+}
+
+//
+// Map the 4MB block starting at 'pp' (from page_alloc_order with
+// PAGE_LARGE_ORDER) at the 4MB-aligned 'va' with a single page
+// directory entry, permissions 'perm|PTE_PS|PTE_P'.
+// Whatever was mapped in that 4MB of address space is unmapped first.
+// Every page of the block gains a reference, so that parts of the
+// mapping can later be unmapped or shared one page at a time.
+//
+// RETURNS
+//   0 on success
+//   -E_NOT_SUPP, if the CPU has no 4MB pages
+//
+int
+page_insert_large(pde_t *pgdir, struct Page *pp, void *va, int perm)
+{
+	int i;
+
+	assert((uintptr_t) va % PTSIZE == 0 && page2pa(pp) % PTSIZE == 0);
+	if (!pse_enabled) {
+		return -E_NOT_SUPP;
+	}
+
+	// Take the new references first, in case pp is what is mapped now
+	for (i = 0; i < NPTENTRIES; i++) {
+		pp[i].pp_ref++;
+	}
+	page_remove_pde(pgdir, va);
+	pgdir[PDX(va)] = page2pa(pp) | perm | PTE_PS | PTE_P;
+	tlb_invalidate(pgdir, (void *) (UVPT + PDX(va) * PGSIZE));
+	return 0;
+}
+
+//
+// Unmap everything in the 4MB of address space around 'va', whether
+// it is mapped by one 4MB page or by a page table, and free the page
+// table if there is one.  A page table other page directories share
+// just loses this reference.
+//
+void
+page_remove_pde(pde_t *pgdir, void *va)
+{
+	pde_t pde = pgdir[PDX(va)];
+	struct Page *pp;
+	pte_t *pt;
+	int i;
+
+	va = ROUNDDOWN(va, PTSIZE);
+	if (!(pde & PTE_P)) {
+		return;
+	}
+	user_mem_changed(pgdir);
+	if (pde & PTE_PS) {
+		pgdir[PDX(va)] = 0;
+		tlb_invalidate(pgdir, va);
+		pp = pa2page(PTE_ADDR(pde));
+		for (i = 0; i < NPTENTRIES; i++) {
+			page_decref(&pp[i]);
+		}
+		return;
+	}
+
+	pt = (pte_t *) KADDR(PTE_ADDR(pde));
+	if (pa2page(PTE_ADDR(pde))->pp_ref > 1) {
+		pgdir[PDX(va)] = 0;
+		for (i = 0; i < NPTENTRIES; i++) {
+			if (pt[i] & PTE_P) {
+				tlb_invalidate(pgdir, va + (i << PTXSHIFT));
+			}
+		}
+		page_decref(pa2page(PTE_ADDR(pde)));
+		return;
+	}
+	for (i = 0; i < NPTENTRIES; i++) {
+		if (pt[i] & PTE_P) {
+			page_remove(pgdir, va + (i << PTXSHIFT));
+		}
+	}
+	pgdir[PDX(va)] = 0;
+	page_decref(pa2page(PTE_ADDR(pde)));
+}
+
+
 //  entry should be set to 'perm|PTE_P'.
 //
 // Requirements
@@ -697,6 +1124,7 @@ page_insert(pde_t *pgdir, struct Page *pp, void *va, int perm)
 
 	if (*ppte & PTE_P) {
 		map_existed = 1;
+		user_mem_changed(pgdir);
 		if (pa2page(PTE_ADDR(*ppte)) == pp) {
 			//*ppte |= perm;
 			*ppte = PTE_ADDR(*ppte) | perm | PTE_P;
@@ -716,10 +1144,42 @@ page_insert(pde_t *pgdir, struct Page *pp, void *va, int perm)
 	return 0;
 }
 
+//
+// Map the physical page 'pp' read-only at virtual address 'va' like
+// page_insert, except that a page table shared with other envs is
+// filled in as it is instead of being copied first, so that they all
+// get the page.  Only for pages every sharer would map the same way,
+// like the program text a pager brings in.  If a sharer already got a
+// page there, that mapping stays.
+//
+// RETURNS:
+//   0 on success
+//   -E_NO_MEM, if page table couldn't be allocated
+//
+int
+page_insert_shared(pde_t *pgdir, struct Page *pp, void *va, int perm)
+{
+	pte_t *ppte;
+
+	assert(!(perm & PTE_W));
+	ppte = pgdir_walk(pgdir, va, 0);
+	if (ppte == NULL) {
+		return page_insert(pgdir, pp, va, perm);
+	}
+	// A missing entry is never in the TLB, so nothing to invalidate
+	if ((*ppte & PTE_P) == 0) {
+		*ppte = page2pa(pp) | perm | PTE_P;
+		++pp->pp_ref;
+	}
+	return 0;
+}
+
 //
 // Map [la, la+size) of linear address space to physical [pa, pa+size)
 // in the page table rooted at pgdir.  Size is a multiple of PGSIZE.
 // Use permission bits perm|PTE_P for the entries.
+// With PTE_PS in perm, la, pa and size must be multiples of PTSIZE and
+// the range is mapped with 4MB pages.
 //
 // This function is only intended to set up the ``static'' mappings
 // above UTOP. As such, it should *not* change the pp_ref field on the
@@ -735,6 +1195,15 @@ boot_map_segment(pde_t *pgdir, uintptr_t la, size_t size, physaddr_t pa, int per
 	void* va;
 
 	assert((size % PGSIZE) == 0);
+	if (perm & PTE_PS) {
+		// 4MB pages, straight into the page directory
+		assert(la % PTSIZE == 0 && pa % PTSIZE == 0
+		       && size % PTSIZE == 0);
+		for (; size > 0; la += PTSIZE, pa += PTSIZE, size -= PTSIZE) {
+			pgdir[PDX(la)] = pa | perm | PTE_P;
+		}
+		return;
+	}
 	//no_pgs = size / PGSIZE;
 	//for (i = 0; i < no_pgs; ++i) {
 	while ((size / PGSIZE) > 0) {
@@ -761,6 +1230,8 @@ boot_map_segment(pde_t *pgdir, uintptr_t la, size_t size, physaddr_t pa, int per
 // but should not be used by most callers.
 //
 // Return NULL if there is no page mapped at va.
+// If va lies in a 4MB page, the page is the one 4KB frame of it at va
+// and *pte_store is the page directory entry.
 //
 // Hint: the TA solution uses pgdir_walk and pa2page.
 //
@@ -769,6 +1240,15 @@ page_lookup(pde_t *pgdir, void *va, pte_t **pte_store)
 {
 	// Fill this function in
 	pte_t* ppte;
+	pde_t* ppde = &pgdir[PDX(va)];
+
+	// Part of a 4MB page: the directory entry stands in for the PTE
+	if ((*ppde & (PTE_PS | PTE_P)) == (PTE_PS | PTE_P)) {
+		if (pte_store != NULL) {
+			*pte_store = ppde;
+		}
+		return pa2page(PTE_ADDR(*ppde) + (PTX(va) << PTXSHIFT));
+	}
 
 	ppte = pgdir_walk(pgdir, va, 0);
 	if (ppte != NULL) {
@@ -805,6 +1285,17 @@ page_remove(pde_t *pgdir, void *va)
 	pte_t* ppte = NULL;
 	struct Page* pp;
 
+	if (page_lookup(pgdir, va, NULL) == NULL) {
+		return;
+	}
+	// Unmapping part of a 4MB page splits it first, and unmapping
+	// from a shared page table unshares it
+	if (pgdir_walk(pgdir, va, 1) == NULL) {
+		cprintf("page_remove: no memory for a page table at %08x\n",
+			va);
+		return;
+	}
+
 	pp = page_lookup(pgdir, va, &ppte);
 	if (pp == NULL) {
 		return;
@@ -817,6 +1308,7 @@ page_remove(pde_t *pgdir, void *va)
 		*ppte = 0;
 	}
 	tlb_invalidate(pgdir, va);
+	user_mem_changed(pgdir);
 }
 
 //
@@ -826,8 +1318,9 @@ page_remove(pde_t *pgdir, void *va)
 void
 tlb_invalidate(pde_t *pgdir, void *va)
 {
-	// Flush the entry only if we're modifying the current address space.
-	if (!curenv || curenv->env_pgdir == pgdir)
+	// Flush the entry only if we're modifying the loaded address space;
+	// any other one gets a fresh TLB when CR3 is next loaded with it.
+	if (rcr3() == PADDR(pgdir))
 		invlpg(va);
 }
 
@@ -851,68 +1344,150 @@ static uintptr_t user_mem_check_addr;
 // Returns 0 if the user program can access this range of addresses,
 // and -E_FAULT otherwise.
 //
+// This is the slow path of user_mem_check() in pmap.h, for ranges that
+// span pages.  The last few ranges found accessible are remembered in
+// env->env_urange until a mapping in env's page directory is removed
+// or loses permissions, so a buffer passed over and over is only walked
+// once.
+//
 int
-user_mem_check(struct Env *env, const void *va, size_t len, int perm)
+user_mem_walk(struct Env *env, const void *va, size_t len, int perm)
 {
-	// LAB 3: Your code here. 
-	uintptr_t va_end;
-	uint32_t pdeno, pteno, ptemin, ptemax;
-	pte_t* ppte = NULL;
-	physaddr_t pa;
+	uintptr_t start = (uintptr_t) va, end = start + len, a;
+	struct UserRange *ur;
+	uint32_t gen;
+	pde_t pde;
+	pte_t pte;
+	int have, i;
 
 	assert(env != NULL);
-	va_end = (uintptr_t) (va + len - 1);
-	//clog("va = %p, va_end = %p", va, va_end);
-	if ((uintptr_t) va > ULIM) {
-		user_mem_check_addr = (uintptr_t) va;
-		//clog("wp1");
-		return -E_FAULT;
+	perm |= PTE_P;
+	if (len == 0) {
+		return 0;
 	}
-	if (va_end > ULIM) {
-		user_mem_check_addr = ULIM + 1;
-		//clog("wp2");
+	if (start >= ULIM || end > ULIM || end < start) {
+		user_mem_check_addr = MAX(start, ULIM);
 		return -E_FAULT;
 	}
 
-	for (pdeno = PDX(va); pdeno <= PDX(va_end); ++pdeno) {
-		if (!(env->env_pgdir[pdeno] & (perm | PTE_P))) {
-			user_mem_check_addr = (uintptr_t) PGADDR(pdeno, 0, 0);
-			if (pdeno == PDX(va)) {
-				// First Page Directory
-				user_mem_check_addr = (uintptr_t) va;
-			}
-			//clog("wp3");
-			return -E_FAULT;
+	gen = pa2page(PADDR(env->env_pgdir))->pp_gen;
+	for (i = 0; i < ENV_NURANGE; i++) {
+		ur = &env->env_urange[i];
+		if (ur->ur_gen == gen && ur->ur_start <= start
+		    && end <= ur->ur_end && (ur->ur_perm & perm) == perm) {
+			return 0;
 		}
+	}
 
-		ptemin = 0;
-		ptemax = PTX(MAXVAL(uintptr_t));
-		if (pdeno == PDX(va)) {
-			// First Page Directory
-			ptemin = PTX(va);
+	have = PTE_USER;
+	for (a = ROUNDDOWN(start, PGSIZE); a < end; a += PGSIZE) {
+		pde = env->env_pgdir[PDX(a)];
+		if ((pde & perm) != perm) {
+			goto fault;
 		}
-		if (pdeno == PDX(va_end)) {
-			// Last Page Directory
-			ptemax = PTX(va_end);
+		if (pde & PTE_PS) {
+			// A 4MB page: the directory entry holds the permissions
+			have &= pde;
+			a = ROUNDDOWN(a, PTSIZE) + PTSIZE - PGSIZE;
+			continue;
 		}
-		pa = PTE_ADDR(env->env_pgdir[pdeno]);
-		ppte = (pte_t*) KADDR(pa);
-		for (pteno = ptemin; pteno <= ptemax; ++pteno) {
-			if (!(ppte[pteno] & (perm | PTE_P))) {
-				user_mem_check_addr = (uintptr_t) PGADDR(pdeno, pteno, 0);
-				if ( (pdeno == PDX(va)) && (pteno == ptemin) ) {
-					// First Page Table in First Page Directory
-					user_mem_check_addr = (uintptr_t) va;
-				}
-				//clog("wp4");
-				return -E_FAULT;
-			}
+		pte = ((pte_t *) KADDR(PTE_ADDR(pde)))[PTX(a)];
+		if ((pte & perm) != perm) {
+			goto fault;
 		}
+		have &= pde & pte;
 	}
 
+	ur = &env->env_urange[env->env_urange_next++ % ENV_NURANGE];
+	ur->ur_start = ROUNDDOWN(start, PGSIZE);
+	ur->ur_end = ROUNDUP(end, PGSIZE);
+	ur->ur_gen = gen;
+	ur->ur_perm = have;
+	return 0;
+
+fault:
+	user_mem_check_addr = MAX(a, start);
+	return -E_FAULT;
+}
+
+// Note that a user mapping in 'pgdir' went away or lost permissions.
+static void
+user_mem_changed(pde_t *pgdir)
+{
+	pa2page(PADDR(pgdir))->pp_gen++;
+}
+
+// Copy between the kernel buffer 'kbuf' and the current environment's
+// memory at 'uva', a page at a time, checking each page just before
+// the part in it is copied.
+static int
+user_copy(char *kbuf, uintptr_t uva, size_t len, int perm, int out)
+{
+	size_t n;
+
+	if (uva + len < uva) {
+		user_mem_check_addr = uva;
+		return -E_FAULT;
+	}
+	while (len > 0) {
+		n = MIN(len, PGSIZE - PGOFF(uva));
+		if (user_mem_check(curenv, (void *) uva, n, perm) < 0) {
+			return -E_FAULT;
+		}
+		if (out) {
+			memmove((void *) uva, kbuf, n);
+		} else {
+			memmove(kbuf, (void *) uva, n);
+		}
+		kbuf += n;
+		uva += n;
+		len -= n;
+	}
 	return 0;
 }
 
+//
+// Copy 'len' bytes from 'usrc' in the current environment, which must
+// be the loaded address space, to the kernel buffer 'dst'.
+// Returns 0 on success, or -E_FAULT if the environment can't read all
+// of them (see user_mem_fault).  'dst' may be partly written then.
+//
+int
+copyin(void *dst, const void *usrc, size_t len)
+{
+	return user_copy((char *) dst, (uintptr_t) usrc, len, PTE_U, 0);
+}
+
+//
+// Copy 'len' bytes from the kernel buffer 'src' to 'udst' in the
+// current environment, which must be the loaded address space.
+// Returns 0 on success, or -E_FAULT if the environment can't write all
+// of them (see user_mem_fault).  'udst' may be partly written then.
+//
+int
+copyout(void *udst, const void *src, size_t len)
+{
+	return user_copy((char *) src, (uintptr_t) udst, len, PTE_U | PTE_W, 1);
+}
+
+//
+// Destroy 'env' for passing the kernel memory it can't access, after
+// user_mem_check(), copyin() or copyout() failed.  If the page is just
+// not in yet, the current environment's system call waits for its
+// pager instead and is restarted (see kern/pager.c).
+// If env is the current environment, this function will not return.
+//
+void
+user_mem_fault(struct Env *env)
+{
+	if (env == curenv) {
+		pager_syscall_fault(user_mem_check_addr);
+	}
+	cprintf("[%08x] user_mem_check assertion failure for "
+		"va %08x\n", env->env_id, user_mem_check_addr);
+	env_destroy(env);	// may not return
+}
+
 //
 // Checks that environment 'env' is allowed to access the range
 // of memory [va, va+len) with permissions 'perm | PTE_U'.
@@ -924,9 +1499,7 @@ void
 user_mem_assert(struct Env *env, const void *va, size_t len, int perm)
 {
 	if (user_mem_check(env, va, len, perm | PTE_U) < 0) {
-		cprintf("[%08x] user_mem_check assertion failure for "
-			"va %08x\n", env->env_id, user_mem_check_addr);
-		env_destroy(env);	// may not return
+		user_mem_fault(env);	// may not return
 	}
 }
 
@@ -951,8 +1524,7 @@ page_check(void)
 	assert(pp2 && pp2 != pp1 && pp2 != pp0);
 
 	// temporarily steal the rest of the free pages
-	fl = page_free_list;
-	LIST_INIT(&page_free_list);
+	page_steal(&fl);
 
 	// should be no free memory
 	assert(page_alloc(&pp) == -E_NO_MEM);
@@ -1081,7 +1653,7 @@ page_check(void)
 	pp0->pp_ref = 0;
 
 	// give free list back
-	page_free_list = fl;
+	page_unsteal(&fl);
 
 	// free the pages we took
 	page_free(pp0);
@@ -8,7 +8,7 @@
 
 #include <inc/memlayout.h>
 #include <inc/assert.h>
-struct Env;
+#include <inc/env.h>
 
 
 /* This macro takes a kernel virtual address -- an address that points above
@@ -42,6 +42,8 @@ extern char bootstacktop[], bootstack[];
 extern struct Page *pages;
 extern size_t npage;
 
+extern int pse_enabled;
+
 extern physaddr_t boot_cr3;
 extern pde_t *boot_pgdir;
 
@@ -51,18 +53,34 @@ extern struct Pseudodesc gdt_pd;
 void	i386_vm_init();
 void	i386_detect_memory();
 
+// Largest block the buddy allocator hands out: 2^10 pages, 4MB
+#define PAGE_MAX_ORDER	10
+// Order of the block behind one 4MB page mapping
+#define PAGE_LARGE_ORDER	(PTSHIFT - PGSHIFT)
+
 void	page_init(void);
 int	page_alloc(struct Page **pp_store);
 void	page_free(struct Page *pp);
+int	page_alloc_order(int order, struct Page **pp_store);
+void	page_free_order(struct Page *pp, int order);
+size_t	page_free_count(void);
+void	page_buddy_print(int verbose);
 int	page_insert(pde_t *pgdir, struct Page *pp, void *va, int perm);
+int	page_insert_shared(pde_t *pgdir, struct Page *pp, void *va, int perm);
 void	page_remove(pde_t *pgdir, void *va);
+int	page_insert_large(pde_t *pgdir, struct Page *pp, void *va, int perm);
+void	page_remove_pde(pde_t *pgdir, void *va);
+int	page_table_share(pde_t *srcpgdir, pde_t *dstpgdir, void *va);
 struct Page *page_lookup(pde_t *pgdir, void *va, pte_t **pte_store);
 void	page_decref(struct Page *pp);
 
 void	tlb_invalidate(pde_t *pgdir, void *va);
 
-int	user_mem_check(struct Env *env, const void *va, size_t len, int perm);
+int	user_mem_walk(struct Env *env, const void *va, size_t len, int perm);
 void	user_mem_assert(struct Env *env, const void *va, size_t len, int perm);
+void	user_mem_fault(struct Env *env);
+int	copyin(void *dst, const void *usrc, size_t len);
+int	copyout(void *udst, const void *src, size_t len);
 
 static inline ppn_t
 page2ppn(struct Page *pp)
@@ -92,4 +110,28 @@ page2kva(struct Page *pp)
 
 pte_t *pgdir_walk(pde_t *pgdir, const void *va, int create);
 
+// Check that 'env' may access [va, va+len) with permissions
+// 'perm | PTE_P'; returns 0 if so and -E_FAULT if not.  A range within
+// one page mapped by a page table, the usual case, is settled here;
+// anything else goes to user_mem_walk() in pmap.c.
+static inline int
+user_mem_check(struct Env *env, const void *va, size_t len, int perm)
+{
+	uintptr_t a = (uintptr_t) va;
+	pde_t pde;
+	pte_t pte;
+
+	perm |= PTE_P;
+	if (a < ULIM && len - 1 < PGSIZE - PGOFF(a)) {
+		pde = env->env_pgdir[PDX(a)];
+		if ((pde & (perm | PTE_PS)) == perm) {
+			pte = ((pte_t *) KADDR(PTE_ADDR(pde)))[PTX(a)];
+			if ((pte & perm) == perm) {
+				return 0;
+			}
+		}
+	}
+	return user_mem_walk(env, va, len, perm);
+}
+
 #endif /* !JOS_KERN_PMAP_H */
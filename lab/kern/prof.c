@@ -0,0 +1,205 @@
+// Sampling profiler.
+//
+// While prof_on is set, every clock interrupt (KCLOCK_HZ a second while
+// envs run) notes the eip it interrupted in a buffer of the running
+// env's, or in the kernel's if it interrupted the kernel, which happens
+// in the idle loop.  An env's buffer is a page, allocated when the
+// profiler starts or the env is created while it is on, and freed with
+// the env; samples past what the page holds are counted but not kept.
+// The clock interrupt never allocates: a sample for an env that could
+// not get a buffer is dropped.
+//
+// prof_report() sorts an address space's samples by function, with the
+// stabs debuginfo_eip() uses, adding together those of all the threads
+// sharing it.
+
+#include <inc/string.h>
+#include <inc/assert.h>
+#include <inc/x86.h>
+
+#include <kern/env.h>
+#include <kern/pmap.h>
+#include <kern/kdebug.h>
+#include <kern/prof.h>
+
+#define PROF_NKEEP	(PGSIZE / sizeof(uintptr_t) - 1)
+#define PROF_NFUNC	256	// functions prof_report() tells apart
+
+struct ProfBuf {
+	uint32_t pb_n;			// samples taken
+	uintptr_t pb_eip[PROF_NKEEP];	// the first PROF_NKEEP of them
+};
+
+bool prof_on;
+uint32_t prof_dropped;		// samples for envs with no buffer
+
+static struct ProfBuf *prof_buf[NENV];	// by ENVX, NULL if no samples
+static struct ProfBuf prof_kern;
+// PROF_NFUNC functions, and <unknown>, <not kept> and <other>
+static struct ProfEntry prof_tab[PROF_NFUNC + 3];
+
+static void
+prof_note(struct ProfBuf *pb, uintptr_t eip)
+{
+	if (pb->pb_n < PROF_NKEEP)
+		pb->pb_eip[pb->pb_n] = eip;
+	pb->pb_n++;
+}
+
+// Called from the clock interrupt.
+void
+prof_sample(struct Trapframe *tf)
+{
+	struct ProfBuf *pb;
+
+	if (!prof_on)
+		return;
+	if ((tf->tf_cs & 3) == 0 || !curenv) {
+		prof_note(&prof_kern, tf->tf_eip);
+		return;
+	}
+	if ((pb = prof_buf[ENVX(curenv->env_id)]) == NULL) {
+		prof_dropped++;
+		return;
+	}
+	prof_note(pb, tf->tf_eip);
+}
+
+// Give e a sample buffer, if the profiler is on and it has none.
+void
+prof_alloc(struct Env *e)
+{
+	struct ProfBuf **pbp = &prof_buf[ENVX(e->env_id)];
+	struct Page *pp;
+
+	if (!prof_on || *pbp || page_alloc(&pp) < 0)
+		return;
+	*pbp = page2kva(pp);
+	(*pbp)->pb_n = 0;
+}
+
+// Start taking samples, with a buffer for every env there is.
+void
+prof_start(void)
+{
+	int i;
+
+	prof_on = 1;
+	for (i = 0; i < NENV; i++)
+		if (envs[i].env_status != ENV_FREE)
+			prof_alloc(&envs[i]);
+}
+
+void
+prof_free(struct Env *e)
+{
+	struct ProfBuf **pbp = &prof_buf[ENVX(e->env_id)];
+
+	if (*pbp) {
+		page_free(pa2page(PADDR(*pbp)));
+		*pbp = NULL;
+	}
+}
+
+// Drop all samples, the kernel's and every env's.
+void
+prof_reset(void)
+{
+	int i;
+
+	for (i = 0; i < NENV; i++)
+		if (prof_buf[i])
+			prof_buf[i]->pb_n = 0;
+	prof_kern.pb_n = 0;
+	prof_dropped = 0;
+}
+
+// Samples taken in e, or in the kernel if e is NULL.
+uint32_t
+prof_nsamples(struct Env *e)
+{
+	struct ProfBuf *pb = e ? prof_buf[ENVX(e->env_id)] : &prof_kern;
+
+	return pb ? pb->pb_n : 0;
+}
+
+// Find or add the entry for the function at addr.  Entries with
+// addr 0 go by name.
+static struct ProfEntry *
+prof_entry(int *n, uintptr_t addr, const char *name, int namelen)
+{
+	int i;
+
+	for (;;) {
+		for (i = 0; i < *n; i++)
+			if (prof_tab[i].pe_addr == addr
+			    && (addr != 0 || strcmp(prof_tab[i].pe_name, name) == 0))
+				return &prof_tab[i];
+		if (*n < PROF_NFUNC || addr == 0)
+			break;
+		// No room to tell more functions apart
+		addr = 0;
+		name = "<other>";
+		namelen = 7;
+	}
+	prof_tab[*n].pe_addr = addr;
+	prof_tab[*n].pe_count = 0;
+	namelen = MIN(namelen, PROF_NAMELEN - 1);
+	memmove(prof_tab[*n].pe_name, name, namelen);
+	prof_tab[*n].pe_name[namelen] = 0;
+	return &prof_tab[(*n)++];
+}
+
+static void
+prof_add(struct Env *e, struct ProfBuf *pb, int *n)
+{
+	struct Eipdebuginfo info;
+	struct ProfEntry *pe;
+	uint32_t i;
+
+	for (i = 0; i < MIN(pb->pb_n, PROF_NKEEP); i++) {
+		debuginfo_eip_env(e, pb->pb_eip[i], &info);
+		if (strncmp(info.eip_fn_name, "<unknown>", 9) == 0)
+			info.eip_fn_addr = 0;
+		pe = prof_entry(n, info.eip_fn_addr, info.eip_fn_name,
+				info.eip_fn_namelen);
+		pe->pe_count++;
+	}
+	if (pb->pb_n > PROF_NKEEP) {
+		pe = prof_entry(n, 0, "<not kept>", 10);
+		pe->pe_count += pb->pb_n - PROF_NKEEP;
+	}
+}
+
+// Sort the samples of e's address space, or the kernel's if e is NULL,
+// by function, most samples first.  Sets *tab_store to the table,
+// which the next call reuses.
+// Returns the number of entries.
+int
+prof_report(struct Env *e, struct ProfEntry **tab_store)
+{
+	struct ProfEntry pe;
+	physaddr_t cr3 = rcr3();
+	int i, j, n = 0;
+
+	if (!e)
+		prof_add(NULL, &prof_kern, &n);
+	else {
+		// debuginfo_eip_env() reads e's stabs in place
+		lcr3(e->env_cr3);
+		for (i = 0; i < NENV; i++)
+			if (prof_buf[i] && envs[i].env_status != ENV_FREE
+			    && envs[i].env_pgdir == e->env_pgdir)
+				prof_add(&envs[i], prof_buf[i], &n);
+		lcr3(cr3);
+	}
+
+	for (i = 1; i < n; i++) {
+		pe = prof_tab[i];
+		for (j = i; j > 0 && prof_tab[j - 1].pe_count < pe.pe_count; j--)
+			prof_tab[j] = prof_tab[j - 1];
+		prof_tab[j] = pe;
+	}
+	*tab_store = prof_tab;
+	return n;
+}
@@ -0,0 +1,22 @@
+#ifndef JOS_KERN_PROF_H
+#define JOS_KERN_PROF_H
+#ifndef JOS_KERNEL
+# error "This is a JOS kernel header; user programs should not #include it"
+#endif
+
+#include <inc/env.h>
+#include <inc/prof.h>
+#include <inc/trap.h>
+
+extern bool prof_on;
+extern uint32_t prof_dropped;
+
+void prof_sample(struct Trapframe *tf);
+void prof_alloc(struct Env *e);
+void prof_start(void);
+void prof_reset(void);
+void prof_free(struct Env *e);
+uint32_t prof_nsamples(struct Env *e);
+int prof_report(struct Env *e, struct ProfEntry **tab_store);
+
+#endif /* JOS_KERN_PROF_H */
@@ -1,8 +1,63 @@
 #include <inc/assert.h>
+#include <inc/x86.h>
 
 #include <kern/env.h>
 #include <kern/pmap.h>
 #include <kern/monitor.h>
+#include <kern/kclock.h>
+#include <kern/time.h>
+#include <kern/timer.h>
+#include <kern/e100.h>
+#include <kern/console.h>
+#include <kern/kstat.h>
+#include <kern/trace.h>
+
+// Runs on a fresh stack until an interrupt comes: first tears down
+// the address spaces env_free() left for later, a page table at a time,
+// and passes on console output, with interrupts let in between, then
+// halts.  The interrupt ends up
+// back in sched_yield() through trap(), leaving this stack behind.
+static void __attribute__((noreturn, used))
+sched_idle(void)
+{
+	while (env_reap(1) || cons_drain(CONS_BURST))
+		__asm __volatile("sti\n\tnop\n\tcli");
+	__asm __volatile("sti\n"
+		"1:\thlt\n"
+		"\tjmp 1b\n");
+	panic("sched_idle: hlt returned");
+}
+
+// Nothing is runnable, but an environment is waiting for a timer or a
+// device, so an interrupt will make it runnable again.  Wait for that
+// interrupt in the kernel, in sched_idle().
+// The clock only interrupts when the next timer is due, if at all;
+// env_run() sets it ticking again.
+// The last env's address space stays loaded, so if that env is the
+// one woken up it finds its TLB entries still there.
+static void __attribute__((noreturn))
+sched_halt(void)
+{
+	uint64_t next, now;
+
+	kstat_leave();
+	trace(TE_IDLE, curenv ? curenv->env_id : 0, 0, 0);
+	curenv = NULL;
+
+	if ((next = timer_next()) == 0)
+		kclock_stop();
+	else {
+		now = time_nsec();
+		kclock_oneshot(next > now ? next - now : 0);
+	}
+
+	__asm __volatile("movl %0, %%esp\n"
+		"\tpushl $0\n"
+		"\tpushl $0\n"
+		"\tcall sched_idle\n"
+		: : "i" (KSTACKTOP));
+	panic("sched_halt: sched_idle returned");
+}
 
 
 // Choose a user environment to run and run it.
@@ -84,9 +139,15 @@ sched_yield(void)
 	}
 #endif
 
-	// Run the special idle environment when nothing else is runnable.
-	if (envs[0].env_status == ENV_RUNNABLE)
+	if (timer_pending() || e100_waiting())
+		sched_halt();
+
+	// Run the special idle environment when nothing else is runnable,
+	// after a page table's worth of reaping.
+	if (envs[0].env_status == ENV_RUNNABLE) {
+		env_reap(1);
 		env_run(&envs[0]);
+	}
 	else {
 		cprintf("Destroyed all environments - nothing more to do!\n");
 		while (1)
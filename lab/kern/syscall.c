@@ -13,7 +13,13 @@
 #include <kern/console.h>
 #include <kern/sched.h>
 #include <kern/time.h>
+#include <kern/timer.h>
+#include <kern/pager.h>
+#include <kern/futex.h>
 #include <kern/e100.h>
+#include <kern/prof.h>
+#include <kern/kstat.h>
+#include <kern/trace.h>
 
 // Print a string to the system console.
 // The string is exactly 'len' characters long.
@@ -27,8 +33,9 @@ sys_cputs(const char *s, size_t len)
 	// LAB 3: Your code here.
 	user_mem_assert(curenv, s, len, PTE_U);
 
-	// Print the string supplied by the user.
-	cprintf("%.*s", len, s);
+	// Add the string to the console log, which the devices take in
+	// their own time (see kern/console.c).
+	cons_write(s, len);
 }
 
 // Read a character from the system console without blocking.
@@ -100,6 +107,11 @@ sys_exofork(void)
 	penv->env_tf = curenv->env_tf;
 	// Child: Tweak to return 0
 	penv->env_tf.tf_regs.reg_eax = 0;
+	// Child: Pages in the same image, if the parent's is demand-paged
+	penv->env_pager = curenv->env_pager;
+	penv->env_pager_lo = curenv->env_pager_lo;
+	penv->env_pager_hi = curenv->env_pager_hi;
+	penv->env_pager_key = curenv->env_pager_key;
 
 	// Parent: return env id of the child
 	return penv->env_id;
@@ -141,6 +153,11 @@ sys_env_set_status(envid_t envid, int status)
 		return -E_INVAL;
 	}
 
+	// Whatever penv was blocked in is over
+	timer_cancel(penv);
+	futex_cancel(penv);
+	pager_clear(penv);
+	e100_cancel(penv);
 	penv->env_status = status;
 	return 0;
 }
@@ -160,6 +177,7 @@ sys_env_set_trapframe(envid_t envid, struct Trapframe *tf)
 	// address!
 	//panic("sys_env_set_trapframe not implemented");
 	struct Env *penv = NULL;
+	struct Trapframe ktf;
 	int rc;
 
 	rc = envid2env(envid, &penv, 1);
@@ -168,11 +186,13 @@ sys_env_set_trapframe(envid_t envid, struct Trapframe *tf)
 	}
 
 	assert(penv != NULL);
-	user_mem_assert(penv, tf, sizeof(struct Trapframe), PTE_U);
-	tf->tf_cs |= RPL_U;
-	tf->tf_eflags |= FL_IF;
+	if (copyin(&ktf, tf, sizeof(ktf)) < 0) {
+		user_mem_fault(curenv);
+	}
+	ktf.tf_cs |= RPL_U;
+	ktf.tf_eflags |= FL_IF;
 
-	penv->env_tf = *tf;
+	penv->env_tf = ktf;
 	return 0;
 }
 
@@ -226,6 +246,9 @@ sys_env_set_transaction(envid_t envid, void *trans)
 //
 // perm -- PTE_U | PTE_P must be set, PTE_AVAIL | PTE_W may or may not be set,
 //         but no other bits may be set.  See PTE_USER in inc/mmu.h.
+//         With PTE_PS as well, 'va' must be 4MB-aligned and a 4MB page of
+//         physically contiguous memory is mapped there instead, replacing
+//         anything mapped in that 4MB.
 //
 // Return 0 on success, < 0 on error.  Errors are:
 //	-E_BAD_ENV if environment envid doesn't currently exist,
@@ -234,6 +257,7 @@ sys_env_set_transaction(envid_t envid, void *trans)
 //	-E_INVAL if perm is inappropriate (see above).
 //	-E_NO_MEM if there's no memory to allocate the new page,
 //		or to allocate any necessary page tables.
+//	-E_NOT_SUPP if PTE_PS is asked for and the CPU has no 4MB pages.
 static int
 sys_page_alloc(envid_t envid, void *va, int perm)
 {
@@ -250,13 +274,17 @@ sys_page_alloc(envid_t envid, void *va, int perm)
 	struct Page *pp = NULL;
 	int rc;
 
-	if ( ((uintptr_t) va >= UTOP) || (((uintptr_t) va % PGSIZE) != 0) ) {
+	if ( ((uintptr_t) va >= UTOP) || (((uintptr_t) va % PGSIZE) != 0)
+			|| ((perm & PTE_PS) && ((uintptr_t) va % PTSIZE) != 0) ) {
 		return -E_INVAL;
 	}
 	if ( ((perm & PTE_U) == 0) || ((perm & PTE_P) == 0)
-			|| ((perm & ~(PTE_USER)) != 0) ) {
+			|| ((perm & ~(PTE_USER | PTE_PS)) != 0) ) {
 		return -E_INVAL;
 	}
+	if ( (perm & PTE_PS) && !pse_enabled ) {
+		return -E_NOT_SUPP;
+	}
 
 	rc = envid2env(envid, &penv, 1);
 	if (rc < 0) {
@@ -264,22 +292,30 @@ sys_page_alloc(envid_t envid, void *va, int perm)
 	}
 	assert(penv != NULL);
 
+	if (perm & PTE_PS) {
+		rc = page_alloc_order(PAGE_LARGE_ORDER, &pp);
+		if (rc < 0) {
+			return rc;
+		}
+		memset(page2kva(pp), 0, PTSIZE);
+		return page_insert_large(penv->env_pgdir, pp, va,
+				perm & ~PTE_PS);
+	}
+
 	rc = page_alloc(&pp);
 	if (rc < 0) {
 		return rc;
 	}
 	assert(pp != NULL);
+	// Set physical content of page to 0, through the kernel's own
+	// mapping rather than by switching address spaces
+	pagezero(page2kva(pp));
 	rc = page_insert(penv->env_pgdir, pp, va, perm);
 	if (rc < 0) {
 		page_free(pp);
 		return rc;
 	}
 
-	lcr3(penv->env_cr3);
-	// Set physical content of page to 0
-	memset(va, 0, PGSIZE);
-	lcr3(curenv->env_cr3);
-
 	return 0;
 }
 
@@ -287,7 +323,8 @@ sys_page_alloc(envid_t envid, void *va, int perm)
 // at 'dstva' in dstenvid's address space with permission 'perm'.
 // Perm has the same restrictions as in sys_page_alloc, except
 // that it also must not grant write access to a read-only
-// page.
+// page.  With PTE_PS, both addresses must be 4MB-aligned and
+// srcva must be mapped by a 4MB page, which is mapped whole.
 //
 // Return 0 on success, < 0 on error.  Errors are:
 //	-E_BAD_ENV if srcenvid and/or dstenvid doesn't currently exist,
@@ -323,8 +360,12 @@ sys_page_map(envid_t srcenvid, void *srcva,
 			|| (((uintptr_t) dstva % PGSIZE) != 0) ) {
 		return -E_INVAL;
 	}
+	if ( (perm & PTE_PS) && ((((uintptr_t) srcva % PTSIZE) != 0)
+				|| (((uintptr_t) dstva % PTSIZE) != 0)) ) {
+		return -E_INVAL;
+	}
 	if ( ((perm & PTE_U) == 0) || ((perm & PTE_P) == 0)
-			|| ((perm & ~(PTE_USER)) != 0) ) {
+			|| ((perm & ~(PTE_USER | PTE_PS)) != 0) ) {
 		return -E_INVAL;
 	}
 
@@ -341,6 +382,9 @@ sys_page_map(envid_t srcenvid, void *srcva,
 
 	pp = page_lookup(psenv->env_pgdir, srcva, &ppte);
 	if (pp == NULL) {
+		if (psenv == curenv) {
+			pager_syscall_fault((uintptr_t) srcva);
+		}
 		return -E_INVAL;
 	}
 	assert(ppte != NULL);
@@ -349,6 +393,14 @@ sys_page_map(envid_t srcenvid, void *srcva,
 		return -E_INVAL;
 	}
 
+	if (perm & PTE_PS) {
+		if ((*ppte & PTE_PS) == 0) {
+			return -E_INVAL;
+		}
+		return page_insert_large(pdenv->env_pgdir, pp, dstva,
+				perm & ~PTE_PS);
+	}
+
 	rc = page_insert(pdenv->env_pgdir, pp, dstva, perm);
 	if (rc < 0) {
 		return rc;
@@ -387,6 +439,159 @@ sys_page_unmap(envid_t envid, void *va)
 	return 0;
 }
 
+// Make the 4MB of address space at 'va' in dstenvid use the same page
+// table as in srcenvid, so that every mapping there is shared in one
+// go.  As soon as either env changes a mapping in that 4MB, it gets a
+// private copy of the table.  Writable pages in the table are shared
+// writable too, so the caller makes private ones copy-on-write first.
+//
+// Return 0 on success, < 0 on error.  Errors are:
+//	-E_BAD_ENV if srcenvid and/or dstenvid doesn't currently exist,
+//		or the caller doesn't have permission to change one of them.
+//	-E_INVAL if va >= UTOP, or va is not 4MB-aligned.
+//	-E_INVAL if srcenvid and dstenvid are the same env.
+//	-E_INVAL if srcenvid has no page table for va (nothing is
+//		mapped there, or a 4MB page is), or dstenvid already has
+//		something mapped in that 4MB.
+static int
+sys_page_table_share(envid_t srcenvid, void *va, envid_t dstenvid)
+{
+	struct Env *psenv = NULL, *pdenv = NULL;
+	int rc;
+
+	if (((uintptr_t) va >= UTOP) || (((uintptr_t) va % PTSIZE) != 0)) {
+		return -E_INVAL;
+	}
+
+	rc = envid2env(srcenvid, &psenv, 1);
+	if (rc < 0) {
+		return rc;
+	}
+	rc = envid2env(dstenvid, &pdenv, 1);
+	if (rc < 0) {
+		return rc;
+	}
+	if (psenv == pdenv) {
+		return -E_INVAL;
+	}
+
+	return page_table_share(psenv->env_pgdir, pdenv->env_pgdir, va);
+}
+
+// Make pagerid the pager for the range [lo, hi) of envid's address
+// space: user-mode faults on pages that are not present there are
+// passed to the pager (see kern/pager.c) instead of being delivered to
+// envid.  Envs that envid forks keep the same pager.  A pagerid of 0
+// removes the pager.
+//
+// Return 0 on success, < 0 on error.  Errors are:
+//	-E_BAD_ENV if envid doesn't currently exist,
+//		or the caller doesn't have permission to change envid.
+//	-E_BAD_ENV if pagerid doesn't currently exist.
+//	-E_INVAL if lo or hi is not page-aligned, lo > hi, or hi > UTOP.
+//	-E_INVAL if pagerid is envid itself.
+static int
+sys_env_set_pager(envid_t envid, envid_t pagerid, uintptr_t lo, uintptr_t hi)
+{
+	struct Env *penv = NULL, *ppager = NULL;
+	int rc;
+
+	if (((lo % PGSIZE) != 0) || ((hi % PGSIZE) != 0) || (lo > hi)
+			|| (hi > UTOP)) {
+		return -E_INVAL;
+	}
+
+	rc = envid2env(envid, &penv, 1);
+	if (rc < 0) {
+		return rc;
+	}
+	if (pagerid != 0) {
+		rc = envid2env(pagerid, &ppager, 0);
+		if (rc < 0) {
+			return rc;
+		}
+		if (ppager == penv) {
+			return -E_INVAL;
+		}
+	}
+
+	penv->env_pager = pagerid;
+	penv->env_pager_lo = lo;
+	penv->env_pager_hi = hi;
+	penv->env_pager_key = penv->env_id;
+	return 0;
+}
+
+// As the pager of envid, resolve the fault envid waits on: map the page
+// at 'srcva' in the caller's address space at the faulting address in
+// envid with permission 'perm', and let envid retry the access.  A
+// read-only page goes into the page table as it is, even if envid
+// shares the table with other envs: they all page in the same image.
+// A perm of 0 says the page can't be had, and destroys envid.
+//
+// Return 0 on success, < 0 on error.  Errors are:
+//	-E_BAD_ENV if envid doesn't currently exist, or is not waiting
+//		for the caller to page something in.
+//	-E_INVAL if srcva >= UTOP or srcva is not page-aligned.
+//	-E_INVAL if perm is inappropriate (see sys_page_alloc).
+//	-E_INVAL if srcva is not mapped in the caller's address space.
+//	-E_INVAL if (perm & PTE_W), but srcva is read-only in the
+//		caller's address space.
+//	-E_NO_MEM if there's no memory to allocate a new page table.
+static int
+sys_pager_reply(envid_t envid, void *srcva, int perm)
+{
+	struct Env *penv = NULL;
+	struct Page *pp = NULL;
+	pte_t *ppte = NULL;
+	int rc;
+
+	rc = envid2env(envid, &penv, 0);
+	if (rc < 0) {
+		return rc;
+	}
+	if ((penv->env_pager != curenv->env_id) || (penv->env_pager_va == 0)) {
+		return -E_BAD_ENV;
+	}
+
+	if (perm == 0) {
+		cprintf("[%08x] pager %08x failed va %08x\n", penv->env_id,
+			curenv->env_id, penv->env_pager_va);
+		env_destroy(penv);
+		return 0;
+	}
+
+	if (((uintptr_t) srcva >= UTOP) || (((uintptr_t) srcva % PGSIZE) != 0)) {
+		return -E_INVAL;
+	}
+	if ( ((perm & PTE_U) == 0) || ((perm & PTE_P) == 0)
+			|| ((perm & ~(PTE_USER)) != 0) ) {
+		return -E_INVAL;
+	}
+	pp = page_lookup(curenv->env_pgdir, srcva, &ppte);
+	if (pp == NULL) {
+		return -E_INVAL;
+	}
+	if ( (perm & PTE_W) && ((*ppte & PTE_W) == 0) ) {
+		return -E_INVAL;
+	}
+
+	if (perm & PTE_W) {
+		rc = page_insert(penv->env_pgdir, pp,
+				(void *) penv->env_pager_va, perm);
+	} else {
+		rc = page_insert_shared(penv->env_pgdir, pp,
+				(void *) penv->env_pager_va, perm);
+	}
+	if (rc < 0) {
+		return rc;
+	}
+
+	pager_clear(penv);
+	penv->env_status = ENV_RUNNABLE;
+	return 0;
+}
+
 // Try to send 'value' to the target env 'envid'.
 // If srcva < UTOP, then also send page currently mapped at 'srcva',
 // so that receiver gets a duplicate mapping of the same page.
@@ -456,6 +661,7 @@ sys_ipc_try_send(envid_t envid, uint32_t value, void *srcva, unsigned perm)
 	//clog("wp1: %x: to = %x, to->ir = %d", curenv->env_id, penv->env_id,
 	//		penv->env_ipc_recving);
 	if (penv->env_ipc_recving != 1) {
+		trace(TE_SEND_BUSY, curenv->env_id, envid, value);
 		return -E_IPC_NOT_RECV;
 	}
 
@@ -463,6 +669,7 @@ sys_ipc_try_send(envid_t envid, uint32_t value, void *srcva, unsigned perm)
 	if ((va < UTOP) && (penv->env_ipc_dstva != NULL)) {
 		pp = page_lookup(curenv->env_pgdir, srcva, &ppte);
 		if (pp == NULL) {
+			pager_syscall_fault((uintptr_t) srcva);
 			return -E_INVAL;
 		}
 		assert(ppte != NULL);
@@ -479,11 +686,13 @@ sys_ipc_try_send(envid_t envid, uint32_t value, void *srcva, unsigned perm)
 		penv->env_ipc_perm = perm;
 	}
 
+	timer_cancel(penv);
 	penv->env_ipc_recving = 0;
 	penv->env_ipc_from = curenv->env_id;
 	penv->env_ipc_value = value;
 	penv->env_tf.tf_regs.reg_eax = 0;
 	penv->env_status = ENV_RUNNABLE;
+	trace(TE_SEND, curenv->env_id, penv->env_id, value);
 
 	return 0;
 }
@@ -495,12 +704,16 @@ sys_ipc_try_send(envid_t envid, uint32_t value, void *srcva, unsigned perm)
 // If 'dstva' is < UTOP, then you are willing to receive a page of data.
 // 'dstva' is the virtual address at which the sent page should be mapped.
 //
+// If 'deadline' is nonzero, give up at that time (in sys_time_msec()
+// units) if nothing has arrived.
+//
 // This function only returns on error, but the system call will eventually
 // return 0 on success.
 // Return < 0 on error.  Errors are:
 //	-E_INVAL if dstva < UTOP but dstva is not page-aligned.
+//	-E_TIMEOUT if the deadline passed first.
 static int
-sys_ipc_recv(void *dstva)
+sys_ipc_recv(void *dstva, unsigned deadline)
 {
 	// LAB 4: Your code here.
 	//panic("sys_ipc_recv not implemented");
@@ -516,14 +729,213 @@ sys_ipc_recv(void *dstva)
 	else {
 		curenv->env_ipc_dstva = NULL;
 	}
+	if (deadline && (int) (deadline - time_msec()) <= 0) {
+		return -E_TIMEOUT;
+	}
+	if (deadline) {
+		timer_add(curenv, deadline);
+	}
+	trace(TE_RECV, curenv->env_id, va, deadline);
 	curenv->env_ipc_recving = 1;
 	curenv->env_status = ENV_NOT_RUNNABLE;
+	// Wake senders waiting for us to receive (see ipc_send)
+	futex_wake_kva(&curenv->env_ipc_recving);
+	// A pager may have a fault waiting for it already
+	pager_recv(curenv);
 	//clog("wp1: %x: ir = %d", curenv->env_id, curenv->env_ipc_recving);
 	sys_yield();
 
 	return 0;
 }
 
+// Block until time 'msec' (in sys_time_msec() units, rounded up to the
+// next clock tick).  Returns 0 at once if that time has passed.
+static int
+sys_sleep_until(unsigned msec)
+{
+	if ((int) (msec - time_msec()) <= 0) {
+		return 0;
+	}
+	timer_add(curenv, msec);
+	curenv->env_tf.tf_regs.reg_eax = 0;
+	curenv->env_status = ENV_NOT_RUNNABLE;
+	sys_yield();
+
+	return 0;
+}
+
+// Sleep while the word at 'addr' holds 'val', until sys_futex_wake()
+// is called on the same word, in this or any env sharing its page, or
+// until time 'deadline' (0 for none) passes.
+// Returns 0 when woken.  Errors are:
+//	-E_AGAIN if *addr != val.
+//	-E_TIMEOUT if the deadline passed first.
+//	-E_INVAL, -E_FAULT if addr is misaligned or not mapped.
+static int
+sys_futex_wait(uint32_t *addr, uint32_t val, unsigned deadline)
+{
+	int r;
+
+	if ((r = futex_wait(curenv, (uintptr_t) addr, val, deadline)) < 0) {
+		return r;
+	}
+	sys_yield();
+
+	return 0;
+}
+
+// Wake up to 'n' envs sleeping on the word at 'addr'.
+// Returns the number woken, < 0 on error.
+static int
+sys_futex_wake(uint32_t *addr, int n)
+{
+	return futex_wake(curenv, (uintptr_t) addr, n);
+}
+
+// Start a thread: a new env running in the caller's address space, at
+// 'eip' with stack pointer 'esp', taking page faults on the exception
+// stack below 'xstacktop' and with %gs based at 'tls' (0 for none).
+// The thread is runnable at once; the caller has mapped its stacks.
+// Returns the thread's envid, < 0 on error.  Errors are:
+//	-E_INVAL if any of the addresses is above UTOP.
+//	-E_NO_FREE_ENV if no free environment is available.
+//	-E_NO_MEM on memory exhaustion.
+static envid_t
+sys_thread_create(uintptr_t eip, uintptr_t esp, uintptr_t xstacktop,
+		  uintptr_t tls)
+{
+	struct Env *e;
+	int r;
+
+	if (eip >= UTOP || esp > UTOP || xstacktop > UTOP
+	    || xstacktop < PGSIZE || tls >= UTOP) {
+		return -E_INVAL;
+	}
+	if ((r = env_alloc_thread(&e, curenv)) < 0) {
+		return r;
+	}
+	e->env_tf.tf_eip = eip;
+	e->env_tf.tf_esp = esp;
+	e->env_xstacktop = xstacktop;
+	e->env_tls = tls;
+
+	return e->env_id;
+}
+
+// Copy up to len bytes of console output to buf, starting at *pos
+// bytes into all the output there has been, or at the oldest the
+// kernel still keeps (CONSLOG_SIZE bytes' worth) if that is later.
+// Sets *pos past the last byte copied.
+// Returns the number of bytes copied.  Destroys the environment on
+// memory errors.
+static int
+sys_cons_log(uint32_t *upos, char *buf, size_t len)
+{
+	char kbuf[256];
+	uint32_t pos;
+	size_t n, tot = 0;
+
+	if (copyin(&pos, upos, sizeof(pos)) < 0) {
+		user_mem_fault(curenv);
+	}
+	while (tot < len
+	       && (n = cons_log_read(&pos, kbuf, MIN(len - tot, sizeof(kbuf)))) > 0) {
+		if (copyout(buf + tot, kbuf, n) < 0) {
+			user_mem_fault(curenv);
+		}
+		tot += n;
+	}
+	if (copyout(upos, &pos, sizeof(pos)) < 0) {
+		user_mem_fault(curenv);
+	}
+	return tot;
+}
+
+// Control the sampling profiler, or report samples (see inc/prof.h).
+// For PROF_REPORT and PROF_KREPORT, copies up to n entries, most
+// samples first, to ents and returns the number copied.
+// Returns 0 for the other commands, < 0 on error.  Errors are:
+//	-E_BAD_ENV if environment envid doesn't currently exist.
+//	-E_INVAL if cmd is not a command.
+// Destroys the environment on memory errors.
+static int
+sys_prof(int cmd, envid_t envid, struct ProfEntry *ents, size_t n)
+{
+	struct ProfEntry *tab;
+	struct Env *e = NULL;
+	int r;
+
+	switch (cmd) {
+	case PROF_START:
+		prof_start();
+		return 0;
+	case PROF_STOP:
+		prof_on = 0;
+		return 0;
+	case PROF_RESET:
+		prof_reset();
+		return 0;
+	case PROF_REPORT:
+		if ((r = envid2env(envid, &e, 0)) < 0) {
+			return r;
+		}
+		/* fall through */
+	case PROF_KREPORT:
+		r = prof_report(e, &tab);
+		n = MIN(n, (size_t) r);
+		if (copyout(ents, tab, n * sizeof(*tab)) < 0) {
+			user_mem_fault(curenv);
+		}
+		return n;
+	default:
+		return -E_INVAL;
+	}
+}
+
+// Control the event trace, or read it (see inc/trace.h).
+// TRACE_SETMASK enables the categories in mask only, and returns those
+// enabled before.  TRACE_READ copies up to n events, from *pos on or
+// the oldest still held, to ev, sets *pos past the last one copied,
+// and returns the number copied.  TRACE_CLEAR returns 0.
+// Returns -E_INVAL if cmd is not a command.
+// Destroys the environment on memory errors.
+static int
+sys_trace(int cmd, uint32_t mask, uint32_t *upos, struct TraceEvent *ev,
+	  size_t n)
+{
+	struct TraceEvent kev[16];
+	const size_t nkev = sizeof(kev) / sizeof(kev[0]);
+	uint32_t old, pos;
+	size_t m, tot = 0;
+
+	switch (cmd) {
+	case TRACE_SETMASK:
+		old = trace_mask;
+		trace_mask = mask & TRACE_ALL;
+		return old;
+	case TRACE_CLEAR:
+		trace_clear();
+		return 0;
+	case TRACE_READ:
+		if (copyin(&pos, upos, sizeof(pos)) < 0) {
+			user_mem_fault(curenv);
+		}
+		while (tot < n
+		       && (m = trace_read(&pos, kev, MIN(n - tot, nkev))) > 0) {
+			if (copyout(ev + tot, kev, m * sizeof(*kev)) < 0) {
+				user_mem_fault(curenv);
+			}
+			tot += m;
+		}
+		if (copyout(upos, &pos, sizeof(pos)) < 0) {
+			user_mem_fault(curenv);
+		}
+		return tot;
+	default:
+		return -E_INVAL;
+	}
+}
+
 // Return the current time.
 static int
 sys_time_msec(void) 
@@ -533,48 +945,93 @@ sys_time_msec(void)
 	return time_msec();
 }
 
+// Store the time since boot in nanoseconds in *nsec.
+// User code can compute the same from the page at UCLOCK without a
+// system call (see time_nsec() in lib/clock.c).
+static int
+sys_time_nsec(uint64_t *nsec)
+{
+	uint64_t now = time_nsec();
+
+	if (copyout(nsec, &now, sizeof(now)) < 0) {
+		user_mem_fault(curenv);
+	}
+	return 0;
+}
+
 // Get the network interface HW address.
 static int
 sys_net_get_hw_addr(void *buf, size_t len)
 {
+	uint8_t addr[HWADDR_LEN_82559ER];
+
 	if (len < HWADDR_LEN_82559ER) {
 		return -E_INVAL;
 	}
 	else if (len > HWADDR_LEN_82559ER) {
 		len = HWADDR_LEN_82559ER;
 	}
-	user_mem_assert(curenv, buf, len, PTE_U | PTE_W);
 
-	return e100_get_hw_addr(buf, len);
+	len = e100_get_hw_addr(addr, len);
+	if (copyout(buf, addr, len) < 0) {
+		user_mem_fault(curenv);
+	}
+	return len;
 }
 
 // Transmit a network packet.
+// If the transmit ring is full, the caller sleeps until the driver has
+// reclaimed a descriptor and then gets -E_NO_BUFS, to retry at once.
 static int
 sys_net_tx_pkt(const void *pkt_buf, size_t pkt_len)
 {
+	int r;
+
 	if (pkt_len > ETH_PKTSZ_MAX) {
 		return -E_INVAL;
 	}
 	user_mem_assert(curenv, pkt_buf, pkt_len, PTE_U);
 
-	return e100_tx_pkt(pkt_buf, pkt_len);
+	r = e100_tx_pkt(curenv->env_pgdir, pkt_buf, pkt_len);
+	if (r == -E_NO_BUFS) {
+		e100_tx_wait(curenv);
+		curenv->env_tf.tf_regs.reg_eax = r;
+		curenv->env_status = ENV_NOT_RUNNABLE;
+		sys_yield();
+	}
+
+	return r;
 }
 
 // Receive a network packet.
+// If none has arrived, the caller sleeps until one does and then gets
+// -E_NO_DATA, to retry at once.
 static int
 sys_net_rx_pkt(void *pkt_buf, size_t pkt_len)
 {
+	int r;
+
 	if (pkt_len > ETH_PKTSZ_MAX) {
 		return -E_INVAL;
 	}
-	user_mem_assert(curenv, pkt_buf, pkt_len, PTE_U | PTE_W);
+	r = e100_rx_pkt(pkt_buf, pkt_len);
+	if (r == -E_FAULT) {
+		user_mem_fault(curenv);
+	}
+	if (r == -E_NO_DATA) {
+		e100_rx_wait(curenv);
+		curenv->env_tf.tf_regs.reg_eax = r;
+		curenv->env_status = ENV_NOT_RUNNABLE;
+		sys_yield();
+	}
 
-	return e100_rx_pkt(pkt_buf, pkt_len);
+	return r;
 }
 
 // Dispatches to the correct kernel function, passing the arguments.
-int32_t
-syscall(uint32_t syscallno, uint32_t a1, uint32_t a2, uint32_t a3, uint32_t a4, uint32_t a5)
+static int32_t
+syscall_dispatch(uint32_t syscallno, uint32_t a1, uint32_t a2, uint32_t a3,
+		 uint32_t a4, uint32_t a5)
 {
 	// Call the function corresponding to the 'syscallno' parameter.
 	// Return any appropriate return value.
@@ -617,7 +1074,7 @@ syscall(uint32_t syscallno, uint32_t a1, uint32_t a2, uint32_t a3, uint32_t a4,
 			return (int32_t) sys_ipc_try_send((envid_t) a1, (uint32_t) a2,
 					(void *) a3, (unsigned) a4);
 		case SYS_ipc_recv:
-			return (int32_t) sys_ipc_recv((void *) a1);
+			return (int32_t) sys_ipc_recv((void *) a1, (unsigned) a2);
 		case SYS_time_msec:
 			return (int32_t) sys_time_msec();
 		case SYS_net_get_hw_addr:
@@ -626,6 +1083,38 @@ syscall(uint32_t syscallno, uint32_t a1, uint32_t a2, uint32_t a3, uint32_t a4,
 			return (int32_t) sys_net_tx_pkt((const void *) a1, (size_t) a2);
 		case SYS_net_rx_pkt:
 			return (int32_t) sys_net_rx_pkt((void *) a1, (size_t) a2);
+		case SYS_sleep_until:
+			return (int32_t) sys_sleep_until((unsigned) a1);
+		case SYS_time_nsec:
+			return (int32_t) sys_time_nsec((uint64_t *) a1);
+		case SYS_page_table_share:
+			return (int32_t) sys_page_table_share((envid_t) a1,
+					(void *) a2, (envid_t) a3);
+		case SYS_env_set_pager:
+			return (int32_t) sys_env_set_pager((envid_t) a1,
+					(envid_t) a2, (uintptr_t) a3, (uintptr_t) a4);
+		case SYS_pager_reply:
+			return (int32_t) sys_pager_reply((envid_t) a1,
+					(void *) a2, (int) a3);
+		case SYS_futex_wait:
+			return (int32_t) sys_futex_wait((uint32_t *) a1,
+					(uint32_t) a2, (unsigned) a3);
+		case SYS_futex_wake:
+			return (int32_t) sys_futex_wake((uint32_t *) a1,
+					(int) a2);
+		case SYS_thread_create:
+			return (int32_t) sys_thread_create((uintptr_t) a1,
+					(uintptr_t) a2, (uintptr_t) a3,
+					(uintptr_t) a4);
+		case SYS_cons_log:
+			return sys_cons_log((uint32_t *) a1, (char *) a2,
+					    (size_t) a3);
+		case SYS_prof:
+			return sys_prof((int) a1, (envid_t) a2,
+					(struct ProfEntry *) a3, (size_t) a4);
+		case SYS_trace:
+			return sys_trace((int) a1, (uint32_t) a2, (uint32_t *) a3,
+					 (struct TraceEvent *) a4, (size_t) a5);
 
 		default:
 			return (int32_t) -E_INVAL;
@@ -634,3 +1123,13 @@ syscall(uint32_t syscallno, uint32_t a1, uint32_t a2, uint32_t a3, uint32_t a4,
 	panic("syscall not implemented");
 }
 
+int32_t
+syscall(uint32_t syscallno, uint32_t a1, uint32_t a2, uint32_t a3, uint32_t a4, uint32_t a5)
+{
+	int32_t r;
+
+	kstat_syscall(syscallno);
+	r = syscall_dispatch(syscallno, a1, a2, a3, a4, a5);
+	kstat_syscall_done();
+	return r;
+}
@@ -1,26 +1,82 @@
-#include <kern/time.h>
+// System time, kept by the time stamp counter.
+//
+// The TSC is calibrated against the 8253's channel 2 at boot, so the
+// clock does not depend on timer interrupts arriving: the scheduler may
+// stop them altogether while the machine is idle (see kclock.c).
+
+#include <inc/x86.h>
 #include <inc/assert.h>
+#include <inc/isareg.h>
+#include <inc/timerreg.h>
+
+#include <kern/time.h>
+#include <kern/pmap.h>
+
+#define CPUID_TSC	(1 << 4)
+
+// Speaker/channel 2 gate control bits at IO_PPI
+#define PPI_GATE2	0x01
+#define PPI_SPEAKER	0x02
+#define PPI_OUT2	0x20
+
+#define CALIBRATE_MSEC	10
+
+union Clock_page clock_page __attribute__((aligned(PGSIZE)));
 
-static unsigned int ticks;
+// Count TSC cycles while channel 2 counts down CALIBRATE_MSEC.
+static uint64_t
+calibrate_tsc(void)
+{
+	unsigned count = TIMER_FREQ / (1000 / CALIBRATE_MSEC);
+	uint64_t t0, t1;
+
+	outb(IO_PPI, (inb(IO_PPI) & ~PPI_SPEAKER) | PPI_GATE2);
+	outb(TIMER_MODE, TIMER_SEL2 | TIMER_INTTC | TIMER_16BIT);
+	outb(TIMER_CNTR2, count % 256);
+	outb(TIMER_CNTR2, count / 256);
+	t0 = read_tsc();
+	while (!(inb(IO_PPI) & PPI_OUT2))
+		/* do nothing */;
+	t1 = read_tsc();
+	return t1 - t0;
+}
 
 void
 time_init(void) 
 {
-	ticks = 0;
+	struct Clock *c = &clock_page.cp_clock;
+	uint32_t edx;
+	uint64_t mult;
+
+	cpuid(1, NULL, NULL, NULL, &edx);
+	if (!(edx & CPUID_TSC))
+		panic("time_init: no time stamp counter");
+
+	c->c_tsc_khz = calibrate_tsc() / CALIBRATE_MSEC;
+	if (c->c_tsc_khz == 0)
+		panic("time_init: TSC calibration failed");
+
+	// Largest shift whose multiplier still fits in 32 bits
+	for (c->c_shift = 32; c->c_shift > 0; c->c_shift--) {
+		mult = (1000000ULL << c->c_shift) / c->c_tsc_khz;
+		if (mult <= 0xffffffff)
+			break;
+	}
+	c->c_mult = mult;
+	c->c_tsc_base = read_tsc();
+
+	cprintf("TSC: %u.%03u MHz\n", c->c_tsc_khz / 1000,
+		c->c_tsc_khz % 1000);
 }
 
-// This should be called once per timer interrupt.  A timer interrupt
-// fires every 10 ms.
-void
-time_tick(void) 
+uint64_t
+time_nsec(void)
 {
-	ticks++;
-	if (ticks * 10 < ticks)
-		panic("time_tick: time overflowed");
+	return clock_nsec(&clock_page.cp_clock);
 }
 
 unsigned int
 time_msec(void) 
 {
-	return ticks * 10;
+	return time_nsec() / 1000000;
 }
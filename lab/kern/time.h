@@ -4,8 +4,18 @@
 # error "This is a JOS kernel header; user programs should not #include it"
 #endif
 
+#include <inc/clock.h>
+#include <inc/mmu.h>
+
+// The clock parameters, alone in the page mapped at UCLOCK
+union Clock_page {
+	struct Clock cp_clock;
+	char cp_pad[PGSIZE];
+};
+extern union Clock_page clock_page;
+
 void time_init(void);
-void time_tick(void); 
+uint64_t time_nsec(void);
 unsigned int time_msec(void);
 
 #endif /* JOS_KERN_TIME_H */
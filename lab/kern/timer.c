@@ -0,0 +1,116 @@
+// Per-environment timeouts, kept in a hashed timer wheel.
+//
+// An environment blocked in sys_sleep_until(), or in sys_ipc_recv()
+// or sys_futex_wait() with a deadline sits in the wheel slot of the clock tick its deadline
+// falls on, and is not runnable until the deadline passes or (for
+// the others) a message or wakeup arrives.  Each clock interrupt only looks at
+// the one slot for the current tick; entries due in a later turn of
+// the wheel stay where they are.
+
+#include <inc/error.h>
+#include <inc/assert.h>
+
+#include <kern/env.h>
+#include <kern/time.h>
+#include <kern/timer.h>
+#include <kern/futex.h>
+
+static struct Env_list timer_wheel[TIMER_WHEEL_SIZE];
+static unsigned timer_last;	// last tick whose slot was run
+static int timer_count;		// environments in the wheel
+
+void
+timer_init(void)
+{
+	int i;
+
+	for (i = 0; i < TIMER_WHEEL_SIZE; i++)
+		LIST_INIT(&timer_wheel[i]);
+	timer_last = time_msec() / TIMER_TICK_MSEC;
+}
+
+// Make 'e' runnable again at time 'msec' (rounded up to a tick).
+// Replaces any timer 'e' already had.
+void
+timer_add(struct Env *e, unsigned msec)
+{
+	unsigned tick = (msec + TIMER_TICK_MSEC - 1) / TIMER_TICK_MSEC;
+
+	timer_cancel(e);
+	e->env_timer_expire = tick;
+	timer_count++;
+	LIST_INSERT_HEAD(&timer_wheel[tick % TIMER_WHEEL_SIZE], e,
+			 env_timer_link);
+}
+
+void
+timer_cancel(struct Env *e)
+{
+	if (!e->env_timer_expire)
+		return;
+	LIST_REMOVE(e, env_timer_link);
+	e->env_timer_expire = 0;
+	timer_count--;
+}
+
+// Return the number of environments waiting for a timer.
+int
+timer_pending(void)
+{
+	return timer_count;
+}
+
+// Return the time in nsec at which the earliest timer is due, 0 if
+// none is set.  Only used when idle, so a scan of the wheel is fine.
+uint64_t
+timer_next(void)
+{
+	struct Env *e;
+	unsigned next = 0;
+	int i;
+
+	if (!timer_count)
+		return 0;
+	for (i = 0; i < TIMER_WHEEL_SIZE; i++)
+		LIST_FOREACH(e, &timer_wheel[i], env_timer_link)
+			if (!next || (int) (e->env_timer_expire - next) < 0)
+				next = e->env_timer_expire;
+	return (uint64_t) next * TIMER_TICK_MSEC * 1000000;
+}
+
+// The deadline of 'e' has passed.
+static void
+timer_expire(struct Env *e)
+{
+	timer_cancel(e);
+	if (e->env_ipc_recving) {
+		e->env_ipc_recving = 0;
+		e->env_tf.tf_regs.reg_eax = -E_TIMEOUT;
+	}
+	if (e->env_futex_pa) {
+		futex_cancel(e);
+		e->env_tf.tf_regs.reg_eax = -E_TIMEOUT;
+	}
+	e->env_status = ENV_RUNNABLE;
+}
+
+// Called on every clock interrupt.  Runs the slots of all ticks since
+// the last call, so a late call only delays the wakeups.
+void
+timer_tick(void)
+{
+	unsigned now = time_msec() / TIMER_TICK_MSEC;
+	struct Env *e, *next;
+	unsigned t;
+
+	if (now - timer_last > TIMER_WHEEL_SIZE)
+		timer_last = now - TIMER_WHEEL_SIZE;
+	for (t = timer_last + 1; (int) (t - now) <= 0; t++)
+		for (e = LIST_FIRST(&timer_wheel[t % TIMER_WHEEL_SIZE]);
+		     e; e = next) {
+			next = LIST_NEXT(e, env_timer_link);
+			if ((int) (e->env_timer_expire - now) <= 0)
+				timer_expire(e);
+		}
+	timer_last = now;
+}
@@ -0,0 +1,22 @@
+#ifndef JOS_KERN_TIMER_H
+#define JOS_KERN_TIMER_H
+#ifndef JOS_KERNEL
+# error "This is a JOS kernel header; user programs should not #include it"
+#endif
+
+#include <inc/env.h>
+
+// Timer resolution: one clock interrupt
+#define TIMER_TICK_MSEC		10
+
+// Wheel slots; a power of two
+#define TIMER_WHEEL_SIZE	64
+
+void timer_init(void);
+void timer_add(struct Env *e, unsigned msec);
+void timer_cancel(struct Env *e);
+void timer_tick(void);
+int timer_pending(void);
+uint64_t timer_next(void);
+
+#endif /* JOS_KERN_TIMER_H */
@@ -0,0 +1,74 @@
+// Event trace.
+//
+// Events go into a ring of the last TRACE_NEVENTS, with no lock: the
+// kernel records them only with interrupts off, and on its one CPU,
+// so nothing else touches the ring meanwhile.  Readers go by position,
+// the count of events ever recorded, as with the console log, and so
+// never hold up the kernel; one that falls more than a ringful behind
+// skips what was overwritten.
+
+#include <inc/x86.h>
+#include <inc/string.h>
+#include <inc/assert.h>
+
+#include <kern/trace.h>
+
+#define TRACEMASK	(TRACE_NEVENTS - 1)
+
+uint32_t trace_mask;
+
+static struct TraceEvent trace_ring[TRACE_NEVENTS];
+static uint32_t trace_wpos;	// events ever recorded
+static uint32_t trace_start;	// the first not cleared
+
+void
+trace_add(uint32_t type, uint32_t env, uint32_t arg0, uint32_t arg1)
+{
+	struct TraceEvent *te = &trace_ring[trace_wpos & TRACEMASK];
+
+	static_assert((TRACE_NEVENTS & TRACEMASK) == 0);
+
+	te->te_tsc = read_tsc();
+	te->te_type = type;
+	te->te_env = env;
+	te->te_arg[0] = arg0;
+	te->te_arg[1] = arg1;
+	trace_wpos++;
+}
+
+// Drop the events recorded so far.
+void
+trace_clear(void)
+{
+	trace_start = trace_wpos;
+}
+
+// Copy to ev up to n events from *pos on, or from the oldest still
+// held if that is later, and set *pos past the last one copied.
+// Returns the number of events copied.
+size_t
+trace_read(uint32_t *pos, struct TraceEvent *ev, size_t n)
+{
+	uint32_t p = *pos, first = trace_start;
+	size_t i;
+
+	if (trace_wpos - first > TRACE_NEVENTS)
+		first = trace_wpos - TRACE_NEVENTS;
+	if ((int32_t) (trace_wpos - p) < 0)
+		return 0;
+	if ((int32_t) (p - first) < 0)
+		p = first;
+	n = MIN(n, trace_wpos - p);
+	for (i = 0; i < n; i++)
+		ev[i] = trace_ring[p++ & TRACEMASK];
+	*pos = p;
+	return n;
+}
+
+// The events the ring holds, and those recorded since boot.
+void
+trace_counts(uint32_t *held, uint32_t *total)
+{
+	*held = MIN(trace_wpos - trace_start, TRACE_NEVENTS);
+	*total = trace_wpos;
+}
@@ -0,0 +1,24 @@
+#ifndef JOS_KERN_TRACE_H
+#define JOS_KERN_TRACE_H
+#ifndef JOS_KERNEL
+# error "This is a JOS kernel header; user programs should not #include it"
+#endif
+
+#include <inc/trace.h>
+
+extern uint32_t trace_mask;
+
+void trace_add(uint32_t type, uint32_t env, uint32_t arg0, uint32_t arg1);
+void trace_clear(void);
+size_t trace_read(uint32_t *pos, struct TraceEvent *ev, size_t n);
+void trace_counts(uint32_t *held, uint32_t *total);
+
+// Record an event, if its category is enabled.
+static inline void
+trace(uint32_t type, uint32_t env, uint32_t arg0, uint32_t arg1)
+{
+	if (trace_mask & TRACE_CAT(type))
+		trace_add(type, env, arg0, arg1);
+}
+
+#endif /* JOS_KERN_TRACE_H */
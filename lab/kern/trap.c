@@ -14,7 +14,13 @@
 #include <kern/kclock.h>
 #include <kern/picirq.h>
 #include <kern/time.h>
+#include <kern/timer.h>
+#include <kern/pager.h>
+#include <kern/fpu.h>
 #include <kern/e100.h>
+#include <kern/prof.h>
+#include <kern/kstat.h>
+#include <kern/trace.h>
 
 static struct Taskstate ts;
 
@@ -221,6 +227,11 @@ trap_dispatch(struct Trapframe *tf)
 					tf->tf_regs.reg_edi, tf->tf_regs.reg_esi);
 			tf->tf_regs.reg_eax = sc_ret;
 			return;
+		case T_DEVICE:
+			if ((tf->tf_cs & 3) == 0)
+				break;
+			fpu_trap();
+			return;
 
 		default:
 			break;
@@ -233,7 +244,14 @@ trap_dispatch(struct Trapframe *tf)
 	// LAB 6: Your code here.
 	switch (tf->tf_trapno) {
 		case (IRQ_OFFSET + IRQ_TIMER):
-			time_tick();
+			prof_sample(tf);
+			timer_tick();
+			// In case a CNA or FR interrupt went missing
+			e100_tx_wakeup();
+			e100_rx_wakeup();
+			// Without a serial port, no interrupt drains the
+			// console log
+			cons_drain(CONS_BURST);
 			sched_yield();
 			return;
 		case (IRQ_OFFSET + IRQ_KBD):
@@ -250,7 +268,8 @@ trap_dispatch(struct Trapframe *tf)
 	}
 
 	if (tf->tf_trapno == (IRQ_OFFSET + e100_irq_line)) {
-		cprintf("E100 interrupt on irq %d\n", e100_irq_line);
+		//cprintf("E100 interrupt on irq %d\n", e100_irq_line);
+		e100_intr();
 		return;
 	}
 
@@ -289,6 +308,12 @@ trap(struct Trapframe *tf)
 	// the interrupt path.
 	assert(!(read_eflags() & FL_IF));
 
+	kstat_trap(tf->tf_trapno);
+	if (tf->tf_trapno >= IRQ_OFFSET && tf->tf_trapno < IRQ_OFFSET + 16)
+		trace(tf->tf_trapno == IRQ_OFFSET + IRQ_TIMER ? TE_CLOCK : TE_IRQ,
+		      (tf->tf_cs & 3) && curenv ? curenv->env_id : 0,
+		      tf->tf_trapno - IRQ_OFFSET, tf->tf_eip);
+
 	if ((tf->tf_cs & 3) == 3) {
 		// Trapped from user mode.
 		// Copy trap frame (which is currently on the stack)
@@ -333,10 +358,17 @@ page_fault_handler(struct Trapframe *tf)
 
 	// We've already handled kernel-mode exceptions, so if we get here,
 	// the page fault happened in user mode.
+	trace(TE_PGFLT, curenv->env_id, fault_va, tf->tf_eip);
+
+	// A page of a demand-paged image that is not in yet goes to the
+	// pager; this does not return if there is one.
+	if (!(tf->tf_err & FEC_PR))
+		pager_fault(curenv, fault_va);
 
 	// Call the environment's page fault upcall, if one exists.  Set up a
 	// page fault stack frame on the user exception stack (below
-	// UXSTACKTOP), then branch to curenv->env_pgfault_upcall.
+	// UXSTACKTOP, or the thread's own env_xstacktop), then branch to
+	// curenv->env_pgfault_upcall.
 	//
 	// The page fault upcall might cause another page fault, in which case
 	// we branch to the page fault upcall recursively, pushing another
@@ -373,8 +405,8 @@ page_fault_handler(struct Trapframe *tf)
 
 		// NOTE: since PF happened in user mode, CR3 should already have the
 		// corres. env's PD loaded, hence no need to do explicit lcr3().
-		if ( ((UXSTACKTOP - PGSIZE) <= tf->tf_esp)
-				&& (tf->tf_esp < UXSTACKTOP) ) {
+		if ( ((curenv->env_xstacktop - PGSIZE) <= tf->tf_esp)
+				&& (tf->tf_esp < curenv->env_xstacktop) ) {
 			va = (void *) (tf->tf_esp - sizeof(utf) - 4);
 			//clog("wp1: va = %p, fault_va = %p, err = 0x%x, esp = %p, eip = %p",
 			//		va, fault_va, tf->tf_err, tf->tf_esp, tf->tf_eip);
@@ -384,7 +416,7 @@ page_fault_handler(struct Trapframe *tf)
 			memset(va + sizeof(utf), 0, 4);
 		}
 		else {
-			va = (void *) (UXSTACKTOP - sizeof(utf));
+			va = (void *) (curenv->env_xstacktop - sizeof(utf));
 			//clog("wp2: va = %p, fault_va = %p, err = 0x%x, esp = %p, eip = %p",
 			//		va, fault_va, tf->tf_err, tf->tf_esp, tf->tf_eip);
 			user_mem_assert(curenv, va, sizeof(utf), PTE_W | PTE_U);
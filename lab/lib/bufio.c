@@ -0,0 +1,419 @@
+// Buffered I/O on file descriptors.
+//
+// A FILE collects reads and writes in a page-sized buffer, the most
+// the file server moves per request, so that a program reading or
+// printing a little at a time makes one IPC or system call per page
+// rather than per call.  Output goes out when the buffer fills, and
+// also at every newline for a line-buffered FILE, or at the end of
+// every call for an unbuffered one (setvbuf).  stdout is line buffered
+// on the console and fully buffered otherwise; stderr is unbuffered.
+//
+// A FILE either reads ("r") or writes ("w", "a"), never both.  exit()
+// flushes every open FILE; a program that ends any other way loses
+// what is still buffered.
+
+#include <inc/lib.h>
+
+#define F_READ		0x1	// opened for reading
+#define F_WRITE		0x2	// opened for writing
+#define F_EOF		0x4	// a read returned end of file
+#define F_ERR		0x8	// a read or write failed
+#define F_MALLOC	0x10	// free the FILE on fclose
+
+static FILE std_err = {
+	.f_fd = 2, .f_flags = F_WRITE, .f_mode = _IONBF,
+	.f_buf = std_err.f_ibuf, .f_bufsize = BUFSIZ
+};
+static FILE std_out = {
+	.f_fd = 1, .f_flags = F_WRITE, .f_mode = -1,
+	.f_buf = std_out.f_ibuf, .f_bufsize = BUFSIZ, .f_next = &std_err
+};
+static FILE std_in = {
+	.f_fd = 0, .f_flags = F_READ, .f_mode = _IOFBF,
+	.f_buf = std_in.f_ibuf, .f_bufsize = BUFSIZ, .f_next = &std_out
+};
+
+FILE *stdin = &std_in;
+FILE *stdout = &std_out;
+FILE *stderr = &std_err;
+
+// All open FILEs, for fflush(NULL)
+static FILE *files = &std_in;
+
+static void
+fsetup(FILE *f)
+{
+	if (f->f_mode < 0)
+		f->f_mode = iscons(f->f_fd) > 0 ? _IOLBF : _IOFBF;
+}
+
+// Refill f's empty input buffer, reading no more than want bytes if
+// f is unbuffered.  Returns what read() did.
+static ssize_t
+ffill(FILE *f, size_t want)
+{
+	ssize_t r;
+
+	// Show any prompt before waiting for input
+	if (f != stdout && stdout->f_mode == _IOLBF)
+		fflush(stdout);
+
+	fsetup(f);
+	r = read(f->f_fd, f->f_buf,
+		 f->f_mode == _IONBF ? MIN(want, f->f_bufsize) : f->f_bufsize);
+	f->f_pos = 0;
+	f->f_len = r > 0 ? r : 0;
+	if (r == 0)
+		f->f_flags |= F_EOF;
+	else if (r < 0)
+		f->f_flags |= F_ERR;
+	return r;
+}
+
+// Write out f's buffered output.  Returns 0 on success, < 0 on error,
+// when the output is dropped.
+static int
+fdrain(FILE *f)
+{
+	size_t done;
+	ssize_t r;
+
+	for (done = 0; done < f->f_pos; done += r)
+		if ((r = write(f->f_fd, f->f_buf + done, f->f_pos - done)) <= 0) {
+			f->f_flags |= F_ERR;
+			f->f_pos = 0;
+			return r < 0 ? r : -E_EOF;
+		}
+	f->f_pos = 0;
+	return 0;
+}
+
+// Add n bytes to f's output buffer, writing it out as it fills.
+// Returns the number of bytes taken.
+static size_t
+fbuffer(FILE *f, const char *p, size_t n)
+{
+	size_t done = 0, m;
+	ssize_t r;
+
+	while (done < n) {
+		if (f->f_pos == f->f_bufsize && fdrain(f) < 0)
+			break;
+		// Skip the copy for whole buffers' worth
+		if (f->f_pos == 0 && n - done >= f->f_bufsize) {
+			if ((r = write(f->f_fd, p + done, n - done)) <= 0) {
+				f->f_flags |= F_ERR;
+				break;
+			}
+			done += r;
+			continue;
+		}
+		m = MIN(n - done, f->f_bufsize - f->f_pos);
+		memmove(f->f_buf + f->f_pos, p + done, m);
+		f->f_pos += m;
+		done += m;
+	}
+	return done;
+}
+
+// Write out what f's buffering policy says must not wait, given
+// whether the output just added had a newline.
+static void
+fpolicy(FILE *f, bool newline)
+{
+	if (f->f_mode == _IONBF || (f->f_mode == _IOLBF && newline))
+		fdrain(f);
+}
+
+static FILE *
+fnew(int fd, const char *mode)
+{
+	FILE *f;
+
+	if ((f = malloc(sizeof(FILE))) == NULL)
+		return NULL;
+	memset(f, 0, offsetof(FILE, f_ibuf));
+	f->f_fd = fd;
+	f->f_flags = (mode[0] == 'r' ? F_READ : F_WRITE) | F_MALLOC;
+	f->f_mode = _IOFBF;
+	f->f_buf = f->f_ibuf;
+	f->f_bufsize = BUFSIZ;
+	f->f_next = files;
+	files = f;
+	return f;
+}
+
+static int
+fmode(const char *mode)
+{
+	if (strchr(mode, '+'))
+		return -E_INVAL;
+	switch (mode[0]) {
+	case 'r':
+		return O_RDONLY;
+	case 'w':
+		return O_WRONLY | O_CREAT | O_TRUNC;
+	case 'a':
+		return O_WRONLY | O_CREAT;
+	default:
+		return -E_INVAL;
+	}
+}
+
+// Open path for reading ("r"), writing from empty ("w") or writing at
+// the end ("a").  Read-and-write modes are not supported.
+// Returns NULL on error.
+FILE *
+fopen(const char *path, const char *mode)
+{
+	struct Stat st;
+	FILE *f;
+	int fd, omode;
+
+	if ((omode = fmode(mode)) < 0)
+		return NULL;
+	if ((fd = open(path, omode)) < 0)
+		return NULL;
+	if (mode[0] == 'a'
+	    && (fstat(fd, &st) < 0 || seek(fd, st.st_size) < 0))
+		goto fail;
+	if ((f = fnew(fd, mode)) == NULL)
+		goto fail;
+	return f;
+
+fail:
+	close(fd);
+	return NULL;
+}
+
+// Wrap the open descriptor fd, which fclose() closes.
+FILE *
+fdopen(int fd, const char *mode)
+{
+	if (fmode(mode) < 0)
+		return NULL;
+	return fnew(fd, mode);
+}
+
+int
+fclose(FILE *f)
+{
+	FILE **fp;
+	int r = fflush(f);
+
+	if (close(f->f_fd) < 0)
+		r = EOF;
+	for (fp = &files; *fp; fp = &(*fp)->f_next)
+		if (*fp == f) {
+			*fp = f->f_next;
+			break;
+		}
+	if (f->f_flags & F_MALLOC)
+		free(f);
+	return r;
+}
+
+// Write out f's buffered output, or every FILE's if f is NULL.
+// Input still buffered is kept.
+int
+fflush(FILE *f)
+{
+	int r = 0;
+
+	if (f == NULL) {
+		for (f = files; f; f = f->f_next)
+			if (fflush(f) < 0)
+				r = EOF;
+		return r;
+	}
+	if ((f->f_flags & F_WRITE) && f->f_pos > 0 && fdrain(f) < 0)
+		return EOF;
+	return 0;
+}
+
+// Set f's buffering policy, and buffer unless buf is NULL.
+// Only allowed before f is first read or written.
+int
+setvbuf(FILE *f, char *buf, int mode, size_t size)
+{
+	if (f->f_pos > 0 || f->f_len > 0
+	    || mode < _IOFBF || mode > _IONBF)
+		return -E_INVAL;
+	f->f_mode = mode;
+	if (buf && size > 0) {
+		f->f_buf = buf;
+		f->f_bufsize = size;
+	}
+	return 0;
+}
+
+size_t
+fread(void *buf, size_t size, size_t n, FILE *f)
+{
+	char *p = buf;
+	size_t want = size * n, done = 0, m;
+	ssize_t r;
+
+	if (!(f->f_flags & F_READ) || want == 0)
+		return 0;
+	while (done < want) {
+		if (f->f_pos == f->f_len) {
+			// Read whole buffers' worth straight into buf
+			if (want - done >= f->f_bufsize) {
+				if ((r = read(f->f_fd, p + done, want - done)) <= 0) {
+					f->f_flags |= r < 0 ? F_ERR : F_EOF;
+					break;
+				}
+				done += r;
+				continue;
+			}
+			if (ffill(f, want - done) <= 0)
+				break;
+		}
+		m = MIN(want - done, f->f_len - f->f_pos);
+		memmove(p + done, f->f_buf + f->f_pos, m);
+		f->f_pos += m;
+		done += m;
+	}
+	return done / size;
+}
+
+size_t
+fwrite(const void *buf, size_t size, size_t n, FILE *f)
+{
+	size_t want = size * n, done;
+
+	if (!(f->f_flags & F_WRITE) || want == 0)
+		return 0;
+	fsetup(f);
+	done = fbuffer(f, buf, want);
+	fpolicy(f, memfind(buf, '\n', done) != (const char *) buf + done);
+	return done / size;
+}
+
+int
+fgetc(FILE *f)
+{
+	if (!(f->f_flags & F_READ))
+		return EOF;
+	if (f->f_pos == f->f_len && ffill(f, 1) <= 0)
+		return EOF;
+	return (unsigned char) f->f_buf[f->f_pos++];
+}
+
+// Read up to and including a newline, or size - 1 bytes, into s and
+// null-terminate it.  Returns NULL if nothing was read.
+char *
+fgets(char *s, int size, FILE *f)
+{
+	char *start, *nl;
+	int i = 0;
+	size_t m;
+
+	if (!(f->f_flags & F_READ) || size <= 0)
+		return NULL;
+	while (i < size - 1) {
+		if (f->f_pos == f->f_len && ffill(f, size - 1 - i) <= 0)
+			break;
+		start = f->f_buf + f->f_pos;
+		m = MIN(size - 1 - i, f->f_len - f->f_pos);
+		nl = memfind(start, '\n', m);
+		if (nl < start + m)
+			m = nl - start + 1;
+		memmove(s + i, start, m);
+		f->f_pos += m;
+		i += m;
+		if (s[i - 1] == '\n')
+			break;
+	}
+	if (i == 0)
+		return NULL;
+	s[i] = 0;
+	return s;
+}
+
+int
+fputc(int c, FILE *f)
+{
+	char ch = c;
+
+	if (fwrite(&ch, 1, 1, f) != 1)
+		return EOF;
+	return (unsigned char) ch;
+}
+
+int
+fputs(const char *s, FILE *f)
+{
+	size_t n = strlen(s);
+
+	if (fwrite(s, 1, n, f) != n)
+		return EOF;
+	return 0;
+}
+
+struct bprintbuf {
+	FILE *f;
+	int cnt;	// bytes printed so far
+	bool newline;	// whether any was a newline
+};
+
+static void
+bputch(int ch, void *thunk)
+{
+	struct bprintbuf *b = thunk;
+	char c = ch;
+
+	if (fbuffer(b->f, &c, 1) == 1)
+		b->cnt++;
+	if (c == '\n')
+		b->newline = 1;
+}
+
+// Like fprintf, but into f's buffer.
+int
+vbprintf(FILE *f, const char *fmt, va_list ap)
+{
+	struct bprintbuf b;
+
+	if (!(f->f_flags & F_WRITE))
+		return -E_INVAL;
+	fsetup(f);
+	b.f = f;
+	b.cnt = 0;
+	b.newline = 0;
+	vprintfmt(bputch, &b, fmt, ap);
+	fpolicy(f, b.newline);
+	return (f->f_flags & F_ERR) && b.cnt == 0 ? EOF : b.cnt;
+}
+
+int
+bprintf(FILE *f, const char *fmt, ...)
+{
+	va_list ap;
+	int cnt;
+
+	va_start(ap, fmt);
+	cnt = vbprintf(f, fmt, ap);
+	va_end(ap);
+
+	return cnt;
+}
+
+int
+feof(FILE *f)
+{
+	return (f->f_flags & F_EOF) != 0;
+}
+
+int
+ferror(FILE *f)
+{
+	return (f->f_flags & F_ERR) != 0;
+}
+
+int
+fileno(FILE *f)
+{
+	return f->f_fd;
+}
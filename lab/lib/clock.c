@@ -0,0 +1,11 @@
+#include <inc/lib.h>
+#include <inc/clock.h>
+
+// Return the time since boot in nanoseconds.  This reads the TSC and
+// the kernel's calibration in the page at UCLOCK, with no system call,
+// so it is cheap enough to time short stretches of code.
+uint64_t
+time_nsec(void)
+{
+	return clock_nsec((const volatile struct Clock *) UCLOCK);
+}
@@ -96,19 +96,11 @@ devcons_read(struct Fd *fd, void *vbuf, size_t n)
 static ssize_t
 devcons_write(struct Fd *fd, const void *vbuf, size_t n)
 {
-	int tot, m;
-	char buf[128];
-
-	// mistake: have to nul-terminate arg to sys_cputs, 
-	// so we have to copy vbuf into buf in chunks and nul-terminate.
-	for (tot = 0; tot < n; tot += m) {
-		m = n - tot;
-		if (m > sizeof(buf) - 1)
-			m = sizeof(buf) - 1;
-		memmove(buf, (char*)vbuf + tot, m);
-		sys_cputs(buf, m);
-	}
-	return tot;
+	USED(fd);
+
+	// sys_cputs takes a length, so the whole buffer goes in one call
+	sys_cputs(vbuf, n);
+	return n;
 }
 
 static int
@@ -4,8 +4,7 @@
 
 // Maximum number of file descriptors a program may hold open concurrently
 #define MAXFD		32
-// Bottom of file descriptor area
-#define FDTABLE		0xD0000000
+// Bottom of file descriptor area is FDTABLE (inc/memlayout.h).
 // Bottom of file data area.  We reserve one data page for each FD,
 // which devices can use if they choose.
 #define FILEDATA	(FDTABLE + MAXFD*PGSIZE)
@@ -303,6 +302,7 @@ fstat(int fdnum, struct Stat *stat)
 	stat->st_name[0] = 0;
 	stat->st_size = 0;
 	stat->st_isdir = 0;
+	stat->st_gen = 0;
 	stat->st_dev = dev;
 	return (*dev->dev_stat)(fd, stat);
 }
@@ -174,6 +174,7 @@ devfile_stat(struct Fd *fd, struct Stat *st)
 	strcpy(st->st_name, fsipcbuf.statRet.ret_name);
 	st->st_size = fsipcbuf.statRet.ret_size;
 	st->st_isdir = fsipcbuf.statRet.ret_isdir;
+	st->st_gen = fsipcbuf.statRet.ret_gen;
 	return 0;
 }
 
@@ -206,3 +207,40 @@ sync(void)
 	return fsipc(FSREQ_SYNC, NULL);
 }
 
+
+// Return a pointer to the file server's modification generation,
+// which changes whenever any file is created, written, truncated or
+// removed.  The page is shared read-only, so once mapped the counter
+// can be polled without an IPC.  Returns NULL if it cannot be mapped.
+const volatile uint32_t *
+fs_generation(void)
+{
+	if (!(vpd[PDX(FSGENVA)] & PTE_P) || !(vpt[VPN(FSGENVA)] & PTE_P))
+		if (fsipc(FSREQ_GEN, (void *) FSGENVA) < 0)
+			return NULL;
+	return (const volatile uint32_t *) FSGENVA;
+}
+
+// Have the file server page in [va, va + len) of env 'envid' on demand
+// from the open file 'fdnum', starting at file offset 'offset', by
+// mapping its block cache pages read-only.  va and offset must be
+// page-aligned.  envid must be our child, with the file server as its
+// pager for the range (see sys_env_set_pager).
+int
+file_pager(int fdnum, envid_t envid, uintptr_t va, size_t len, off_t offset)
+{
+	struct Fd *fd;
+	int r;
+
+	if ((r = fd_lookup(fdnum, &fd)) < 0)
+		return r;
+	if (fd->fd_dev_id != devfile.dev_id)
+		return -E_INVAL;
+
+	fsipcbuf.pager.req_fileid = fd->fd_file.id;
+	fsipcbuf.pager.req_envid = envid;
+	fsipcbuf.pager.req_va = va;
+	fsipcbuf.pager.req_len = len;
+	fsipcbuf.pager.req_offset = offset;
+	return fsipc(FSREQ_PAGER, NULL);
+}
@@ -48,7 +48,7 @@ pgfault(struct UTrapframe *utf)
 	if (r < 0) {
 		panic("pgfault: sys_page_alloc FAILED: %e", r);
 	}
-	memmove(PFTEMP, addr, PGSIZE);
+	pagecopy(PFTEMP, addr);
 	r = sys_page_map(0, PFTEMP, 0, addr, PTE_W | PTE_U | PTE_P);
 	if (r < 0) {
 		panic("pgfault: sys_page_map FAILED: %e", r);
@@ -109,6 +109,68 @@ duppage(envid_t envid, unsigned pn)
 	return 0;
 }
 
+//
+// Give the child the 4MB page at 'addr'.  Shared and read-only ones
+// are mapped whole.  A private writable one is split into 4KB pages
+// instead, by remapping one of them in place, so the caller can go on
+// to make it copy-on-write page by page.
+// Returns 1 if the whole 4MB has been dealt with, 0 if the caller
+// should go on page by page.
+//
+static int
+duplargepage(envid_t envid, void *addr, pde_t pde)
+{
+	int r;
+
+	if ((pde & PTE_SHARE) || !(pde & PTE_W)) {
+		r = sys_page_map(0, addr, envid, addr, (pde & PTE_USER) | PTE_PS);
+		if (r < 0) {
+			panic("duplargepage: sys_page_map FAILED: %e", r);
+		}
+		return 1;
+	}
+	r = sys_page_map(0, addr, 0, addr, pde & PTE_USER);
+	if (r < 0) {
+		panic("duplargepage: sys_page_map FAILED: %e", r);
+	}
+	return 0;
+}
+
+//
+// Give the child the page table for the 4MB at 'addr', shared with ours
+// until either of us changes a mapping in it (the kernel then copies
+// it).  Our private writable pages there go copy-on-write first, as in
+// duppage.  The exception stacks are left writable: the child gets its
+// own before it ever runs, which unshares the table on its side, and
+// new pages for any threads it starts.
+//
+static void
+duppagetable(envid_t envid, void *addr)
+{
+	unsigned pn;
+	pte_t pte;
+	int r;
+
+	for (pn = VPN(addr); pn < VPN(addr + PTSIZE); pn++) {
+		pte = vpt[pn];
+		if ((pte & (PTE_SHARE | PTE_W)) != PTE_W
+		    || pn == VPN(UXSTACKTOP - PGSIZE)
+		    || thr_isxstack(pn * PGSIZE)) {
+			continue;
+		}
+		r = sys_page_map(0, (void *) (pn * PGSIZE), 0,
+				(void *) (pn * PGSIZE), PTE_COW | PTE_U | PTE_P);
+		if (r < 0) {
+			panic("duppagetable: sys_page_map FAILED: %e", r);
+		}
+	}
+
+	r = sys_page_table_share(0, addr, envid);
+	if (r < 0) {
+		panic("duppagetable: sys_page_table_share FAILED: %e", r);
+	}
+}
+
 //
 // User-level fork with copy-on-write.
 // Set up our page fault handler appropriately.
@@ -134,7 +196,6 @@ fork(void)
 	void *addr;
 	int r;
 	pde_t pde;
-	pte_t pte;
 
 	set_pgfault_handler(pgfault);
 	//clog("wp1: vpt = %p, vpd = %p", vpt, vpd);
@@ -147,28 +208,24 @@ fork(void)
 	if (envid == 0) {
 		// Child process, fix "env"
 		env = &envs[ENVX(sys_getenvid())];
+		thr_forkchild();
 		return 0;
 	}
 
-	for (addr = (void *) UTEXT; (uintptr_t) addr < UTOP; addr += PGSIZE) {
-		// skip Exception stack
-		if ((uintptr_t) addr == (UXSTACKTOP - PGSIZE)) {
-			continue;
-		}
-
+	// Whole page tables go to the child, one 4MB at a time
+	static_assert(UTEXT % PTSIZE == 0);
+	for (addr = (void *) UTEXT; (uintptr_t) addr < UTOP; addr += PTSIZE) {
 		pde = vpd[VPD(addr)];
 		if ( !(pde & PTE_P) ) {
-			addr += PTSIZE - PGSIZE;
 			continue;
 		}
-		pte = vpt[VPN(addr)];
-		if ( (pte & (PTE_U | PTE_P)) != (PTE_U | PTE_P) ) {
+		if ( (pde & PTE_PS) && duplargepage(envid, addr, pde) ) {
 			continue;
 		}
 
-		// (re)map Writeable pages as COW, both in child & parent
-		// and copy Shared page mappings to child
-		duppage(envid, VPN(addr));
+		// (re)map Writeable pages as COW in the parent
+		// and share the page table with the child
+		duppagetable(envid, addr);
 	}
 
 	r = sys_page_alloc(envid, (void *) (UXSTACKTOP - PGSIZE),
@@ -188,80 +245,3 @@ fork(void)
 
 	return envid;
 }
-
-// Challenge!
-int
-sfork(void)
-{
-	//panic("sfork not implemented");
-	envid_t envid;
-	void *addr;
-	int r;
-	pde_t pde;
-	pte_t pte;
-	volatile struct Env *penv = NULL;
-
-	env = NULL;
-	penv = getenv();
-	assert(penv != NULL);
-
-	set_pgfault_handler(pgfault);
-
-	envid = sys_exofork();
-	if (envid < 0) {
-		panic("sfork: sys_exofork FAILED: %e", envid);
-	}
-	if (envid == 0) {
-		// Child process, no need to fix "env"
-		return 0;
-	}
-
-	for (addr = (void *) UTEXT; (uintptr_t) addr < UTOP; addr += PGSIZE) {
-		// skip Exception stack
-		if ((uintptr_t) addr == (UXSTACKTOP - PGSIZE)) {
-			continue;
-		}
-		// skip Normal stack
-		if ((uintptr_t) addr == (USTACKTOP - PGSIZE)) {
-			continue;
-		}
-
-		pde = vpd[VPD(addr)];
-		if ( !(pde & PTE_P) ) {
-			addr += PTSIZE - PGSIZE;
-			continue;
-		}
-		pte = vpt[VPN(addr)];
-		if ( (pte & (PTE_U | PTE_P)) != (PTE_U | PTE_P) ) {
-			continue;
-		}
-
-		// (re)map W pages onto child, shared-write by parent also
-		if (pte & PTE_W) {
-			r = sys_page_map(0, addr, envid, addr, PTE_W | PTE_U | PTE_P);
-			if (r < 0) {
-				panic("sfork: sys_page_map FAILED: %e", r);
-			}
-		}
-	}
-	// (re)map Normal stack as COW, both in child & parent
-	duppage(envid, VPN(USTACKTOP - PGSIZE));
-
-	r = sys_page_alloc(envid, (void *) (UXSTACKTOP - PGSIZE),
-			PTE_W | PTE_U | PTE_P);
-	if (r < 0) {
-		panic("sfork: sys_page_alloc FAILED: %e", r);
-	}
-	r = sys_env_set_pgfault_upcall(envid, penv->env_pgfault_upcall);
-	if (r < 0) {
-		panic("sfork: sys_env_set_pgfault_upcall FAILED: %e", r);
-	}
-
-	r = sys_env_set_status(envid, ENV_RUNNABLE);
-	if (r < 0) {
-		panic("sfork: sys_env_set_status FAILED: %e", r);
-	}
-
-	//return -E_INVAL;
-	return envid;
-}
@@ -16,15 +16,25 @@
 // Otherwise, return the value sent by the sender
 //
 // Hint:
-//   Use 'env' to discover the value and who sent it.
+//   Use thisenv() to discover the value and who sent it.
 //   If 'pg' is null, pass sys_ipc_recv a value that it will understand
 //   as meaning "no page".  (Zero is not the right value, since that's
 //   a perfectly valid place to map a page.)
 int32_t
 ipc_recv(envid_t *from_env_store, void *pg, int *perm_store)
+{
+	return ipc_recv_until(from_env_store, pg, perm_store, 0);
+}
+
+// Like ipc_recv, but give up with -E_TIMEOUT once sys_time_msec()
+// reaches 'deadline'.  A 'deadline' of 0 waits forever.
+int32_t
+ipc_recv_until(envid_t *from_env_store, void *pg, int *perm_store,
+	       unsigned deadline)
 {
 	// LAB 4: Your code here.
 	//panic("ipc_recv not implemented");
+	volatile struct Env *e;
 	int rc;
 
 	if (from_env_store) {
@@ -37,19 +47,19 @@ ipc_recv(envid_t *from_env_store, void *pg, int *perm_store)
 		*perm_store = 0;
 	}
 
-	rc = sys_ipc_recv(pg);
+	rc = sys_ipc_recv(pg, deadline);
 	if (rc < 0) {
 		return rc;
 	}
 
-	assert(env != NULL);
+	e = thisenv();
 	if (from_env_store) {
-		*from_env_store = env->env_ipc_from;
+		*from_env_store = e->env_ipc_from;
 	}
 	if (perm_store) {
-		*perm_store = env->env_ipc_perm;
+		*perm_store = e->env_ipc_perm;
 	}
-	return (int32_t) env->env_ipc_value;
+	return (int32_t) e->env_ipc_value;
 	//return 0;
 }
 
@@ -57,24 +67,25 @@ ipc_recv(envid_t *from_env_store, void *pg, int *perm_store)
 // This function keeps trying until it succeeds.
 // It should panic() on any error other than -E_IPC_NOT_RECV.
 //
-// Hint:
-//   Use sys_yield() to be CPU-friendly.
-//   If 'pg' is null, pass sys_ipc_recv a value that it will understand
-//   as meaning "no page".  (Zero is not the right value.)
+// While the receiver is not receiving we sleep on its env_ipc_recving
+// flag, which the kernel wakes when the flag goes up or the receiver
+// exits.
 void
 ipc_send(envid_t to_env, uint32_t val, void *pg, int perm)
 {
 	// LAB 4: Your code here.
 	//panic("ipc_send not implemented");
-	int rc = -E_IPC_NOT_RECV;
+	volatile struct Env *e = &envs[ENVX(to_env)];
+	int rc;
 
 	if (pg == NULL) {
 		pg = (void *) UTOP;
 	}
 
-	while (rc == -E_IPC_NOT_RECV) {
-		rc = sys_ipc_try_send(to_env, val, pg, perm);
-		sys_yield();
+	while ((rc = sys_ipc_try_send(to_env, val, pg, perm))
+	       == -E_IPC_NOT_RECV) {
+		sys_futex_wait((volatile uint32_t *) &e->env_ipc_recving,
+			       0, 0);
 	}
 	if (rc < 0) {
 		panic("ipc_send: sys_ipc_try_send FAILED: %e", rc);
@@ -2,139 +2,445 @@
 #include <inc/lib.h>
 
 /*
- * Simple malloc/free.
+ * Size-class slab malloc/free.
  *
- * Uses the address space to do most of the hard work.
- * The address space from mbegin to mend is scanned
- * in order.  Pages are allocated, used to fill successive
- * malloc requests, and then left alone.  Free decrements
- * a ref count maintained in the page; the page is freed
- * when the ref count hits zero.
+ * Requests of up to MAXSLAB bytes are rounded up to one of the size
+ * classes in class_size[] and carved out of slab pages.  A slab page
+ * starts with a struct Slab header followed by objects of one size;
+ * its free objects are kept on a list threaded through the objects
+ * themselves.  Each class keeps a list of its slabs that have free
+ * objects, so malloc and free are a few pointer operations unless a
+ * slab page has to be allocated or given back.  A slab whose objects
+ * are all free is returned to the kernel unless it is the last one
+ * its class has, so an alloc/free pair does not map and unmap a page
+ * each time.
  *
- * If we need to allocate a large amount (more than a page)
- * we can't put a ref count at the end of each page,
- * so we mark the pte entry with the bit PTE_CONTINUED.
+ * Larger requests get a run of whole pages and are returned
+ * page-aligned.  A slab object never is, since it sits after the slab
+ * header, which is how free tells the two apart.  Which pages are in
+ * use, and which pages of a run continue into the next page (the old
+ * PTE_CONTINUED bit), is kept in two bitmaps over the malloc region.
+ * The bitmaps live in our data segment rather than in PTE software
+ * bits so that fork carries them to the child along with the data:
+ * fork remaps copy-on-write pages with fresh permissions, and the old
+ * PTE_CONTINUED (0x400) was PTE_SHARE, which made fork share large
+ * blocks with the child instead of copying them.
  */
-enum
-{
-	MAXMALLOC = 1024*1024	/* max size of one allocated chunk */
+
+#define MBEGIN		0x08000000
+#define MEND		0x10000000
+#define MNPAGES		((MEND - MBEGIN) / PGSIZE)
+
+#define SLAB_MAGIC	0x51ab51ab
+#define SLAB_HDR	32		// objects start here in a slab page
+#define MAXSLAB		2032		// largest slab object
+
+struct Slab {
+	uint32_t s_magic;
+	uint16_t s_class;		// index into class_size[]
+	uint16_t s_nfree;		// free objects in this slab
+	void *s_free;			// list of free objects
+	struct Slab *s_next;		// class's slabs with free objects
+	struct Slab **s_prevp;
 };
 
-#define PTE_CONTINUED 0x400
+// Multiples of 16 chosen so that each class fills most of a page.
+static const uint16_t class_size[] = {
+	16, 32, 48, 64, 80, 96, 128, 160, 192, 256,
+	336, 448, 576, 800, 1008, 1344, 2032
+};
+#define NCLASS		(sizeof(class_size) / sizeof(class_size[0]))
 
-static uint8_t *mbegin = (uint8_t*) 0x08000000;
-static uint8_t *mend   = (uint8_t*) 0x10000000;
-static uint8_t *mptr;
+struct SlabClass {
+	struct Slab *c_list;		// slabs with free objects
+	uint32_t c_npages;		// slab pages held
+	uint32_t c_inuse;		// objects allocated
+	uint32_t c_nmalloc;		// allocations ever
+};
 
-static int
-isfree(void *v, size_t n)
+static struct SlabClass classes[NCLASS];
+static uint8_t size_class[MAXSLAB / 16 + 1];	// (n + 15) / 16 -> class
+static int malloc_ready;
+
+static uint32_t mused[MNPAGES / 32];	// page is mapped by malloc
+static uint32_t mcont[MNPAGES / 32];	// run continues into next page
+static int mhint;			// page to start run searches at
+
+static struct MallocStats stats;
+
+static inline int
+bit_test(uint32_t *map, int i)
 {
-	uintptr_t va, end_va = (uintptr_t) v + n;
+	return (map[i >> 5] >> (i & 31)) & 1;
+}
 
-	for (va = (uintptr_t) v; va < end_va; va += PGSIZE)
-		if (va >= (uintptr_t) mend
-		    || ((vpd[PDX(va)] & PTE_P) && (vpt[VPN(va)] & PTE_P)))
-			return 0;
-	return 1;
+static inline void
+bit_set(uint32_t *map, int i)
+{
+	map[i >> 5] |= 1 << (i & 31);
 }
 
-void*
-malloc(size_t n)
+static inline void
+bit_clear(uint32_t *map, int i)
 {
-	int i, cont;
-	int nwrap;
-	uint32_t *ref;
-	void *v;
+	map[i >> 5] &= ~(1 << (i & 31));
+}
 
-	if (mptr == 0)
-		mptr = mbegin;
+static inline void *
+page2va(int pn)
+{
+	return (void *) (MBEGIN + pn * PGSIZE);
+}
 
-	n = ROUNDUP(n, 4);
+static inline int
+va2page(void *v)
+{
+	return ((uintptr_t) v - MBEGIN) / PGSIZE;
+}
 
-	if (n >= MAXMALLOC)
-		return 0;
+static void
+malloc_init(void)
+{
+	int i, c;
 
-	if ((uintptr_t) mptr % PGSIZE){
-		/*
-		 * we're in the middle of a partially
-		 * allocated page - can we add this chunk?
-		 * the +4 below is for the ref count.
-		 */
-		ref = (uint32_t*) (ROUNDUP(mptr, PGSIZE) - 4);
-		if ((uintptr_t) mptr / PGSIZE == (uintptr_t) (mptr + n - 1 + 4) / PGSIZE) {
-			(*ref)++;
-			v = mptr;
-			mptr += n;
-			return v;
-		}
-		/*
-		 * stop working on this page and move on.
-		 */
-		free(mptr);	/* drop reference to this page */
-		mptr = ROUNDDOWN(mptr + PGSIZE, PGSIZE);
+	static_assert(sizeof(struct Slab) <= SLAB_HDR);
+	for (i = 0, c = 0; i <= MAXSLAB / 16; i++) {
+		if (i * 16 > class_size[c])
+			c++;
+		size_class[i] = c;
 	}
+	malloc_ready = 1;
+}
 
-	/*
-	 * now we need to find some address space for this chunk.
-	 * if it's less than a page we leave it open for allocation.
-	 * runs of more than a page can't have ref counts so we 
-	 * flag the PTE entries instead.
-	 */
-	nwrap = 0;
-	while (1) {
-		if (isfree(mptr, n + 4))
-			break;
-		mptr += PGSIZE;
-		if (mptr == mend) {
-			mptr = mbegin;
-			if (++nwrap == 2)
-				return 0;	/* out of address space */
+// Find 'npages' free pages in a row, searching from mhint onwards
+// and then from the start of the region.
+// Returns the first page number, or -1 if there is no such run.
+static int
+run_find(int npages)
+{
+	int pn, start, n, pass;
+
+	for (pass = 0; pass < 2; pass++) {
+		pn = pass ? 0 : mhint;
+		start = pn;
+		n = 0;
+		while (pn < MNPAGES) {
+			if (pn % 32 == 0 && mused[pn >> 5] == ~0U) {
+				pn += 32;
+				start = pn;
+				n = 0;
+				continue;
+			}
+			if (bit_test(mused, pn)) {
+				start = ++pn;
+				n = 0;
+				continue;
+			}
+			pn++;
+			if (++n == npages)
+				return start;
 		}
 	}
+	return -1;
+}
 
-	/*
-	 * allocate at mptr - the +4 makes sure we allocate a ref count.
-	 */
-	for (i = 0; i < n + 4; i += PGSIZE){
-		cont = (i + PGSIZE < n + 4) ? PTE_CONTINUED : 0;
-		if (sys_page_alloc(0, mptr + i, PTE_P|PTE_U|PTE_W|cont) < 0){
-			for (; i >= 0; i -= PGSIZE)
-				sys_page_unmap(0, mptr + i);
-			return 0;	/* out of physical memory */
+// Map pages 'pn' through 'pn + npages - 1', which must be free.
+static int
+run_map(int pn, int npages)
+{
+	int i, r;
+
+	for (i = 0; i < npages; i++) {
+		if ((r = sys_page_alloc(0, page2va(pn + i),
+					PTE_P|PTE_U|PTE_W)) < 0) {
+			while (--i >= 0) {
+				sys_page_unmap(0, page2va(pn + i));
+				bit_clear(mused, pn + i);
+			}
+			return r;
 		}
+		bit_set(mused, pn + i);
+	}
+	return 0;
+}
+
+static void
+run_unmap(int pn, int npages)
+{
+	int i;
+
+	for (i = 0; i < npages; i++) {
+		sys_page_unmap(0, page2va(pn + i));
+		bit_clear(mused, pn + i);
+		bit_clear(mcont, pn + i);
+	}
+	if (pn < mhint)
+		mhint = pn;
+}
+
+static int
+run_length(int pn)
+{
+	int n;
+
+	for (n = 1; bit_test(mcont, pn + n - 1); n++)
+		;
+	return n;
+}
+
+static void *
+run_alloc(int npages)
+{
+	int pn, i;
+
+	if ((pn = run_find(npages)) < 0 || run_map(pn, npages) < 0)
+		return 0;
+	for (i = 0; i < npages - 1; i++)
+		bit_set(mcont, pn + i);
+	mhint = pn + npages;
+	return page2va(pn);
+}
+
+// Grow or shrink the run at 'pn' in place to 'npages' pages.
+static int
+run_resize(int pn, int npages)
+{
+	int old = run_length(pn), i, r;
+
+	if (npages < old) {
+		run_unmap(pn + npages, old - npages);
+		bit_clear(mcont, pn + npages - 1);
+	} else if (npages > old) {
+		if (pn + npages > MNPAGES)
+			return -E_NO_MEM;
+		for (i = old; i < npages; i++)
+			if (bit_test(mused, pn + i))
+				return -E_NO_MEM;
+		if ((r = run_map(pn + old, npages - old)) < 0)
+			return r;
+		for (i = old - 1; i < npages - 1; i++)
+			bit_set(mcont, pn + i);
+	}
+	return 0;
+}
+
+static struct Slab *
+slab_new(int c)
+{
+	struct Slab *s;
+	char *obj;
+	int size = class_size[c];
+
+	if ((s = run_alloc(1)) == 0)
+		return 0;
+	s->s_magic = SLAB_MAGIC;
+	s->s_class = c;
+	s->s_nfree = 0;
+	s->s_free = 0;
+	// Thread the free list in address order
+	for (obj = (char *) s + SLAB_HDR + (PGSIZE - SLAB_HDR) / size * size;
+	     (obj -= size) >= (char *) s + SLAB_HDR; s->s_nfree++) {
+		*(void **) obj = s->s_free;
+		s->s_free = obj;
+	}
+	if ((s->s_next = classes[c].c_list) != 0)
+		s->s_next->s_prevp = &s->s_next;
+	s->s_prevp = &classes[c].c_list;
+	classes[c].c_list = s;
+	classes[c].c_npages++;
+	return s;
+}
+
+static inline void
+slab_unlink(struct Slab *s)
+{
+	if (s->s_next)
+		s->s_next->s_prevp = s->s_prevp;
+	*s->s_prevp = s->s_next;
+}
+
+static void *
+slab_alloc(int c)
+{
+	struct SlabClass *sc = &classes[c];
+	struct Slab *s;
+	void *v;
+
+	if ((s = sc->c_list) == 0 && (s = slab_new(c)) == 0)
+		return 0;
+	v = s->s_free;
+	s->s_free = *(void **) v;
+	if (--s->s_nfree == 0)
+		slab_unlink(s);
+	sc->c_inuse++;
+	sc->c_nmalloc++;
+	return v;
+}
+
+static void
+slab_free(struct Slab *s, void *v)
+{
+	struct SlabClass *sc = &classes[s->s_class];
+	int size = class_size[s->s_class];
+
+	assert(((char *) v - (char *) s - SLAB_HDR) % size == 0);
+	*(void **) v = s->s_free;
+	s->s_free = v;
+	sc->c_inuse--;
+	if (s->s_nfree++ == 0) {
+		// Was full; now has room again
+		if ((s->s_next = sc->c_list) != 0)
+			s->s_next->s_prevp = &s->s_next;
+		s->s_prevp = &sc->c_list;
+		sc->c_list = s;
+	} else if (s->s_nfree == (PGSIZE - SLAB_HDR) / size
+		   && (sc->c_list != s || s->s_next != 0)) {
+		// All free and not the class's only slab with room
+		slab_unlink(s);
+		s->s_magic = 0;
+		run_unmap(va2page(s), 1);
+		sc->c_npages--;
 	}
+}
+
+// Usable size of the block at 'v'.
+static size_t
+block_size(void *v)
+{
+	struct Slab *s;
+
+	if (PGOFF(v) == 0)
+		return run_length(va2page(v)) * PGSIZE;
+	s = ROUNDDOWN(v, PGSIZE);
+	return class_size[s->s_class];
+}
+
+void *
+malloc(size_t n)
+{
+	void *v;
+
+	if (!malloc_ready)
+		malloc_init();
+
+	if (n <= MAXSLAB)
+		v = slab_alloc(size_class[(n + 15) / 16]);
+	else if (n <= MEND - MBEGIN
+		 && (v = run_alloc(ROUNDUP(n, PGSIZE) / PGSIZE)) != 0)
+		stats.ms_run_pages += ROUNDUP(n, PGSIZE) / PGSIZE;
+	else
+		v = 0;
 
-	ref = (uint32_t*) (mptr + i - 4);
-	*ref = 2;	/* reference for mptr, reference for returned block */
-	v = mptr;
-	mptr += n;
+	if (v)
+		stats.ms_nmalloc++;
+	else
+		stats.ms_nfailed++;
 	return v;
 }
 
 void
 free(void *v)
 {
-	uint8_t *c;
-	uint32_t *ref;
+	struct Slab *s;
+	int pn, npages;
 
 	if (v == 0)
 		return;
-	assert(mbegin <= (uint8_t*) v && (uint8_t*) v < mend);
+	assert(MBEGIN <= (uintptr_t) v && (uintptr_t) v < MEND);
 
-	c = ROUNDDOWN(v, PGSIZE);
+	stats.ms_nfree++;
+	if (PGOFF(v) == 0) {
+		pn = va2page(v);
+		assert(bit_test(mused, pn) && (pn == 0 || !bit_test(mcont, pn - 1)));
+		npages = run_length(pn);
+		run_unmap(pn, npages);
+		stats.ms_run_pages -= npages;
+	} else {
+		s = ROUNDDOWN(v, PGSIZE);
+		assert(s->s_magic == SLAB_MAGIC);
+		slab_free(s, v);
+	}
+}
+
+void *
+calloc(size_t nmemb, size_t size)
+{
+	void *v;
+
+	if (size && nmemb > (size_t) -1 / size)
+		return 0;
+	if ((v = malloc(nmemb * size)) == 0)
+		return 0;
+	// Runs are fresh pages from the kernel and already zero
+	if (PGOFF(v) != 0)
+		memset(v, 0, nmemb * size);
+	return v;
+}
 
-	while (vpt[VPN(c)] & PTE_CONTINUED) {
-		sys_page_unmap(0, c);
-		c += PGSIZE;
-		assert(mbegin <= c && c < mend);
+void *
+realloc(void *v, size_t n)
+{
+	size_t old;
+	void *nv;
+	int npages;
+
+	if (v == 0)
+		return malloc(n);
+	if (n == 0) {
+		free(v);
+		return 0;
 	}
 
-	/*
-	 * c is just a piece of this page, so dec the ref count
-	 * and maybe free the page.
-	 */
-	ref = (uint32_t*) (c + PGSIZE - 4);
-	if (--(*ref) == 0)
-		sys_page_unmap(0, c);	
+	old = block_size(v);
+	npages = ROUNDUP(n, PGSIZE) / PGSIZE;
+	if (PGOFF(v) == 0 && n > MAXSLAB && n <= MEND - MBEGIN
+	    && run_resize(va2page(v), npages) == 0) {
+		stats.ms_run_pages += npages - old / PGSIZE;
+		return v;
+	}
+	// Stay in the slab unless the request moved to a smaller class
+	if (PGOFF(v) != 0 && n <= old
+	    && class_size[size_class[(n + 15) / 16]] == old)
+		return v;
+
+	if ((nv = malloc(n)) == 0)
+		return 0;
+	memmove(nv, v, MIN(old, n));
+	free(v);
+	return nv;
 }
 
+void
+malloc_getstats(struct MallocStats *ms)
+{
+	int c;
+
+	*ms = stats;
+	ms->ms_slab_pages = 0;
+	ms->ms_inuse = 0;
+	for (c = 0; c < NCLASS; c++) {
+		ms->ms_slab_pages += classes[c].c_npages;
+		ms->ms_inuse += classes[c].c_inuse * class_size[c];
+	}
+	ms->ms_inuse += stats.ms_run_pages * PGSIZE;
+}
+
+void
+malloc_stats(void)
+{
+	struct MallocStats ms;
+	int c;
+
+	malloc_getstats(&ms);
+	cprintf("malloc: %u mallocs, %u frees, %u failed, "
+		"%u bytes in use\n", ms.ms_nmalloc, ms.ms_nfree,
+		ms.ms_nfailed, ms.ms_inuse);
+	cprintf("malloc: %u slab pages, %u large-block pages\n",
+		ms.ms_slab_pages, ms.ms_run_pages);
+	for (c = 0; c < NCLASS; c++)
+		if (classes[c].c_nmalloc)
+			cprintf("  %4u bytes: %6u in use, %3u pages, "
+				"%8u allocated\n", class_size[c],
+				classes[c].c_inuse, classes[c].c_npages,
+				classes[c].c_nmalloc);
+}
@@ -0,0 +1,110 @@
+// Mutexes and condition variables on top of sys_futex_wait/wake.
+//
+// The mutex is the three-state futex mutex from Drepper's "Futexes
+// Are Tricky": an uncontended lock or unlock is a single atomic
+// instruction, and only an unlock that may have waiters makes a
+// system call.  A condition variable is a sequence number that every
+// signal bumps; a waiter sleeps on the value it saw before releasing
+// the mutex, so a signal that comes in between is not lost.
+
+#include <inc/lib.h>
+#include <inc/x86.h>
+
+enum {
+	MUTEX_FREE = 0,
+	MUTEX_HELD = 1,
+	MUTEX_WAITERS = 2,	// held, and someone may be asleep on it
+};
+
+void
+mutex_init(struct Mutex *m)
+{
+	m->m_state = MUTEX_FREE;
+}
+
+void
+mutex_lock(struct Mutex *m)
+{
+	uint32_t c;
+
+	if ((c = cmpxchg(&m->m_state, MUTEX_FREE, MUTEX_HELD)) == MUTEX_FREE)
+		return;
+	// Contended: mark the mutex as having waiters and sleep until
+	// we are the ones to take it from free.  Taking it in the
+	// WAITERS state is conservative; it costs an extra wakeup at
+	// worst.
+	if (c != MUTEX_WAITERS)
+		c = xchg(&m->m_state, MUTEX_WAITERS);
+	while (c != MUTEX_FREE) {
+		sys_futex_wait(&m->m_state, MUTEX_WAITERS, 0);
+		c = xchg(&m->m_state, MUTEX_WAITERS);
+	}
+}
+
+// Returns 0 if the mutex was taken, -E_BUSY if it is held.
+int
+mutex_trylock(struct Mutex *m)
+{
+	if (cmpxchg(&m->m_state, MUTEX_FREE, MUTEX_HELD) != MUTEX_FREE)
+		return -E_BUSY;
+	return 0;
+}
+
+void
+mutex_unlock(struct Mutex *m)
+{
+	if (xchg(&m->m_state, MUTEX_FREE) == MUTEX_WAITERS)
+		sys_futex_wake(&m->m_state, 1);
+}
+
+void
+cond_init(struct Cond *c)
+{
+	c->c_seq = 0;
+}
+
+// Release 'm', sleep until the condition is signalled or time
+// 'deadline' (0 for none) passes, and take 'm' again.
+// Returns 0, or -E_TIMEOUT if the deadline passed.  As with any
+// condition variable, the caller must recheck its condition.
+int
+cond_wait_until(struct Cond *c, struct Mutex *m, unsigned deadline)
+{
+	uint32_t seq = c->c_seq;
+	int r;
+
+	mutex_unlock(m);
+	r = sys_futex_wait(&c->c_seq, seq, deadline);
+	mutex_lock(m);
+	return r == -E_TIMEOUT ? r : 0;
+}
+
+void
+cond_wait(struct Cond *c, struct Mutex *m)
+{
+	cond_wait_until(c, m, 0);
+}
+
+static void
+cond_bump(struct Cond *c)
+{
+	uint32_t seq;
+
+	do {
+		seq = c->c_seq;
+	} while (cmpxchg(&c->c_seq, seq, seq + 1) != seq);
+}
+
+void
+cond_signal(struct Cond *c)
+{
+	cond_bump(c);
+	sys_futex_wake(&c->c_seq, 1);
+}
+
+void
+cond_broadcast(struct Cond *c)
+{
+	cond_bump(c);
+	sys_futex_wake(&c->c_seq, NENV);
+}
@@ -9,20 +9,27 @@
 extern union Nsipc nsipcbuf;	// page-aligned, declared in entry.S
 
 // Send an IP request to the network server, and wait for a reply.
-// The request body should be in nsipcbuf, and parts of the response
-// may be written back to nsipcbuf.
+// The request body should be in the page 'req', and parts of the
+// response may be written back to it.
 // type: request code, passed as the simple integer IPC value.
 // Returns 0 if successful, < 0 on failure.
 static int
-nsipc(unsigned type)
+nsipc_page(unsigned type, union Nsipc *req)
 {
 	if (debug)
 		cprintf("[%08x] nsipc %d\n", env->env_id, type);
 
-	ipc_send(envs[2].env_id, type, &nsipcbuf, PTE_P|PTE_W|PTE_U);
+	ipc_send(envs[2].env_id, type, req, PTE_P|PTE_W|PTE_U);
 	return ipc_recv(NULL, NULL, NULL);
 }
 
+// Like nsipc_page, with the request in nsipcbuf.
+static int
+nsipc(unsigned type)
+{
+	return nsipc_page(type, &nsipcbuf);
+}
+
 int
 nsipc_accept(int s, struct sockaddr *addr, socklen_t *addrlen)
 {
@@ -106,6 +113,48 @@ nsipc_send(int s, const void *buf, int size, unsigned int flags)
 	return nsipc(NSREQ_SEND);
 }
 
+// Send the 'size' bytes already in pg->send.req_buf.  The page itself
+// is handed to the network server, so the data is not copied here.
+int
+nsipc_send_page(int s, union Nsipc *pg, int size, unsigned int flags)
+{
+	assert(size <= NSIPC_SENDPAGE_MAX);
+	pg->send.req_s = s;
+	pg->send.req_size = size;
+	pg->send.req_flags = flags;
+	return nsipc_page(NSREQ_SENDPAGE, pg);
+}
+
+int
+nsipc_sendfile(int s, int fileid, off_t offset, size_t len, unsigned int flags)
+{
+	nsipcbuf.sendfile.req_s = s;
+	nsipcbuf.sendfile.req_fileid = fileid;
+	nsipcbuf.sendfile.req_offset = offset;
+	nsipcbuf.sendfile.req_len = len;
+	nsipcbuf.sendfile.req_flags = flags;
+	return nsipc(NSREQ_SENDFILE);
+}
+
+int
+nsipc_select(int nfds, fd_set *readset, fd_set *writeset, fd_set *exceptset,
+	     int timeout)
+{
+	int r;
+
+	nsipcbuf.select.req_nfds = nfds;
+	nsipcbuf.select.req_readset = *readset;
+	nsipcbuf.select.req_writeset = *writeset;
+	nsipcbuf.select.req_exceptset = *exceptset;
+	nsipcbuf.select.req_timeout = timeout;
+	if ((r = nsipc(NSREQ_SELECT)) >= 0) {
+		*readset = nsipcbuf.select.req_readset;
+		*writeset = nsipcbuf.select.req_writeset;
+		*exceptset = nsipcbuf.select.req_exceptset;
+	}
+	return r;
+}
+
 int
 nsipc_socket(int domain, int type, int protocol)
 {
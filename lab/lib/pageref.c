@@ -3,10 +3,14 @@
 int
 pageref(void *v)
 {
+	pde_t pde;
 	pte_t pte;
 
-	if (!(vpd[PDX(v)] & PTE_P))
+	pde = vpd[PDX(v)];
+	if (!(pde & PTE_P))
 		return 0;
+	if (pde & PTE_PS)
+		return pages[PPN(pde) + PTX(v)].pp_ref;
 	pte = vpt[VPN(v)];
 	if (!(pte & PTE_P))
 		return 0;
@@ -17,14 +17,62 @@ struct Dev devpipe =
 	.dev_stat =	devpipe_stat,
 };
 
-#define PIPEBUFSIZ 32		// small to provoke races
+// The pipe structure fills the data page shared by both ends.
+// Positions run modulo 2 * PIPEBUFSIZ, so that a full ring
+// (p_wpos - p_rpos == PIPEBUFSIZ) differs from an empty one.
+#define PIPEBUFSIZ	(PGSIZE - 4 * sizeof(uint32_t))
+
+// A reader or writer that has to wait sleeps in sys_futex_wait() on
+// the other side's position, after setting its p_rwait or p_wwait
+// flag; whoever next moves that position clears the flag and wakes
+// it.  The flag is set before the position is checked one last time,
+// and the kernel only puts us to sleep if the position has not moved
+// since, so no wakeup is lost.  The sleep has a deadline all the
+// same, for the ends that go away without a wakeup (an env killed
+// with the pipe open, or a close racing with the check in
+// _pipeisclosed).
+#define PIPE_WAIT_MSEC	50
 
 struct Pipe {
-	off_t p_rpos;		// read position
-	off_t p_wpos;		// write position
+	volatile uint32_t p_rpos;	// read position
+	volatile uint32_t p_wpos;	// write position
+	volatile uint32_t p_rwait;	// a reader sleeps on p_wpos
+	volatile uint32_t p_wwait;	// a writer sleeps on p_rpos
 	uint8_t p_buf[PIPEBUFSIZ];	// data buffer
 };
 
+// Bytes in the pipe
+static inline uint32_t
+pipe_count(struct Pipe *p)
+{
+	return (p->p_wpos - p->p_rpos + 2 * PIPEBUFSIZ) % (2 * PIPEBUFSIZ);
+}
+
+static inline uint32_t
+pipe_advance(uint32_t pos, uint32_t n)
+{
+	return (pos + n) % (2 * PIPEBUFSIZ);
+}
+
+// Sleep until *pos moves from 'old', or a while.
+static void
+pipe_wait(volatile uint32_t *flag, volatile uint32_t *pos, uint32_t old)
+{
+	*flag = 1;
+	if (*pos == old)
+		sys_futex_wait(pos, old, sys_time_msec() + PIPE_WAIT_MSEC);
+}
+
+// We just moved *pos: wake whoever waits for that.
+static void
+pipe_wake(volatile uint32_t *flag, volatile uint32_t *pos)
+{
+	if (*flag) {
+		*flag = 0;
+		sys_futex_wake(pos, NENV);
+	}
+}
+
 int
 pipe(int pfd[2])
 {
@@ -75,16 +123,17 @@ pipe(int pfd[2])
 static int
 _pipeisclosed(struct Fd *fd, struct Pipe *p)
 {
+	volatile struct Env *e = thisenv();
 	int n, nn, ret;
 
 	while (1) {
-		n = env->env_runs;
+		n = e->env_runs;
 		ret = pageref(fd) == pageref(p);
-		nn = env->env_runs;
+		nn = e->env_runs;
 		if (n == nn)
 			return ret;
 		if (n != nn && ret == 1)
-			cprintf("pipe race avoided\n", n, env->env_runs, ret);
+			cprintf("pipe race avoided\n", n, e->env_runs, ret);
 	}
 }
 
@@ -105,7 +154,8 @@ static ssize_t
 devpipe_read(struct Fd *fd, void *vbuf, size_t n)
 {
 	uint8_t *buf;
-	size_t i;
+	size_t i, m, off;
+	uint32_t rpos, wpos;
 	struct Pipe *p;
 
 	p = (struct Pipe*)fd2data(fd);
@@ -114,33 +164,36 @@ devpipe_read(struct Fd *fd, void *vbuf, size_t n)
 			env->env_id, vpt[VPN(p)], n, p->p_rpos, p->p_wpos);
 
 	buf = vbuf;
-	for (i = 0; i < n; i++) {
-		while (p->p_rpos == p->p_wpos) {
-			// pipe is empty
-			// if we got any data, return it
-			if (i > 0)
-				return i;
-			// if all the writers are gone, note eof
-			if (_pipeisclosed(fd, p))
-				return 0;
-			// yield and see what happens
-			if (debug)
-				cprintf("devpipe_read yield\n");
-			sys_yield();
-		}
-		// there's a byte.  take it.
-		// wait to increment rpos until the byte is taken!
-		buf[i] = p->p_buf[p->p_rpos % PIPEBUFSIZ];
-		p->p_rpos++;
+	while ((wpos = p->p_wpos) == p->p_rpos) {
+		// pipe is empty
+		// if all the writers are gone, note eof
+		if (n == 0 || _pipeisclosed(fd, p))
+			return 0;
+		if (debug)
+			cprintf("devpipe_read wait\n");
+		pipe_wait(&p->p_rwait, &p->p_wpos, wpos);
 	}
-	return i;
+
+	// take what there is, in at most two contiguous pieces
+	rpos = p->p_rpos;
+	n = MIN(n, pipe_count(p));
+	for (i = 0; i < n; i += m) {
+		off = (rpos + i) % PIPEBUFSIZ;
+		m = MIN(n - i, PIPEBUFSIZ - off);
+		memmove(buf + i, &p->p_buf[off], m);
+	}
+	// wait to advance rpos until the bytes are taken!
+	p->p_rpos = pipe_advance(rpos, n);
+	pipe_wake(&p->p_wwait, &p->p_rpos);
+	return n;
 }
 
 static ssize_t
 devpipe_write(struct Fd *fd, const void *vbuf, size_t n)
 {
 	const uint8_t *buf;
-	size_t i;
+	size_t i, m, off;
+	uint32_t rpos, wpos;
 	struct Pipe *p;
 
 	p = (struct Pipe*) fd2data(fd);
@@ -149,23 +202,28 @@ devpipe_write(struct Fd *fd, const void *vbuf, size_t n)
 			env->env_id, vpt[VPN(p)], n, p->p_rpos, p->p_wpos);
 
 	buf = vbuf;
-	for (i = 0; i < n; i++) {
-		while (p->p_wpos >= p->p_rpos + sizeof(p->p_buf)) {
+	for (i = 0; i < n; i += m) {
+		while (pipe_count(p) == PIPEBUFSIZ) {
 			// pipe is full
 			// if all the readers are gone
 			// (it's only writers like us now),
 			// note eof
+			rpos = p->p_rpos;
 			if (_pipeisclosed(fd, p))
 				return 0;
-			// yield and see what happens
 			if (debug)
-				cprintf("devpipe_write yield\n");
-			sys_yield();
+				cprintf("devpipe_write wait\n");
+			pipe_wait(&p->p_wwait, &p->p_rpos, rpos);
 		}
-		// there's room for a byte.  store it.
-		// wait to increment wpos until the byte is stored!
-		p->p_buf[p->p_wpos % PIPEBUFSIZ] = buf[i];
-		p->p_wpos++;
+		// store as much as fits, without wrapping
+		wpos = p->p_wpos;
+		off = wpos % PIPEBUFSIZ;
+		m = MIN(n - i, PIPEBUFSIZ - pipe_count(p));
+		m = MIN(m, PIPEBUFSIZ - off);
+		memmove(&p->p_buf[off], buf + i, m);
+		// wait to advance wpos until the bytes are stored!
+		p->p_wpos = pipe_advance(wpos, m);
+		pipe_wake(&p->p_rwait, &p->p_wpos);
 	}
 	
 	return i;
@@ -176,7 +234,7 @@ devpipe_stat(struct Fd *fd, struct Stat *stat)
 {
 	struct Pipe *p = (struct Pipe*) fd2data(fd);
 	strcpy(stat->st_name, "<pipe>");
-	stat->st_size = p->p_wpos - p->p_rpos;
+	stat->st_size = pipe_count(p);
 	stat->st_isdir = 0;
 	stat->st_dev = &devpipe;
 	return 0;
@@ -185,7 +243,15 @@ devpipe_stat(struct Fd *fd, struct Stat *stat)
 static int
 devpipe_close(struct Fd *fd)
 {
+	struct Pipe *p = (struct Pipe*) fd2data(fd);
+
 	(void) sys_page_unmap(0, fd);
-	return sys_page_unmap(0, fd2data(fd));
+	// Let a waiting other end see that we are gone.  It only runs
+	// after we return, by which time the data page is unmapped too,
+	// unless we are preempted in between; the deadline in pipe_wait
+	// covers that.
+	pipe_wake(&p->p_rwait, &p->p_wpos);
+	pipe_wake(&p->p_wwait, &p->p_rpos);
+	return sys_page_unmap(0, p);
 }
 
@@ -41,6 +41,8 @@ static const char * const error_string[MAXERROR + 1] =
 	"no buffer space available",
 	"no data available",
 	"device or resource busy",
+	"timed out",
+	"try again",
 };
 
 /*
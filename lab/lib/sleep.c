@@ -11,7 +11,5 @@ sleep(int sec)
 	if (end < now)
 		panic("sleep: wrap");
 
-	while (sys_time_msec() < end)
-		sys_yield();
+	sys_sleep_until(end);
 }
-
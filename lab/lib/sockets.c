@@ -112,6 +112,129 @@ devsock_write(struct Fd *fd, const void *buf, size_t n)
 	return nsipc_send(fd->fd_sock.sockid, buf, n, 0);
 }
 
+// Receive up to 'len' bytes from socket 's', as read() does, but with
+// the lwIP MSG_* 'flags'.  With MSG_DONTWAIT, returns -E_AGAIN instead
+// of waiting when no data has arrived.
+int
+recv(int s, void *buf, size_t len, int flags)
+{
+	int r;
+	if ((r = fd2sockid(s)) < 0)
+		return r;
+	return nsipc_recv(r, buf, len, flags);
+}
+
+// Send up to 'len' bytes on socket 's', as write() does, but with the
+// lwIP MSG_* 'flags'.  With MSG_DONTWAIT, only what the connection takes
+// without waiting is sent, and -E_AGAIN returned if that is nothing.
+// Returns the number of bytes sent.
+int
+send(int s, const void *buf, size_t len, int flags)
+{
+	int r;
+	if ((r = fd2sockid(s)) < 0)
+		return r;
+	return nsipc_send(r, buf, len, flags);
+}
+
+// Send 'len' bytes of the open file 'fd', starting at 'offset', on
+// socket 's'.  The file data never passes through this environment:
+// the network server maps the file server's block cache pages and
+// transmits straight out of them.  With MSG_DONTWAIT in 'flags', only
+// what the connection takes without waiting is sent, as for send().
+// Returns the number of bytes sent, or < 0 on error.
+int
+sendfile(int s, int fd, off_t offset, size_t len, int flags)
+{
+	struct Fd *ffd;
+	int r;
+
+	if ((r = fd2sockid(s)) < 0)
+		return r;
+	if ((s = fd_lookup(fd, &ffd)) < 0)
+		return s;
+	if (ffd->fd_dev_id != devfile.dev_id)
+		return -E_NOT_SUPP;
+	return nsipc_sendfile(r, ffd->fd_file.id, offset, len, flags);
+}
+
+// Send the first 'size' bytes of pg->send.req_buf on socket 's',
+// handing the page to the network server instead of copying the data.
+// The page must be page-aligned and writable (the request header at
+// its start is filled in here).  The network server may send straight
+// from it until the peer acknowledges the data, so the data must not
+// change afterwards: to reuse the address, unmap the page and map a
+// fresh one.  With MSG_DONTWAIT in 'flags', the data goes whole if the
+// connection takes it without waiting, and otherwise -E_AGAIN is
+// returned.
+int
+sendpage(int s, union Nsipc *pg, int size, int flags)
+{
+	int r;
+	if ((r = fd2sockid(s)) < 0)
+		return r;
+	return nsipc_send_page(r, pg, size, flags);
+}
+
+// Wait until one of the socket file descriptors below 'nfds' in
+// 'readset', 'writeset' or 'exceptset' is ready, or until 'timeout'
+// expires (NULL waits forever).  The wait happens inside the network
+// server, which is woken by the stack's own socket events, so this
+// environment does not spin.  On return the sets hold only the ready
+// descriptors.  Any set may be NULL.
+// Returns the number of ready descriptors, 0 on timeout,
+// -E_NOT_SUPP if a set names a descriptor that is not a socket,
+// or another error < 0.
+int
+select(int nfds, fd_set *readset, fd_set *writeset, fd_set *exceptset,
+       struct timeval *timeout)
+{
+	fd_set *sets[3] = { readset, writeset, exceptset };
+	fd_set socksets[3];
+	int sockid[FD_SETSIZE];
+	int i, fd, n, msec, r, snfds;
+
+	if (nfds < 0 || nfds > FD_SETSIZE)
+		return -E_INVAL;
+
+	// Translate file descriptors into the server's socket ids.
+	snfds = 0;
+	for (i = 0; i < 3; i++)
+		FD_ZERO(&socksets[i]);
+	for (fd = 0; fd < nfds; fd++) {
+		sockid[fd] = -1;
+		for (i = 0; i < 3; i++) {
+			if (!sets[i] || !FD_ISSET(fd, sets[i]))
+				continue;
+			if (sockid[fd] < 0 && (sockid[fd] = fd2sockid(fd)) < 0)
+				return sockid[fd];
+			FD_SET(sockid[fd], &socksets[i]);
+			snfds = MAX(snfds, sockid[fd] + 1);
+		}
+	}
+
+	msec = -1;
+	if (timeout)
+		msec = timeout->tv_sec * 1000 + timeout->tv_usec / 1000;
+	if ((r = nsipc_select(snfds, &socksets[0], &socksets[1],
+			      &socksets[2], msec)) < 0)
+		return r;
+
+	// And the ready socket ids back into file descriptors.
+	n = 0;
+	for (i = 0; i < 3; i++) {
+		if (!sets[i])
+			continue;
+		FD_ZERO(sets[i]);
+		for (fd = 0; fd < nfds; fd++)
+			if (sockid[fd] >= 0 && FD_ISSET(sockid[fd], &socksets[i])) {
+				FD_SET(fd, sets[i]);
+				n++;
+			}
+	}
+	return n;
+}
+
 static int
 devsock_stat(struct Fd *fd, struct Stat *stat)
 {
@@ -12,6 +12,24 @@ static int map_segment(envid_t child, uintptr_t va, size_t memsz,
 		       int fd, size_t filesz, off_t fileoffset, int perm);
 static int copy_shared_pages(envid_t child);
 
+// Whether to page read-only segments in on demand; spawnbench turns
+// this off to compare.
+int spawn_demand = 1;
+
+// Whether 'ph' is a segment the file server can page in as it is:
+// loaded, read-only, and with no zero-filled part.  The stabs at
+// USTABDATA are loaded up front: only the kernel reads them, for
+// backtraces and the profiler, and it does not page anything in.
+static int
+demand_paged(const struct Proghdr *ph)
+{
+	return ph->p_type == ELF_PROG_LOAD
+		&& !(ph->p_flags & ELF_PROG_FLAG_WRITE)
+		&& ph->p_filesz > 0 && ph->p_memsz <= ph->p_filesz
+		&& !(ph->p_va <= USTABDATA
+		     && USTABDATA < ph->p_va + ph->p_memsz);
+}
+
 // Spawn a child process from a program image loaded from the file system.
 // prog: the pathname of the program to run.
 // argv: pointer to null-terminated array of pointers to strings,
@@ -27,7 +45,8 @@ spawn(const char *prog, const char **argv)
 	int fd, i, r;
 	struct Elf *elf;
 	struct Proghdr *ph;
-	int perm;
+	uintptr_t lo, hi;
+	int perm, demand;
 
 	// This code follows this procedure:
 	//
@@ -112,11 +131,37 @@ spawn(const char *prog, const char **argv)
 	if ((r = init_stack(child, argv, &child_tf.tf_esp)) < 0)
 		return r;
 
+	// Read-only segments are left to the file server to page in on
+	// first touch, straight from its block cache, so a program only
+	// reads the text it runs and all its instances share one copy.
+	// The file server pages for the range the segments span.
+	ph = (struct Proghdr*) (elf_buf + elf->e_phoff);
+	lo = UTOP;
+	hi = 0;
+	for (i = 0; i < elf->e_phnum; i++, ph++)
+		if (demand_paged(ph)) {
+			lo = MIN(lo, ROUNDDOWN(ph->p_va, PGSIZE));
+			hi = MAX(hi, ROUNDUP(ph->p_va + ph->p_memsz, PGSIZE));
+		}
+	if (!spawn_demand || lo >= hi)
+		lo = hi = 0;
+	demand = lo < hi;
+	// envs[1] is the file server; sys_exofork gave the child our pager
+	if ((r = sys_env_set_pager(child, demand ? envs[1].env_id : 0,
+				   lo, hi)) < 0)
+		goto error;
+
 	// Set up program segments as defined in ELF header.
 	ph = (struct Proghdr*) (elf_buf + elf->e_phoff);
 	for (i = 0; i < elf->e_phnum; i++, ph++) {
 		if (ph->p_type != ELF_PROG_LOAD)
 			continue;
+		if (demand && demand_paged(ph)
+		    && file_pager(fd, child, ROUNDDOWN(ph->p_va, PGSIZE),
+				  ROUNDUP(ph->p_va + ph->p_memsz, PGSIZE)
+				  - ROUNDDOWN(ph->p_va, PGSIZE),
+				  ROUNDDOWN(ph->p_offset, PGSIZE)) == 0)
+			continue;
 		perm = PTE_P | PTE_U;
 		if (ph->p_flags & ELF_PROG_FLAG_WRITE)
 			perm |= PTE_W;
@@ -274,6 +319,20 @@ map_segment(envid_t child, uintptr_t va, size_t memsz,
 	return 0;
 }
 
+// Whether every page mapped in the 4MB at 'addr' is shared writable,
+// so that the child can simply have our page table for it.
+static int
+all_shared(void *addr)
+{
+	unsigned pn;
+
+	for (pn = VPN(addr); pn < VPN(addr + PTSIZE); pn++)
+		if ((vpt[pn] & PTE_P)
+		    && (vpt[pn] & (PTE_SHARE | PTE_W)) != (PTE_SHARE | PTE_W))
+			return 0;
+	return 1;
+}
+
 // Copy the mappings for shared pages into the child address space.
 static int
 copy_shared_pages(envid_t child)
@@ -290,6 +349,25 @@ copy_shared_pages(envid_t child)
 			addr += PTSIZE - PGSIZE;
 			continue;
 		}
+		if (pde & PTE_PS) {
+			// a shared 4MB page goes over whole
+			if ((pde & (PTE_SHARE | PTE_W)) == (PTE_SHARE | PTE_W)) {
+				r = sys_page_map(0, addr, child, addr,
+						(pde & PTE_USER) | PTE_PS);
+				if (r < 0) {
+					return r;
+				}
+			}
+			addr += PTSIZE - PGSIZE;
+			continue;
+		}
+		// the file descriptor table and the like go over as
+		// one page table, if the child has nothing there yet
+		if ( ((uintptr_t) addr % PTSIZE) == 0 && all_shared(addr)
+				&& sys_page_table_share(0, addr, child) == 0 ) {
+			addr += PTSIZE - PGSIZE;
+			continue;
+		}
 		pte = vpt[VPN(addr)];
 		if ( (pte & (PTE_U | PTE_P)) != (PTE_U | PTE_P) ) {
 			continue;
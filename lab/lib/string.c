@@ -1,6 +1,8 @@
-// Basic string routines.  Not hardware optimized, but not shabby.
+// Basic string routines.
 
 #include <inc/string.h>
+#include <inc/mmu.h>
+#include <inc/x86.h>
 
 // Using assembly for memset/memmove
 // makes some difference on real hardware,
@@ -68,9 +70,25 @@ strlcpy(char *dst, const char *src, size_t size)
 	return dst - dst_in;
 }
 
+// True if some byte of the word w is zero.
+#define HASZERO(w)	(((w) - 0x01010101) & ~(w) & 0x80808080)
+
 int
 strcmp(const char *p, const char *q)
 {
+	uint32_t w;
+
+	// With p and q equally aligned, compare a word at a time once
+	// they are word aligned.  Aligned loads never cross into a page
+	// beyond the end of the string.
+	if ((((uintptr_t) p ^ (uintptr_t) q) & 3) == 0) {
+		for (; (uintptr_t) p & 3; p++, q++)
+			if (*p == 0 || *p != *q)
+				return (int) ((unsigned char) *p - (unsigned char) *q);
+		while ((w = *(const uint32_t *) p) == *(const uint32_t *) q
+		       && !HASZERO(w))
+			p += 4, q += 4;
+	}
 	while (*p && *p == *q)
 		p++, q++;
 	return (int) ((unsigned char) *p - (unsigned char) *q);
@@ -110,23 +128,186 @@ strfind(const char *s, char c)
 }
 
 #if ASM
+// memset and memmove align the destination with byte stores, do the
+// bulk with 4-byte string instructions, and finish the tail with byte
+// stores, so unaligned buffers no longer fall back to 'rep movsb'.
+// In user space, blocks of SSE_MIN bytes or more use 16-byte SSE2
+// loads and stores instead, when the CPU has SSE2.  The kernel keeps
+// to the integer registers: it does not save an environment's SSE
+// registers when it is entered (see kern/fpu.c).
+
+#define SSE_MIN		128
+
+// The registers the SSE loops use.  The compiler only knows them, and
+// could keep values in them, when it may use SSE itself.
+#ifdef __SSE__
+# define SSE_CLOBBERS	, "xmm0", "xmm1", "xmm2", "xmm3"
+#else
+# define SSE_CLOBBERS
+#endif
+
+#ifdef JOS_USER
+static int sse2 = -1;
+
+static int
+have_sse2(void)
+{
+	uint32_t edx;
+
+	if (sse2 < 0) {
+		cpuid(1, NULL, NULL, NULL, &edx);
+		sse2 = (edx >> 26) & 1;
+	}
+	return sse2;
+}
+
+// Fill n bytes at 16-byte aligned d with the word c; n % 64 == 0.
+static inline void
+sse_set(char *d, uint32_t c, size_t n)
+{
+	asm volatile("movd %2, %%xmm0\n\t"
+		     "pshufd $0, %%xmm0, %%xmm0\n"
+		     "1:\tmovdqa %%xmm0, (%0)\n\t"
+		     "movdqa %%xmm0, 16(%0)\n\t"
+		     "movdqa %%xmm0, 32(%0)\n\t"
+		     "movdqa %%xmm0, 48(%0)\n\t"
+		     "addl $64, %0\n\t"
+		     "subl $64, %1\n\t"
+		     "jnz 1b"
+		     : "+r" (d), "+r" (n) : "r" (c) : "cc", "memory" SSE_CLOBBERS);
+}
+
+// Copy n bytes from s to 16-byte aligned d, lowest address first;
+// n % 64 == 0.  Each 64-byte block is loaded before it is stored, so
+// overlap with s above d is fine.
+static inline void
+sse_copy(char *d, const char *s, size_t n)
+{
+	asm volatile("1:\tmovdqu (%1), %%xmm0\n\t"
+		     "movdqu 16(%1), %%xmm1\n\t"
+		     "movdqu 32(%1), %%xmm2\n\t"
+		     "movdqu 48(%1), %%xmm3\n\t"
+		     "movdqa %%xmm0, (%0)\n\t"
+		     "movdqa %%xmm1, 16(%0)\n\t"
+		     "movdqa %%xmm2, 32(%0)\n\t"
+		     "movdqa %%xmm3, 48(%0)\n\t"
+		     "addl $64, %0\n\t"
+		     "addl $64, %1\n\t"
+		     "subl $64, %2\n\t"
+		     "jnz 1b"
+		     : "+r" (d), "+r" (s), "+r" (n)
+		     : : "cc", "memory" SSE_CLOBBERS);
+}
+
+// Copy the n bytes below s to those below 16-byte aligned d, highest
+// address first; n % 64 == 0.  For overlap with s below d.
+static inline void
+sse_copy_back(char *d, const char *s, size_t n)
+{
+	asm volatile("1:\tsubl $64, %0\n\t"
+		     "subl $64, %1\n\t"
+		     "movdqu (%1), %%xmm0\n\t"
+		     "movdqu 16(%1), %%xmm1\n\t"
+		     "movdqu 32(%1), %%xmm2\n\t"
+		     "movdqu 48(%1), %%xmm3\n\t"
+		     "movdqa %%xmm0, (%0)\n\t"
+		     "movdqa %%xmm1, 16(%0)\n\t"
+		     "movdqa %%xmm2, 32(%0)\n\t"
+		     "movdqa %%xmm3, 48(%0)\n\t"
+		     "subl $64, %2\n\t"
+		     "jnz 1b"
+		     : "+r" (d), "+r" (s), "+r" (n)
+		     : : "cc", "memory" SSE_CLOBBERS);
+}
+
+// Return a mask with bit i set if a[i] == b[i], for i < 16.
+static inline int
+sse_cmp16(const void *a, const void *b)
+{
+	int mask;
+
+	asm("movdqu %1, %%xmm0\n\t"
+	    "movdqu %2, %%xmm1\n\t"
+	    "pcmpeqb %%xmm1, %%xmm0\n\t"
+	    "pmovmskb %%xmm0, %0"
+	    : "=r" (mask)
+	    : "m" (*(const char (*)[16]) a), "m" (*(const char (*)[16]) b)
+	    : "cc" SSE_CLOBBERS);
+	return mask;
+}
+#endif
+
+// String instructions over n bytes or 4-byte words.  The 'r' forms
+// copy the n units just below d and s, highest address first.
+static inline void
+stosb(char *d, int c, size_t n)
+{
+	asm volatile("cld; rep stosb\n"
+		: "+D" (d), "+c" (n) : "a" (c) : "cc", "memory");
+}
+
+static inline void
+stosl(char *d, int c, size_t n)
+{
+	asm volatile("cld; rep stosl\n"
+		: "+D" (d), "+c" (n) : "a" (c) : "cc", "memory");
+}
+
+static inline void
+movsb(char *d, const char *s, size_t n)
+{
+	asm volatile("cld; rep movsb\n"
+		: "+D" (d), "+S" (s), "+c" (n) : : "cc", "memory");
+}
+
+static inline void
+movsl(char *d, const char *s, size_t n)
+{
+	asm volatile("cld; rep movsl\n"
+		: "+D" (d), "+S" (s), "+c" (n) : : "cc", "memory");
+}
+
+// Some versions of GCC rely on DF being clear, hence the cld.
+static inline void
+rmovsb(char *d, const char *s, size_t n)
+{
+	d--, s--;
+	asm volatile("std; rep movsb; cld\n"
+		: "+D" (d), "+S" (s), "+c" (n) : : "cc", "memory");
+}
+
+static inline void
+rmovsl(char *d, const char *s, size_t n)
+{
+	d -= 4, s -= 4;
+	asm volatile("std; rep movsl; cld\n"
+		: "+D" (d), "+S" (s), "+c" (n) : : "cc", "memory");
+}
+
 void *
 memset(void *v, int c, size_t n)
 {
-	char *p;
-
-	if (n == 0)
-		return v;
-	if ((int)v%4 == 0 && n%4 == 0) {
-		c &= 0xFF;
-		c = (c<<24)|(c<<16)|(c<<8)|c;
-		asm volatile("cld; rep stosl\n"
-			:: "D" (v), "a" (c), "c" (n/4)
-			: "cc", "memory");
-	} else
-		asm volatile("cld; rep stosb\n"
-			:: "D" (v), "a" (c), "c" (n)
-			: "cc", "memory");
+	char *p = v;
+	size_t m;
+
+	c &= 0xFF;
+	if (n >= 16) {
+		c = c * 0x01010101;
+		m = -(uintptr_t) p & 15;
+		stosb(p, c, m);
+		p += m, n -= m;
+#ifdef JOS_USER
+		if (n >= SSE_MIN && have_sse2()) {
+			sse_set(p, c, n & ~63);
+			p += n & ~63;
+			n &= 63;
+		}
+#endif
+		stosl(p, c, n / 4);
+		p += n & ~3;
+		n &= 3;
+	}
+	stosb(p, c, n);
 	return v;
 }
 
@@ -135,31 +316,72 @@ memmove(void *dst, const void *src, size_t n)
 {
 	const char *s;
 	char *d;
-	
+	size_t m;
+
 	s = src;
 	d = dst;
 	if (s < d && s + n > d) {
+		// The source overlaps the end of the destination:
+		// copy from the top down
 		s += n;
 		d += n;
-		if ((int)s%4 == 0 && (int)d%4 == 0 && n%4 == 0)
-			asm volatile("std; rep movsl\n"
-				:: "D" (d-4), "S" (s-4), "c" (n/4) : "cc", "memory");
-		else
-			asm volatile("std; rep movsb\n"
-				:: "D" (d-1), "S" (s-1), "c" (n) : "cc", "memory");
-		// Some versions of GCC rely on DF being clear
-		asm volatile("cld" ::: "cc");
+		if (n >= 16) {
+			m = (uintptr_t) d & 15;
+			rmovsb(d, s, m);
+			d -= m, s -= m, n -= m;
+#ifdef JOS_USER
+			if (n >= SSE_MIN && have_sse2()) {
+				sse_copy_back(d, s, n & ~63);
+				d -= n & ~63;
+				s -= n & ~63;
+				n &= 63;
+			}
+#endif
+			rmovsl(d, s, n / 4);
+			d -= n & ~3, s -= n & ~3;
+			n &= 3;
+		}
+		rmovsb(d, s, n);
 	} else {
-		if ((int)s%4 == 0 && (int)d%4 == 0 && n%4 == 0)
-			asm volatile("cld; rep movsl\n"
-				:: "D" (d), "S" (s), "c" (n/4) : "cc", "memory");
-		else
-			asm volatile("cld; rep movsb\n"
-				:: "D" (d), "S" (s), "c" (n) : "cc", "memory");
+		if (n >= 16) {
+			m = -(uintptr_t) d & 15;
+			movsb(d, s, m);
+			d += m, s += m, n -= m;
+#ifdef JOS_USER
+			if (n >= SSE_MIN && have_sse2()) {
+				sse_copy(d, s, n & ~63);
+				d += n & ~63;
+				s += n & ~63;
+				n &= 63;
+			}
+#endif
+			movsl(d, s, n / 4);
+			d += n & ~3, s += n & ~3;
+			n &= 3;
+		}
+		movsb(d, s, n);
 	}
 	return dst;
 }
 
+// Zero or copy one page-aligned page.  Whole aligned pages are the
+// case 'rep stosl/movsl' is fastest at, and these leave the SSE
+// registers alone, so pgfault() can use them even when the fault
+// interrupted an SSE copy.
+void *
+pagezero(void *dst)
+{
+	stosl(dst, 0, PGSIZE / 4);
+	return dst;
+}
+
+void *
+pagecopy(void *dst, const void *src)
+{
+	movsl(dst, src, PGSIZE / 4);
+	return dst;
+}
+
 #else
 
 void *
@@ -197,6 +419,18 @@ memmove(void *dst, const void *src, size_t n)
 
 	return dst;
 }
+
+void *
+pagezero(void *dst)
+{
+	return memset(dst, 0, PGSIZE);
+}
+
+void *
+pagecopy(void *dst, const void *src)
+{
+	return memmove(dst, src, PGSIZE);
+}
 #endif
 
 /* sigh - gcc emits references to this for structure assignments! */
@@ -212,7 +446,23 @@ memcmp(const void *v1, const void *v2, size_t n)
 {
 	const uint8_t *s1 = (const uint8_t *) v1;
 	const uint8_t *s2 = (const uint8_t *) v2;
-
+	int mask;
+
+#if ASM && defined(JOS_USER)
+	if (n >= 16 && have_sse2()) {
+		// Skip 16 equal bytes at a time, then find the first
+		// difference in the block that has one
+		for (; n >= 16; s1 += 16, s2 += 16, n -= 16)
+			if ((mask = sse_cmp16(s1, s2)) != 0xFFFF) {
+				mask = __builtin_ctz(~mask);
+				return (int) s1[mask] - (int) s2[mask];
+			}
+	}
+#endif
+	// Then a word at a time while the words match
+	for (; n >= 4; s1 += 4, s2 += 4, n -= 4)
+		if (*(const uint32_t *) s1 != *(const uint32_t *) s2)
+			break;
 	while (n-- > 0) {
 		if (*s1 != *s2)
 			return (int) *s1 - (int) *s2;
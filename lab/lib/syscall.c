@@ -136,6 +136,61 @@ sys_page_unmap(envid_t envid, void *va)
 	return syscall(SYS_page_unmap, 1, envid, (uint32_t) va, 0, 0, 0);
 }
 
+int
+sys_page_table_share(envid_t srcenv, void *va, envid_t dstenv)
+{
+	return syscall(SYS_page_table_share, 1, srcenv, (uint32_t) va, dstenv, 0, 0);
+}
+
+int
+sys_env_set_pager(envid_t envid, envid_t pager, uintptr_t lo, uintptr_t hi)
+{
+	return syscall(SYS_env_set_pager, 1, envid, pager, lo, hi, 0);
+}
+
+int
+sys_pager_reply(envid_t envid, void *pg, int perm)
+{
+	return syscall(SYS_pager_reply, 1, envid, (uint32_t) pg, perm, 0, 0);
+}
+
+int
+sys_futex_wait(volatile uint32_t *addr, uint32_t val, unsigned deadline)
+{
+	return syscall(SYS_futex_wait, 0, (uint32_t) addr, val, deadline, 0, 0);
+}
+
+int
+sys_futex_wake(volatile uint32_t *addr, int n)
+{
+	return syscall(SYS_futex_wake, 0, (uint32_t) addr, n, 0, 0, 0);
+}
+
+envid_t
+sys_thread_create(uintptr_t eip, uintptr_t esp, uintptr_t xstacktop,
+		  uintptr_t tls)
+{
+	return syscall(SYS_thread_create, 0, eip, esp, xstacktop, tls, 0);
+}
+
+int
+sys_cons_log(uint32_t *pos, char *buf, size_t len)
+{
+	return syscall(SYS_cons_log, 0, (uint32_t) pos, (uint32_t) buf, len, 0, 0);
+}
+
+int
+sys_prof(int cmd, envid_t envid, struct ProfEntry *ents, size_t n)
+{
+	return syscall(SYS_prof, 0, cmd, envid, (uint32_t) ents, n, 0);
+}
+
+int
+sys_trace(int cmd, uint32_t mask, uint32_t *pos, struct TraceEvent *ev, size_t n)
+{
+	return syscall(SYS_trace, 0, cmd, mask, (uint32_t) pos, (uint32_t) ev, n);
+}
+
 // sys_exofork is inlined in lib.h
 
 int
@@ -169,9 +224,21 @@ sys_ipc_try_send(envid_t envid, uint32_t value, void *srcva, int perm)
 }
 
 int
-sys_ipc_recv(void *dstva)
+sys_ipc_recv(void *dstva, unsigned deadline)
+{
+	return syscall(SYS_ipc_recv, 1, (uint32_t)dstva, deadline, 0, 0, 0);
+}
+
+int
+sys_time_nsec(uint64_t *nsec)
+{
+	return syscall(SYS_time_nsec, 0, (uint32_t) nsec, 0, 0, 0, 0);
+}
+
+int
+sys_sleep_until(unsigned msec)
 {
-	return syscall(SYS_ipc_recv, 1, (uint32_t)dstva, 0, 0, 0, 0);
+	return syscall(SYS_sleep_until, 0, msec, 0, 0, 0, 0);
 }
 
 unsigned int
@@ -0,0 +1,125 @@
+// Threads on sys_thread_create.
+//
+// Each thread gets a slot of THRSLOT bytes from THRBASE up (see
+// inc/thread.h), with its struct Thread at the very top of its stack.
+// A slot is reused once the thread that had it is gone, and its pages
+// stay mapped for the next one.
+
+#include <inc/lib.h>
+#include <inc/x86.h>
+
+#define SLOT_BUSY	((uint32_t) -1)	// owner not known yet
+
+// Envid of each slot's last thread, 0 if none
+static volatile uint32_t thr_owner[THRMAX];
+static bool thr_mapped[THRMAX];
+
+static bool
+slot_free(uint32_t id)
+{
+	volatile struct Env *e = &envs[ENVX(id)];
+
+	if (id == 0)
+		return 1;
+	return id != SLOT_BUSY
+		&& (e->env_id != id || e->env_status == ENV_FREE);
+}
+
+static int
+slot_map(uintptr_t slot)
+{
+	uintptr_t va;
+	int r;
+
+	if ((r = sys_page_alloc(0, (void *) (slot + THRXSTACK - PGSIZE),
+				PTE_P|PTE_U|PTE_W)) < 0)
+		return r;
+	for (va = slot + THRSTACK; va < slot + THRSLOT; va += PGSIZE)
+		if ((r = sys_page_alloc(0, (void *) va, PTE_P|PTE_U|PTE_W)) < 0)
+			return r;
+	return 0;
+}
+
+static void
+thr_start(struct Thread *t)
+{
+	t->t_env = &envs[ENVX(sys_getenvid())];
+	t->t_func(t->t_arg);
+	thr_exit();
+}
+
+// Start a thread running func(arg) in this address space.
+// Returns its envid, < 0 on error.
+envid_t
+thr_create(void (*func)(void *), void *arg)
+{
+	struct Thread *t;
+	uintptr_t slot;
+	uint32_t *sp;
+	uint32_t owner;
+	envid_t id;
+	int i, r;
+
+	for (i = 0; i < THRMAX; i++) {
+		owner = thr_owner[i];
+		if (slot_free(owner)
+		    && cmpxchg(&thr_owner[i], owner, SLOT_BUSY) == owner)
+			break;
+	}
+	if (i == THRMAX)
+		return -E_NO_FREE_ENV;
+
+	slot = THRBASE + i * THRSLOT;
+	if (!thr_mapped[i]) {
+		if ((r = slot_map(slot)) < 0) {
+			thr_owner[i] = 0;
+			return r;
+		}
+		thr_mapped[i] = 1;
+	}
+
+	t = (struct Thread *) (slot + THRSLOT) - 1;
+	memset(t, 0, sizeof(*t));
+	t->t_self = t;
+	t->t_func = func;
+	t->t_arg = arg;
+
+	// thr_start(t), returning nowhere
+	sp = (uint32_t *) t;
+	*--sp = (uint32_t) t;
+	*--sp = 0;
+
+	if ((id = sys_thread_create((uintptr_t) thr_start, (uintptr_t) sp,
+				    slot + THRXSTACK, (uintptr_t) t)) < 0)
+		thr_owner[i] = 0;
+	else
+		thr_owner[i] = id;
+	return id;
+}
+
+// Called in the child of a fork(), where none of the threads came
+// along: their slots are free, but the child's own stack if a thread
+// forked it, and new threads get fresh pages rather than the ones the
+// child shares copy-on-write.
+void
+thr_forkchild(void)
+{
+	uintptr_t sp = (uintptr_t) &sp;
+	int i;
+
+	for (i = 0; i < THRMAX; i++) {
+		thr_owner[i] = 0;
+		thr_mapped[i] = 0;
+	}
+	if (sp >= THRBASE && sp < THRBASE + THRMAX * THRSLOT)
+		thr_owner[(sp - THRBASE) / THRSLOT] = SLOT_BUSY;
+}
+
+// Exit the calling thread.  Unlike exit(), this leaves the file
+// descriptors open for the rest of the threads.
+void
+thr_exit(void)
+{
+	sys_env_destroy(0);
+	panic("thr_exit: still running");
+}
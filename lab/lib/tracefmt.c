@@ -0,0 +1,95 @@
+// Event trace names and text, shared by the kernel monitor and
+// user/trace.
+
+#include <inc/stdio.h>
+#include <inc/string.h>
+#include <inc/error.h>
+#include <inc/trace.h>
+
+static const struct {
+	const char *name;
+	uint32_t mask;
+} trace_cats[] = {
+	{ "sched", TRACE_SCHED },
+	{ "ipc", TRACE_IPC },
+	{ "pgflt", TRACE_PGFLT },
+	{ "irq", TRACE_IRQ },
+	{ "clock", TRACE_CLOCK },
+	{ "all", TRACE_ALL },
+	{ "none", 0 },
+};
+
+static const struct {
+	uint32_t type;
+	const char *name;
+} trace_events[] = {
+	{ TE_RUN, "run" },
+	{ TE_IDLE, "idle" },
+	{ TE_SEND, "send" },
+	{ TE_SEND_BUSY, "sendbusy" },
+	{ TE_RECV, "recv" },
+	{ TE_PGFLT, "pgflt" },
+	{ TE_IRQ, "irq" },
+	{ TE_CLOCK, "clock" },
+};
+
+#define NELEM(a)	(sizeof(a) / sizeof((a)[0]))
+
+// Parse a comma-separated list of category names, such as "sched,ipc"
+// or "all", into a mask.  Returns -E_INVAL on an unknown name.
+int
+trace_parse_mask(const char *s)
+{
+	const char *end;
+	size_t i, len;
+	int mask = 0;
+
+	while (*s) {
+		if ((end = strchr(s, ',')) == NULL)
+			end = s + strlen(s);
+		len = end - s;
+		for (i = 0; i < NELEM(trace_cats); i++)
+			if (strlen(trace_cats[i].name) == len
+			    && strncmp(trace_cats[i].name, s, len) == 0)
+				break;
+		if (i == NELEM(trace_cats))
+			return -E_INVAL;
+		mask |= trace_cats[i].mask;
+		s = *end ? end + 1 : end;
+	}
+	return mask;
+}
+
+// Write the names of the categories in mask to buf, comma-separated.
+void
+trace_mask_names(char *buf, int size, uint32_t mask)
+{
+	size_t i;
+	int n = 0;
+
+	buf[0] = 0;
+	for (i = 0; i < NELEM(trace_cats) && n < size; i++)
+		if (trace_cats[i].mask != TRACE_ALL
+		    && (trace_cats[i].mask & mask))
+			n += snprintf(buf + n, size - n, "%s%s",
+				      n ? "," : "", trace_cats[i].name);
+	if (n == 0)
+		snprintf(buf, size, "none");
+}
+
+// Write te to buf as a line of text, as user/trace prints it:
+//	<tsc> <event> <envid> <arg0> <arg1>
+// Returns what snprintf() does.
+int
+trace_format(char *buf, int size, const struct TraceEvent *te)
+{
+	const char *name = "?";
+	size_t i;
+
+	for (i = 0; i < NELEM(trace_events); i++)
+		if (trace_events[i].type == te->te_type)
+			name = trace_events[i].name;
+	return snprintf(buf, size, "%08x%08x %-8s %08x %08x %08x\n",
+			(uint32_t) (te->te_tsc >> 32), (uint32_t) te->te_tsc,
+			name, te->te_env, te->te_arg[0], te->te_arg[1]);
+}
@@ -5,9 +5,11 @@ void
 wait(envid_t envid)
 {
 	volatile struct Env *e;
+	unsigned status;
 
 	assert(envid != 0);
 	e = &envs[ENVX(envid)];
-	while (e->env_id == envid && e->env_status != ENV_FREE)
-		sys_yield();
+	// The kernel wakes us when the env is freed
+	while (e->env_id == envid && (status = e->env_status) != ENV_FREE)
+		sys_futex_wait(&e->env_status, status, 0);
 }
@@ -23,11 +23,10 @@ input(envid_t ns_envid)
 			panic("input: sys_page_alloc FAILED: %e", r);
 		}
 
-		r = -E_NO_DATA;
-		while (r == -E_NO_DATA) {
+		// Sleeps in the kernel until a frame arrives
+		do {
 			r = sys_net_rx_pkt(pkt->jp_data, ETH_PKTSZ_MAX);
-			sys_yield();
-		}
+		} while (r == -E_NO_DATA);
 		if (r < 0) {
 			panic("input: sys_net_rx_pkt FAILED: %e", r);
 		}
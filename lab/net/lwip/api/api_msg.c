@@ -51,6 +51,7 @@
 #include "lwip/tcpip.h"
 #include "lwip/igmp.h"
 #include "lwip/dns.h"
+#include "lwip/sockets.h"
 
 /* forward declarations */
 #if LWIP_TCP
@@ -258,6 +259,11 @@ sent_tcp(void *arg, struct tcp_pcb *pcb, u16_t len)
   LWIP_UNUSED_ARG(pcb);
   LWIP_ASSERT("conn != NULL", (conn != NULL));
 
+#if LWIP_SOCKET
+  /* JOS: wake threads waiting for data queued by reference to go */
+  lwip_sent_notify();
+#endif
+
   if (conn->state == NETCONN_WRITE) {
     LWIP_ASSERT("conn->pcb.tcp != NULL", conn->pcb.tcp != NULL);
     do_writemore(conn);
@@ -290,6 +296,10 @@ err_tcp(void *arg, err_t err)
   LWIP_ASSERT("conn != NULL", (conn != NULL));
 
   conn->pcb.tcp = NULL;
+#if LWIP_SOCKET
+  /* JOS: the pcb and its queued segments are gone */
+  lwip_sent_notify();
+#endif
 
   conn->err = err;
   if (conn->recvmbox != SYS_MBOX_NULL) {
@@ -54,6 +54,8 @@
 
 #include <string.h>
 
+#include <arch/thread.h>
+
 #define NUM_SOCKETS MEMP_NUM_NETCONN
 
 /** Contains all internal pointers and states used for a socket */
@@ -605,6 +607,19 @@ lwip_recv(int s, void *mem, int len, unsigned int flags)
   return lwip_recvfrom(s, mem, len, flags, NULL, NULL);
 }
 
+/**
+ * JOS extension: how much of 'size' bytes a TCP connection takes into its
+ * send buffer now, without netconn_write() waiting for acknowledgements.
+ * A connection that is gone takes it all, for netconn_write() to fail.
+ */
+static int
+sock_sendspace(struct lwip_socket *sock, int size)
+{
+  if (sock->conn->pcb.tcp == NULL)
+    return size;
+  return LWIP_MIN(size, tcp_sndbuf(sock->conn->pcb.tcp));
+}
+
 int
 lwip_send(int s, const void *data, int size, unsigned int flags)
 {
@@ -627,6 +642,11 @@ lwip_send(int s, const void *data, int size, unsigned int flags)
 #endif /* (LWIP_UDP || LWIP_RAW) */
   }
 
+  if ((flags & MSG_DONTWAIT) && (size = sock_sendspace(sock, size)) == 0) {
+    sock_set_errno(sock, EWOULDBLOCK);
+    return -1;
+  }
+
   err = netconn_write(sock->conn, data, size, NETCONN_COPY | ((flags & MSG_MORE)?NETCONN_MORE:0));
 
   LWIP_DEBUGF(SOCKETS_DEBUG, ("lwip_send(%d) err=%d size=%d\n", s, err, size));
@@ -634,6 +654,116 @@ lwip_send(int s, const void *data, int size, unsigned int flags)
   return (err==ERR_OK?size:-1);
 }
 
+/**
+ * JOS extension: like lwip_send() for TCP sockets, but the data is not
+ * copied into the stack.  tcp_enqueue() references it with PBUF_ROM
+ * pbufs, so it must stay valid until lwip_sent() reports the sequence
+ * number stored in *endseq as acknowledged.  With MSG_DONTWAIT, only
+ * what fits in the send buffer now is queued, as for lwip_send().
+ *
+ * @param endseq set to the sequence number following the last byte queued
+ */
+int
+lwip_send_nocopy(int s, const void *data, int size, unsigned int flags, u32_t *endseq)
+{
+  struct lwip_socket *sock;
+  err_t err;
+
+  LWIP_DEBUGF(SOCKETS_DEBUG, ("lwip_send_nocopy(%d, data=%p, size=%d, flags=0x%x)\n",
+                              s, data, size, flags));
+
+  sock = get_socket(s);
+  if (!sock)
+    return -1;
+
+  if (sock->conn->type!=NETCONN_TCP) {
+    sock_set_errno(sock, err_to_errno(ERR_ARG));
+    return -1;
+  }
+
+  if ((flags & MSG_DONTWAIT) && (size = sock_sendspace(sock, size)) == 0) {
+    sock_set_errno(sock, EWOULDBLOCK);
+    return -1;
+  }
+
+  err = netconn_write(sock->conn, data, size, NETCONN_NOCOPY | ((flags & MSG_MORE)?NETCONN_MORE:0));
+  if (sock->conn->pcb.tcp != NULL)
+    *endseq = sock->conn->pcb.tcp->snd_lbb;
+
+  LWIP_DEBUGF(SOCKETS_DEBUG, ("lwip_send_nocopy(%d) err=%d size=%d\n", s, err, size));
+  sock_set_errno(sock, err_to_errno(err));
+  return (err==ERR_OK?size:-1);
+}
+
+/**
+ * JOS extension: check whether data queued with lwip_send_nocopy() is
+ * still referenced by the stack.
+ *
+ * @return 1 once everything before endseq has been acknowledged or the
+ *         connection is gone (which frees all queued segments), 0 otherwise
+ */
+int
+lwip_sent(int s, u32_t endseq)
+{
+  struct lwip_socket *sock;
+  struct tcp_pcb *pcb;
+
+  sock = get_socket(s);
+  if (!sock || sock->conn->type!=NETCONN_TCP)
+    return 1;
+
+  pcb = sock->conn->pcb.tcp;
+  if (pcb == NULL || pcb->state == CLOSED)
+    return 1;
+
+  return TCP_SEQ_GEQ(pcb->lastack, endseq);
+}
+
+/** JOS extension: bumped whenever a TCP peer acknowledges data or a
+ * TCP connection fails, so that a thread waiting for lwip_sent() can
+ * sleep on it with thread_wait(). */
+volatile u32_t lwip_sent_gen;
+
+/**
+ * JOS extension: called from the TCP sent and error callbacks to bump
+ * lwip_sent_gen and wake its waiters.
+ */
+void
+lwip_sent_notify(void)
+{
+  lwip_sent_gen++;
+  thread_wakeup(&lwip_sent_gen);
+}
+
+/**
+ * JOS extension: how many of 'size' bytes lwip_send() or
+ * lwip_send_nocopy() with MSG_DONTWAIT would queue on socket s now.
+ * Datagram sockets take it all.
+ */
+int
+lwip_sendspace(int s, int size)
+{
+  struct lwip_socket *sock;
+
+  sock = get_socket(s);
+  if (!sock || sock->conn->type!=NETCONN_TCP)
+    return size;
+  return sock_sendspace(sock, size);
+}
+
+/**
+ * JOS extension: whether socket s is a TCP socket, which
+ * lwip_send_nocopy() takes.
+ */
+int
+lwip_is_tcp(int s)
+{
+  struct lwip_socket *sock;
+
+  sock = get_socket(s);
+  return sock && sock->conn->type==NETCONN_TCP;
+}
+
 int
 lwip_sendto(int s, const void *data, int size, unsigned int flags,
        struct sockaddr *to, socklen_t tolen)
@@ -40,7 +40,7 @@ extern "C" {
 
 #if MEM_LIBC_MALLOC
 
-#include <stddef.h> /* for size_t */
+#include <inc/types.h> /* for size_t; JOS has no stddef.h */
 
 typedef size_t mem_size_t;
 
@@ -314,6 +314,12 @@ int lwip_read(int s, void *mem, int len);
 int lwip_recvfrom(int s, void *mem, int len, unsigned int flags,
       struct sockaddr *from, socklen_t *fromlen);
 int lwip_send(int s, const void *dataptr, int size, unsigned int flags);
+int lwip_send_nocopy(int s, const void *dataptr, int size, unsigned int flags, u32_t *endseq);
+int lwip_sent(int s, u32_t endseq);
+extern volatile u32_t lwip_sent_gen;
+void lwip_sent_notify(void);
+int lwip_is_tcp(int s);
+int lwip_sendspace(int s, int size);
 int lwip_sendto(int s, const void *dataptr, int size, unsigned int flags,
     struct sockaddr *to, socklen_t tolen);
 int lwip_socket(int domain, int type, int protocol);
@@ -0,0 +1,369 @@
+// Page-granular slab allocator behind lwIP's mem_malloc() and memp.
+//
+// lwIP's own heap (core/mem.c) and pools (core/memp.c) reserve MEM_SIZE
+// bytes plus every pool's worst case up front.  Here memory is taken a
+// page at a time with sys_page_alloc() and handed back with
+// sys_page_unmap() once a page empties, so the network server's
+// footprint follows its live connections.  MEM_SIZE and the MEMP_NUM_*
+// options only cap how much may be in use at once.
+//
+// A slab is one page: a struct slab header followed by equal-sized
+// objects on a free list.  Every memp pool has a cache of its exact
+// element size; mem_malloc() rounds up to one of a few size classes.
+// Requests too big for a slab get whole pages of their own.
+// Usage is reported in lwip_stats.mem and lwip_stats.memp[].
+//
+// If the kernel can give us one, the first 4MB of the range is a single
+// 4MB page, so the slabs in use most of the time share one TLB entry.
+// Pages there stay mapped when their slab empties.
+
+#include <inc/lib.h>
+
+#include <lwip/opt.h>
+#include <lwip/mem.h>
+#include <lwip/memp.h>
+#include <lwip/pbuf.h>
+#include <lwip/udp.h>
+#include <lwip/raw.h>
+#include <lwip/tcp.h>
+#include <lwip/igmp.h>
+#include <lwip/api.h>
+#include <lwip/api_msg.h>
+#include <lwip/tcpip.h>
+#include <lwip/sys.h>
+#include <lwip/stats.h>
+#include <netif/etharp.h>
+#include <lwip/ip_frag.h>
+
+// Address range slab pages are mapped in, 4MB-aligned
+#define SLAB_VA		0x20000000
+#define SLAB_NPAGES	16384
+
+struct slab_cache;
+
+struct slab {
+	LIST_ENTRY(slab) s_link;	// on the cache's partial list
+	struct slab_cache *s_cache;	// NULL for a large allocation
+	void *s_free;			// free objects in this slab
+	u16_t s_inuse;			// objects handed out
+	u16_t s_npages;			// pages, for a large allocation
+};
+
+#define SLAB_HDRSIZE	LWIP_MEM_ALIGN_SIZE(sizeof(struct slab))
+#define SLAB_OBJMAX	(PGSIZE - SLAB_HDRSIZE)
+
+LIST_HEAD(slab_list, slab);
+
+struct slab_cache {
+	const char *c_name;
+	u16_t c_size;			// object size
+	u16_t c_perslab;		// objects per slab
+	u16_t c_limit;			// max objects in use, 0 for no limit
+	u16_t c_inuse;
+	u16_t c_nempty;			// empty slabs kept around
+	struct slab_list c_partial;	// slabs with a free object
+};
+
+// Size classes for mem_malloc().  The last two pack three and two
+// full-sized Ethernet frames into a page.
+#define MEM_CACHE(size)	{ "mem" #size, (size), SLAB_OBJMAX / (size) }
+static struct slab_cache mem_caches[] = {
+	MEM_CACHE(32), MEM_CACHE(64), MEM_CACHE(128), MEM_CACHE(256),
+	MEM_CACHE(512), MEM_CACHE(1024), MEM_CACHE(1352), MEM_CACHE(2036),
+};
+#define NMEMCACHE	(sizeof(mem_caches) / sizeof(mem_caches[0]))
+
+static struct slab_cache memp_caches[MEMP_MAX];
+
+// Pool elements carry no header here, unlike in core/memp.c
+#define MEMP_ALIGN_SIZE(x)	LWIP_MEM_ALIGN_SIZE(x)
+
+static const u16_t memp_sizes[MEMP_MAX] = {
+#define LWIP_MEMPOOL(name,num,size,desc)  LWIP_MEM_ALIGN_SIZE(size),
+#include <lwip/memp_std.h>
+};
+
+static const u16_t memp_num[MEMP_MAX] = {
+#define LWIP_MEMPOOL(name,num,size,desc)  (num),
+#include <lwip/memp_std.h>
+};
+
+static const char *memp_desc[MEMP_MAX] = {
+#define LWIP_MEMPOOL(name,num,size,desc)  (desc),
+#include <lwip/memp_std.h>
+};
+
+// Which pages of the slab range are mapped
+static uint32_t slab_map[SLAB_NPAGES / 32];
+static int slab_hint;
+static int slab_npages;
+static int slab_nlarge;		// pages backed by the 4MB page
+static mem_size_t mem_used;
+
+#define MAPPED(i)	(slab_map[(i) / 32] & (1 << ((i) % 32)))
+
+// Map 'n' contiguous fresh pages from the slab range.
+static void *
+slab_page_alloc(int n)
+{
+	int i, j, start, r;
+	uintptr_t va;
+
+	for (i = 0; i < SLAB_NPAGES; i++) {
+		start = (slab_hint + i) % SLAB_NPAGES;
+		if (start + n > SLAB_NPAGES)
+			continue;
+		for (j = 0; j < n && !MAPPED(start + j); j++)
+			;
+		if (j < n) {
+			i += j;
+			continue;
+		}
+
+		va = SLAB_VA + start * PGSIZE;
+		for (j = 0; j < n; j++)
+			if (start + j >= slab_nlarge
+			    && (r = sys_page_alloc(0, (void *) (va + j * PGSIZE),
+						   PTE_P|PTE_U|PTE_W)) < 0) {
+				while (--j >= 0)
+					if (start + j >= slab_nlarge)
+						sys_page_unmap(0, (void *) (va + j * PGSIZE));
+				return NULL;
+			}
+		for (j = start; j < start + n; j++)
+			slab_map[j / 32] |= 1 << (j % 32);
+		slab_hint = start + n;
+		slab_npages += n;
+		return (void *) va;
+	}
+	return NULL;
+}
+
+static void
+slab_page_free(void *va, int n)
+{
+	int i, start = ((uintptr_t) va - SLAB_VA) / PGSIZE;
+
+	for (i = start; i < start + n; i++) {
+		if (i >= slab_nlarge)
+			sys_page_unmap(0, (void *) (SLAB_VA + i * PGSIZE));
+		slab_map[i / 32] &= ~(1 << (i % 32));
+	}
+	slab_npages -= n;
+	// Refill the 4MB page before spilling past it again
+	if (start < slab_nlarge)
+		slab_hint = MIN(slab_hint, start);
+}
+
+static struct slab *
+slab_of(void *obj)
+{
+	LWIP_ASSERT("slab: pointer outside the slab range",
+		    (uintptr_t) obj >= SLAB_VA
+		    && (uintptr_t) obj < SLAB_VA + SLAB_NPAGES * PGSIZE);
+	return (struct slab *) ROUNDDOWN(obj, PGSIZE);
+}
+
+static struct slab *
+slab_new(struct slab_cache *c)
+{
+	struct slab *s;
+	char *obj;
+	int i;
+
+	if ((s = slab_page_alloc(1)) == NULL)
+		return NULL;
+	s->s_cache = c;
+	s->s_inuse = 0;
+	s->s_npages = 1;
+	s->s_free = NULL;
+	obj = (char *) s + SLAB_HDRSIZE;
+	for (i = 0; i < c->c_perslab; i++, obj += c->c_size) {
+		*(void **) obj = s->s_free;
+		s->s_free = obj;
+	}
+	LIST_INSERT_HEAD(&c->c_partial, s, s_link);
+	c->c_nempty++;
+	return s;
+}
+
+static void *
+cache_alloc(struct slab_cache *c)
+{
+	struct slab *s;
+	void *obj;
+
+	if (c->c_limit && c->c_inuse >= c->c_limit)
+		return NULL;
+	if ((s = LIST_FIRST(&c->c_partial)) == NULL
+	    && (s = slab_new(c)) == NULL)
+		return NULL;
+
+	obj = s->s_free;
+	s->s_free = *(void **) obj;
+	if (s->s_inuse++ == 0)
+		c->c_nempty--;
+	if (s->s_free == NULL)
+		LIST_REMOVE(s, s_link);
+	c->c_inuse++;
+	return obj;
+}
+
+static void
+cache_free(struct slab_cache *c, struct slab *s, void *obj)
+{
+	if (s->s_free == NULL)
+		LIST_INSERT_HEAD(&c->c_partial, s, s_link);
+	*(void **) obj = s->s_free;
+	s->s_free = obj;
+	c->c_inuse--;
+
+	if (--s->s_inuse == 0) {
+		// Keep one empty slab so alloc/free pairs don't churn pages
+		if (c->c_nempty > 0) {
+			LIST_REMOVE(s, s_link);
+			slab_page_free(s, 1);
+		} else
+			c->c_nempty++;
+	}
+}
+
+void *
+jos_mem_malloc(mem_size_t size)
+{
+	struct slab *s;
+	mem_size_t n;
+	void *obj = NULL;
+	int i;
+
+	size = LWIP_MEM_ALIGN_SIZE(size);
+	for (i = 0; i < NMEMCACHE && mem_caches[i].c_size < size; i++)
+		;
+	if (i < NMEMCACHE)
+		n = mem_caches[i].c_size;
+	else
+		n = ROUNDUP(size + SLAB_HDRSIZE, PGSIZE);
+
+	if (mem_used + n <= MEM_SIZE) {
+		if (i < NMEMCACHE)
+			obj = cache_alloc(&mem_caches[i]);
+		else if ((s = slab_page_alloc(n / PGSIZE)) != NULL) {
+			s->s_cache = NULL;
+			s->s_npages = n / PGSIZE;
+			obj = (char *) s + SLAB_HDRSIZE;
+		}
+	}
+
+	if (obj == NULL) {
+		LWIP_DEBUGF(MEM_DEBUG | 2, ("mem_malloc: out of memory for %u bytes\n", size));
+		MEM_STATS_INC(err);
+		return NULL;
+	}
+	mem_used += n;
+	MEM_STATS_INC_USED(used, n);
+	return obj;
+}
+
+void
+jos_mem_free(void *mem)
+{
+	struct slab *s;
+
+	if (mem == NULL)
+		return;
+	s = slab_of(mem);
+	if (s->s_cache) {
+		mem_used -= s->s_cache->c_size;
+		MEM_STATS_DEC_USED(used, s->s_cache->c_size);
+		cache_free(s->s_cache, s, mem);
+	} else {
+		mem_used -= s->s_npages * PGSIZE;
+		MEM_STATS_DEC_USED(used, s->s_npages * PGSIZE);
+		slab_page_free(s, s->s_npages);
+	}
+}
+
+void *
+jos_mem_calloc(mem_size_t count, mem_size_t size)
+{
+	void *p;
+
+	if ((p = jos_mem_malloc(count * size)) != NULL)
+		memset(p, 0, count * size);
+	return p;
+}
+
+// lwIP only ever shrinks an allocation (pbuf_realloc), which fits in
+// place.
+void *
+jos_mem_realloc(void *mem, mem_size_t size)
+{
+	return mem;
+}
+
+void
+memp_init(void)
+{
+	int i;
+
+	if (sys_page_alloc(0, (void *) SLAB_VA, PTE_P|PTE_U|PTE_W|PTE_PS) == 0)
+		slab_nlarge = PTSIZE / PGSIZE;
+
+	for (i = 0; i < MEMP_MAX; i++) {
+		LWIP_ASSERT("memp_init: pool element too large for a slab",
+			    memp_sizes[i] <= SLAB_OBJMAX);
+		memp_caches[i].c_name = memp_desc[i];
+		memp_caches[i].c_size = MAX(memp_sizes[i], sizeof(void *));
+		memp_caches[i].c_perslab = SLAB_OBJMAX / memp_caches[i].c_size;
+		memp_caches[i].c_limit = memp_num[i];
+		LIST_INIT(&memp_caches[i].c_partial);
+
+		MEMP_STATS_AVAIL(used, i, 0);
+		MEMP_STATS_AVAIL(max, i, 0);
+		MEMP_STATS_AVAIL(err, i, 0);
+		MEMP_STATS_AVAIL(avail, i, memp_num[i]);
+	}
+	MEM_STATS_AVAIL(avail, MEM_SIZE);
+}
+
+void *
+memp_malloc(memp_t type)
+{
+	void *mem;
+
+	LWIP_ERROR("memp_malloc: type < MEMP_MAX", (type < MEMP_MAX), return NULL;);
+
+	if ((mem = cache_alloc(&memp_caches[type])) == NULL) {
+		LWIP_DEBUGF(MEMP_DEBUG | 2, ("memp_malloc: out of memory in pool %s\n", memp_desc[type]));
+		MEMP_STATS_INC(err, type);
+		return NULL;
+	}
+	MEMP_STATS_INC_USED(used, type);
+	return mem;
+}
+
+void
+memp_free(memp_t type, void *mem)
+{
+	if (mem == NULL)
+		return;
+	MEMP_STATS_DEC(used, type);
+	cache_free(&memp_caches[type], slab_of(mem), mem);
+}
+
+// Print what each cache holds and how many pages are mapped.
+void
+slab_stats_display(void)
+{
+	struct slab_cache *c;
+	int i;
+
+	cprintf("slab: %d pages in use, the first %d in a 4MB page, "
+		"%u bytes of mem in use\n", slab_npages, slab_nlarge, mem_used);
+	for (i = 0; i < NMEMCACHE + MEMP_MAX; i++) {
+		c = i < NMEMCACHE ? &mem_caches[i] : &memp_caches[i - NMEMCACHE];
+		if (c->c_inuse || c->c_nempty)
+			cprintf("  %-16s %5u x %4u bytes\n",
+				c->c_name, c->c_inuse, c->c_size);
+	}
+}
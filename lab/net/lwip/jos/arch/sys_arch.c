@@ -252,7 +252,7 @@ sys_thread_new(char *name, void (* thread)(void *arg), void *arg,
     if (lt == 0)
 	panic("sys_thread_new: cannot allocate thread struct");
 
-    if (stacksize > PGSIZE)
+    if (stacksize > THRSLOT - THRSTACK)
 	panic("large stack %d", stacksize);
 
     lt->func = thread;
@@ -311,6 +311,7 @@ out:
     return &t->tmo;
 }
 
+// Nothing to do: the threads only run lwIP holding thread.c's big lock.
 void
 lwip_core_lock(void)
 {
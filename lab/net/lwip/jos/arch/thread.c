@@ -1,188 +1,166 @@
+// lwIP's threads, each a thread of the ns env (lib/thread.c).
+//
+// They take turns, as the coroutines this replaced did: a thread holds
+// big_lock whenever it runs lwIP or ns code, and lets go only while it
+// waits or yields, so lwIP never sees two of them at once.  A waiting
+// thread sleeps in the kernel on the word it waits for.
+
 #include <inc/lib.h>
 
 #include <arch/thread.h>
-#include <arch/threadq.h>
-#include <arch/setjmp.h>
 
+enum { name_size = 32 };
+#define THREAD_NUM_ONHALT 4
+
+struct thread_context {
+    thread_id_t		tc_tid;
+    char		tc_name[name_size];
+    void		(*tc_entry)(uint32_t);
+    uint32_t		tc_arg;
+    void		(*tc_onhalt[THREAD_NUM_ONHALT])(thread_id_t);
+    int			tc_nonhalt;
+};
+
+static struct Mutex big_lock;
 static thread_id_t max_tid;
-static struct thread_context *cur_tc;
+static struct thread_context main_tc;
+
+// The initial thread has no thread block, and is main_tc.
+static struct thread_context *
+cur_thread(void) {
+    struct Thread *t = thr_self();
+    return t ? t->t_arg : &main_tc;
+}
 
-static struct thread_queue thread_queue;
-static struct thread_queue kill_queue;
+static thread_id_t
+alloc_tid(void) {
+    int tid = max_tid++;
+    if (max_tid == (uint32_t)~0)
+	panic("alloc_tid: no more thread ids");
+    return tid;
+}
+
+static void
+thread_set_name(struct thread_context *tc, const char *name)
+{
+    strncpy(tc->tc_name, name, name_size - 1);
+    tc->tc_name[name_size - 1] = 0;
+}
 
+// Make the calling thread the first lwIP thread, holding big_lock.
 void
 thread_init(void) {
-    threadq_init(&thread_queue);
+    mutex_init(&big_lock);
+    mutex_lock(&big_lock);
     max_tid = 0;
+    main_tc.tc_tid = alloc_tid();
+    thread_set_name(&main_tc, "main");
 }
 
 uint32_t
 thread_id(void) {
-    return cur_tc->tc_tid;
+    return cur_thread()->tc_tid;
 }
 
+// The waker changes *addr before calling this, so a thread about to
+// sleep on the old value does not miss it.
 void
 thread_wakeup(volatile uint32_t *addr) {
-    struct thread_context *tc = thread_queue.tq_first;
-    while (tc) {
-	if (tc->tc_wait_addr == addr)
-	    tc->tc_wakeup = 1;
-	tc = tc->tc_queue_link;
-    }
+    sys_futex_wake(addr, NENV);
 }
 
+// Wait until *addr != val, or sys_time_msec() reaches msec (~0 for
+// never), with big_lock let go meanwhile.
 void
 thread_wait(volatile uint32_t *addr, uint32_t val, uint32_t msec) {
-    uint32_t s = sys_time_msec();
-    uint32_t p = s;
-
-    cur_tc->tc_wait_addr = addr;
-    cur_tc->tc_wakeup = 0;
-
-    while (p < msec) {
-	if (p < s)
-	    break;
-	if (addr && *addr != val)
-	    break;
-	if (cur_tc->tc_wakeup)
-	    break;
-
-	thread_yield();
-	p = sys_time_msec();
-    }
+    unsigned deadline = msec == (uint32_t)~0 ? 0 : msec;
+
+    thread_unlock();
+    if (!addr)
+	sys_sleep_until(deadline);
+    else
+	while (*addr == val)
+	    if (sys_futex_wait(addr, val, deadline) == -E_TIMEOUT)
+		break;
+    thread_lock();
+}
 
-    cur_tc->tc_wait_addr = 0;
-    cur_tc->tc_wakeup = 0;
+// Let go of big_lock around a call that blocks outside lwIP,
+// such as ipc_recv.
+void
+thread_unlock(void) {
+    mutex_unlock(&big_lock);
 }
 
-int
-thread_wakeups_pending(void)
-{
-    struct thread_context *tc = thread_queue.tq_first;
-    int n = 0;
-    while (tc) {
-	if (tc->tc_wakeup)
-	    ++n;
-	tc = tc->tc_queue_link;
-    }
-    return n;
+void
+thread_lock(void) {
+    mutex_lock(&big_lock);
 }
 
 int
 thread_onhalt(void (*fun)(thread_id_t)) {
-    if (cur_tc->tc_nonhalt >= THREAD_NUM_ONHALT)
+    struct thread_context *tc = cur_thread();
+
+    if (tc->tc_nonhalt >= THREAD_NUM_ONHALT)
 	return -E_NO_MEM;
 
-    cur_tc->tc_onhalt[cur_tc->tc_nonhalt++] = fun;
+    tc->tc_onhalt[tc->tc_nonhalt++] = fun;
     return 0;
 }
 
-static thread_id_t
-alloc_tid(void) {
-    int tid = max_tid++;
-    if (max_tid == (uint32_t)~0)
-	panic("alloc_tid: no more thread ids");
-    return tid;
-}
-
 static void
-thread_set_name(struct thread_context *tc, const char *name)
-{
-    strncpy(tc->tc_name, name, name_size - 1);
-    tc->tc_name[name_size - 1] = 0;
-}
+thread_entry(void *arg) {
+    struct thread_context *tc = arg;
 
-static void
-thread_entry(void) {
-    cur_tc->tc_entry(cur_tc->tc_arg);
+    thread_lock();
+    tc->tc_entry(tc->tc_arg);
     thread_halt();
 }
 
 int
-thread_create(thread_id_t *tid, const char *name, 
+thread_create(thread_id_t *tid, const char *name,
 		void (*entry)(uint32_t), uint32_t arg) {
     struct thread_context *tc = malloc(sizeof(struct thread_context));
+    envid_t id;
+
     if (!tc)
 	return -E_NO_MEM;
 
     memset(tc, 0, sizeof(struct thread_context));
-    
+
     thread_set_name(tc, name);
     tc->tc_tid = alloc_tid();
-
-    tc->tc_stack_bottom = malloc(stack_size);
-    if (!tc->tc_stack_bottom) {
-	free(tc);
-	return -E_NO_MEM;
-    }
-
-    void *stacktop = tc->tc_stack_bottom + stack_size;
-    // Terminate stack unwinding
-    stacktop = stacktop - 4;
-    memset(stacktop, 0, 4);
-    
-    memset(&tc->tc_jb, 0, sizeof(tc->tc_jb));
-    tc->tc_jb.jb_esp = (uint32_t)stacktop;
-    tc->tc_jb.jb_eip = (uint32_t)&thread_entry;
     tc->tc_entry = entry;
     tc->tc_arg = arg;
 
-    threadq_push(&thread_queue, tc);
+    // The new thread runs once we let go of big_lock
+    if ((id = thr_create(thread_entry, tc)) < 0) {
+	free(tc);
+	return id;
+    }
 
     if (tid)
 	*tid = tc->tc_tid;
     return 0;
 }
 
-static void
-thread_clean(struct thread_context *tc) {
-    if (!tc) return;
-
+void
+thread_halt() {
+    struct thread_context *tc = cur_thread();
     int i;
+
     for (i = 0; i < tc->tc_nonhalt; i++)
 	tc->tc_onhalt[i](tc->tc_tid);
-    free(tc->tc_stack_bottom);
-    free(tc);
-}
+    if (tc != &main_tc)
+	free(tc);
 
-void
-thread_halt() {
-    // right now the kill_queue will never be more than one
-    // clean up a thread if one is on the queue
-    thread_clean(threadq_pop(&kill_queue));
-
-    threadq_push(&kill_queue, cur_tc);
-    cur_tc = NULL;
-    thread_yield();
-    // WHAT IF THERE ARE NO MORE THREADS? HOW DO WE STOP?
-    // when yield has no thread to run, it will return here!
-    exit();
+    thread_unlock();
+    thr_exit();
 }
 
 void
 thread_yield(void) {
-    struct thread_context *next_tc = threadq_pop(&thread_queue);
-
-    if (!next_tc)
-	return;
-
-    if (cur_tc) {
-	if (jos_setjmp(&cur_tc->tc_jb) != 0)
-	    return;
-	threadq_push(&thread_queue, cur_tc);
-    }
-
-    cur_tc = next_tc;
-    jos_longjmp(&cur_tc->tc_jb, 1);
-}
-
-static void
-print_jb(struct thread_context *tc) {
-    cprintf("jump buffer for thread %s:\n", tc->tc_name);
-    cprintf("\teip: %x\n", tc->tc_jb.jb_eip);
-    cprintf("\tesp: %x\n", tc->tc_jb.jb_esp);
-    cprintf("\tebp: %x\n", tc->tc_jb.jb_ebp);
-    cprintf("\tebx: %x\n", tc->tc_jb.jb_ebx);
-    cprintf("\tesi: %x\n", tc->tc_jb.jb_esi);
-    cprintf("\tedi: %x\n", tc->tc_jb.jb_edi);
+    thread_unlock();
+    sys_yield();
+    thread_lock();
 }
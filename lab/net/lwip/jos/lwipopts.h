@@ -10,21 +10,51 @@ void *memcpy(void *dst, const void *src, size_t n);
 
 //#define NO_SYS 1
 
-#define LWIP_STATS		0
-#define LWIP_STATS_DISPLAY	0
+#define LWIP_STATS		1
+#define LWIP_STATS_DISPLAY	1
+// Only the memory counters; jos/arch/slab.c keeps them up to date
+#define MEM_STATS		1
+#define MEMP_STATS		1
+#define LINK_STATS		0
+#define ETHARP_STATS		0
+#define IP_STATS		0
+#define IPFRAG_STATS		0
+#define ICMP_STATS		0
+#define IGMP_STATS		0
+#define UDP_STATS		0
+#define TCP_STATS		0
+#define SYS_STATS		0
 #define LWIP_DHCP		1
 #define LWIP_COMPAT_SOCKETS	0
 //#define SYS_LIGHTWEIGHT_PROT	1
 #define LWIP_PROVIDE_ERRNO      1
+// Let connections to our own address (e.g. user/httpload against
+// jhttpd) loop back inside the stack instead of hitting the wire.
+#define LWIP_NETIF_LOOPBACK	1
 
 // Various tuning knobs, see:
 // http://lists.gnu.org/archive/html/lwip-users/2006-11/msg00007.html
 
 #define MEM_ALIGNMENT		4
 
+// mem_malloc() and the memp pools come from the page-granular slab
+// allocator in jos/arch/slab.c, which maps pages only as they are
+// needed.  MEM_SIZE and the MEMP_NUM_* values below are limits on
+// what may be in use at once, not reservations.
+#define MEM_LIBC_MALLOC		1
+#define mem_malloc		jos_mem_malloc
+#define mem_free		jos_mem_free
+#define mem_calloc		jos_mem_calloc
+#define mem_realloc		jos_mem_realloc
+void *jos_mem_malloc(size_t size);
+void jos_mem_free(void *mem);
+void *jos_mem_calloc(size_t count, size_t size);
+void *jos_mem_realloc(void *mem, size_t size);
+void slab_stats_display(void);
+
 #define MEMP_NUM_PBUF		64
 #define MEMP_NUM_UDP_PCB	8
-#define MEMP_NUM_TCP_PCB	32
+#define MEMP_NUM_TCP_PCB	256
 #define MEMP_NUM_TCP_PCB_LISTEN	16
 #define MEMP_NUM_TCP_SEG	TCP_SND_QUEUELEN// at least as big as TCP_SND_QUEUELEN
 #define MEMP_NUM_NETBUF		128
@@ -17,14 +17,16 @@ output(envid_t ns_envid)
 	while (1) {
 		r = ipc_recv(&env, &nsipcbuf.pkt, &perm);
 		assert(r == NSREQ_OUTPUT);
-		assert(env == ns_envid);
+		// from ns or one of its threads
+		assert(env == ns_envid
+		       || envs[ENVX(env)].env_parent_id == ns_envid);
 		assert((perm & PTE_W) != 0);
 
-		r = -E_NO_BUFS;
-		while (r == -E_NO_BUFS) {
+		// While the transmit ring is full the kernel puts us to
+		// sleep, so just retry.
+		do {
 			r = sys_net_tx_pkt(nsipcbuf.pkt.jp_data, nsipcbuf.pkt.jp_len);
-			sys_yield();
-		}
+		} while (r == -E_NO_BUFS);
 		if (r < 0) {
 			panic("output: sys_net_tx_pkt FAILED: %e", r);
 		}
@@ -33,19 +33,34 @@ struct netif nif;
 
 #define debug 0
 
-struct timer_thread {
-	uint32_t msec;
-	void (*func)(void);
-	const char *name;
+static envid_t input_envid;
+static envid_t output_envid;
+
+extern union Fsipc fsipcbuf;	// page-aligned, declared in entry.S
+
+// Pages queued on a TCP connection by reference are pinned until the
+// peer acknowledges them: a sendfile's block cache pages, at most
+// SENDFILE_NPAGES a connection, and at most SENDFILE_MAXPAGES in all,
+// so serve() always finds a free request buffer.  lwIP's sent and
+// error callbacks bump lwip_sent_gen, and whoever waits for a pin to
+// go sleeps on that.
+#define SENDFILE_NPAGES		4
+#define SENDFILE_MAXPAGES	(QUEUE_SIZE / 2)
+// How long to sleep for an acknowledgement before looking anyway
+#define SENDFILE_POLL_MSEC	1000
+
+struct sf_page {
+	void *va;		// request buffer it is mapped at
+	int s;			// socket it is queued on
+	u32_t endseq;		// sequence number following it
 };
 
-static struct timer_thread t_arp;
-static struct timer_thread t_tcpf;
-static struct timer_thread t_tcps;
+static struct sf_page sf_pinned[SENDFILE_MAXPAGES];
+static uint32_t sendfile_pages;		// entries in sf_pinned
 
-static envid_t timer_envid;
-static envid_t input_envid;
-static envid_t output_envid;
+// The network server is a client of the file server for sendfile.
+// fs_busy serializes the requests, which share fsipcbuf.
+static uint32_t fs_busy;
 
 static bool buse[QUEUE_SIZE];
 static int next_i(int i) { return (i+1) % QUEUE_SIZE; }
@@ -76,6 +91,194 @@ put_buffer(void *va) {
 	buse[i] = 0;
 }
 
+// Send a request to the file server and wait for the reply, with the
+// other threads running meanwhile.  The request body should be in
+// fsipcbuf.  The reply comes to the calling thread, not to serve().
+// A page sent back is left mapped in a request buffer and returned in
+// *pg_store; the caller releases it with put_buffer/sys_page_unmap.
+static int32_t
+fs_ipc(unsigned type, void **pg_store, int *perm_store)
+{
+	void *va;
+	int32_t r;
+
+	while (fs_busy)
+		thread_wait(&fs_busy, 1, (uint32_t)~0);
+	fs_busy = 1;
+
+	va = get_buffer();
+	thread_unlock();
+	ipc_send(envs[1].env_id, type, &fsipcbuf, PTE_P|PTE_W|PTE_U);
+	r = ipc_recv(NULL, va, perm_store);
+	thread_lock();
+
+	fs_busy = 0;
+	thread_wakeup(&fs_busy);
+
+	if (*perm_store & PTE_P) {
+		*pg_store = va;
+	} else {
+		*pg_store = 0;
+		put_buffer(va);
+	}
+	return r;
+}
+
+// Release the pinned pages lwIP no longer references.
+static void
+sendfile_reap(void)
+{
+	uint32_t i = 0;
+
+	while (i < sendfile_pages)
+		if (lwip_sent(sf_pinned[i].s, sf_pinned[i].endseq)) {
+			put_buffer(sf_pinned[i].va);
+			sys_page_unmap(0, sf_pinned[i].va);
+			sf_pinned[i] = sf_pinned[--sendfile_pages];
+		} else
+			i++;
+}
+
+// Pages pinned on socket s.
+static int
+sendfile_npinned(int s)
+{
+	uint32_t i;
+	int n = 0;
+
+	for (i = 0; i < sendfile_pages; i++)
+		if (sf_pinned[i].s == s)
+			n++;
+	return n;
+}
+
+// Whether another page may be pinned on socket s now.
+static bool
+sendfile_room(int s)
+{
+	return sendfile_npinned(s) < SENDFILE_NPAGES
+		&& sendfile_pages < SENDFILE_MAXPAGES;
+}
+
+// Wait until socket s has fewer than 'max' pages pinned, and if 'pin',
+// there is room for another pin.
+static void
+sendfile_wait(int s, int max, bool pin)
+{
+	uint32_t gen;
+
+	for (;;) {
+		gen = lwip_sent_gen;
+		sendfile_reap();
+		if (sendfile_npinned(s) < max
+		    && (!pin || sendfile_pages < SENDFILE_MAXPAGES))
+			return;
+		thread_wait(&lwip_sent_gen, gen,
+			    sys_time_msec() + SENDFILE_POLL_MSEC);
+	}
+}
+
+// Pin the page at va, just queued on socket s up to endseq.
+static void
+sendfile_pin(void *va, int s, u32_t endseq)
+{
+	assert(sendfile_pages < SENDFILE_MAXPAGES);
+	sf_pinned[sendfile_pages].va = va;
+	sf_pinned[sendfile_pages].s = s;
+	sf_pinned[sendfile_pages].endseq = endseq;
+	sendfile_pages++;
+}
+
+// Transmit file data without copying it: each block cache page is
+// mapped from the file server and queued on the TCP connection by
+// reference, pinned until the peer acknowledges it.  Returns once the
+// data is queued; closing the socket waits for the pins to go.
+//
+// With MSG_DONTWAIT, nothing waits: only what fits in the connection's
+// send buffer now is queued, and a block that cannot be pinned now is
+// copied instead.
+static int
+serve_sendfile(struct Nsreq_sendfile *req)
+{
+	bool dontwait = req->req_flags & MSG_DONTWAIT;
+	size_t sent = 0;
+	off_t off;
+	void *pg;
+	int perm, n, more, space = 0, r = 0;
+	u32_t endseq;
+
+	while (sent < req->req_len) {
+		if (!dontwait)
+			sendfile_wait(req->req_s, SENDFILE_NPAGES, 1);
+		else {
+			sendfile_reap();
+			space = lwip_sendspace(req->req_s, req->req_len - sent);
+			if (space == 0) {
+				r = -E_AGAIN;
+				break;
+			}
+		}
+
+		off = req->req_offset + sent;
+		fsipcbuf.map.req_fileid = req->req_fileid;
+		fsipcbuf.map.req_offset = off;
+		if ((r = fs_ipc(FSREQ_MAP, &pg, &perm)) <= 0)
+			break;
+		if (!(perm & PTE_P)) {
+			r = -E_INVAL;
+			break;
+		}
+
+		n = MIN(r, req->req_len - sent);
+		if (dontwait)
+			n = MIN(n, space);
+		more = (sent + n < req->req_len) ? MSG_MORE : 0;
+		if (dontwait && !sendfile_room(req->req_s)) {
+			r = lwip_send(req->req_s, pg + off % PGSIZE, n, more);
+			put_buffer(pg);
+			sys_page_unmap(0, pg);
+		} else {
+			endseq = 0;
+			r = lwip_send_nocopy(req->req_s, pg + off % PGSIZE, n,
+					     more, &endseq);
+			// Part of it may be queued even if that failed
+			sendfile_pin(pg, req->req_s, endseq);
+		}
+		if (r < 0)
+			break;
+		sent += n;
+	}
+
+	return sent > 0 ? sent : r;
+}
+
+// Send the data of a page passed with sendpage() by reference, pinned
+// until the peer acknowledges it, or by copying if it cannot be pinned
+// now: the client is not held up waiting for room.  Sets *pinned if
+// the page at va stays with lwIP.  With MSG_DONTWAIT, the page goes
+// whole or not at all.
+static int
+serve_sendpage(struct Nsreq_send *req, void *va, bool *pinned)
+{
+	u32_t endseq = 0;
+	int r;
+
+	sendfile_reap();
+	if ((req->req_flags & MSG_DONTWAIT)
+	    && lwip_sendspace(req->req_s, req->req_size) < req->req_size)
+		return -E_AGAIN;
+	if (!lwip_is_tcp(req->req_s) || !sendfile_room(req->req_s))
+		return lwip_send(req->req_s, req->req_buf, req->req_size,
+				 req->req_flags);
+
+	r = lwip_send_nocopy(req->req_s, req->req_buf, req->req_size,
+			     req->req_flags, &endseq);
+	// Part of it may be queued even if that failed
+	sendfile_pin(va, req->req_s, endseq);
+	*pinned = 1;
+	return r;
+}
+
 static void
 lwip_init(struct netif *nif, void *if_state,
 	  uint32_t init_addr, uint32_t init_mask, uint32_t init_gw)
@@ -95,33 +298,6 @@ lwip_init(struct netif *nif, void *if_state,
 	netif_set_up(nif);
 }
 
-static void __attribute__((noreturn))
-net_timer(uint32_t arg)
-{
-	struct timer_thread *t = (struct timer_thread *) arg;
-
-	for (;;) {
-		uint32_t cur = sys_time_msec();
-
-		lwip_core_lock();
-		t->func();
-		lwip_core_unlock();
-
-		thread_wait(0, 0, cur + t->msec);
-	}
-}
-
-static void
-start_timer(struct timer_thread *t, void (*func)(void), const char *name, int msec)
-{
-	t->msec = msec;
-	t->func = func;
-	t->name = name;
-	int r = thread_create(0, name, &net_timer, (uint32_t)t);
-	if (r < 0)
-		panic("cannot create timer thread: %s", e2s(r));
-}
-
 static void
 tcpip_init_done(void *arg)
 {
@@ -144,9 +320,8 @@ serve_init(uint32_t ipaddr, uint32_t netmask, uint32_t gw)
 
 	lwip_init(&nif, &output_envid, ipaddr, netmask, gw);
 
-	start_timer(&t_arp, &etharp_tmr, "arp timer", ARP_TMR_INTERVAL);
-	start_timer(&t_tcpf, &tcp_fasttmr, "tcp f timer", TCP_FAST_INTERVAL);
-	start_timer(&t_tcps, &tcp_slowtmr, "tcp s timer", TCP_SLOW_INTERVAL);
+	// The ARP and TCP timers run as sys_timeout()s in tcpip_thread,
+	// the TCP ones only while there are active connections.
 
 	struct in_addr ia = {ipaddr};
 	cprintf("ns: %02x:%02x:%02x:%02x:%02x:%02x" 
@@ -160,23 +335,6 @@ serve_init(uint32_t ipaddr, uint32_t netmask, uint32_t gw)
 	cprintf("NS: TCP/IP initialized.\n");
 }
 
-static void
-process_timer(envid_t envid) {
-	uint32_t start, now, to;
-
-	if (envid != timer_envid) {
-		cprintf("NS: received timer interrupt from envid %x not timer env\n", envid);
-		return;
-	}
-
-	start = sys_time_msec();
-	thread_yield();
-	now = sys_time_msec();
-
-	to = TIMER_INTERVAL - (now - start);
-	ipc_send(envid, to, 0, 0);
-}
-
 struct st_args {
 	int32_t reqno;
 	uint32_t whom;
@@ -187,6 +345,7 @@ static void
 serve_thread(uint32_t a) {
 	struct st_args *args = (struct st_args *)a;
 	union Nsipc *req = args->req;
+	bool replied = 0, pinned = 0;
 	int r;
 
 	switch (args->reqno) {
@@ -206,6 +365,13 @@ serve_thread(uint32_t a) {
 		r = lwip_shutdown(req->shutdown.req_s, req->shutdown.req_how);
 		break;
 	case NSREQ_CLOSE:
+		// Pinned pages must go before lwIP forgets the connection.
+		// The client need not wait for that.
+		if (sendfile_npinned(req->close.req_s) > 0) {
+			ipc_send(args->whom, 0, 0, 0);
+			replied = 1;
+			sendfile_wait(req->close.req_s, 1, 0);
+		}
 		r = lwip_close(req->close.req_s);
 		break;
 	case NSREQ_CONNECT:
@@ -225,6 +391,25 @@ serve_thread(uint32_t a) {
 		r = lwip_send(req->send.req_s, &req->send.req_buf,
 			      req->send.req_size, req->send.req_flags);
 		break;
+	case NSREQ_SENDPAGE:
+		r = serve_sendpage(&req->send, req, &pinned);
+		break;
+	case NSREQ_SENDFILE:
+		r = serve_sendfile(&req->sendfile);
+		break;
+	case NSREQ_SELECT:
+	{
+		struct timeval tv, *tvp = NULL;
+		if (req->select.req_timeout >= 0) {
+			tv.tv_sec = req->select.req_timeout / 1000;
+			tv.tv_usec = (req->select.req_timeout % 1000) * 1000;
+			tvp = &tv;
+		}
+		r = lwip_select(req->select.req_nfds, &req->select.req_readset,
+				&req->select.req_writeset,
+				&req->select.req_exceptset, tvp);
+		break;
+	}
 	case NSREQ_SOCKET:
 		r = lwip_socket(req->socket.req_domain, req->socket.req_type,
 				req->socket.req_protocol);
@@ -239,17 +424,24 @@ serve_thread(uint32_t a) {
 		break;
 	}
 
+	// A call that would have had to wait
+	if (r == -1 && errno == EWOULDBLOCK)
+		r = -E_AGAIN;
+
 	if (r == -1) {
 		char buf[100];
 		snprintf(buf, sizeof buf, "ns req type %d", args->reqno);
 		perror(buf);
 	}
 
-	if (args->reqno != NSREQ_INPUT)
+	if (args->reqno != NSREQ_INPUT && !replied)
 		ipc_send(args->whom, r, 0, 0);
 
-	put_buffer(args->req);
-	sys_page_unmap(0, (void*) args->req);
+	// A pinned page goes once the peer acknowledges it
+	if (!pinned) {
+		put_buffer(args->req);
+		sys_page_unmap(0, (void*) args->req);
+	}
 	free(args);
 }
 
@@ -257,31 +449,24 @@ void
 serve(void) {
 	int32_t reqno;
 	uint32_t whom;
-	int i, perm;
+	int perm, r;
 	void *va;
 	
 	while (1) {
-		// ipc_recv will block the entire process, so we flush
-		// all pending work from other threads.  We limit the
-		// number of yields in case there's a rogue thread.
-		for (i = 0; thread_wakeups_pending() && i < 32; ++i)
-			thread_yield();
+		// Pinned pages acknowledged meanwhile free request buffers
+		sendfile_reap();
 
+		// The other threads run while we wait for a request
 		perm = 0;
 		va = get_buffer();
+		thread_unlock();
 		reqno = ipc_recv((int32_t *) &whom, (void *) va, &perm);
+		thread_lock();
 		if (debug) {
 			cprintf("ns req %d from %08x\n", reqno, whom);
 		}
 
-		// first take care of requests that do not contain an argument page
-		if (reqno == NSREQ_TIMER) {
-			process_timer(whom);
-			put_buffer(va);
-			continue;
-		}
-
-		// All remaining requests must contain an argument page
+		// All requests must contain an argument page
 		if (!(perm & PTE_P)) {
 			cprintf("Invalid request from %08x: no argument page\n", whom);
 			continue; // just leave it hanging...
@@ -297,19 +482,18 @@ serve(void) {
 		args->whom = whom;
 		args->req = va;
 
-		thread_create(0, "serve_thread", serve_thread, (uint32_t)args);
-		thread_yield(); // let the thread created run
+		r = thread_create(0, "serve_thread", serve_thread, (uint32_t)args);
+		if (r < 0) {
+			cprintf("ns: cannot start serve_thread: %e\n", r);
+			if (reqno != NSREQ_INPUT)
+				ipc_send(whom, r, 0, 0);
+			put_buffer(va);
+			sys_page_unmap(0, va);
+			free(args);
+		}
 	}
 }
 
-static void
-tmain(uint32_t arg) {
-	serve_init(inet_addr(IP),
-		   inet_addr(MASK),
-		   inet_addr(DEFAULT));
-	serve();
-}
-
 void
 umain(void)
 {
@@ -317,15 +501,6 @@ umain(void)
 
 	binaryname = "ns";
 
-	// fork off the timer thread which will send us periodic messages
-	timer_envid = fork();
-	if (timer_envid < 0)
-		panic("error forking");
-	else if (timer_envid == 0) {
-		timer(ns_envid, TIMER_INTERVAL);
-		return;
-	}
-
 	// fork off the input thread which will poll the NIC driver for input
 	// packets
 	input_envid = fork();
@@ -346,10 +521,11 @@ umain(void)
 		return;
 	}
 
-	// lwIP requires a user threading library; start the library and jump
-	// into a thread to continue initialization. 
+	// lwIP requires a user threading library; we become its first
+	// thread, and serve requests once the stack is up.
 	thread_init();
-	thread_create(0, "main", tmain, 0);
-	thread_yield();
-	// never coming here!
+	serve_init(inet_addr(IP),
+		   inet_addr(MASK),
+		   inet_addr(DEFAULT));
+	serve();
 }
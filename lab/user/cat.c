@@ -6,11 +6,10 @@ void
 cat(int f, char *s)
 {
 	long n;
-	int r;
 
 	while ((n = read(f, buf, (long)sizeof(buf))) > 0)
-		if ((r = write(1, buf, n)) != n)
-			panic("write error copying %s: %e", s, r);
+		if (fwrite(buf, 1, n, stdout) != n)
+			panic("write error copying %s", s);
 	if (n < 0)
 		panic("error reading %s: %e", s, n);
 }
@@ -27,7 +26,7 @@ umain(int argc, char **argv)
 		for (i = 1; i < argc; i++) {
 			f = open(argv[i], O_RDONLY);
 			if (f < 0)
-				printf("can't open %s: %e\n", argv[i], f);
+				bprintf(stdout, "can't open %s: %e\n", argv[i], f);
 			else {
 				cat(f, argv[i]);
 				close(f);
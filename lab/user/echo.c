@@ -13,9 +13,9 @@ umain(int argc, char **argv)
 	}
 	for (i = 1; i < argc; i++) {
 		if (i > 1)
-			write(1, " ", 1);
-		write(1, argv[i], strlen(argv[i]));
+			fputc(' ', stdout);
+		fputs(argv[i], stdout);
 	}
 	if (!nflag)
-		write(1, "\n", 1);
+		fputc('\n', stdout);
 }
@@ -1,9 +1,19 @@
 // Fork a binary tree of processes and display their structure.
+//
+// With -b, time instead how long env teardown keeps a parent waiting:
+// children mapping 'pages' pages spread over 'tables' page tables exit,
+// and the parent measures from their last instruction until its wait()
+// returns, 'n' times.
+//
+// usage: forktree [-b [-n rounds] [-p pages] [-t tables]]
 
 #include <inc/lib.h>
 
 #define DEPTH 3
 
+#define BENCH_VA	0x40000000	// 4MB-aligned and otherwise unused
+#define STAMP_VA	(BENCH_VA - PGSIZE)
+
 void forktree(const char *cur);
 
 void
@@ -30,9 +40,96 @@ forktree(const char *cur)
 	forkchild(cur, '1');
 }
 
-void
-umain(void)
+static void
+usage(void)
+{
+	cprintf("usage: forktree [-b [-n rounds] [-p pages] [-t tables]]\n");
+	exit();
+}
+
+// Map 'npages' pages, spread evenly over 'ntables' 4MB regions from
+// BENCH_VA, then note the time in the page shared with the parent and
+// exit without closing any files.
+static void
+bench_child(int npages, int ntables)
+{
+	volatile uint64_t *stamp = (volatile uint64_t *) STAMP_VA;
+	uintptr_t va;
+	int i, r;
+
+	for (i = 0; i < npages; i++) {
+		va = BENCH_VA + (i % ntables) * PTSIZE + (i / ntables) * PGSIZE;
+		if ((r = sys_page_alloc(0, (void *) va, PTE_P|PTE_U|PTE_W)) < 0)
+			panic("forktree: sys_page_alloc: %e", r);
+	}
+	*stamp = time_nsec();
+	sys_env_destroy(0);
+}
+
+static void
+bench(int rounds, int npages, int ntables)
 {
-	forktree("");
+	volatile uint64_t *stamp = (volatile uint64_t *) STAMP_VA;
+	uint64_t total = 0, worst = 0, nsec;
+	envid_t child;
+	int i, r;
+
+	if ((r = sys_page_alloc(0, (void *) STAMP_VA,
+				PTE_P|PTE_U|PTE_W|PTE_SHARE)) < 0)
+		panic("forktree: sys_page_alloc: %e", r);
+
+	cprintf("forktree: %d rounds, %d pages in %d page tables\n",
+		rounds, npages, ntables);
+	for (i = 0; i < rounds; i++) {
+		if ((child = fork()) < 0)
+			panic("forktree: fork: %e", child);
+		if (child == 0)
+			bench_child(npages, ntables);
+		wait(child);
+		nsec = time_nsec() - *stamp;
+		total += nsec;
+		worst = MAX(worst, nsec);
+	}
+	cprintf("forktree: exit latency %u usec mean, %u usec worst\n",
+		(unsigned) (total / rounds / 1000), (unsigned) (worst / 1000));
 }
 
+void
+umain(int argc, char **argv)
+{
+	int dobench = 0, rounds = 20, npages = 4096, ntables = 16;
+	char *arg;
+
+	ARGBEGIN{
+	default:
+		usage();
+	case 'b':
+		dobench = 1;
+		break;
+	case 'n':
+		if ((arg = ARGF()) == 0)
+			usage();
+		rounds = strtol(arg, 0, 0);
+		break;
+	case 'p':
+		if ((arg = ARGF()) == 0)
+			usage();
+		npages = strtol(arg, 0, 0);
+		break;
+	case 't':
+		if ((arg = ARGF()) == 0)
+			usage();
+		ntables = strtol(arg, 0, 0);
+		break;
+	}ARGEND
+
+	if (!dobench) {
+		forktree("");
+		return;
+	}
+	if (rounds < 1 || npages < 1 || ntables < 1
+	    || ntables > (0xC0000000 - BENCH_VA) / PTSIZE
+	    || npages > ntables * NPTENTRIES)
+		usage();
+	bench(rounds, npages, ntables);
+}
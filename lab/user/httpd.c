@@ -9,12 +9,35 @@
 #define E_BAD_REQ	1000
 
 #define BUFFSIZE 512
+#define OUTSIZE 1024	// response header or error page bytes queued
 #define MAXPENDING 5	// Max connection requests
+#define MAXCLIENTS 16	// Max connections served at once
+
+// An open connection.  A request may arrive in several segments, and
+// several requests in one, so what has been received but not yet served
+// is kept here between reads.  The response to the request being served
+// is queued here too, and goes out only as fast as the connection takes
+// it: first the bytes in 'out', then the body, from the pages of a cache
+// entry or from a file.  No socket call waits, so one slow client holds
+// up no one else.
+struct conn {
+	int sock;
+	int len;			// bytes in buf
+	char buf[BUFFSIZE];
+	bool sending;			// a response is queued
+	bool keepalive;			// keep the connection once it is out
+	int outlen, outoff;		// bytes in out, and of them sent
+	char out[OUTSIZE];
+	struct cache_entry *ce;		// body from its pages, if not NULL,
+	int fd;				// or from this file, if >= 0
+	off_t off, size;		// body bytes sent, body size
+};
 
 struct http_request {
-	int sock;
+	struct conn *conn;
 	char *url;
 	char *version;
+	int keepalive;
 };
 
 struct responce_header {
@@ -45,6 +68,19 @@ die(char *m)
 	exit();
 }
 
+// Queue 'len' bytes of response on the request's connection.
+static int
+out_write(struct http_request *req, const char *buf, int len)
+{
+	struct conn *c = req->conn;
+
+	if (len > OUTSIZE - c->outlen)
+		return -1;
+	memmove(c->out + c->outlen, buf, len);
+	c->outlen += len;
+	return 0;
+}
+
 static void
 req_free(struct http_request *req)
 {
@@ -65,37 +101,37 @@ send_header(struct http_request *req, int code)
 	if (h->code == 0)
 		return -1;
 
-	int len = strlen(h->header);
-	if (write(req->sock, h->header, len) != len) {
-		die("Failed to send bytes to client");
-	}
-	
-	return 0;
+	return out_write(req, h->header, strlen(h->header));
 }
 
 static int
-send_data(struct http_request *req, int fd, off_t fsize)
+send_connection(struct http_request *req)
 {
-	// LAB 6: Your code here.
-	//panic("send_data not implemented");
-	char buf[BUFFSIZE];
-	int r = 0;
-	off_t count = 0;
-
-	while (count < fsize) {
-		r = readn(fd, buf, BUFFSIZE);
-		if (r < 0) {
-			return -1;
-		}
-		assert(r <= BUFFSIZE);
+	char *conn;
+	int len;
 
-		if (write(req->sock, buf, r) != r) {
-			return -1;
-		}
+	if (req->keepalive)
+		conn = "Connection: keep-alive\r\n";
+	else
+		conn = "Connection: close\r\n";
 
-		count += r;
-	}
+	len = strlen(conn);
+	return out_write(req, conn, len);
+}
 
+static int
+send_data(struct http_request *req, int fd, off_t fsize)
+{
+	// LAB 6: Your code here.
+	//panic("send_data not implemented");
+	struct conn *c = req->conn;
+
+	// The connection sends the file with sendfile() as it takes it:
+	// the network server maps the file's blocks from the file server
+	// and transmits them directly, the data never passes through here.
+	c->fd = fd;
+	c->off = 0;
+	c->size = fsize;
 	return 0;
 }
 
@@ -109,10 +145,7 @@ send_size(struct http_request *req, off_t size)
 	if (r > 63)
 		panic("buffer too small!");
 
-	if (write(req->sock, buf, r) != r)
-		return -1;
-
-	return 0;
+	return out_write(req, buf, r);
 }
 
 static const char*
@@ -155,10 +188,7 @@ send_content_type(struct http_request *req)
 	if (r > 127)
 		panic("buffer too small!");
 
-	if (write(req->sock, buf, r) != r)
-		return -1;
-
-	return 0;
+	return out_write(req, buf, r);
 }
 
 static int
@@ -167,10 +197,7 @@ send_header_fin(struct http_request *req)
 	char *fin = "\r\n";
 	int fin_len = strlen(fin);
 
-	if (write(req->sock, fin, fin_len) != fin_len)
-		return -1;
-
-	return 0;
+	return out_write(req, fin, fin_len);
 }
 
 // given a request, this function creates a struct http_request
@@ -212,6 +239,23 @@ http_request_parse(struct http_request *req, char *request)
 	memmove(req->version, version, version_len);
 	req->version[version_len] = '\0';
 
+	// HTTP/1.1 connections persist unless the client asks otherwise,
+	// HTTP/1.0 ones only if it asks for it.
+	req->keepalive = (strncmp(req->version, "HTTP/1.1", 8) == 0);
+	while (*request) {
+		// skip to the next header line
+		while (*request && *request++ != '\n')
+			;
+		if (strncmp(request, "Connection: ", 12) != 0)
+			continue;
+		request += 12;
+		if (strncmp(request, "close", 5) == 0)
+			req->keepalive = 0;
+		else if (strncmp(request, "keep-alive", 10) == 0
+			 || strncmp(request, "Keep-Alive", 10) == 0)
+			req->keepalive = 1;
+	}
+
 	// no entity parsing
 
 	return 0;
@@ -233,17 +277,196 @@ send_error(struct http_request *req, int code)
 	if (e->code == 0)
 		return -1;
 
+	req->keepalive = 0;
 	r = snprintf(buf, 512, "HTTP/" HTTP_VERSION" %d %s\r\n"
 			       "Server: jhttpd/" VERSION "\r\n"
-			       "Connection: close"
+			       "Connection: close\r\n"
 			       "Content-type: text/html\r\n"
 			       "\r\n"
 			       "<html><body><p>%d - %s</p></body></html>\r\n",
 			       e->code, e->msg, e->code, e->msg);
 
-	if (write(req->sock, buf, r) != r)
+	return out_write(req, buf, r);
+}
+
+// Response cache.  Hot files are kept as pre-rendered responses: the
+// headers (all but the per-connection "Connection:" line) and the body.
+// The body sits in pages laid out as ready-made Nsreq_send requests,
+// so sendpage() hands them to the network server, which queues them on
+// the connection without copying.  A body page is never written once
+// filled: eviction unmaps it, and lwIP may still hold it meanwhile.
+// An entry whose body a connection is still sending is not reused, and
+// its pages stay mapped until the last such connection is done.
+//
+// An entry is trusted as long as the file server's modification
+// generation has not moved, which costs no IPC.  Once it has, the file
+// is re-stat'ed and the entry dropped if its size or generation differ.
+#define CACHE_NENTRY	16
+#define CACHE_MAXPAGES	64	// largest cacheable body, in pages
+#define CACHE_MAXPATH	128
+#define CACHE_HDRSIZE	256
+
+struct cache_entry {
+	char path[CACHE_MAXPATH];	// empty if the entry is free
+	char hdr[CACHE_HDRSIZE];
+	off_t size;			// file size
+	uint32_t gen;			// file generation (st_gen)
+	uint32_t fsgen;			// fs generation last validated at
+	unsigned lastuse;
+	int refs;			// connections sending the body
+};
+
+static struct cache_entry cache[CACHE_NENTRY];
+static unsigned cache_clock;
+
+// Return the i'th body page of 'ce'
+static union Nsipc *
+cache_page(struct cache_entry *ce, int i)
+{
+	static_assert(CACHE_NENTRY * CACHE_MAXPAGES * PGSIZE <= HTTPD_CACHESIZE);
+	return (union Nsipc *) (HTTPD_CACHEVA
+				+ ((ce - cache) * CACHE_MAXPAGES + i) * PGSIZE);
+}
+
+static uint32_t
+cache_fsgen(void)
+{
+	const volatile uint32_t *fsgen = fs_generation();
+
+	return fsgen ? *fsgen : 0;
+}
+
+static void
+cache_evict(struct cache_entry *ce)
+{
+	int i;
+
+	ce->path[0] = '\0';
+	if (ce->refs > 0)
+		return;
+	for (i = 0; i < CACHE_MAXPAGES; i++)
+		sys_page_unmap(0, cache_page(ce, i));
+}
+
+// A connection is done sending the body of 'ce'.
+static void
+cache_put(struct cache_entry *ce)
+{
+	if (--ce->refs == 0 && !ce->path[0])
+		cache_evict(ce);
+}
+
+static struct cache_entry *
+cache_lookup(const char *path)
+{
+	const volatile uint32_t *fsgenp;
+	struct cache_entry *ce;
+	struct Stat stat;
+	uint32_t fsgen;
+	int fd, ok;
+
+	for (ce = cache; ce < cache + CACHE_NENTRY; ce++)
+		if (ce->path[0] && strcmp(ce->path, path) == 0)
+			break;
+	if (ce == cache + CACHE_NENTRY)
+		return NULL;
+
+	// If the file server would not share its generation, every hit
+	// is revalidated.
+	fsgenp = fs_generation();
+	fsgen = fsgenp ? *fsgenp : 0;
+	if (!fsgenp || fsgen != ce->fsgen) {
+		if ((fd = open(path, O_RDONLY)) < 0) {
+			cache_evict(ce);
+			return NULL;
+		}
+		ok = (fstat(fd, &stat) >= 0 && stat.st_size == ce->size
+		      && stat.st_gen == ce->gen);
+		close(fd);
+		if (!ok) {
+			cache_evict(ce);
+			return NULL;
+		}
+		ce->fsgen = fsgen;
+	}
+
+	ce->lastuse = ++cache_clock;
+	return ce;
+}
+
+// Render the response for the file open at 'fd' into a cache entry,
+// replacing the least recently used one if need be.  'fsgen' is the fs
+// generation sampled before the file was opened.
+// Returns NULL if the file is too large or cannot be read.
+static struct cache_entry *
+cache_fill(const char *path, int fd, struct Stat *stat, uint32_t fsgen)
+{
+	struct cache_entry *ce, *victim;
+	union Nsipc *pg;
+	off_t off;
+	int i, n;
+
+	if (strlen(path) >= CACHE_MAXPATH
+	    || stat->st_size > CACHE_MAXPAGES * NSIPC_SENDPAGE_MAX)
+		return NULL;
+
+	victim = NULL;
+	for (ce = cache; ce < cache + CACHE_NENTRY; ce++) {
+		if (ce->refs > 0)
+			continue;
+		if (!victim || !ce->path[0] || ce->lastuse < victim->lastuse)
+			victim = ce;
+		if (!ce->path[0])
+			break;
+	}
+	if ((ce = victim) == NULL)
+		return NULL;
+	if (ce->path[0])
+		cache_evict(ce);
+
+	n = snprintf(ce->hdr, CACHE_HDRSIZE, "%s"
+		     "Content-Length: %ld\r\n"
+		     "Content-Type: %s\r\n",
+		     headers[0].header, (long) stat->st_size, mime_type(path));
+	if (n >= CACHE_HDRSIZE)
+		return NULL;
+
+	for (off = 0, i = 0; off < stat->st_size; off += n, i++) {
+		pg = cache_page(ce, i);
+		n = MIN(stat->st_size - off, NSIPC_SENDPAGE_MAX);
+		if (sys_page_alloc(0, pg, PTE_P|PTE_U|PTE_W) < 0
+		    || readn(fd, pg->send.req_buf, n) != n) {
+			cache_evict(ce);
+			return NULL;
+		}
+	}
+
+	ce->size = stat->st_size;
+	ce->gen = stat->st_gen;
+	ce->fsgen = fsgen;
+	ce->lastuse = ++cache_clock;
+	strcpy(ce->path, path);
+	return ce;
+}
+
+static int
+cache_send(struct http_request *req, struct cache_entry *ce)
+{
+	struct conn *c = req->conn;
+	char buf[CACHE_HDRSIZE + 32];
+	int n;
+
+	n = snprintf(buf, sizeof(buf), "%sConnection: %s\r\n\r\n", ce->hdr,
+		     req->keepalive ? "keep-alive" : "close");
+	if (out_write(req, buf, n) < 0)
 		return -1;
 
+	// The connection sends the body pages with sendpage() as it takes
+	// them
+	ce->refs++;
+	c->ce = ce;
+	c->off = 0;
+	c->size = ce->size;
 	return 0;
 }
 
@@ -254,6 +477,13 @@ send_file(struct http_request *req)
 	off_t file_size = -1;
 	int fd;
 	struct Stat stat;
+	struct cache_entry *ce;
+	uint32_t fsgen;
+
+	// Repeat requests for hot files never reach the file server
+	if ((ce = cache_lookup(req->url)) != NULL)
+		return cache_send(req, ce);
+	fsgen = cache_fsgen();
 
 	// open the requested url for reading
 	// if the file does not exist, send a 404 error using send_error
@@ -280,59 +510,190 @@ send_file(struct http_request *req)
 	}
 	file_size = stat.st_size;
 
+	if ((ce = cache_fill(req->url, fd, &stat, fsgen)) != NULL) {
+		r = cache_send(req, ce);
+		goto end;
+	}
+
 	if ((r = send_header(req, 200)) < 0)
 		goto end;
 
 	if ((r = send_size(req, file_size)) < 0)
 		goto end;
 
+	if ((r = send_connection(req)) < 0)
+		goto end;
+
 	if ((r = send_content_type(req)) < 0)
 		goto end;
 
 	if ((r = send_header_fin(req)) < 0)
 		goto end;
 
-	r = send_data(req, fd, file_size);
+	// The connection closes fd once the body is out
+	if ((r = send_data(req, fd, file_size)) == 0)
+		return 0;
 
 end:
 	close(fd);
 	return r;
 }
 
+// Return the length of the request at the start of 'c->buf', up to and
+// including the blank line ending its headers, or 0 if not all of it
+// has arrived.
+static int
+request_len(struct conn *c)
+{
+	int i;
+
+	for (i = 0; i + 1 < c->len; i++)
+		if (c->buf[i] == '\n'
+		    && (c->buf[i + 1] == '\n'
+			|| (c->buf[i + 1] == '\r' && i + 2 < c->len
+			    && c->buf[i + 2] == '\n')))
+			return i + (c->buf[i + 1] == '\n' ? 2 : 3);
+	return 0;
+}
+
+// Drop the response queued on 'c', sent or not.
+static void
+conn_reset(struct conn *c)
+{
+	if (c->ce)
+		cache_put(c->ce);
+	if (c->fd >= 0)
+		close(c->fd);
+	c->ce = NULL;
+	c->fd = -1;
+	c->outlen = c->outoff = 0;
+	c->off = c->size = 0;
+	c->sending = 0;
+}
+
+// Queue on 'c' the response to the request of 'n' bytes at the start
+// of 'c->buf'.
 static void
-handle_client(int sock)
+serve_request(struct conn *c, int n)
 {
 	struct http_request con_d;
-	int r;
-	char buffer[BUFFSIZE];
-	int received = -1;
 	struct http_request *req = &con_d;
+	int r;
 
-	while (1) 
-	{
-		// Receive message
-		if ((received = read(sock, buffer, BUFFSIZE)) < 0)
-			panic("failed to read");
+	memset(req, 0, sizeof(*req));
+	req->conn = c;
+	c->sending = 1;
+
+	c->buf[n - 1] = '\0';
+	r = http_request_parse(req, c->buf);
+	if (r == -E_BAD_REQ) {
+		send_error(req, 400);
+		c->keepalive = 0;
+		return;
+	} else if (r < 0)
+		panic("parse failed");
+
+	// send_error() already clears keepalive, this catches failures
+	// to queue the response
+	if (send_file(req) < 0)
+		req->keepalive = 0;
+
+	c->keepalive = req->keepalive;
+	req_free(req);
+}
 
-		memset(req, 0, sizeof(req));
+// Send as much of the response queued on 'c' as the connection takes
+// without waiting.  Returns 1 if the connection should stay open, 0 if
+// it should be closed.
+static int
+conn_send(struct conn *c)
+{
+	int n;
 
-		req->sock = sock;
+	while (c->outoff < c->outlen) {
+		n = send(c->sock, c->out + c->outoff, c->outlen - c->outoff,
+			 MSG_DONTWAIT);
+		if (n == -E_AGAIN)
+			return 1;
+		if (n <= 0)
+			return 0;
+		c->outoff += n;
+	}
 
-		r = http_request_parse(req, buffer);
-		if (r == -E_BAD_REQ)
-			send_error(req, 400);
-		else if (r < 0)
-			panic("parse failed");
-		else
-			send_file(req);
+	while (c->off < c->size) {
+		if (c->ce) {
+			n = MIN(c->size - c->off, NSIPC_SENDPAGE_MAX);
+			n = sendpage(c->sock, cache_page(c->ce,
+					c->off / NSIPC_SENDPAGE_MAX), n,
+				     MSG_DONTWAIT);
+		} else
+			n = sendfile(c->sock, c->fd, c->off,
+				     c->size - c->off, MSG_DONTWAIT);
+		if (n == -E_AGAIN)
+			return 1;
+		if (n <= 0)
+			return 0;
+		c->off += n;
+	}
 
-		req_free(req);
+	conn_reset(c);
+	return c->keepalive;
+}
 
-		// no keep alive
-		break;
+// Move 'c' along: send what it takes of the response queued, and once
+// that is out, serve the next request already received.  Returns 1 if
+// the connection should stay open, 0 if it should be closed.
+static int
+conn_run(struct conn *c)
+{
+	struct http_request req;
+	int n;
+
+	for (;;) {
+		if (c->sending) {
+			if (!conn_send(c))
+				return 0;
+			if (c->sending)
+				return 1;
+		}
+		if ((n = request_len(c)) == 0)
+			break;
+		serve_request(c, n);
+		c->len -= n;
+		memmove(c->buf, c->buf + n, c->len);
 	}
 
-	close(sock);
+	// Headers that do not fit are not worth waiting for
+	if (c->len == BUFFSIZE - 1) {
+		memset(&req, 0, sizeof(req));
+		req.conn = c;
+		c->sending = 1;
+		c->keepalive = 0;
+		send_error(&req, 400);
+		return conn_send(c);
+	}
+	return 1;
+}
+
+// Take in what has arrived on 'c', which select reported readable, and
+// serve the requests now complete.  The read does not wait, so a client
+// that sends part of a request holds up no one.
+// Returns 1 if the connection should stay open, 0 if it should be
+// closed.
+static int
+handle_client(struct conn *c)
+{
+	int n;
+
+	// 0 means the client closed the connection
+	n = recv(c->sock, c->buf + c->len, BUFFSIZE - 1 - c->len,
+		 MSG_DONTWAIT);
+	if (n == -E_AGAIN)
+		return 1;
+	if (n <= 0)
+		return 0;
+	c->len += n;
+	return conn_run(c);
 }
 
 int
@@ -340,6 +701,9 @@ umain(void)
 {
 	int serversock, clientsock;
 	struct sockaddr_in server, client;
+	static struct conn clients[MAXCLIENTS];
+	int nclients, maxfd, i, keep;
+	fd_set readset, writeset;
 
 	binaryname = "jhttpd";
 
@@ -366,16 +730,55 @@ umain(void)
 
 	cprintf("Waiting for http connections...\n");
 
+	// A single event loop multiplexes the listening socket and every
+	// open (possibly keep-alive) connection, so one slow or idle
+	// client no longer holds up the others.  A connection with a
+	// response queued waits to be writable, any other to be readable.
+	nclients = 0;
 	while (1) {
-		unsigned int clientlen = sizeof(client);
-		// Wait for client connection
-		if ((clientsock = accept(serversock,
-					 (struct sockaddr *) &client,
-					 &clientlen)) < 0) 
-		{
-			die("Failed to accept client connection");
+		FD_ZERO(&readset);
+		FD_ZERO(&writeset);
+		maxfd = 0;
+		if (nclients < MAXCLIENTS) {
+			FD_SET(serversock, &readset);
+			maxfd = serversock;
+		}
+		for (i = 0; i < nclients; i++) {
+			FD_SET(clients[i].sock, clients[i].sending ? &writeset
+			       : &readset);
+			maxfd = MAX(maxfd, clients[i].sock);
+		}
+
+		if (select(maxfd + 1, &readset, &writeset, NULL, NULL) < 0)
+			die("Failed to select");
+
+		for (i = 0; i < nclients; i++) {
+			if (FD_ISSET(clients[i].sock, &writeset))
+				keep = conn_run(&clients[i]);
+			else if (FD_ISSET(clients[i].sock, &readset))
+				keep = handle_client(&clients[i]);
+			else
+				continue;
+			if (!keep) {
+				conn_reset(&clients[i]);
+				close(clients[i].sock);
+				clients[i--] = clients[--nclients];
+			}
+		}
+
+		if (FD_ISSET(serversock, &readset)) {
+			unsigned int clientlen = sizeof(client);
+			// Accept the new client connection
+			if ((clientsock = accept(serversock,
+						 (struct sockaddr *) &client,
+						 &clientlen)) < 0) 
+			{
+				die("Failed to accept client connection");
+			}
+			memset(&clients[nclients], 0, sizeof(clients[0]));
+			clients[nclients].sock = clientsock;
+			clients[nclients++].fd = -1;
 		}
-		handle_client(clientsock);
 	}
 
 	close(serversock);
@@ -0,0 +1,256 @@
+// HTTP load generator: keeps N connections to an http server busy
+// with GET requests and reports throughput and latency.
+//
+// usage: httpload [-k] [-c conns] [-n requests] [-a ipaddr] [-p port] [url]
+//	-k	reuse connections (HTTP/1.1 keep-alive)
+//
+// With the default address the requests go to jhttpd in this machine
+// over the loopback path of the network server.
+
+#include <inc/lib.h>
+#include <lwip/sockets.h>
+#include <lwip/inet.h>
+
+#define IPADDR "10.0.2.15"
+#define PORT 80
+#define MAXCONNS 16
+#define HDRSIZE 512
+#define BUFFSIZE 1024
+
+struct conn {
+	int sock;
+	int hdrlen;		// response header bytes seen so far
+	int bodyleft;		// body bytes still expected, < 0 in header
+	int keepalive;		// the server will keep the connection open
+	uint64_t start;		// nsec when the request was sent
+	char hdr[HDRSIZE];
+};
+
+static struct conn conns[MAXCONNS];
+static struct sockaddr_in server;
+static const char *url = "/index.html";
+static int keepalive;
+static int nsent, ndone, nerrors, nconnects;
+static unsigned long long nbytes, latency, maxlatency;
+
+static void
+usage(void)
+{
+	cprintf("usage: httpload [-k] [-c conns] [-n requests] "
+		"[-a ipaddr] [-p port] [url]\n");
+	exit();
+}
+
+static int
+conn_open(struct conn *c)
+{
+	if ((c->sock = socket(PF_INET, SOCK_STREAM, IPPROTO_TCP)) < 0)
+		return c->sock;
+	if (connect(c->sock, (struct sockaddr *) &server,
+		    sizeof(server)) < 0) {
+		close(c->sock);
+		c->sock = -1;
+		return -E_INVAL;
+	}
+	nconnects++;
+	return 0;
+}
+
+static void
+conn_close(struct conn *c)
+{
+	if (c->sock >= 0)
+		close(c->sock);
+	c->sock = -1;
+}
+
+static int
+conn_request(struct conn *c)
+{
+	char buf[256];
+	int r;
+
+	if (c->sock < 0 && (r = conn_open(c)) < 0)
+		return r;
+
+	r = snprintf(buf, sizeof(buf), "GET %s HTTP/1.%d\r\n"
+		     "Connection: %s\r\n"
+		     "\r\n", url, keepalive, keepalive ? "keep-alive" : "close");
+	c->hdrlen = 0;
+	c->bodyleft = -1;
+	c->start = time_nsec();
+	if (write(c->sock, buf, r) != r)
+		return -E_INVAL;
+	nsent++;
+	return 0;
+}
+
+// Parse the complete response header in c->hdr.
+// Returns the Content-Length, or < 0 if the response is not a 200.
+static int
+conn_parse(struct conn *c)
+{
+	char *p = c->hdr;
+	int len = -1;
+
+	if (strncmp(p, "HTTP/1.", 7) != 0 || strncmp(p + 8, " 200", 4) != 0)
+		return -E_INVAL;
+	c->keepalive = keepalive;
+	while (*p) {
+		while (*p && *p++ != '\n')
+			;
+		if (strncmp(p, "Content-Length: ", 16) == 0)
+			len = strtol(p + 16, 0, 10);
+		else if (strncmp(p, "Connection: close", 17) == 0)
+			c->keepalive = 0;
+	}
+	return len;
+}
+
+// Consume 'n' bytes of response data.
+// Returns 1 once the response is complete, 0 if more is expected,
+// < 0 on a malformed response.
+static int
+conn_input(struct conn *c, const char *buf, int n)
+{
+	int i;
+
+	for (i = 0; c->bodyleft < 0 && i < n; i++) {
+		if (c->hdrlen == HDRSIZE - 1)
+			return -E_INVAL;
+		c->hdr[c->hdrlen++] = buf[i];
+		if (c->hdrlen >= 4
+		    && strncmp(c->hdr + c->hdrlen - 4, "\r\n\r\n", 4) == 0) {
+			c->hdr[c->hdrlen] = '\0';
+			if ((c->bodyleft = conn_parse(c)) < 0)
+				return -E_INVAL;
+		}
+	}
+	if (c->bodyleft < 0)
+		return 0;
+	c->bodyleft -= n - i;
+	nbytes += n - i;
+	return c->bodyleft <= 0;
+}
+
+void
+umain(int argc, char **argv)
+{
+	struct conn *c;
+	char buf[BUFFSIZE];
+	fd_set readset;
+	uint64_t start, t;
+	unsigned elapsed;
+	int nconns = 4, nrequests = 100;
+	char *arg;
+	int i, r, maxfd;
+
+	binaryname = "httpload";
+
+	memset(&server, 0, sizeof(server));
+	server.sin_family = AF_INET;
+	server.sin_addr.s_addr = inet_addr(IPADDR);
+	server.sin_port = htons(PORT);
+
+	ARGBEGIN{
+	default:
+		usage();
+	case 'k':
+		keepalive = 1;
+		break;
+	case 'c':
+		if ((arg = ARGF()) == 0)
+			usage();
+		nconns = strtol(arg, 0, 0);
+		break;
+	case 'n':
+		if ((arg = ARGF()) == 0)
+			usage();
+		nrequests = strtol(arg, 0, 0);
+		break;
+	case 'a':
+		if ((arg = ARGF()) == 0)
+			usage();
+		server.sin_addr.s_addr = inet_addr(arg);
+		break;
+	case 'p':
+		if ((arg = ARGF()) == 0)
+			usage();
+		server.sin_port = htons(strtol(arg, 0, 0));
+		break;
+	}ARGEND
+
+	if (argc > 1)
+		usage();
+	if (argc == 1)
+		url = argv[0];
+	if (nconns < 1 || nconns > MAXCONNS)
+		nconns = MAXCONNS;
+	nconns = MIN(nconns, nrequests);
+
+	cprintf("httpload: %d requests for %s, %d connections%s\n",
+		nrequests, url, nconns, keepalive ? ", keep-alive" : "");
+
+	start = time_nsec();
+	for (i = 0; i < nconns; i++) {
+		conns[i].sock = -1;
+		if ((r = conn_request(&conns[i])) < 0)
+			panic("httpload: request failed: %e", r);
+	}
+
+	while (ndone + nerrors < nrequests) {
+		FD_ZERO(&readset);
+		maxfd = 0;
+		for (i = 0; i < nconns; i++)
+			if (conns[i].sock >= 0) {
+				FD_SET(conns[i].sock, &readset);
+				maxfd = MAX(maxfd, conns[i].sock);
+			}
+		if ((r = select(maxfd + 1, &readset, NULL, NULL, NULL)) < 0)
+			panic("httpload: select: %e", r);
+
+		for (i = 0; i < nconns; i++) {
+			c = &conns[i];
+			if (c->sock < 0 || !FD_ISSET(c->sock, &readset))
+				continue;
+			if ((r = read(c->sock, buf, sizeof(buf))) <= 0)
+				r = -E_INVAL;
+			else
+				r = conn_input(c, buf, r);
+			if (r == 0)
+				continue;
+
+			if (r > 0) {
+				ndone++;
+				t = time_nsec() - c->start;
+				latency += t;
+				maxlatency = MAX(maxlatency, t);
+			} else
+				nerrors++;
+			if (r < 0 || !c->keepalive)
+				conn_close(c);
+			if (nsent < nrequests && (r = conn_request(c)) < 0) {
+				conn_close(c);
+				nerrors++;
+				nsent++;
+			}
+		}
+	}
+
+	elapsed = (time_nsec() - start) / 1000000;
+	for (i = 0; i < nconns; i++)
+		conn_close(&conns[i]);
+
+	cprintf("httpload: %d ok, %d errors, %d connects in %u msec\n",
+		ndone, nerrors, nconnects, elapsed);
+	if (ndone && elapsed) {
+		latency /= ndone;
+		cprintf("httpload: %u req/s, %u KB/s, "
+			"latency avg %u.%03u max %u.%03u usec\n",
+			(unsigned) (ndone * 1000ULL / elapsed),
+			(unsigned) (nbytes * 1000 / 1024 / elapsed),
+			(unsigned) (latency / 1000), (unsigned) (latency % 1000),
+			(unsigned) (maxlatency / 1000),
+			(unsigned) (maxlatency % 1000));
+	}
+}
@@ -26,7 +26,8 @@ ls(const char *path, const char *prefix)
 void
 lsdir(const char *path, const char *prefix)
 {
-	int fd, n;
+	int fd;
+	FILE *dir;
 	struct File f;
 
 	//clog("wp1");
@@ -35,21 +36,23 @@ lsdir(const char *path, const char *prefix)
 		clog("open %s: %e", path, fd);
 		exit();
 	}
-	while ((n = readn(fd, &f, sizeof f)) == sizeof f)
+	// A page of entries per read rather than one
+	if ((dir = fdopen(fd, "r")) == NULL)
 	{
-		if (f.f_name[0])
-			ls1(prefix, f.f_type==FTYPE_DIR, f.f_size, f.f_name);
+		clog("fdopen %s: out of memory", path);
+		exit();
 	}
-	if (n > 0)
+	while (fread(&f, sizeof f, 1, dir) == 1)
 	{
-		clog("short read in directory %s", path);
-		exit();
+		if (f.f_name[0])
+			ls1(prefix, f.f_type==FTYPE_DIR, f.f_size, f.f_name);
 	}
-	if (n < 0)
+	if (ferror(dir))
 	{
-		clog("error reading directory %s: %e", path, n);
+		clog("error reading directory %s", path);
 		exit();
 	}
+	fclose(dir);
 }
 
 void
@@ -59,24 +62,24 @@ ls1(const char *prefix, bool isdir, off_t size, const char *name)
 
 	//clog("wp1");
 	if(flag['l'])
-		printf("%11d %c ", size, isdir ? 'd' : '-');
+		bprintf(stdout, "%11d %c ", size, isdir ? 'd' : '-');
 	if(prefix) {
 		if (prefix[0] && prefix[strlen(prefix)-1] != '/')
 			sep = "/";
 		else
 			sep = "";
-		printf("%s%s", prefix, sep);
+		bprintf(stdout, "%s%s", prefix, sep);
 	}
-	printf("%s", name);
+	bprintf(stdout, "%s", name);
 	if(flag['F'] && isdir)
-		printf("/");
-	printf("\n");
+		bprintf(stdout, "/");
+	bprintf(stdout, "\n");
 }
 
 void
 usage(void)
 {
-	printf("usage: ls [-dFl] [file...]\n");
+	bprintf(stdout, "usage: ls [-dFl] [file...]\n");
 	exit();
 }
 
@@ -4,44 +4,44 @@ int bol = 1;
 int line = 0;
 
 void
-num(int f, char *s)
+num(FILE *f, char *s)
 {
-	long n;
-	int r;
-	char c;
+	int c;
 
-	while ((n = read(f, &c, 1)) > 0) {
+	while ((c = fgetc(f)) != EOF) {
 		if (bol) {
-			printf("%5d ", ++line);
+			bprintf(stdout, "%5d ", ++line);
 			bol = 0;
 		}
-		if ((r = write(1, &c, 1)) != 1)
-			panic("write error copying %s: %e", s, r);
+		if (fputc(c, stdout) == EOF)
+			panic("write error copying %s", s);
 		if (c == '\n')
 			bol = 1;
 	}
-	if (n < 0)
-		panic("error reading %s: %e", s, n);
+	if (ferror(f))
+		panic("error reading %s", s);
 }
 
 void
 umain(int argc, char **argv)
 {
-	int f, i;
+	FILE *f;
+	int fd, i;
 
 	argv0 = "num";
 	if (argc == 1)
-		num(0, "<stdin>");
+		num(stdin, "<stdin>");
 	else
 		for (i = 1; i < argc; i++) {
-			f = open(argv[i], O_RDONLY);
-			if (f < 0)
-				panic("can't open %s: %e", argv[i], f);
+			fd = open(argv[i], O_RDONLY);
+			if (fd < 0)
+				panic("can't open %s: %e", argv[i], fd);
+			else if ((f = fdopen(fd, "r")) == NULL)
+				panic("fdopen %s: out of memory", argv[i]);
 			else {
 				num(f, argv[i]);
-				close(f);
+				fclose(f);
 			}
 		}
 	exit();
 }
-
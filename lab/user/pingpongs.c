@@ -1,27 +1,19 @@
-// Ping-pong a counter between two shared-memory processes.
-// Only need to start one of these -- splits into two with sfork.
+// Ping-pong a counter between two threads sharing memory.
+// Only need to start one of these -- splits into two with thr_create.
 
 #include <inc/lib.h>
 
 uint32_t val;
 
-void
-umain(void)
+static void
+pingpong(void *arg)
 {
 	envid_t who;
-	uint32_t i;
-
-	i = 0;
-	if ((who = sfork()) != 0) {
-		cprintf("i am %08x; env is %p\n", sys_getenvid(), env);
-		// get the ball rolling
-		cprintf("send 0 from %x to %x\n", sys_getenvid(), who);
-		ipc_send(who, 0, 0, 0);
-	}
 
 	while (1) {
 		ipc_recv(&who, 0, 0);
-		cprintf("%x got %d from %x (env is %p %x)\n", sys_getenvid(), val, who, env, env->env_id);
+		cprintf("%x got %d from %x (env is %p %x)\n", sys_getenvid(),
+			val, who, thisenv(), thisenv()->env_id);
 		if (val == 10)
 			return;
 		++val;
@@ -29,5 +21,18 @@ umain(void)
 		if (val == 10)
 			return;
 	}
-		
+}
+
+void
+umain(void)
+{
+	envid_t who;
+
+	if ((who = thr_create(pingpong, 0)) < 0)
+		panic("thr_create: %e", who);
+	cprintf("i am %08x; env is %p\n", sys_getenvid(), thisenv());
+	// get the ball rolling
+	cprintf("send 0 from %x to %x\n", sys_getenvid(), who);
+	ipc_send(who, 0, 0, 0);
+	pingpong(0);
 }
@@ -0,0 +1,88 @@
+// Packet blaster: transmit raw Ethernet frames back to back for a while
+// and report the frame rate the driver sustains.
+//
+// usage: pktblast [-s framesize] [-t seconds]
+
+#include <inc/lib.h>
+
+#define ETHERTYPE_BLAST	0x88b5		// IEEE local experimental
+#define MINFRAME	60
+
+static uint8_t frame[ETH_PKTSZ_MAX] __attribute__((aligned(PGSIZE)));
+
+static void
+usage(void)
+{
+	cprintf("usage: pktblast [-s framesize] [-t seconds]\n");
+	exit();
+}
+
+void
+umain(int argc, char **argv)
+{
+	uint64_t start, now, nsec;
+	unsigned msec;
+	uint64_t frames = 0, stalls = 0;
+	int size = MINFRAME, secs = 5;
+	char *arg;
+	int i, r;
+
+	binaryname = "pktblast";
+
+	ARGBEGIN{
+	default:
+		usage();
+	case 's':
+		if ((arg = ARGF()) == 0)
+			usage();
+		size = strtol(arg, 0, 0);
+		break;
+	case 't':
+		if ((arg = ARGF()) == 0)
+			usage();
+		secs = strtol(arg, 0, 0);
+		break;
+	}ARGEND
+
+	if (size < MINFRAME || size > ETH_PKTSZ_MAX - 4)
+		size = MINFRAME;
+	if (secs <= 0)
+		secs = 5;
+
+	// Broadcast from our own address, payload is a byte counter
+	memset(frame, 0xff, 6);
+	if ((r = sys_net_get_hw_addr(frame + 6, 6)) < 0)
+		panic("pktblast: sys_net_get_hw_addr: %e", r);
+	frame[12] = ETHERTYPE_BLAST >> 8;
+	frame[13] = ETHERTYPE_BLAST & 0xff;
+	for (i = 14; i < size; i++)
+		frame[i] = i;
+
+	cprintf("pktblast: %d byte frames for %d seconds\n", size, secs);
+
+	start = now = time_nsec();
+	while (now - start < secs * 1000000000ULL) {
+		// Only look at the clock every so often
+		for (i = 0; i < 64; i++) {
+			r = sys_net_tx_pkt(frame, size);
+			if (r == -E_NO_BUFS)
+				stalls++;
+			else if (r < 0)
+				panic("pktblast: sys_net_tx_pkt: %e", r);
+			else
+				frames++;
+		}
+		now = time_nsec();
+	}
+
+	nsec = now - start;
+	msec = MAX(nsec / 1000000, 1);
+	cprintf("pktblast: %u frames in %u msec, %u frames/s, %u kbit/s, "
+		"%u ring-full stalls\n", (unsigned) frames, msec,
+		(unsigned) (frames * 1000 / msec),
+		(unsigned) (frames * size * 8 / msec),
+		(unsigned) stalls);
+	if (frames)
+		cprintf("pktblast: %u nsec per frame\n",
+			(unsigned) (nsec / frames));
+}
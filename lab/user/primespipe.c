@@ -7,9 +7,62 @@
 // Since NENVS is 1024, we can print 1022 primes before running out.
 // The remaining two environments are the integer generator at the bottom
 // of main and user/idle.
+//
+// With -b it instead measures pipe bandwidth: a child reads and
+// discards what the parent writes in blocks of the given size.
+//
+// usage: primespipe [-b] [-s blocksize] [-m megabytes]
 
 #include <inc/lib.h>
 
+#define MAXBLOCK	(64 * 1024)
+
+static char block[MAXBLOCK];
+
+static void
+usage(void)
+{
+	cprintf("usage: primespipe [-b] [-s blocksize] [-m megabytes]\n");
+	exit();
+}
+
+static void
+bandwidth(size_t size, size_t total)
+{
+	int p[2], id, r;
+	size_t done;
+	uint64_t start, nsec;
+
+	if ((r = pipe(p)) < 0)
+		panic("pipe: %e", r);
+	if ((id = fork()) < 0)
+		panic("fork: %e", id);
+	if (id == 0) {
+		close(p[1]);
+		for (done = 0; (r = read(p[0], block, size)) > 0; done += r)
+			;
+		if (r < 0)
+			panic("primespipe read: %e", r);
+		if (done != total)
+			panic("primespipe: read %d of %d bytes", done, total);
+		exit();
+	}
+
+	close(p[0]);
+	memset(block, 'x', size);
+	start = time_nsec();
+	for (done = 0; done < total; done += r)
+		if ((r = write(p[1], block, MIN(size, total - done))) <= 0)
+			panic("primespipe write: %d %e", r, r >= 0 ? 0 : r);
+	close(p[1]);
+	wait(id);
+	nsec = time_nsec() - start;
+
+	cprintf("primespipe: %u bytes in %u-byte writes: %u msec, %u KB/s\n",
+		total, size, (unsigned) (nsec / 1000000),
+		(unsigned) ((uint64_t) total * 1000000000 / 1024 / MAX(nsec, 1)));
+}
+
 unsigned
 primeproc(int fd)
 {
@@ -48,11 +101,38 @@ top:
 }
 
 void
-umain(void)
+umain(int argc, char **argv)
 {
 	int i, id, p[2], r;
+	int bench = 0, size = 4096, mb = 16;
+	char *arg;
+
+	binaryname = "primespipe";
 
-	argv0 = "primespipe";
+	ARGBEGIN{
+	default:
+		usage();
+	case 'b':
+		bench = 1;
+		break;
+	case 's':
+		if ((arg = ARGF()) == 0)
+			usage();
+		size = strtol(arg, 0, 0);
+		break;
+	case 'm':
+		if ((arg = ARGF()) == 0)
+			usage();
+		mb = strtol(arg, 0, 0);
+		break;
+	}ARGEND
+
+	if (bench) {
+		if (size < 1 || size > MAXBLOCK)
+			size = 4096;
+		bandwidth(size, MAX(mb, 1) << 20);
+		return;
+	}
 
 	if ((i=pipe(p)) < 0)
 		panic("pipe: %e", i);
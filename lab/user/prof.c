@@ -0,0 +1,66 @@
+// Control the kernel's sampling profiler and show where an env, or
+// the kernel, spends its time, by function.
+//
+// usage: prof on|off|reset
+//        prof [-n count] envid|kern
+
+#include <inc/lib.h>
+
+#define NENTRY	64
+
+struct ProfEntry ents[NENTRY];
+
+static void
+usage(void)
+{
+	cprintf("usage: prof on|off|reset\n"
+		"       prof [-n count] envid|kern\n");
+	exit();
+}
+
+void
+umain(int argc, char **argv)
+{
+	int nshow = 20, i, n, r;
+	uint32_t total = 0;
+	char *arg;
+
+	ARGBEGIN{
+	default:
+		usage();
+	case 'n':
+		if ((arg = ARGF()) == 0)
+			usage();
+		nshow = strtol(arg, 0, 0);
+		break;
+	}ARGEND
+
+	if (argc != 1 || nshow < 1)
+		usage();
+	if (strcmp(argv[0], "on") == 0)
+		r = sys_prof(PROF_START, 0, 0, 0);
+	else if (strcmp(argv[0], "off") == 0)
+		r = sys_prof(PROF_STOP, 0, 0, 0);
+	else if (strcmp(argv[0], "reset") == 0)
+		r = sys_prof(PROF_RESET, 0, 0, 0);
+	else {
+		if (strcmp(argv[0], "kern") == 0)
+			n = sys_prof(PROF_KREPORT, 0, ents, NENTRY);
+		else
+			n = sys_prof(PROF_REPORT, strtol(argv[0], 0, 16),
+				     ents, NENTRY);
+		if (n < 0)
+			panic("prof %s: %e", argv[0], n);
+		for (i = 0; i < n; i++)
+			total += ents[i].pe_count;
+		bprintf(stdout, "%u samples\n", total);
+		for (i = 0; i < n && i < nshow; i++)
+			bprintf(stdout, "%8u %3u%%  %08x %s\n",
+				ents[i].pe_count,
+				ents[i].pe_count * 100 / total,
+				ents[i].pe_addr, ents[i].pe_name);
+		return;
+	}
+	if (r < 0)
+		panic("prof %s: %e", argv[0], r);
+}
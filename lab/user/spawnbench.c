@@ -0,0 +1,71 @@
+// Spawn benchmark: spawn a program over and over and report how long
+// spawn() takes, and how long until the child has exited.
+//
+// usage: spawnbench [-ek] [-n count] prog [arg...]
+//	-e	load every page before the child starts, instead of
+//		paging read-only segments in on demand
+//	-k	destroy each child as soon as spawn() returns, for
+//		programs that do not exit, like sh or httpd
+
+#include <inc/lib.h>
+
+static void
+usage(void)
+{
+	cprintf("usage: spawnbench [-ek] [-n count] prog [arg...]\n");
+	exit();
+}
+
+void
+umain(int argc, char **argv)
+{
+	uint64_t start, spawned, spawn_nsec = 0, run_nsec = 0;
+	int count = 20, kill = 0;
+	char *arg;
+	envid_t child;
+	int i;
+
+	binaryname = "spawnbench";
+
+	ARGBEGIN{
+	default:
+		usage();
+	case 'e':
+		spawn_demand = 0;
+		break;
+	case 'k':
+		kill = 1;
+		break;
+	case 'n':
+		if ((arg = ARGF()) == 0)
+			usage();
+		count = strtol(arg, 0, 0);
+		break;
+	}ARGEND
+
+	if (argc < 1)
+		usage();
+	if (count < 1)
+		count = 20;
+
+	cprintf("spawnbench: %s %d times, %s\n", argv[0], count,
+		spawn_demand ? "on demand" : "eager");
+
+	for (i = 0; i < count; i++) {
+		start = time_nsec();
+		if ((child = spawn(argv[0], (const char **) argv)) < 0)
+			panic("spawnbench: spawn %s: %e", argv[0], child);
+		spawned = time_nsec();
+		if (kill)
+			sys_env_destroy(child);
+		wait(child);
+		spawn_nsec += spawned - start;
+		run_nsec += time_nsec() - start;
+	}
+
+	cprintf("spawnbench: spawn %u usec", (unsigned) (spawn_nsec / count / 1000));
+	if (!kill)
+		cprintf(", spawn to exit %u usec",
+			(unsigned) (run_nsec / count / 1000));
+	cprintf("\n");
+}
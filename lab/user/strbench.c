@@ -0,0 +1,108 @@
+// String-ops benchmark: time memmove, memset, memcmp and strcmp on
+// aligned and misaligned buffers of several sizes, and report the
+// throughput of each next to that of a plain byte loop.
+//
+// usage: strbench [-m megabytes]
+
+#include <inc/lib.h>
+
+#define BUFSIZE		(64 * 1024)
+
+static char src[BUFSIZE + 64] __attribute__((aligned(PGSIZE)));
+static char dst[BUFSIZE + 64] __attribute__((aligned(PGSIZE)));
+
+static const size_t sizes[] = { 16, 64, 256, 1500, 4096, 65536 };
+#define NSIZES		(sizeof(sizes) / sizeof(sizes[0]))
+
+enum { OP_MOVE, OP_SET, OP_CMP, OP_STRCMP, OP_BYTEMOVE, NOPS };
+static const char *opname[NOPS] = {
+	"memmove", "memset", "memcmp", "strcmp", "byte loop"
+};
+
+static void
+usage(void)
+{
+	cprintf("usage: strbench [-m megabytes]\n");
+	exit();
+}
+
+// Do 'op' on 'n' bytes at the given offsets until 'total' bytes have
+// been processed.  Returns MB/s.
+static unsigned
+run(int op, size_t n, int soff, int doff, size_t total)
+{
+	char *s = src + soff, *d = dst + doff;
+	uint64_t start, nsec;
+	size_t done, i;
+	int sink = 0;
+
+	// Equal strings of length n - 1, so that memcmp and strcmp
+	// look at every byte
+	memset(s, 'x', n);
+	memset(d, 'x', n);
+	s[n - 1] = d[n - 1] = '\0';
+
+	start = time_nsec();
+	for (done = 0; done < total; done += n) {
+		switch (op) {
+		case OP_MOVE:
+			memmove(d, s, n);
+			break;
+		case OP_SET:
+			memset(d, done, n);
+			break;
+		case OP_CMP:
+			sink += memcmp(d, s, n);
+			break;
+		case OP_STRCMP:
+			sink += strcmp(d, s);
+			break;
+		case OP_BYTEMOVE:
+			for (i = 0; i < n; i++)
+				d[i] = s[i];
+			break;
+		}
+	}
+	nsec = time_nsec() - start;
+	if (sink == 1)
+		cprintf("strbench: unexpected result\n");
+	return total * 1000 / MAX(nsec, 1);
+}
+
+void
+umain(int argc, char **argv)
+{
+	size_t total = 64 << 20;
+	char *arg;
+	int op, i;
+
+	binaryname = "strbench";
+
+	ARGBEGIN{
+	default:
+		usage();
+	case 'm':
+		if ((arg = ARGF()) == 0)
+			usage();
+		total = strtol(arg, 0, 0) << 20;
+		break;
+	}ARGEND
+
+	if (total == 0)
+		total = 64 << 20;
+
+	cprintf("strbench: %d MB per test, MB/s aligned / misaligned\n",
+		total >> 20);
+	cprintf("%10s", "");
+	for (i = 0; i < NSIZES; i++)
+		cprintf(" %13d", sizes[i]);
+	cprintf("\n");
+
+	for (op = 0; op < NOPS; op++) {
+		cprintf("%10s", opname[op]);
+		for (i = 0; i < NSIZES; i++)
+			cprintf(" %6u/%6u", run(op, sizes[i], 0, 0, total),
+				run(op, sizes[i], 3, 1, total));
+		cprintf("\n");
+	}
+}
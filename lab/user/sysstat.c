@@ -0,0 +1,216 @@
+// Show where the kernel's time goes, by system call and by trap, from
+// the counters the kernel keeps at USYSSTAT and in each Env.
+//
+// With -i, show what changed every 'secs' seconds instead of the
+// totals since boot, 'n' times (forever if 0); with -e, show only
+// the system calls of env 'envid'.  With -c, run 'cmd' and show the
+// system calls it made, read from its Env once it has exited (its
+// counters stay there until the Env is reused).
+//
+// usage: sysstat [-e envid] [-i secs [-n rounds]] | -c cmd [arg...]
+
+#include <inc/lib.h>
+#include <inc/clock.h>
+
+#define NROW		(NSYSCALLS + KSTAT_NTRAP)
+#define IRQ_OFFSET	32	// as in kern/picirq.h
+
+static const char * const syscallname[NSYSCALLS] = {
+	[SYS_cputs] = "cputs",
+	[SYS_cgetc] = "cgetc",
+	[SYS_getenvid] = "getenvid",
+	[SYS_env_destroy] = "env_destroy",
+	[SYS_page_alloc] = "page_alloc",
+	[SYS_page_map] = "page_map",
+	[SYS_page_unmap] = "page_unmap",
+	[SYS_exofork] = "exofork",
+	[SYS_env_set_status] = "env_set_status",
+	[SYS_env_set_trapframe] = "env_set_trapframe",
+	[SYS_env_set_pgfault_upcall] = "env_set_pgfault_upcall",
+	[SYS_env_set_transaction] = "env_set_transaction",
+	[SYS_yield] = "yield",
+	[SYS_ipc_try_send] = "ipc_try_send",
+	[SYS_ipc_recv] = "ipc_recv",
+	[SYS_time_msec] = "time_msec",
+	[SYS_net_get_hw_addr] = "net_get_hw_addr",
+	[SYS_net_tx_pkt] = "net_tx_pkt",
+	[SYS_net_rx_pkt] = "net_rx_pkt",
+	[SYS_sleep_until] = "sleep_until",
+	[SYS_time_nsec] = "time_nsec",
+	[SYS_page_table_share] = "page_table_share",
+	[SYS_env_set_pager] = "env_set_pager",
+	[SYS_pager_reply] = "pager_reply",
+	[SYS_futex_wait] = "futex_wait",
+	[SYS_futex_wake] = "futex_wake",
+	[SYS_thread_create] = "thread_create",
+	[SYS_cons_log] = "cons_log",
+	[SYS_prof] = "prof",
+	[SYS_trace] = "trace",
+};
+
+static const char * const trapname[] = {
+	[T_DIVIDE] = "divide error",
+	[T_DEBUG] = "debug",
+	[T_NMI] = "NMI",
+	[T_BRKPT] = "breakpoint",
+	[T_OFLOW] = "overflow",
+	[T_BOUND] = "bound",
+	[T_ILLOP] = "invalid opcode",
+	[T_DEVICE] = "device not available",
+	[T_DBLFLT] = "double fault",
+	[T_TSS] = "invalid TSS",
+	[T_SEGNP] = "segment not present",
+	[T_STACK] = "stack fault",
+	[T_GPFLT] = "general protection",
+	[T_PGFLT] = "page fault",
+	[T_FPERR] = "FPU error",
+	[T_ALIGN] = "alignment check",
+	[T_MCHK] = "machine check",
+	[T_SIMDERR] = "SIMD error",
+	[T_SYSCALL] = "int $0x30",
+};
+
+struct Row {
+	char name[32];
+	struct KStat ks;
+};
+
+static struct KStat prev[NROW], cur[NROW];
+static struct Row rows[NROW];
+
+static void
+usage(void)
+{
+	cprintf("usage: sysstat [-e envid] [-i secs [-n rounds]]"
+		" | -c cmd [arg...]\n");
+	exit();
+}
+
+// Copy the counters to ks: system calls, then traps unless only an
+// env's are wanted.
+static void
+snapshot(struct KStat *ks, envid_t envid)
+{
+	const volatile struct SysStat *ss = (const volatile struct SysStat *) USYSSTAT;
+	volatile struct Env *e = &envs[ENVX(envid)];
+	int i;
+
+	for (i = 0; i < NSYSCALLS; i++)
+		ks[i] = envid ? e->env_syscalls[i] : ss->ss_syscall[i];
+	for (i = 0; i < KSTAT_NTRAP; i++)
+		if (envid)
+			memset(&ks[NSYSCALLS + i], 0, sizeof(struct KStat));
+		else
+			ks[NSYSCALLS + i] = ss->ss_trap[i];
+	if (envid && e->env_id != envid)
+		panic("sysstat: no env %08x", envid);
+}
+
+static void
+rowname(char *buf, int i)
+{
+	if (i < NSYSCALLS)
+		snprintf(buf, 32, "sys_%s", syscallname[i] ? syscallname[i] : "?");
+	else if ((i -= NSYSCALLS) >= IRQ_OFFSET && i < IRQ_OFFSET + 16)
+		snprintf(buf, 32, "irq %d", i - IRQ_OFFSET);
+	else if (i < sizeof(trapname) / sizeof(trapname[0]) && trapname[i])
+		snprintf(buf, 32, "%s", trapname[i]);
+	else
+		snprintf(buf, 32, "trap %d", i);
+}
+
+// Show cur less prev, most cycles first.  Max is since boot.
+static void
+show(uint32_t tsc_khz)
+{
+	struct Row r;
+	int i, j, n = 0;
+	uint64_t usec;
+
+	for (i = 0; i < NROW; i++) {
+		if (cur[i].ks_count == prev[i].ks_count)
+			continue;
+		rowname(rows[n].name, i);
+		rows[n].ks.ks_count = cur[i].ks_count - prev[i].ks_count;
+		rows[n].ks.ks_cycles = cur[i].ks_cycles - prev[i].ks_cycles;
+		rows[n].ks.ks_max = cur[i].ks_max;
+		n++;
+	}
+	for (i = 1; i < n; i++) {
+		r = rows[i];
+		for (j = i; j > 0 && rows[j - 1].ks.ks_cycles < r.ks.ks_cycles; j--)
+			rows[j] = rows[j - 1];
+		rows[j] = r;
+	}
+
+	bprintf(stdout, "%-24s %10s %10s %10s %10s\n",
+		"", "count", "usec", "avg cyc", "max cyc");
+	for (i = 0; i < n; i++) {
+		usec = tsc_khz ? rows[i].ks.ks_cycles * 1000 / tsc_khz : 0;
+		bprintf(stdout, "%-24s %10u %10u %10u %10u\n", rows[i].name,
+			rows[i].ks.ks_count, (uint32_t) usec,
+			(uint32_t) (rows[i].ks.ks_cycles / rows[i].ks.ks_count),
+			rows[i].ks.ks_max);
+	}
+	fflush(stdout);
+}
+
+void
+umain(int argc, char **argv)
+{
+	const volatile struct Clock *c = (const volatile struct Clock *) UCLOCK;
+	int interval = 0, rounds = 0, i;
+	envid_t envid = 0;
+	bool cmd = 0;
+	char *arg;
+
+	ARGBEGIN{
+	default:
+		usage();
+	case 'e':
+		if ((arg = ARGF()) == 0)
+			usage();
+		envid = strtol(arg, 0, 16);
+		break;
+	case 'i':
+		if ((arg = ARGF()) == 0)
+			usage();
+		interval = strtol(arg, 0, 0);
+		break;
+	case 'n':
+		if ((arg = ARGF()) == 0)
+			usage();
+		rounds = strtol(arg, 0, 0);
+		break;
+	case 'c':
+		cmd = 1;
+		break;
+	}ARGEND
+
+	if (cmd) {
+		if (argc == 0 || envid || interval || rounds)
+			usage();
+		if ((envid = spawn(argv[0], (const char **) argv)) < 0)
+			panic("sysstat: spawn %s: %e", argv[0], envid);
+		wait(envid);
+		snapshot(cur, envid);
+		show(c->c_tsc_khz);
+		return;
+	}
+
+	if (argc != 0 || interval < 0 || rounds < 0)
+		usage();
+
+	snapshot(cur, envid);
+	if (interval == 0) {
+		show(c->c_tsc_khz);
+		return;
+	}
+	for (i = 0; rounds == 0 || i < rounds; i++) {
+		memmove(prev, cur, sizeof(cur));
+		sleep(interval);
+		snapshot(cur, envid);
+		bprintf(stdout, "--- %d sec\n", interval);
+		show(c->c_tsc_khz);
+	}
+}
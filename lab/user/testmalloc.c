@@ -1,12 +1,160 @@
+// Interactive malloc tester, and a malloc microbenchmark with -b.
+//
+// usage: testmalloc [-b] [-n ops]
+
 #include <inc/lib.h>
 
+#define NSLOTS		256
+
+static void *slots[NSLOTS];
+static size_t slotsize[NSLOTS];
+static uint32_t seed = 12345;
+
+static void
+usage(void)
+{
+	cprintf("usage: testmalloc [-b] [-n ops]\n");
+	exit();
+}
+
+static uint32_t
+rand(void)
+{
+	seed = seed * 1103515245 + 12345;
+	return seed >> 8;
+}
+
+static void
+report(const char *what, int nops, uint64_t nsec)
+{
+	cprintf("testmalloc: %-28s %6u nsec per op\n", what,
+		(unsigned) (nsec / MAX(nops, 1)));
+}
+
+// malloc and immediately free one block of 'size' bytes, 'nops' times.
+static void
+bench_pair(size_t size, int nops)
+{
+	char what[32];
+	uint64_t start;
+	void *v;
+	int i;
+
+	start = time_nsec();
+	for (i = 0; i < nops; i++) {
+		if ((v = malloc(size)) == 0)
+			panic("testmalloc: malloc(%d) failed", size);
+		free(v);
+	}
+	snprintf(what, sizeof(what), "malloc+free %d", size);
+	report(what, nops, time_nsec() - start);
+}
+
+// malloc NSLOTS blocks of 'size' bytes, then free them all.
+static void
+bench_batch(size_t size, int nops)
+{
+	char what[32];
+	uint64_t start;
+	int i, j;
+
+	start = time_nsec();
+	for (i = 0; i < nops; i += NSLOTS) {
+		for (j = 0; j < NSLOTS; j++)
+			if ((slots[j] = malloc(size)) == 0)
+				panic("testmalloc: malloc(%d) failed", size);
+		for (j = 0; j < NSLOTS; j++)
+			free(slots[j]);
+	}
+	snprintf(what, sizeof(what), "batch of %d x %d", NSLOTS, size);
+	report(what, ROUNDUP(nops, NSLOTS), time_nsec() - start);
+}
+
+// Random sizes, mostly small, with random frees and reallocs over a
+// working set of NSLOTS blocks.  Each block is filled with its slot
+// number and checked before it is freed.
+static void
+bench_mixed(int nops)
+{
+	uint64_t start;
+	size_t n;
+	int i, j, k;
+
+	start = time_nsec();
+	for (i = 0; i < nops; i++) {
+		j = rand() % NSLOTS;
+		if (slots[j]) {
+			for (k = 0; k < slotsize[j]; k++)
+				if (((uint8_t *) slots[j])[k] != (uint8_t) j)
+					panic("testmalloc: block %d corrupt", j);
+		}
+		n = rand() % 8 ? rand() % 256 : rand() % 3 ? rand() % 2048
+			: rand() % 16384;
+		if (slots[j] && rand() % 4 == 0) {
+			if ((slots[j] = realloc(slots[j], n)) == 0 && n)
+				panic("testmalloc: realloc(%d) failed", n);
+		} else {
+			free(slots[j]);
+			if ((slots[j] = malloc(n)) == 0)
+				panic("testmalloc: malloc(%d) failed", n);
+		}
+		slotsize[j] = slots[j] ? n : 0;
+		memset(slots[j], j, slotsize[j]);
+	}
+	for (j = 0; j < NSLOTS; j++) {
+		free(slots[j]);
+		slots[j] = 0;
+	}
+	report("mixed sizes with realloc", nops, time_nsec() - start);
+}
+
+static void
+bench(int nops)
+{
+	static const size_t sizes[] = { 16, 100, 1000, 2000, 3000, 20000 };
+	struct MallocStats ms;
+	int i;
+
+	cprintf("testmalloc: %d ops per test\n", nops);
+	for (i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++)
+		bench_pair(sizes[i], nops);
+	for (i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++)
+		bench_batch(sizes[i], nops);
+	bench_mixed(nops);
+	malloc_stats();
+
+	malloc_getstats(&ms);
+	if (ms.ms_inuse != 0 || ms.ms_nmalloc != ms.ms_nfree)
+		panic("testmalloc: %d bytes still allocated", ms.ms_inuse);
+}
+
 void
 umain(int argc, char **argv)
 {
-	char *buf;
-	int n;
+	char *buf, *arg;
+	int n, nops = 10000, dobench = 0;
 	void *v;
 
+	binaryname = "testmalloc";
+
+	ARGBEGIN{
+	default:
+		usage();
+	case 'b':
+		dobench = 1;
+		break;
+	case 'n':
+		if ((arg = ARGF()) == 0)
+			usage();
+		nops = strtol(arg, 0, 0);
+		break;
+	}ARGEND
+
+	if (dobench) {
+		bench(MAX(nops, 1));
+		return;
+	}
+
 	while (1) {
 		buf = readline("> ");
 		if (buf == 0)
@@ -18,7 +166,9 @@ umain(int argc, char **argv)
 			n = strtol(buf + 7, 0, 0);
 			v = malloc(n);
 			printf("\t0x%x\n", (uintptr_t) v);
-		} else
+		} else if (strcmp(buf, "stats") == 0)
+			malloc_stats();
+		else
 			printf("?unknown command\n");
 	}
 }
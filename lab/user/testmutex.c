@@ -0,0 +1,99 @@
+// Test the futex-based mutexes and condition variables between
+// environments sharing a PTE_SHARE page.
+
+#include <inc/lib.h>
+
+#define SHARED_VA	0x30000000
+#define NCHILD		4
+#define NITER		1000
+#define NROUNDS		100
+
+struct Shared {
+	struct Mutex s_mutex;
+	struct Cond s_cond;
+	uint32_t s_counter;
+	uint32_t s_turn;
+};
+
+static struct Shared *sh = (struct Shared *) SHARED_VA;
+
+// Increment the counter under the mutex, giving up the CPU in the
+// middle now and then so that the others really contend for it.
+static void
+counter_child(void)
+{
+	uint32_t v;
+	int i;
+
+	for (i = 0; i < NITER; i++) {
+		mutex_lock(&sh->s_mutex);
+		v = sh->s_counter;
+		if (i % 50 == 0)
+			sys_yield();
+		sh->s_counter = v + 1;
+		mutex_unlock(&sh->s_mutex);
+	}
+	exit();
+}
+
+// Take turns with the other side: wait for our turn, pass it on.
+static void
+pingpong(uint32_t me)
+{
+	int i;
+
+	mutex_lock(&sh->s_mutex);
+	for (i = 0; i < NROUNDS; i++) {
+		while (sh->s_turn != me)
+			cond_wait(&sh->s_cond, &sh->s_mutex);
+		sh->s_turn = !me;
+		cond_broadcast(&sh->s_cond);
+	}
+	mutex_unlock(&sh->s_mutex);
+}
+
+void
+umain(int argc, char **argv)
+{
+	envid_t kids[NCHILD];
+	unsigned start;
+	int i, r;
+
+	binaryname = "testmutex";
+
+	if ((r = sys_page_alloc(0, sh, PTE_P|PTE_U|PTE_W|PTE_SHARE)) < 0)
+		panic("sys_page_alloc: %e", r);
+
+	for (i = 0; i < NCHILD; i++) {
+		if ((r = fork()) < 0)
+			panic("fork: %e", r);
+		if (r == 0)
+			counter_child();
+		kids[i] = r;
+	}
+	for (i = 0; i < NCHILD; i++)
+		wait(kids[i]);
+	if (sh->s_counter != NCHILD * NITER)
+		panic("counter is %d, want %d", sh->s_counter, NCHILD * NITER);
+	cprintf("testmutex: mutex ok\n");
+
+	if ((r = fork()) < 0)
+		panic("fork: %e", r);
+	if (r == 0) {
+		pingpong(1);
+		exit();
+	}
+	pingpong(0);
+	wait(r);
+	cprintf("testmutex: condvar ok\n");
+
+	// A timed wait with nobody to signal must time out
+	mutex_lock(&sh->s_mutex);
+	start = sys_time_msec();
+	r = cond_wait_until(&sh->s_cond, &sh->s_mutex, start + 50);
+	mutex_unlock(&sh->s_mutex);
+	if (r != -E_TIMEOUT || sys_time_msec() - start < 50)
+		panic("cond_wait_until returned %e after %d msec", r,
+		      sys_time_msec() - start);
+	cprintf("testmutex: timeout ok\n");
+}
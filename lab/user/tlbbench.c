@@ -0,0 +1,118 @@
+// TLB benchmark: chase pointers through a 4MB region in random page
+// order, once mapped with 4KB pages and once with a single 4MB page,
+// and report the time per access of each.
+//
+// usage: tlbbench [-n pages] [-i rounds]
+
+#include <inc/lib.h>
+
+#define BENCH_VA	0x40000000	// 4MB-aligned and otherwise unused
+#define NPAGES		(PTSIZE / PGSIZE)
+
+static int order[NPAGES];
+
+static void
+usage(void)
+{
+	cprintf("usage: tlbbench [-n pages] [-i rounds]\n");
+	exit();
+}
+
+// Link the first 'npages' pages into one cycle in random order.
+// Each link sits at a different offset in its page so the walk does
+// not keep hitting the same cache sets.
+static void
+link_pages(int npages)
+{
+	uint32_t seed = 12345;
+	char *va = (char *) BENCH_VA;
+	int i, j, t;
+
+	for (i = 0; i < npages; i++)
+		order[i] = i;
+	for (i = npages - 1; i > 0; i--) {
+		seed = seed * 1103515245 + 12345;
+		j = (seed >> 8) % (i + 1);
+		t = order[i];
+		order[i] = order[j];
+		order[j] = t;
+	}
+	for (i = 0; i < npages; i++) {
+		j = (i + 1) % npages;
+		*(void **) (va + order[i] * PGSIZE + (i * 64) % PGSIZE) =
+			va + order[j] * PGSIZE + (j * 64) % PGSIZE;
+	}
+}
+
+// Walk the cycle 'rounds' times; returns psec per access.
+static unsigned
+walk(int npages, int rounds)
+{
+	void **p = (void **) BENCH_VA + order[0] * (PGSIZE / sizeof(void *));
+	uint64_t start, nsec;
+	int i;
+
+	start = time_nsec();
+	for (i = 0; i < npages * rounds; i++)
+		p = *p;
+	nsec = time_nsec() - start;
+	// Keep the compiler from dropping the walk
+	if (p == NULL)
+		cprintf("tlbbench: broken chain\n");
+	return nsec * 1000 / (npages * rounds);
+}
+
+void
+umain(int argc, char **argv)
+{
+	unsigned small, large;
+	int npages = NPAGES, rounds = 200;
+	char *arg;
+	int i, r;
+
+	binaryname = "tlbbench";
+
+	ARGBEGIN{
+	default:
+		usage();
+	case 'n':
+		if ((arg = ARGF()) == 0)
+			usage();
+		npages = strtol(arg, 0, 0);
+		break;
+	case 'i':
+		if ((arg = ARGF()) == 0)
+			usage();
+		rounds = strtol(arg, 0, 0);
+		break;
+	}ARGEND
+
+	if (npages < 2 || npages > NPAGES)
+		npages = NPAGES;
+	if (rounds < 1)
+		rounds = 200;
+
+	cprintf("tlbbench: %d pages, %d rounds\n", npages, rounds);
+
+	for (i = 0; i < NPAGES; i++)
+		if ((r = sys_page_alloc(0, (void *) (BENCH_VA + i * PGSIZE),
+					PTE_P|PTE_U|PTE_W)) < 0)
+			panic("tlbbench: sys_page_alloc: %e", r);
+	link_pages(npages);
+	walk(npages, 1);
+	small = walk(npages, rounds);
+	cprintf("tlbbench: 4KB pages: %u.%03u nsec per access\n",
+		small / 1000, small % 1000);
+
+	r = sys_page_alloc(0, (void *) BENCH_VA, PTE_P|PTE_U|PTE_W|PTE_PS);
+	if (r == -E_NOT_SUPP) {
+		cprintf("tlbbench: no 4MB pages on this CPU\n");
+		return;
+	} else if (r < 0)
+		panic("tlbbench: sys_page_alloc 4MB: %e", r);
+	link_pages(npages);
+	walk(npages, 1);
+	large = walk(npages, rounds);
+	cprintf("tlbbench: 4MB page: %u.%03u nsec per access\n",
+		large / 1000, large % 1000);
+}
@@ -0,0 +1,127 @@
+// Control the kernel's event trace, or copy out the events it holds.
+//
+// With -e, enable the categories listed (sched, ipc, pgflt, irq, clock,
+// all or none, comma-separated) and no others; with -c, drop the events
+// recorded so far.  Otherwise print the events, one a line (see
+// inc/trace.h), or with -o write them to 'file' as binary records;
+// with -f, keep on copying new events as they come.
+//
+// usage: trace [-e cats] [-c] | [-f] [-o file]
+
+#include <inc/lib.h>
+#include <inc/clock.h>
+
+#define NREAD		128	// events a read
+#define POLL_MSEC	100	// how often -f looks for more
+
+static struct TraceEvent ev[NREAD];
+
+static void
+usage(void)
+{
+	cprintf("usage: trace [-e cats] [-c] | [-f] [-o file]\n");
+	exit();
+}
+
+static void
+header(FILE *out, bool binary)
+{
+	const volatile struct Clock *c = (const volatile struct Clock *) UCLOCK;
+	struct TraceHeader th;
+
+	th.th_magic = TRACE_MAGIC;
+	th.th_tsc_khz = c->c_tsc_khz;
+	th.th_tsc_base = c->c_tsc_base;
+	if (binary)
+		fwrite(&th, sizeof(th), 1, out);
+	else
+		bprintf(out, "# tsc_khz %u tsc_base %llx\n",
+			th.th_tsc_khz, th.th_tsc_base);
+}
+
+// Copy events to out until none are left, or forever if follow.
+static void
+dump(FILE *out, bool binary, bool follow)
+{
+	uint32_t pos = 0, last = 0, copied = 0;
+	bool first = 1;
+	char buf[64];
+	int i, n;
+
+	header(out, binary);
+	while (follow || copied < TRACE_NEVENTS) {
+		if ((n = sys_trace(TRACE_READ, 0, &pos, ev, NREAD)) < 0)
+			panic("trace: sys_trace: %e", n);
+		// The kernel skips what was overwritten before we got to it
+		if (!first && pos - n != last)
+			bprintf(binary ? stderr : out, "# lost %u\n", pos - n - last);
+		last = pos;
+		first = 0;
+		copied += n;
+		if (binary)
+			fwrite(ev, sizeof(ev[0]), n, out);
+		else
+			for (i = 0; i < n; i++) {
+				trace_format(buf, sizeof(buf), &ev[i]);
+				fputs(buf, out);
+			}
+		if (n == NREAD)
+			continue;
+		if (!follow)
+			break;
+		fflush(out);
+		sys_sleep_until(sys_time_msec() + POLL_MSEC);
+	}
+	if (ferror(out))
+		panic("trace: write error");
+}
+
+void
+umain(int argc, char **argv)
+{
+	char *cats = 0, *file = 0, names[64];
+	bool clear = 0, follow = 0;
+	FILE *out = stdout;
+	int mask, old;
+
+	ARGBEGIN{
+	default:
+		usage();
+	case 'e':
+		if ((cats = ARGF()) == 0)
+			usage();
+		break;
+	case 'c':
+		clear = 1;
+		break;
+	case 'f':
+		follow = 1;
+		break;
+	case 'o':
+		if ((file = ARGF()) == 0)
+			usage();
+		break;
+	}ARGEND
+
+	if (argc != 0 || ((cats || clear) && (follow || file)))
+		usage();
+
+	if (cats || clear) {
+		if (cats) {
+			if ((mask = trace_parse_mask(cats)) < 0)
+				usage();
+			old = sys_trace(TRACE_SETMASK, mask, 0, 0, 0);
+			trace_mask_names(names, sizeof(names), old);
+			cprintf("trace: %s, was %s\n", cats, names);
+		}
+		if (clear)
+			sys_trace(TRACE_CLEAR, 0, 0, 0, 0);
+		return;
+	}
+
+	if (file && (out = fopen(file, "w")) == NULL)
+		panic("trace: cannot open %s", file);
+	dump(out, file != 0, follow);
+	if (file)
+		fclose(out);
+}